@@ -0,0 +1,1321 @@
+#define _POSIX_C_SOURCE 200809L
+#include "assembler_context.h"
+#include "bytecode.h"
+#include "emitter.h"
+#include "lexer.h"
+#include "logger.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "token_stream.h"
+#include "vm.h"
+#include "vm_batch.h"
+#include "vm_image.h"
+#include "vm_pipe.h"
+#include "vm_scheduler.h"
+#include "vm_utils.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_CODE 4096
+#define AT(index) ((index) * INSTRUCTION_SIZE)
+
+typedef struct
+{
+    uint8_t  code[BENCH_MAX_CODE];
+    uint32_t len;
+    uint16_t version; // 0 means BYTECODE_SUPPORTED_VERSION
+} BenchImage;
+
+static void emit(BenchImage* image, Opcode opcode, uint8_t operand_1, uint8_t operand_2,
+                 uint32_t imm, uint8_t metadata)
+{
+    uint8_t* out = image->code + image->len;
+    out[OPCODE_INDEX]    = (uint8_t) opcode;
+    out[OPERAND_1_INDEX] = operand_1;
+    out[OPERAND_2_INDEX] = operand_2;
+    memcpy(&out[IMMEDIATE_VALUE_START], &imm, sizeof(uint32_t));
+    out[METADATA_INDEX] = metadata;
+    image->len += INSTRUCTION_SIZE;
+}
+
+static void write_u32(FILE* f, uint32_t value)
+{
+    uint8_t b[4] = {(uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16),
+                    (uint8_t) (value >> 24)};
+    fwrite(b, 1, sizeof(b), f);
+}
+
+static int write_image(const BenchImage* image, char* path)
+{
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    FILE*    f          = fdopen(fd, "wb");
+    uint16_t format     = image->version ? image->version : BYTECODE_SUPPORTED_VERSION;
+    uint8_t  version[2] = {(uint8_t) format, (uint8_t) (format >> 8)};
+    write_u32(f, BYTECODE_MAGIC);
+    fwrite(version, 1, sizeof(version), f);
+    write_u32(f, image->len);
+    write_u32(f, 0);
+    write_u32(f, 0);
+    write_u32(f, 0);
+    fwrite(image->code, 1, image->len, f);
+    fclose(f);
+    return 0;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/*
+ *   fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2), one CALL per invocation.
+ * */
+static void build_fib(BenchImage* image, uint32_t n)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg_reg = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    const uint8_t target  = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_REG_DIRECT);
+
+    emit(image, OP_MOV, REG_R0, 0, n, reg_imm);
+    emit(image, OP_CALL, 0, 0, AT(3), target);
+    emit(image, OP_HALT, 0, 0, 0, 0);
+    // fib:
+    emit(image, OP_MOV, REG_R1, 0, 2, reg_imm);
+    emit(image, OP_CMP, 0, 0, 0, 0);
+    emit(image, OP_JLT, 0, 0, AT(17), target);
+    emit(image, OP_PUSH, REG_R0, 0, 0, 0);
+    emit(image, OP_SUB, REG_R0, 0, 1, reg_imm);
+    emit(image, OP_CALL, 0, 0, AT(3), target);
+    emit(image, OP_POP, REG_R2, 0, 0, 0);
+    emit(image, OP_PUSH, REG_R0, 0, 0, 0);
+    emit(image, OP_MOV, REG_R0, REG_R2, 0, reg_reg);
+    emit(image, OP_SUB, REG_R0, 0, 2, reg_imm);
+    emit(image, OP_CALL, 0, 0, AT(3), target);
+    emit(image, OP_POP, REG_R2, 0, 0, 0);
+    emit(image, OP_ADD, REG_R0, REG_R2, 0, reg_reg);
+    emit(image, OP_RET, 0, 0, 0, 0);
+    // base:
+    emit(image, OP_RET, 0, 0, 0, 0);
+}
+
+/*
+ *   Writes the image to a temporary file and times run_vm over it. Returns the halted context.
+ * */
+static VMContext* run_image(const BenchImage* image, double* elapsed)
+{
+    char path[] = "/tmp/bitlang_bench_XXXXXX";
+    if (write_image(image, path) != 0)
+    {
+        LOG_ERROR("Failed to write benchmark image\n");
+        return NULL;
+    }
+
+    VMContext* ctx    = vm_create();
+    double     start  = now_seconds();
+    int8_t     status = run_vm(ctx, path);
+    *elapsed          = now_seconds() - start;
+    unlink(path);
+
+    if (status != VM_EXIT_SUCCESS)
+    {
+        LOG_ERROR("Benchmark image failed with status %d\n", status);
+        vm_destroy(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+static int bench_fib_calls(uint32_t n)
+{
+    BenchImage image = {0};
+    double     elapsed;
+    build_fib(&image, n);
+
+    VMContext* ctx = run_image(&image, &elapsed);
+    if (ctx == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    uint32_t result = ctx->registers[REG_R0];
+    vm_destroy(ctx);
+
+    // Each invocation of fib(k) is one CALL; fib(n) makes 2 * fib(n + 1) - 1 of them.
+    uint64_t a = 0, b = 1;
+    for (uint32_t i = 0; i < n + 1; i++)
+    {
+        uint64_t next = a + b;
+        a             = b;
+        b             = next;
+    }
+    uint64_t calls = 2 * a - 1;
+
+    printf("fib(%u) = %u: %llu calls in %.3f s, %.2f M calls/s\n", n, result,
+           (unsigned long long) calls, elapsed, (double) calls / elapsed / 1e6);
+    return EXIT_SUCCESS;
+}
+
+/*
+ *   Fills DATA with a `len` byte string. Shared prologue of the string benchmarks.
+ * */
+static void build_string_setup(BenchImage* image, uint32_t len)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+
+    emit(image, OP_MOV, REG_R1, 0, DATA_START, reg_imm);
+    emit(image, OP_MOV, REG_R2, 0, len + 1, reg_imm);
+    emit(image, OP_MEMSET, REG_R1, 0, 0, reg_imm);
+    emit(image, OP_MOV, REG_R2, 0, len, reg_imm);
+    emit(image, OP_MEMSET, REG_R1, 0, 'a', reg_imm);
+}
+
+/*
+ *   Compares a guest byte loop against the STRLEN instruction over the same string.
+ * */
+static int bench_strlen(uint32_t len, uint32_t repetitions)
+{
+    const uint8_t reg_imm      = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg_reg      = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    const uint8_t reg_indirect = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_INDIRECT);
+    const uint8_t target       = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_REG_DIRECT);
+    double        loop_elapsed, bulk_elapsed;
+
+    BenchImage loop = {0};
+    build_string_setup(&loop, len);
+    emit(&loop, OP_MOV, REG_R0, 0, 0, reg_imm);
+    emit(&loop, OP_MOV, REG_R3, REG_R1, 0, reg_indirect); // 6: loop
+    emit(&loop, OP_AND, REG_R3, 0, LSB_MASK, reg_imm);
+    emit(&loop, OP_JZ, 0, 0, AT(12), target);
+    emit(&loop, OP_ADD, REG_R0, 0, 1, reg_imm);
+    emit(&loop, OP_ADD, REG_R1, 0, 1, reg_imm);
+    emit(&loop, OP_JMP, 0, 0, AT(6), target);
+    emit(&loop, OP_HALT, 0, 0, 0, 0); // 12: done
+
+    BenchImage bulk = {0};
+    build_string_setup(&bulk, len);
+    emit(&bulk, OP_MOV, REG_R4, 0, repetitions, reg_imm);
+    emit(&bulk, OP_STRLEN, REG_R0, REG_R1, 0, reg_reg); // 6: loop
+    emit(&bulk, OP_SUB, REG_R4, 0, 1, reg_imm);
+    emit(&bulk, OP_JNZ, 0, 0, AT(6), target);
+    emit(&bulk, OP_HALT, 0, 0, 0, 0);
+
+    VMContext* ctx = run_image(&loop, &loop_elapsed);
+    if (ctx == NULL || ctx->registers[REG_R0] != len)
+    {
+        return EXIT_FAILURE;
+    }
+    vm_destroy(ctx);
+
+    ctx = run_image(&bulk, &bulk_elapsed);
+    if (ctx == NULL || ctx->registers[REG_R0] != len)
+    {
+        return EXIT_FAILURE;
+    }
+    vm_destroy(ctx);
+
+    double loop_rate = (double) len / loop_elapsed;
+    double bulk_rate = (double) len * repetitions / bulk_elapsed;
+    printf("strlen(%u): byte loop %.2f MB/s, strlen instruction %.2f MB/s (%.0fx)\n", len,
+           loop_rate / 1e6, bulk_rate / 1e6, bulk_rate / loop_rate);
+    return EXIT_SUCCESS;
+}
+
+/*
+ *   Counts 'a' bytes in a buffer: scalar byte loop against 16-byte VCMPEQ8/VSUM8 blocks.
+ * */
+static int bench_byte_count(uint32_t len)
+{
+    const uint8_t reg_imm      = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg_reg      = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    const uint8_t reg_indirect = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_INDIRECT);
+    const uint8_t target       = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_REG_DIRECT);
+    double        scalar_elapsed, vector_elapsed;
+
+    len &= ~(uint32_t) (VM_VECTOR_SIZE - 1);
+
+    // Both images start with a buffer whose first half is 'b' and second half is 'a'
+    BenchImage scalar = {0};
+    build_string_setup(&scalar, len);
+    emit(&scalar, OP_MOV, REG_R2, 0, len / 2, reg_imm);
+    emit(&scalar, OP_MEMSET, REG_R1, 0, 'b', reg_imm);
+    emit(&scalar, OP_MOV, REG_R0, 0, 0, reg_imm);
+    emit(&scalar, OP_MOV, REG_R4, 0, len, reg_imm);
+    emit(&scalar, OP_MOV, REG_R3, REG_R1, 0, reg_indirect); // 9: loop
+    emit(&scalar, OP_AND, REG_R3, 0, LSB_MASK, reg_imm);
+    emit(&scalar, OP_SUB, REG_R3, 0, 'a', reg_imm);
+    emit(&scalar, OP_JNZ, 0, 0, AT(14), target);
+    emit(&scalar, OP_ADD, REG_R0, 0, 1, reg_imm);
+    emit(&scalar, OP_ADD, REG_R1, 0, 1, reg_imm); // 14: skip
+    emit(&scalar, OP_SUB, REG_R4, 0, 1, reg_imm);
+    emit(&scalar, OP_JNZ, 0, 0, AT(9), target);
+    emit(&scalar, OP_HALT, 0, 0, 0, 0);
+
+    BenchImage vector = {0};
+    build_string_setup(&vector, len);
+    emit(&vector, OP_MOV, REG_R2, 0, len / 2, reg_imm);
+    emit(&vector, OP_MEMSET, REG_R1, 0, 'b', reg_imm);
+    emit(&vector, OP_MOV, REG_R0, 0, 0, reg_imm);
+    emit(&vector, OP_MOV, REG_R4, 0, len / VM_VECTOR_SIZE, reg_imm);
+    emit(&vector, OP_VSPLAT8, 1, 0, 'a', reg_imm);
+    emit(&vector, OP_VLOAD, 0, REG_R1, 0, reg_reg); // 10: loop
+    emit(&vector, OP_VCMPEQ8, 0, 1, 0, reg_reg);
+    emit(&vector, OP_VSUM8, REG_R3, 0, 0, reg_reg);
+    emit(&vector, OP_ADD, REG_R0, REG_R3, 0, reg_reg);
+    emit(&vector, OP_ADD, REG_R1, 0, VM_VECTOR_SIZE, reg_imm);
+    emit(&vector, OP_SUB, REG_R4, 0, 1, reg_imm);
+    emit(&vector, OP_JNZ, 0, 0, AT(10), target);
+    emit(&vector, OP_DIV, REG_R0, 0, 0xFF, reg_imm);
+    emit(&vector, OP_HALT, 0, 0, 0, 0);
+
+    VMContext* ctx = run_image(&scalar, &scalar_elapsed);
+    if (ctx == NULL || ctx->registers[REG_R0] != len - len / 2)
+    {
+        return EXIT_FAILURE;
+    }
+    vm_destroy(ctx);
+
+    ctx = run_image(&vector, &vector_elapsed);
+    if (ctx == NULL || ctx->registers[REG_R0] != len - len / 2)
+    {
+        return EXIT_FAILURE;
+    }
+    vm_destroy(ctx);
+
+    printf("byte count(%u): scalar %.2f MB/s, vector %.2f MB/s (%.1fx)\n", len,
+           (double) len / scalar_elapsed / 1e6, (double) len / vector_elapsed / 1e6,
+           scalar_elapsed / vector_elapsed);
+    return EXIT_SUCCESS;
+}
+
+/*
+ *   Compares the fixed (v1) and compact (v2) encodings of the fib image: file size, load time
+ *   (which for v2 includes expanding back to the fixed form) and run time.
+ * */
+static int bench_formats(uint32_t n, uint32_t loads)
+{
+    BenchImage fixed   = {0};
+    BenchImage compact = {.version = BYTECODE_COMPACT_VERSION};
+    build_fib(&fixed, n);
+    for (uint32_t pc = 0; pc < fixed.len; pc += bytecode_fixed_size(fixed.code[pc]))
+    {
+        uint32_t length;
+        if (bytecode_compact_encode(fixed.code + pc, compact.code + compact.len, &length) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+        compact.len += length;
+    }
+
+    const BenchImage* images[] = {&fixed, &compact};
+    const char*       names[]  = {"fixed", "compact"};
+    for (int i = 0; i < 2; i++)
+    {
+        char path[] = "/tmp/bitlang_bench_XXXXXX";
+        if (write_image(images[i], path) != 0)
+        {
+            LOG_ERROR("Failed to write benchmark image\n");
+            return EXIT_FAILURE;
+        }
+
+        VMContext* ctx   = vm_create();
+        double     start = now_seconds();
+        for (uint32_t j = 0; j < loads; j++)
+        {
+            load_bytecode(ctx, path);
+        }
+        double load_elapsed = now_seconds() - start;
+        vm_destroy(ctx);
+        unlink(path);
+
+        double run_elapsed;
+        ctx = run_image(images[i], &run_elapsed);
+        if (ctx == NULL)
+        {
+            return EXIT_FAILURE;
+        }
+        vm_destroy(ctx);
+
+        printf("%-7s: code %4u bytes, load %.2f us, fib(%u) in %.3f s\n", names[i],
+               images[i]->len, load_elapsed / loads * 1e6, n, run_elapsed);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ *   Assembles BitLang source into a sectioned image at path, through the -O pipeline when
+ *   `optimize` is set.
+ * */
+static int8_t assemble_source(const char* source, bool optimize, char* path)
+{
+    MemoryArena arena;
+    arena_init(&arena, MEM_SIZE + 8 * MAX_ARENA_SIZE);
+
+    int          token_count = 0;
+    FILE*        input       = fmemopen((void*) source, strlen(source), "r");
+    TokenVector* tokens      = run_lexer(&arena, input, &token_count);
+    fclose(input);
+
+    AssemblerContext* asm_ctx = asm_ctx_init(&arena);
+    TokenStream*      stream  = build_token_stream(&arena, tokens->items, token_count);
+    asm_ctx->program.capcity  = 256;
+    int8_t         status     = run_parser(&arena, stream, &asm_ctx->program);
+    OptimizerStats stats      = {0};
+    if (status == 0 && optimize)
+    {
+        status = optimize_program(asm_ctx, &arena, &stats);
+    }
+
+    FILE* out = fdopen(mkstemp(path), "wb");
+    if (status == 0)
+    {
+        status = emit_program(asm_ctx, &arena, out, BYTECODE_SECTIONED_VERSION, false);
+    }
+    fclose(out);
+    asm_ctx_release(asm_ctx);
+    arena_free(&arena);
+    return status;
+}
+
+/*
+ *   Runs an image one instruction at a time, counting what is executed. Returns the halted
+ *   context, or NULL if the image fails.
+ * */
+static VMContext* count_instructions(const char* path, uint64_t* executed, double* elapsed)
+{
+    VMContext*         ctx = vm_create();
+    uint8_t            raw[INSTRUCTION_SIZE];
+    DecodedInstruction decoded;
+
+    *executed    = 0;
+    double start = now_seconds();
+    if (load_bytecode(ctx, path) != VM_EXIT_SUCCESS)
+    {
+        vm_destroy(ctx);
+        return NULL;
+    }
+    ctx->state = VM_STATE_RUNNING;
+    while (ctx->state == VM_STATE_RUNNING)
+    {
+        if (fetch_instruction(ctx, raw) != VM_EXIT_SUCCESS ||
+            decode_instruction(ctx, raw, &decoded) != VM_EXIT_SUCCESS ||
+            execute_bytecode(ctx, &decoded) != VM_EXIT_SUCCESS)
+        {
+            vm_destroy(ctx);
+            return NULL;
+        }
+        (*executed)++;
+    }
+    *elapsed = now_seconds() - start;
+    return ctx;
+}
+
+/*
+ *   Assembles `source` with and without -O and runs both, reporting how many instructions each
+ *   executed. The program leaves its result in r0.
+ * */
+static int compare_optimized(const char* benchmark, const char* source)
+{
+    const char* names[] = {"-O0", "-O"};
+    for (int optimize = 0; optimize < 2; optimize++)
+    {
+        char path[] = "/tmp/bitlang_bench_XXXXXX";
+        if (assemble_source(source, optimize, path) != 0)
+        {
+            LOG_ERROR("Failed to assemble the %s benchmark\n", benchmark);
+            unlink(path);
+            return EXIT_FAILURE;
+        }
+
+        uint64_t   executed;
+        double     elapsed;
+        VMContext* ctx = count_instructions(path, &executed, &elapsed);
+        unlink(path);
+        if (ctx == NULL)
+        {
+            return EXIT_FAILURE;
+        }
+        printf("%s %-3s: sum = %llu, %llu instructions executed in %.3f s\n", benchmark,
+               names[optimize], (unsigned long long) ctx->registers[REG_R0],
+               (unsigned long long) executed, elapsed);
+        vm_destroy(ctx);
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ *   A loop written the way a naive code generator emits it, assembled with and without -O.
+ * */
+static int bench_peephole(uint32_t iterations)
+{
+    char source[1024];
+    snprintf(source, sizeof(source),
+             ".start main\n"
+             "main:\n"
+             "mov r0, 0\n"
+             "mov r1, %u\n"
+             "loop:\n"
+             "push r1\n"
+             "pop r2\n"
+             "mov r2, r2\n"
+             "mov r3, r2\n"
+             "add r3, 2\n"
+             "sub r3, 1\n"
+             "add r0, r3\n"
+             "push r0\n"
+             "pop r0\n"
+             "sub r1, 1\n"
+             "jnz loop\n"
+             "jmp done\n"
+             "done:\n"
+             "halt\n",
+             iterations);
+    return compare_optimized("peephole", source);
+}
+
+/*
+ *   Copies between scratch registers, a dead store and a spill of the loop counter around a body
+ *   that never touches it: nothing adjacent for the peephole rules, all of it for liveness.
+ * */
+static int bench_coalesce(uint32_t iterations)
+{
+    char source[1024];
+    snprintf(source, sizeof(source),
+             ".start main\n"
+             "main:\n"
+             "mov r0, 0\n"
+             "mov r1, %u\n"
+             "loop:\n"
+             "push r1\n"
+             "mov r2, r1\n"
+             "mov r4, 7\n"
+             "add r2, 3\n"
+             "mov r4, r2\n"
+             "mov r3, r4\n"
+             "add r0, r3\n"
+             "mov r4, 0\n"
+             "pop r1\n"
+             "sub r1, 1\n"
+             "jnz loop\n"
+             "mov r2, 0\n"
+             "mov r3, 0\n"
+             "mov r4, 0\n"
+             "halt\n",
+             iterations);
+    return compare_optimized("coalesce", source);
+}
+
+/*
+ *   Runs `count` copies of fib(n) through a scheduler with `workers` threads; 0 on success.
+ * */
+static int time_scheduler(const char* path, uint32_t count, uint32_t workers, double* elapsed)
+{
+    VMScheduler* scheduler = vm_scheduler_create(workers, 100000);
+    VMTask*      tasks     = calloc(count, sizeof(VMTask));
+    int          status    = scheduler != NULL && tasks != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+    for (uint32_t i = 0; i < count && status == EXIT_SUCCESS; i++)
+    {
+        tasks[i].vm = vm_create();
+        if (vm_load(tasks[i].vm, path) != VM_EXIT_SUCCESS ||
+            vm_scheduler_submit(scheduler, &tasks[i]) != VM_EXIT_SUCCESS)
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    double start = now_seconds();
+    if (status == EXIT_SUCCESS && vm_scheduler_run(scheduler) != VM_EXIT_SUCCESS)
+    {
+        status = EXIT_FAILURE;
+    }
+    *elapsed = now_seconds() - start;
+
+    for (uint32_t i = 0; tasks != NULL && i < count; i++)
+    {
+        if (tasks[i].vm != NULL && tasks[i].result != VM_RUN_HALTED)
+        {
+            status = EXIT_FAILURE;
+        }
+        vm_task_release(&tasks[i]);
+        vm_destroy(tasks[i].vm);
+    }
+    free(tasks);
+    vm_scheduler_destroy(scheduler);
+    return status;
+}
+
+/*
+ *   Throughput of many independent VMs on one worker and on one worker per online CPU.
+ * */
+static int bench_scheduler(uint32_t count, uint32_t n)
+{
+    BenchImage image  = {0};
+    char       path[] = "/tmp/bitlang_bench_XXXXXX";
+    build_fib(&image, n);
+    if (write_image(&image, path) != 0)
+    {
+        LOG_ERROR("Failed to write benchmark image\n");
+        return EXIT_FAILURE;
+    }
+
+    long     online  = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t workers = online > 0 ? (uint32_t) online : 1;
+    double   single, pooled;
+    int      status = time_scheduler(path, count, 1, &single);
+    status |= time_scheduler(path, count, workers, &pooled);
+    unlink(path);
+
+    printf("scheduler: %u x fib(%u), 1 worker %.3f s, %u workers %.3f s (%.2fx)\n", count, n,
+           single, workers, pooled, single / pooled);
+    return status;
+}
+
+static long resident_kb(void)
+{
+    long  size  = 0;
+    long  pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        if (fscanf(statm, "%ld %ld", &size, &pages) != 2)
+        {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+/*
+ *   Spawns `count` fib(n) instances by loading the file into each and from one shared image,
+ *   then runs one instance of each kind.
+ * */
+static int bench_image(uint32_t count, uint32_t n)
+{
+    BenchImage  bench     = {0};
+    char        path[]    = "/tmp/bitlang_bench_XXXXXX";
+    VMContext** instances = calloc(count, sizeof(VMContext*));
+    build_fib(&bench, n);
+    if (instances == NULL || write_image(&bench, path) != 0)
+    {
+        LOG_ERROR("Failed to write benchmark image\n");
+        free(instances);
+        return EXIT_FAILURE;
+    }
+
+    int    status = EXIT_SUCCESS;
+    long   rss    = resident_kb();
+    double start  = now_seconds();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        instances[i] = vm_create();
+        status |= vm_load(instances[i], path) == VM_EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    double load_spawn = (now_seconds() - start) / count;
+    long   load_kb    = (resident_kb() - rss) / (long) count;
+    start             = now_seconds();
+    status |= vm_run_until(instances[0]) == VM_RUN_HALTED ? EXIT_SUCCESS : EXIT_FAILURE;
+    double load_run = now_seconds() - start;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        vm_destroy(instances[i]);
+    }
+
+    VMImage* image = vm_image_load(path);
+    unlink(path);
+    if (image == NULL)
+    {
+        free(instances);
+        return EXIT_FAILURE;
+    }
+    rss   = resident_kb();
+    start = now_seconds();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        instances[i] = vm_create_from_image(image);
+        status |= instances[i] != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    double image_spawn = (now_seconds() - start) / count;
+    long   image_kb    = (resident_kb() - rss) / (long) count;
+    start              = now_seconds();
+    status |= vm_run_until(instances[0]) == VM_RUN_HALTED ? EXIT_SUCCESS : EXIT_FAILURE;
+    double image_run = now_seconds() - start;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        vm_destroy(instances[i]);
+    }
+    vm_image_release(image);
+    free(instances);
+
+    printf("image: %u instances, vm_load %.1f us and %ld KB each, shared image %.1f us and %ld KB "
+           "each\n",
+           count, load_spawn * 1e6, load_kb, image_spawn * 1e6, image_kb);
+    printf("image: fib(%u) loaded %.3f s, predecoded %.3f s\n", n, load_run, image_run);
+    return status;
+}
+
+/*
+ *   Stands in for a run that starts after an expensive setup phase: the first `setup`
+ *   instructions of fib(n). Compares reloading and replaying the setup with forking a snapshot
+ *   taken right after it.
+ * */
+static int bench_fork(uint32_t count, uint64_t setup)
+{
+    BenchImage bench  = {0};
+    char       path[] = "/tmp/bitlang_bench_XXXXXX";
+    build_fib(&bench, 25);
+    if (write_image(&bench, path) != 0)
+    {
+        LOG_ERROR("Failed to write benchmark image\n");
+        return EXIT_FAILURE;
+    }
+
+    int    status = EXIT_SUCCESS;
+    double start  = now_seconds();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        VMContext* ctx = vm_create();
+        status |= vm_load(ctx, path) == VM_EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+        status |= vm_step_n(ctx, setup) == VM_RUN_BUDGET_EXHAUSTED ? EXIT_SUCCESS : EXIT_FAILURE;
+        vm_destroy(ctx);
+    }
+    double replay = (now_seconds() - start) / count;
+
+    VMContext* warm = vm_create();
+    status |= vm_load(warm, path) == VM_EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+    unlink(path);
+    vm_step_n(warm, setup);
+    start                 = now_seconds();
+    VMImage* snapshot     = vm_snapshot(warm);
+    double   capture_time = now_seconds() - start;
+    vm_destroy(warm);
+    if (snapshot == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    start = now_seconds();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        VMContext* ctx = vm_fork(snapshot);
+        status |= ctx != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+        vm_destroy(ctx);
+    }
+    double fork = (now_seconds() - start) / count;
+    vm_image_release(snapshot);
+
+    printf("fork: setup of %lu instructions, reload and replay %.1f us, snapshot %.1f us once, "
+           "fork %.1f us\n",
+           (unsigned long) setup, replay * 1e6, capture_time * 1e6, fork * 1e6);
+    return status;
+}
+
+/*
+ *   Two guest threads passing control back and forth n times: through yield alone, then through
+ *   a pair of one-slot channels. Each round trip is two thread switches.
+ * */
+static int bench_threads(uint32_t n)
+{
+    const uint8_t reg_imm    = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg_reg    = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    const uint8_t reg_target = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_ADDR);
+    const uint8_t target     = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE);
+
+    BenchImage yield = {0};
+    emit(&yield, OP_SPAWN, REG_R1, 0, AT(6), reg_target);
+    emit(&yield, OP_MOV, REG_R3, 0, n, reg_imm);
+    emit(&yield, OP_YIELD, 0, 0, 0, 0);
+    emit(&yield, OP_SUB, REG_R3, 0, 1, reg_imm);
+    emit(&yield, OP_JNZ, 0, 0, AT(2), target);
+    emit(&yield, OP_HALT, 0, 0, 0, 0);
+    emit(&yield, OP_YIELD, 0, 0, 0, 0); // 6: the other thread
+    emit(&yield, OP_JMP, 0, 0, AT(6), target);
+
+    BenchImage channels = {0};
+    emit(&channels, OP_CHAN, REG_R1, 0, 1, reg_imm);
+    emit(&channels, OP_CHAN, REG_R2, 0, 1, reg_imm);
+    emit(&channels, OP_SPAWN, REG_R5, 0, AT(9), reg_target);
+    emit(&channels, OP_MOV, REG_R3, 0, n, reg_imm);
+    emit(&channels, OP_SEND, REG_R1, REG_R3, 0, reg_reg);
+    emit(&channels, OP_RECV, REG_R4, REG_R2, 0, reg_reg);
+    emit(&channels, OP_SUB, REG_R3, 0, 1, reg_imm);
+    emit(&channels, OP_JNZ, 0, 0, AT(4), target);
+    emit(&channels, OP_HALT, 0, 0, 0, 0);
+    emit(&channels, OP_RECV, REG_R6, REG_R1, 0, reg_reg); // 9: echo thread
+    emit(&channels, OP_SEND, REG_R2, REG_R6, 0, reg_reg);
+    emit(&channels, OP_JMP, 0, 0, AT(9), target);
+
+    double     yield_time;
+    double     channel_time;
+    VMContext* yielded   = run_image(&yield, &yield_time);
+    VMContext* exchanged = run_image(&channels, &channel_time);
+    int        status    = yielded != NULL && exchanged != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (exchanged != NULL && exchanged->registers[REG_R4] != 1)
+    {
+        LOG_ERROR("Echo thread returned %lu\n", (unsigned long) exchanged->registers[REG_R4]);
+        status = EXIT_FAILURE;
+    }
+    vm_destroy(yielded);
+    vm_destroy(exchanged);
+
+    printf("threads: %u round trips, yield %.1f ns per switch, channels %.1f ns per round trip\n",
+           n, yield_time * 1e9 / (2.0 * n), channel_time * 1e9 / n);
+    return status;
+}
+
+/*
+ *   A producer VM streams n messages of `size` bytes from its data segment to a consumer VM
+ *   through a host pipe, both on a scheduler with one worker per online CPU.
+ * */
+static int bench_pipe(uint32_t n, uint32_t size)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg_reg = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    const uint8_t target  = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE);
+    BenchImage    images[2] = {0};
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        emit(&images[i], OP_MOV, REG_R1, 0, 0, reg_imm);
+        emit(&images[i], OP_MOV, REG_R5, 0, DATA_START, reg_imm);
+        emit(&images[i], OP_MOV, REG_R6, 0, n, reg_imm);
+        emit(&images[i], i == 0 ? OP_PSEND : OP_PRECV, REG_R1, REG_R5, 0, reg_reg);
+        emit(&images[i], OP_SUB, REG_R6, 0, 1, reg_imm);
+        emit(&images[i], OP_JNZ, 0, 0, AT(3), target);
+        emit(&images[i], OP_HALT, 0, 0, 0, 0);
+    }
+
+    long         online    = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t     workers   = online > 1 ? (uint32_t) online : 1;
+    VMPipe*      pipe      = vm_pipe_create(VM_PIPE_SPSC, 256, size);
+    VMScheduler* scheduler = vm_scheduler_create(workers, 100000);
+    VMTask       tasks[2]  = {0};
+    int          status    = pipe != NULL && scheduler != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+    for (uint32_t i = 0; i < 2 && status == EXIT_SUCCESS; i++)
+    {
+        char path[] = "/tmp/bitlang_bench_XXXXXX";
+        tasks[i].vm = vm_create();
+        if (write_image(&images[i], path) != 0 || vm_load(tasks[i].vm, path) != VM_EXIT_SUCCESS ||
+            vm_attach_pipe(tasks[i].vm, 0, pipe) != VM_EXIT_SUCCESS ||
+            vm_scheduler_submit(scheduler, &tasks[i]) != VM_EXIT_SUCCESS)
+        {
+            status = EXIT_FAILURE;
+        }
+        unlink(path);
+    }
+
+    double start = now_seconds();
+    if (status == EXIT_SUCCESS && vm_scheduler_run(scheduler) != VM_EXIT_SUCCESS)
+    {
+        status = EXIT_FAILURE;
+    }
+    double elapsed = now_seconds() - start;
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        if (tasks[i].vm != NULL && tasks[i].result != VM_RUN_HALTED)
+        {
+            status = EXIT_FAILURE;
+        }
+        vm_task_release(&tasks[i]);
+        vm_destroy(tasks[i].vm);
+    }
+    vm_scheduler_destroy(scheduler);
+    vm_pipe_destroy(pipe);
+
+    printf("pipe: %u x %u-byte messages, %u workers, %.3f s, %.1f ns per message, %.0f MB/s\n", n,
+           size, workers, elapsed, elapsed * 1e9 / n, (double) n * size / elapsed / 1e6);
+    return status;
+}
+
+// r0 = r0 * 31 + each of the r2 bytes at r1, as the guest loop in bench_native computes it
+static int8_t native_poly_hash(VMContext* ctx, uint64_t* registers)
+{
+    const uint8_t* data = vm_guest_pointer(ctx, registers[REG_R1], registers[REG_R2], false);
+    if (data == NULL)
+    {
+        return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+    }
+    uint64_t hash = registers[REG_R0];
+    for (uint64_t i = 0; i < registers[REG_R2]; i++)
+    {
+        hash = hash * 31 + data[i];
+    }
+    registers[REG_R0] = hash;
+    return VM_EXIT_SUCCESS;
+}
+
+static VMContext* run_with_natives(const BenchImage* image, const VMNativeFn* natives,
+                                   double* elapsed)
+{
+    char       path[] = "/tmp/bitlang_bench_XXXXXX";
+    VMContext* ctx    = vm_create();
+    if (write_image(image, path) != 0 || vm_load(ctx, path) != VM_EXIT_SUCCESS)
+    {
+        LOG_ERROR("Failed to load benchmark image\n");
+        unlink(path);
+        vm_destroy(ctx);
+        return NULL;
+    }
+    unlink(path);
+    ctx->natives       = natives;
+    double      start  = now_seconds();
+    VMRunResult result = vm_step_n(ctx, UINT64_MAX);
+    *elapsed           = now_seconds() - start;
+    if (result != VM_RUN_HALTED)
+    {
+        LOG_ERROR("Benchmark image stopped with result %d\n", result);
+        vm_destroy(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/*
+ *   Hashes `rounds` passes over a 4 KB guest buffer, once in interpreted guest code and once
+ *   through CALLNATIVE, then times `calls` calls to a native function that does nothing.
+ * */
+static int bench_native(uint32_t rounds, uint32_t calls)
+{
+    const uint8_t  reg_imm                = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t  reg_reg                = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    const uint8_t  reg_indirect           = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_INDIRECT);
+    const uint8_t  imm                    = MAKE_METADATA(VM_AM_IMM_INT, VM_AM_NONE);
+    const uint8_t  target                 = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE);
+    const uint32_t len                    = 4096;
+    VMNativeFn     natives[VM_NATIVE_MAX] = {[0] = native_poly_hash};
+
+    BenchImage guest = {0};
+    emit(&guest, OP_MOV, REG_R6, 0, rounds, reg_imm);
+    emit(&guest, OP_MOV, REG_R1, 0, DATA_START, reg_imm); // 1: each round
+    emit(&guest, OP_MOV, REG_R2, 0, len, reg_imm);
+    emit(&guest, OP_MOV, REG_R4, REG_R1, 0, reg_indirect); // 3: each byte
+    emit(&guest, OP_AND, REG_R4, 0, 0xFF, reg_imm);
+    emit(&guest, OP_MUL, REG_R0, 0, 31, reg_imm);
+    emit(&guest, OP_ADD, REG_R0, REG_R4, 0, reg_reg);
+    emit(&guest, OP_ADD, REG_R1, 0, 1, reg_imm);
+    emit(&guest, OP_SUB, REG_R2, 0, 1, reg_imm);
+    emit(&guest, OP_JNZ, 0, 0, AT(3), target);
+    emit(&guest, OP_SUB, REG_R6, 0, 1, reg_imm);
+    emit(&guest, OP_JNZ, 0, 0, AT(1), target);
+    emit(&guest, OP_HALT, 0, 0, 0, 0);
+
+    BenchImage native = {0};
+    emit(&native, OP_MOV, REG_R6, 0, rounds, reg_imm);
+    emit(&native, OP_MOV, REG_R1, 0, DATA_START, reg_imm); // 1: each round
+    emit(&native, OP_MOV, REG_R2, 0, len, reg_imm);
+    emit(&native, OP_CALLNATIVE, 0, 0, 0, imm);
+    emit(&native, OP_SUB, REG_R6, 0, 1, reg_imm);
+    emit(&native, OP_JNZ, 0, 0, AT(1), target);
+    emit(&native, OP_HALT, 0, 0, 0, 0);
+
+    // r2 = 0 makes the hash a no-op, leaving the cost of the call itself
+    BenchImage empty = {0};
+    emit(&empty, OP_MOV, REG_R6, 0, calls, reg_imm);
+    emit(&empty, OP_MOV, REG_R1, 0, DATA_START, reg_imm);
+    emit(&empty, OP_MOV, REG_R2, 0, 0, reg_imm);
+    emit(&empty, OP_CALLNATIVE, 0, 0, 0, imm); // 3: each call
+    emit(&empty, OP_SUB, REG_R6, 0, 1, reg_imm);
+    emit(&empty, OP_JNZ, 0, 0, AT(3), target);
+    emit(&empty, OP_HALT, 0, 0, 0, 0);
+
+    double     guest_time, native_time, call_time;
+    VMContext* interpreted = run_with_natives(&guest, natives, &guest_time);
+    VMContext* called      = run_with_natives(&native, natives, &native_time);
+    VMContext* overhead    = run_with_natives(&empty, natives, &call_time);
+    int        status      = EXIT_SUCCESS;
+    if (interpreted == NULL || called == NULL || overhead == NULL ||
+        interpreted->registers[REG_R0] != called->registers[REG_R0])
+    {
+        LOG_ERROR("Guest and native hashes disagree\n");
+        status = EXIT_FAILURE;
+    }
+    vm_destroy(interpreted);
+    vm_destroy(called);
+    vm_destroy(overhead);
+
+    printf("native: %u x 4 KB hash, guest %.3f s, callnative %.4f s (%.0fx); "
+           "%.1f ns per empty-call loop iteration\n",
+           rounds, guest_time, native_time, guest_time / native_time, call_time * 1e9 / calls);
+    return status;
+}
+
+/*
+ *   `count` VMs each read the same `size`-byte file to end of file in 4 KB reads: first one
+ *   after another with blocking system calls, then together on a single scheduler worker whose
+ *   io_uring takes the reads while the worker runs the other VMs.
+ * */
+static int bench_io(uint32_t count, uint32_t size)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg_reg = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    const uint8_t target  = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE);
+    BenchImage    image   = {0};
+    emit(&image, OP_MOV, REG_R1, 0, DATA_START, reg_imm);
+    emit(&image, OP_MOV, REG_R2, 0, VM_OPEN_READ, reg_imm);
+    emit(&image, OP_OPEN, REG_R3, REG_R1, 0, reg_reg);
+    emit(&image, OP_MOV, REG_R4, 0, DATA_START + 256, reg_imm);
+    emit(&image, OP_MOV, REG_R2, 0, 4096, reg_imm); // 4: each read
+    emit(&image, OP_READ, REG_R3, REG_R4, 0, reg_reg);
+    emit(&image, OP_JNZ, 0, 0, AT(4), target);
+    emit(&image, OP_CLOSE, REG_R3, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_NONE));
+    emit(&image, OP_HALT, 0, 0, 0, 0);
+
+    char  data[] = "/tmp/bitlang_bench_XXXXXX";
+    char  path[] = "/tmp/bitlang_bench_XXXXXX";
+    int   fd     = mkstemp(data);
+    char* block  = calloc(1, 4096);
+    int   status = fd >= 0 && block != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+    for (uint32_t written = 0; status == EXIT_SUCCESS && written < size; written += 4096)
+    {
+        if (write(fd, block, 4096) != 4096)
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+    free(block);
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (status != EXIT_SUCCESS || write_image(&image, path) != 0)
+    {
+        LOG_ERROR("Failed to write benchmark files\n");
+        unlink(data);
+        return EXIT_FAILURE;
+    }
+
+    VMScheduler* scheduler = vm_scheduler_create(1, 100000);
+    VMTask*      tasks     = calloc(count, sizeof(VMTask));
+    status = scheduler != NULL && tasks != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+    for (uint32_t i = 0; i < count && status == EXIT_SUCCESS; i++)
+    {
+        tasks[i].vm = vm_create();
+        if (vm_load(tasks[i].vm, path) != VM_EXIT_SUCCESS)
+        {
+            status = EXIT_FAILURE;
+            break;
+        }
+        memcpy(tasks[i].vm->memory + DATA_START, data, sizeof(data));
+    }
+
+    double start = now_seconds();
+    for (uint32_t i = 0; i < count && status == EXIT_SUCCESS; i++)
+    {
+        VMContext* copy = vm_create();
+        if (vm_load(copy, path) != VM_EXIT_SUCCESS)
+        {
+            status = EXIT_FAILURE;
+        }
+        memcpy(copy->memory + DATA_START, data, sizeof(data));
+        if (status == EXIT_SUCCESS && vm_step_n(copy, UINT64_MAX) != VM_RUN_HALTED)
+        {
+            status = EXIT_FAILURE;
+        }
+        vm_destroy(copy);
+    }
+    double blocking = now_seconds() - start;
+
+    for (uint32_t i = 0; i < count && status == EXIT_SUCCESS; i++)
+    {
+        if (vm_scheduler_submit(scheduler, &tasks[i]) != VM_EXIT_SUCCESS)
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+    start = now_seconds();
+    if (status == EXIT_SUCCESS && vm_scheduler_run(scheduler) != VM_EXIT_SUCCESS)
+    {
+        status = EXIT_FAILURE;
+    }
+    double ring = now_seconds() - start;
+    for (uint32_t i = 0; tasks != NULL && i < count; i++)
+    {
+        if (tasks[i].vm != NULL && tasks[i].result != VM_RUN_HALTED)
+        {
+            status = EXIT_FAILURE;
+        }
+        vm_task_release(&tasks[i]);
+        vm_destroy(tasks[i].vm);
+    }
+    free(tasks);
+    vm_scheduler_destroy(scheduler);
+    unlink(path);
+    unlink(data);
+
+    double reads = (double) count * (size / 4096 + 1);
+    printf("io: %u VMs x %u KB in 4 KB reads, blocking %.3f s (%.2f us per read), "
+           "1 worker + io_uring %.3f s (%.2f us per read)\n",
+           count, size / 1024, blocking, blocking * 1e6 / reads, ring, ring * 1e6 / reads);
+    return status;
+}
+
+/*
+ *   A small record program (add a 16-byte input into a running total in data, write the total)
+ *   over n records: a fresh instance per record, then vm_run_batch on one thread and on one per
+ *   online CPU.
+ * */
+static int bench_batch(uint32_t n)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg_reg = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    BenchImage    bench   = {0};
+    emit(&bench, OP_MOV, REG_R1, 0, DATA_START, reg_imm);
+    emit(&bench, OP_MOV, REG_R2, 0, DATA_START + 16, reg_imm);
+    emit(&bench, OP_VLOAD, 0, REG_R1, 0, reg_reg);
+    emit(&bench, OP_VLOAD, 1, REG_R2, 0, reg_reg);
+    emit(&bench, OP_VADD32, 0, 1, 0, reg_reg);
+    emit(&bench, OP_VSTORE, REG_R2, 0, 0, reg_reg);
+    emit(&bench, OP_HALT, 0, 0, 0, 0);
+
+    char     path[]  = "/tmp/bitlang_bench_XXXXXX";
+    VMImage* image   = write_image(&bench, path) == 0 ? vm_image_load(path) : NULL;
+    uint8_t* inputs  = malloc((size_t) n * 16);
+    uint8_t* outputs = malloc((size_t) n * 16);
+    unlink(path);
+    if (image == NULL || inputs == NULL || outputs == NULL)
+    {
+        LOG_ERROR("Failed to set up the batch benchmark\n");
+        vm_image_release(image);
+        free(inputs);
+        free(outputs);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < (size_t) n * 16; i++)
+    {
+        inputs[i] = (uint8_t) i;
+    }
+
+    // Instance per record, on a sample: vm_destroy's logging dominates a full run
+    int      status  = EXIT_SUCCESS;
+    uint32_t sampled = n < 10000 ? n : 10000;
+    double   start   = now_seconds();
+    for (uint32_t i = 0; i < sampled; i++)
+    {
+        VMContext* ctx = vm_create_from_image(image);
+        memcpy(ctx->memory + DATA_START, inputs + (size_t) i * 16, 16);
+        status |= vm_step_n(ctx, UINT64_MAX) == VM_RUN_HALTED ? EXIT_SUCCESS : EXIT_FAILURE;
+        memcpy(outputs + (size_t) i * 16, ctx->memory + DATA_START + 16, 16);
+        vm_destroy(ctx);
+    }
+    double fresh = (now_seconds() - start) / sampled;
+
+    VMBatchLayout layout = {
+        .input_at    = DATA_START,
+        .input_size  = 16,
+        .output_at   = DATA_START + 16,
+        .output_size = 16,
+        .threads     = 1,
+    };
+    double timed[2];
+    for (uint32_t run = 0; run < 2; run++)
+    {
+        layout.threads = run == 0 ? 1 : 0;
+        start          = now_seconds();
+        if (vm_run_batch(image, &layout, inputs, outputs, n, NULL) != VM_EXIT_SUCCESS ||
+            memcmp(inputs, outputs, (size_t) n * 16) != 0)
+        {
+            status = EXIT_FAILURE;
+        }
+        timed[run] = (now_seconds() - start) / n;
+    }
+    vm_image_release(image);
+    free(inputs);
+    free(outputs);
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    printf("batch: %u records, instance per record %.0f ns, vm_run_batch 1 thread %.0f ns, "
+           "%ld threads %.0f ns per record\n",
+           n, fresh * 1e9, timed[0] * 1e9, online > 1 ? online : 1L, timed[1] * 1e9);
+    return status;
+}
+
+#define BENCH_LOG_CALLS 200000
+
+static FILE* bench_log_sink;
+
+// What log_message did before it queued records: three fprintf calls on the caller's thread
+static void log_synchronously(const char* file, int line, const char* func, const char* fmt, ...)
+{
+    fprintf(bench_log_sink, "[%s] %s:%d %s() - ", "WARN ", file, line, func);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(bench_log_sink, fmt, args);
+    va_end(args);
+    fprintf(bench_log_sink, "\n");
+}
+
+static void* log_calls(void* arg)
+{
+    bool queued = arg != NULL;
+    for (uint32_t i = 0; i < BENCH_LOG_CALLS; i++)
+    {
+        if (queued)
+        {
+            LOG_WARN("VM State: %d, opcode %x at %s", 1, i, "bench");
+        }
+        else
+        {
+            log_synchronously(__FILE__, __LINE__, __func__, "VM State: %d, opcode %x at %s", 1, i,
+                              "bench");
+        }
+    }
+    return NULL;
+}
+
+// Times `threads` threads making BENCH_LOG_CALLS calls each, with and without the output drained
+static void time_logging(uint32_t threads, bool queued)
+{
+    pthread_t workers[64];
+    double    start = now_seconds();
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        pthread_create(&workers[i], NULL, log_calls, queued ? &workers[i] : NULL);
+    }
+    for (uint32_t i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    double calls = now_seconds() - start;
+    log_flush();
+    fflush(bench_log_sink);
+    printf("logger: %u thread(s), %s: %.0f ns per call, %.0f ns per call with output\n", threads,
+           queued ? "queued" : "synchronous", calls * 1e9 / ((double) threads * BENCH_LOG_CALLS),
+           (now_seconds() - start) * 1e9 / ((double) threads * BENCH_LOG_CALLS));
+}
+
+/*
+ *   LOG_WARN from one thread and from one per online CPU into /dev/null, against the old
+ *   synchronous fprintf path. LOG_ERROR is not timed: it waits for its record to be written.
+ * */
+static int bench_logger(void)
+{
+    bench_log_sink = fopen("/dev/null", "w");
+    if (bench_log_sink == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    long     online  = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threads = online > 1 ? (uint32_t) (online < 64 ? online : 64) : 1;
+    LogLevel saved       = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_WARN;
+    setvbuf(bench_log_sink, NULL, _IONBF, 0); // stderr is unbuffered too
+    log_set_sink(bench_log_sink);
+    // Bursts that fit in a thread's ring: what a caller pays when the writer keeps up
+    double burst = 0;
+    for (uint32_t round = 0; round < BENCH_LOG_CALLS / 100; round++)
+    {
+        double start = now_seconds();
+        for (uint32_t i = 0; i < 100; i++)
+        {
+            LOG_WARN("VM State: %d, opcode %x at %s", 1, i, "bench");
+        }
+        burst += now_seconds() - start;
+        log_flush();
+    }
+    printf("logger: bursts of 100, queued: %.0f ns per call\n", burst * 1e9 / BENCH_LOG_CALLS);
+    time_logging(1, false);
+    time_logging(1, true);
+    if (threads > 1)
+    {
+        time_logging(threads, false);
+        time_logging(threads, true);
+    }
+    log_set_sink(NULL);
+    g_compiler_log_level = saved;
+    fclose(bench_log_sink);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+
+    const char* which = argc > 1 ? argv[1] : "all";
+    int         status = EXIT_SUCCESS;
+
+    if (strcmp(which, "all") == 0 || strcmp(which, "fib") == 0)
+    {
+        uint32_t n = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 25;
+        status |= bench_fib_calls(n);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "strlen") == 0)
+    {
+        uint32_t len = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 200000;
+        status |= bench_strlen(len, 1000);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "bytecount") == 0)
+    {
+        uint32_t len = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 200000;
+        status |= bench_byte_count(len);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "format") == 0)
+    {
+        uint32_t n = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 25;
+        status |= bench_formats(n, 1000);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "peephole") == 0)
+    {
+        uint32_t n = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 1000000;
+        status |= bench_peephole(n);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "coalesce") == 0)
+    {
+        uint32_t n = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 1000000;
+        status |= bench_coalesce(n);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "scheduler") == 0)
+    {
+        uint32_t count = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 64;
+        status |= bench_scheduler(count, 20);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "image") == 0)
+    {
+        uint32_t count = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 256;
+        status |= bench_image(count, 25);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "fork") == 0)
+    {
+        uint64_t setup = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+        status |= bench_fork(64, setup);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "threads") == 0)
+    {
+        uint32_t n = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 1000000;
+        status |= bench_threads(n);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "pipe") == 0)
+    {
+        uint32_t n = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 1000000;
+        status |= bench_pipe(n, 256);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "native") == 0)
+    {
+        uint32_t rounds = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 256;
+        status |= bench_native(rounds, 1000000);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "io") == 0)
+    {
+        uint32_t count = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 16;
+        status |= bench_io(count, 8u << 20);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "batch") == 0)
+    {
+        uint32_t n = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 1000000;
+        status |= bench_batch(n);
+    }
+    if (strcmp(which, "all") == 0 || strcmp(which, "logger") == 0)
+    {
+        status |= bench_logger();
+    }
+
+    return status;
+}
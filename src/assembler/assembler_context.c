@@ -10,16 +10,33 @@ AssemblerContext* asm_ctx_init(MemoryArena* arena)
 
     // SECTIONS
     asm_ctx->code_start   = CODE_START;
+    asm_ctx->code_size    = 0;
+    asm_ctx->entry_point  = CODE_START;
     asm_ctx->data_start   = DATA_START;
+    asm_ctx->data_size    = 0;
     asm_ctx->rodata_start = RODATA_START;
+    asm_ctx->rodata_size  = 0;
     asm_ctx->initial_hp   = HEAP_START;
     asm_ctx->initial_sp   = STACK_START;
 
     // SYMBOL TABLE
-    asm_ctx->symbol_table = NULL;
+    asm_ctx->symbol_table  = (SymbolTable**) arena_alloc(arena, sizeof(SymbolTable*));
+    *asm_ctx->symbol_table = symbol_table_init();
 
-    // MEMORY
-    asm_ctx->memory = (uint8_t*) arena_alloc(arena, MEM_SIZE);
+    // CONSTANT POOL
+    constant_pool_init(&asm_ctx->constant_pool);
+
+    // MEMORY: laid out like the VM's, so section addresses are final addresses
+    asm_ctx->memory = (uint8_t*) arena_calloc(arena, 1, MEM_SIZE);
 
     return asm_ctx;
 }
+
+/*
+ *   Everything else lives in the arena; this releases the hash tables' bucket arrays.
+ * */
+void asm_ctx_release(AssemblerContext* asm_ctx)
+{
+    symbol_table_clear(asm_ctx->symbol_table);
+    constant_pool_clear(&asm_ctx->constant_pool);
+}
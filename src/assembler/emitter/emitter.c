@@ -0,0 +1,571 @@
+#include "emitter.h"
+#include "bytecode.h"
+#include "constant_pool.h"
+#include "instruction_format_table.h"
+#include "lexer.h"
+#include "logger.h"
+#include "symbol_table.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DATA_ALIGN_LOG2 3
+#define DATA_ALIGN (1u << DATA_ALIGN_LOG2)
+#define ALIGN_UP(value, align) (((value) + (align) - 1) & ~(uint32_t) ((align) - 1))
+
+static int8_t define_symbol(AssemblerContext* asm_ctx, MemoryArena* arena, const char* name,
+                            uint32_t address)
+{
+    if (!symbol_table_add(arena, asm_ctx->symbol_table, name, address))
+    {
+        LOG_ERROR("Symbol '%s' is defined more than once\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ *   `.data name, value` places one item in the data section and binds name to its address.
+ *   Integers are stored as 8-byte little-endian words, so both 32- and 64-bit images read them
+ *   correctly.
+ * */
+static int8_t layout_datum(AssemblerContext* asm_ctx, MemoryArena* arena,
+                           const ParsedDirective* directive)
+{
+    const Operand* name  = &directive->operands[0];
+    const Operand* value = &directive->operands[1];
+
+    if (name->type != OT_SYMBOL || value->type == OT_NONE)
+    {
+        LOG_ERROR(".data expects a name and a value\n");
+        return -1;
+    }
+
+    const void* bytes;
+    uint32_t    len;
+    int64_t     word;
+    char        chr;
+    switch (value->type)
+    {
+    case OT_IMMEDIATE_STR:
+        bytes = value->value.literal.value.stringValue;
+        len   = (uint32_t) strlen(value->value.literal.value.stringValue) + 1;
+        break;
+    case OT_IMMEDIATE_INT:
+        word  = value->value.literal.value.longValue;
+        bytes = &word;
+        len   = sizeof(word);
+        break;
+    case OT_IMMEDIATE_CHR:
+        chr   = value->value.literal.value.charValue;
+        bytes = &chr;
+        len   = sizeof(chr);
+        break;
+    default:
+        LOG_ERROR("Unsupported value for data item '%s'\n", name->value.symbol);
+        return -1;
+    }
+
+    uint32_t offset = ALIGN_UP(asm_ctx->data_size, DATA_ALIGN);
+    if (offset > DATA_SIZE || len > DATA_SIZE - offset)
+    {
+        LOG_ERROR("Data item '%s' does not fit in its section\n", name->value.symbol);
+        return -1;
+    }
+    memcpy(asm_ctx->memory + asm_ctx->data_start + offset, bytes, len);
+    asm_ctx->data_size = offset + len;
+    return define_symbol(asm_ctx, arena, name->value.symbol, asm_ctx->data_start + offset);
+}
+
+/*
+ *   `.rodata name, value` items and string operands of instructions all go through the constant
+ *   pool, so each distinct constant is stored once. Chars are pooled as integer words.
+ * */
+static int8_t pool_constant(AssemblerContext* asm_ctx, MemoryArena* arena, const Operand* value)
+{
+    switch (value->type)
+    {
+    case OT_IMMEDIATE_STR:
+        constant_pool_add_string(arena, &asm_ctx->constant_pool,
+                                 value->value.literal.value.stringValue);
+        return 0;
+    case OT_IMMEDIATE_INT:
+        constant_pool_add_integer(arena, &asm_ctx->constant_pool,
+                                  value->value.literal.value.longValue);
+        return 0;
+    case OT_IMMEDIATE_CHR:
+        constant_pool_add_integer(arena, &asm_ctx->constant_pool,
+                                  value->value.literal.value.charValue);
+        return 0;
+    default:
+        LOG_ERROR("Unsupported read-only value\n");
+        return -1;
+    }
+}
+
+static bool constant_address(AssemblerContext* asm_ctx, const Operand* value, uint32_t* out)
+{
+    uint32_t offset;
+    bool     found = false;
+    switch (value->type)
+    {
+    case OT_IMMEDIATE_STR:
+        found = constant_pool_string_offset(&asm_ctx->constant_pool,
+                                            value->value.literal.value.stringValue, &offset);
+        break;
+    case OT_IMMEDIATE_INT:
+        found = constant_pool_integer_offset(&asm_ctx->constant_pool,
+                                             value->value.literal.value.longValue, &offset);
+        break;
+    case OT_IMMEDIATE_CHR:
+        found = constant_pool_integer_offset(&asm_ctx->constant_pool,
+                                             value->value.literal.value.charValue, &offset);
+        break;
+    default:
+        break;
+    }
+    if (found)
+    {
+        *out = asm_ctx->rodata_start + offset;
+    }
+    return found;
+}
+
+static bool is_rodata(const Line* line)
+{
+    return line->type == LINE_DIRECTIVE && line->value.directive.type == DIRECTIVE_RODATA;
+}
+
+/*
+ *   Pools every read-only constant, lays the pool out as the rodata section, then binds the names
+ *   of `.rodata` items to their (possibly shared) addresses.
+ * */
+static int8_t layout_rodata(AssemblerContext* asm_ctx, MemoryArena* arena)
+{
+    for (int i = 0; i < asm_ctx->program.count; i++)
+    {
+        const Line* line = &asm_ctx->program.lines[i];
+        if (is_rodata(line))
+        {
+            const Operand* name  = &line->value.directive.operands[0];
+            const Operand* value = &line->value.directive.operands[1];
+            if (name->type != OT_SYMBOL || pool_constant(asm_ctx, arena, value) != 0)
+            {
+                LOG_ERROR(".rodata expects a name and a value\n");
+                return -1;
+            }
+        }
+        else if (line->type == LINE_INSTRUCTION)
+        {
+            const Instruction* instruction = &line->value.instruction;
+            const int operand_count = instruction->operand_types[0] == OT_NONE
+                                          ? 0
+                                          : opcode_info[instruction->opcode].operand_count;
+            for (int j = 0; j < operand_count; j++)
+            {
+                if (instruction->operand_types[j] == OT_IMMEDIATE_STR)
+                {
+                    pool_constant(asm_ctx, arena, &instruction->operands[j]);
+                }
+            }
+        }
+    }
+
+    if (constant_pool_layout(&asm_ctx->constant_pool, asm_ctx->memory + asm_ctx->rodata_start,
+                             RODATA_SIZE) != 0)
+    {
+        return -1;
+    }
+    asm_ctx->rodata_size = asm_ctx->constant_pool.size;
+
+    for (int i = 0; i < asm_ctx->program.count; i++)
+    {
+        const Line* line = &asm_ctx->program.lines[i];
+        uint32_t    address;
+        if (is_rodata(line) &&
+            (!constant_address(asm_ctx, &line->value.directive.operands[1], &address) ||
+             define_symbol(asm_ctx, arena, line->value.directive.operands[0].value.symbol,
+                           address) != 0))
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ *   Pass one: assigns every label its fixed-form code address and lays out .data/.rodata items.
+ *   Compact images reuse these addresses, since the loader expands them back to the fixed form.
+ * */
+int8_t emit_layout(AssemblerContext* asm_ctx, MemoryArena* arena)
+{
+    asm_ctx->location_counter = asm_ctx->code_start;
+
+    for (int i = 0; i < asm_ctx->program.count; i++)
+    {
+        const Line* line   = &asm_ctx->program.lines[i];
+        int8_t      status = 0;
+        switch (line->type)
+        {
+        case LINE_LABEL_DEF:
+            status = define_symbol(asm_ctx, arena, line->value.label, asm_ctx->location_counter);
+            break;
+        case LINE_INSTRUCTION:
+            asm_ctx->location_counter += bytecode_fixed_size(line->value.instruction.opcode);
+            if (asm_ctx->location_counter > asm_ctx->code_start + CODE_SIZE)
+            {
+                LOG_ERROR("Program does not fit in the code segment\n");
+                return -1;
+            }
+            break;
+        case LINE_DIRECTIVE:
+            if (line->value.directive.type == DIRECTIVE_DATA)
+            {
+                status = layout_datum(asm_ctx, arena, &line->value.directive);
+            }
+            break;
+        }
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+    return layout_rodata(asm_ctx, arena);
+}
+
+static int8_t encode_operand(AssemblerContext* asm_ctx, const Instruction* instruction, int index,
+                             uint8_t* out, VMAddressingMode* mode, bool* has_immediate)
+{
+    const Operand* operand = &instruction->operands[index];
+    const char*    name    = opcode_info[instruction->opcode].name;
+    const bool     vector  = opcode_info[instruction->opcode].operands[index] == OT_VECTOR_REGISTER;
+    int64_t        value;
+
+    // r- and v-registers both encode as a bare index, so the class can only be checked here
+    if (vector && operand->type != OT_REGISTER)
+    {
+        LOG_ERROR("%s: operand %d must be a vector register\n", name, index + 1);
+        return -1;
+    }
+
+    switch (operand->type)
+    {
+    case OT_REGISTER:
+    {
+        Register reg = operand->value.reg;
+        if (reg >= REG_V0 && reg <= REG_V7)
+        {
+            if (!vector)
+            {
+                LOG_ERROR("%s: operand %d must be a scalar register\n", name, index + 1);
+                return -1;
+            }
+            out[OPERAND_1_INDEX + index] = (uint8_t) (reg - REG_V0);
+        }
+        else if (reg <= REG_R7)
+        {
+            if (vector)
+            {
+                LOG_ERROR("%s: operand %d must be a vector register\n", name, index + 1);
+                return -1;
+            }
+            out[OPERAND_1_INDEX + index] = (uint8_t) reg;
+        }
+        else
+        {
+            LOG_ERROR("%s: sp and bp cannot be used as operands\n", name);
+            return -1;
+        }
+        *mode = VM_AM_REG_DIRECT;
+        return 0;
+    }
+    case OT_IMMEDIATE_INT:
+        value = operand->value.literal.value.longValue;
+        *mode = VM_AM_IMM_INT;
+        break;
+    case OT_IMMEDIATE_CHR:
+        value = (unsigned char) operand->value.literal.value.charValue;
+        *mode = VM_AM_IMM_INT;
+        break;
+    case OT_IMMEDIATE_STR:
+    {
+        uint32_t address;
+        if (!constant_address(asm_ctx, operand, &address))
+        {
+            LOG_ERROR("%s: string literal is not in the constant pool\n", name);
+            return -1;
+        }
+        value = address;
+        *mode = VM_AM_IMM_ADDR;
+        break;
+    }
+    case OT_SYMBOL:
+    {
+        uint32_t address;
+        if (!symbol_table_lookup(*asm_ctx->symbol_table, operand->value.symbol, &address))
+        {
+            LOG_ERROR("%s: undefined symbol '%s'\n", name, operand->value.symbol);
+            return -1;
+        }
+        value = address;
+        *mode = VM_AM_IMM_ADDR;
+        break;
+    }
+    default:
+        LOG_ERROR("%s: operand %d cannot be encoded\n", name, index + 1);
+        return -1;
+    }
+
+    if (*has_immediate)
+    {
+        LOG_ERROR("%s: only one operand can be an immediate\n", name);
+        return -1;
+    }
+    *has_immediate = true;
+
+    uint32_t low  = (uint32_t) value;
+    uint32_t high = (uint32_t) ((uint64_t) value >> 32);
+    if (instruction->opcode == OP_MOVQ)
+    {
+        memcpy(&out[INSTRUCTION_SIZE], &high, sizeof(uint32_t));
+    }
+    else if (value < INT32_MIN || value > (int64_t) UINT32_MAX)
+    {
+        LOG_ERROR("%s: immediate does not fit in 32 bits, use movq\n", name);
+        return -1;
+    }
+    memcpy(&out[IMMEDIATE_VALUE_START], &low, sizeof(uint32_t));
+    return 0;
+}
+
+static int8_t encode_instruction(AssemblerContext* asm_ctx, const Instruction* instruction,
+                                 uint8_t* out)
+{
+    const OpcodeInfo* info               = &opcode_info[instruction->opcode];
+    VMAddressingMode  modes[2]           = {VM_AM_REG_DIRECT, VM_AM_REG_DIRECT};
+    bool              has_immediate      = false;
+    int               available_operands = info->operand_count;
+
+    memset(out, 0, bytecode_fixed_size(instruction->opcode));
+    out[OPCODE_INDEX] = (uint8_t) instruction->opcode;
+
+    // The parser leaves operand_types[1] unset when the first operand is missing
+    if (available_operands > 0 && instruction->operand_types[0] == OT_NONE)
+    {
+        available_operands = 0;
+    }
+    if (available_operands < info->operand_count ||
+        (info->operand_count == 2 && instruction->operand_types[1] == OT_NONE))
+    {
+        LOG_ERROR("%s expects %d operand(s)\n", info->name, info->operand_count);
+        return -1;
+    }
+
+    for (int i = 0; i < info->operand_count; i++)
+    {
+        int8_t status = encode_operand(asm_ctx, instruction, i, out, &modes[i], &has_immediate);
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    out[METADATA_INDEX] = MAKE_METADATA(modes[0], modes[1]);
+    return 0;
+}
+
+/*
+ *   Pass two: encodes instructions into the code segment and resolves the entry point.
+ * */
+int8_t emit_code(AssemblerContext* asm_ctx)
+{
+    uint32_t address = asm_ctx->code_start;
+
+    for (int i = 0; i < asm_ctx->program.count; i++)
+    {
+        const Line* line = &asm_ctx->program.lines[i];
+        if (line->type == LINE_INSTRUCTION)
+        {
+            int8_t status = encode_instruction(asm_ctx, &line->value.instruction,
+                                               asm_ctx->memory + address);
+            if (status != 0)
+            {
+                LOG_ERROR("Failed to encode instruction at 0x%X\n", address);
+                return status;
+            }
+            address += bytecode_fixed_size(line->value.instruction.opcode);
+        }
+        else if (line->type == LINE_DIRECTIVE && line->value.directive.type == DIRECTIVE_START)
+        {
+            const Operand* label = &line->value.directive.operands[0];
+            if (label->type != OT_SYMBOL ||
+                !symbol_table_lookup(*asm_ctx->symbol_table, label->value.symbol,
+                                     &asm_ctx->entry_point))
+            {
+                LOG_ERROR(".start needs a defined label\n");
+                return -1;
+            }
+        }
+    }
+
+    asm_ctx->code_size = address - asm_ctx->code_start;
+    return 0;
+}
+
+static void write_u16(FILE* f, uint16_t value)
+{
+    uint8_t b[2] = {(uint8_t) value, (uint8_t) (value >> 8)};
+    fwrite(b, 1, sizeof(b), f);
+}
+
+static void write_u32(FILE* f, uint32_t value)
+{
+    uint8_t b[4] = {(uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16),
+                    (uint8_t) (value >> 24)};
+    fwrite(b, 1, sizeof(b), f);
+}
+
+/*
+ *   Version 3 layout: header, section table, then each non-empty section at an 8-aligned file
+ *   offset so the loader can read it straight into its segment.
+ * */
+static void write_sectioned(AssemblerContext* asm_ctx, FILE* out, uint16_t version,
+                            const uint8_t* code, uint32_t code_len, bool compact_code)
+{
+    const uint8_t  types[BYTECODE_MAX_SECTIONS]    = {BYTECODE_SECTION_CODE, BYTECODE_SECTION_RODATA,
+                                                      BYTECODE_SECTION_DATA};
+    const uint8_t* payloads[BYTECODE_MAX_SECTIONS] = {code,
+                                                      asm_ctx->memory + asm_ctx->rodata_start,
+                                                      asm_ctx->memory + asm_ctx->data_start};
+    const uint32_t sizes[BYTECODE_MAX_SECTIONS]    = {code_len, asm_ctx->rodata_size,
+                                                      asm_ctx->data_size};
+
+    uint16_t count = 0;
+    for (int i = 0; i < BYTECODE_MAX_SECTIONS; i++)
+    {
+        count += sizes[i] > 0;
+    }
+
+    write_u32(out, BYTECODE_MAGIC);
+    write_u16(out, version);
+    write_u16(out, count);
+    write_u32(out, asm_ctx->entry_point - asm_ctx->code_start);
+
+    uint32_t offsets[BYTECODE_MAX_SECTIONS];
+    uint32_t offset = BYTECODE_SECTIONED_HEADER_SIZE + count * BYTECODE_SECTION_ENTRY_SIZE;
+    for (int i = 0; i < BYTECODE_MAX_SECTIONS; i++)
+    {
+        if (sizes[i] == 0)
+        {
+            continue;
+        }
+        const bool    compact  = types[i] == BYTECODE_SECTION_CODE && compact_code;
+        const uint8_t entry[4] = {types[i], compact ? BYTECODE_SECTION_COMPACT : 0,
+                                  DATA_ALIGN_LOG2, 0};
+        offsets[i]             = ALIGN_UP(offset, DATA_ALIGN);
+        offset                 = offsets[i] + sizes[i];
+        fwrite(entry, 1, sizeof(entry), out);
+        write_u32(out, offsets[i]);
+        write_u32(out, sizes[i]);
+    }
+
+    uint32_t position = BYTECODE_SECTIONED_HEADER_SIZE + count * BYTECODE_SECTION_ENTRY_SIZE;
+    for (int i = 0; i < BYTECODE_MAX_SECTIONS; i++)
+    {
+        if (sizes[i] == 0)
+        {
+            continue;
+        }
+        for (; position < offsets[i]; position++)
+        {
+            fputc(0, out);
+        }
+        fwrite(payloads[i], 1, sizes[i], out);
+        position += sizes[i];
+    }
+}
+
+int8_t emit_write(AssemblerContext* asm_ctx, FILE* out, uint16_t version, bool compact_code)
+{
+    const uint16_t format   = version & BYTECODE_VERSION_MASK;
+    const uint8_t* code     = asm_ctx->memory + asm_ctx->code_start;
+    uint32_t       code_len = (uint32_t) asm_ctx->code_size;
+    uint8_t*       compact  = NULL;
+
+    if (format == BYTECODE_COMPACT_VERSION)
+    {
+        compact_code = true;
+    }
+    else if (format != BYTECODE_SECTIONED_VERSION && compact_code)
+    {
+        LOG_ERROR("Version %u images cannot hold compact code\n", format);
+        return -1;
+    }
+
+    if (compact_code)
+    {
+        // A compact instruction is at most 9 bytes, except MOVQ which shrinks from 16
+        compact = (uint8_t*) malloc((size_t) code_len * 2 + BYTECODE_COMPACT_MAX_SIZE);
+        if (compact == NULL)
+        {
+            LOG_ERROR("Out of memory while compacting code\n");
+            return -1;
+        }
+
+        uint32_t compact_len = 0;
+        for (uint32_t pc = 0; pc < code_len; pc += bytecode_fixed_size(code[pc]))
+        {
+            uint32_t length;
+            if (bytecode_compact_encode(code + pc, compact + compact_len, &length) != 0)
+            {
+                free(compact);
+                return -1;
+            }
+            compact_len += length;
+        }
+        code     = compact;
+        code_len = compact_len;
+    }
+
+    if (format == BYTECODE_SECTIONED_VERSION)
+    {
+        write_sectioned(asm_ctx, out, version, code, code_len, compact_code);
+    }
+    else
+    {
+        write_u32(out, BYTECODE_MAGIC);
+        write_u16(out, version);
+        write_u32(out, code_len);
+        write_u32(out, asm_ctx->entry_point - asm_ctx->code_start);
+        write_u32(out, asm_ctx->rodata_size);
+        write_u32(out, asm_ctx->data_size);
+        fwrite(code, 1, code_len, out);
+        fwrite(asm_ctx->memory + asm_ctx->rodata_start, 1, asm_ctx->rodata_size, out);
+        fwrite(asm_ctx->memory + asm_ctx->data_start, 1, asm_ctx->data_size, out);
+    }
+    free(compact);
+
+    if (ferror(out))
+    {
+        LOG_ERROR("Failed to write bytecode image\n");
+        return -1;
+    }
+    return 0;
+}
+
+int8_t emit_program(AssemblerContext* asm_ctx, MemoryArena* arena, FILE* out, uint16_t version,
+                    bool compact_code)
+{
+    int8_t status = emit_layout(asm_ctx, arena);
+    if (status == 0)
+    {
+        status = emit_code(asm_ctx);
+    }
+    if (status == 0)
+    {
+        status = emit_write(asm_ctx, out, version, compact_code);
+    }
+    return status;
+}
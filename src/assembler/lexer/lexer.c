@@ -2,6 +2,7 @@
 #include "arena_allocator.h"
 #include "logger.h"
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -16,14 +17,20 @@
 //  OPCODE LIST
 // ------------------------
 
-const char* const OPCODES[] = {"print_chr", "print_str", "mov",  "load_addr", "add", "sub", "mul",
-                               "div",       "mod",       "and",  "or",        "not", "cmp", "jz",
-                               "jnz",       "jeq",       "jgt",  "jge",       "jlt", "jle", "jmp",
-                               "call",      "ret",       "push", "pop",       "halt"};
+const char* const OPCODES[] = {"print_chr", "print_str", "mov", "load_addr", "add", "sub", "mul",
+                               "div", "mod", "and", "or", "not", "cmp", "jz", "jnz", "jeq", "jgt",
+                               "jge", "jlt", "jle", "jmp", "call", "ret", "push", "pop", "halt",
+                               "alloc", "free", "realloc", "memcpy", "memset", "memcmp", "memchr",
+                               "strlen", "vload", "vstore", "vsplat8", "vsplat32", "vadd8",
+                               "vadd32", "vsub8", "vsub32", "vmul32", "vand", "vor", "vcmpeq8",
+                               "vcmpeq32", "vsum8", "vsum32", "movq", "spawn", "chan", "yield",
+                               "join", "send", "recv", "psend", "precv",
+                               "callnative", "open", "read", "write", "close"};
 
 const int NUM_OPCODES = sizeof(OPCODES) / sizeof(OPCODES[0]);
 
-const char* const REGISTERS[] = {"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "sp", "bp", "hp"};
+const char* const REGISTERS[] = {"r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "sp", "bp",
+                                 "hp", "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7"};
 
 const int NUM_REGISTERS = sizeof(REGISTERS) / sizeof(REGISTERS[0]);
 
@@ -224,31 +231,29 @@ Token* lexer(MemoryArena* arena, char** line, int count)
                 bool is_negetive_int_literal =
                     (lexeme[0] == '-' && isdigit((unsigned char) lexeme[1]));
                 bool is_hex_literal =
-                    (lexeme[0] == '0' && lexeme[1] == 'x' && isdigit((unsigned char) lexeme[2]));
+                    (lexeme[0] == '0' && lexeme[1] == 'x' && isxdigit((unsigned char) lexeme[2]));
                 if (isdigit((unsigned char) lexeme[0]) || is_negetive_int_literal || is_hex_literal)
                 {
 
-                    token.kind = TOK_LITERAL;
-                    // strtoll correctly handles signed long long conversion
-                    if (is_hex_literal)
+                    token.kind               = TOK_LITERAL;
+                    token.value.literal.type = LIT_INTEGER;
+                    // Literals may use the full 64 bits; values above INT64_MAX keep their bit
+                    // pattern. Whether an operand can hold them is the encoder's call.
+                    errno = 0;
+                    if (is_negetive_int_literal)
                     {
-                        long value = strtoll((const char*) lexeme, NULL, 16);
-                        if (value > UINT32_MAX)
-                        {
-                            LOG_ERROR("Literal longer than 32 bits is not supported.");
-                            value = UINT32_MAX;
-                        }
-                        token.value.literal.value.longValue = value;
+                        long long value = strtoll((const char*) lexeme, NULL, 10);
+                        token.value.literal.value.longValue = (long) value;
                     }
                     else
                     {
-                        long long value = strtoll((const char*) lexeme, NULL, 10);
-                        if (value > UINT32_MAX)
-                        {
-                            LOG_ERROR("Literal longer than 32 bits is not supported.");
-                            value = UINT32_MAX;
-                        }
-                        token.value.literal.value.longValue = value;
+                        unsigned long long value =
+                            strtoull((const char*) lexeme, NULL, is_hex_literal ? 16 : 10);
+                        token.value.literal.value.longValue = (long) value;
+                    }
+                    if (errno == ERANGE)
+                    {
+                        LOG_ERROR("Literal longer than 64 bits is not supported.");
                     }
                     token.lexeme = lexeme;
                 }
@@ -256,6 +261,7 @@ Token* lexer(MemoryArena* arena, char** line, int count)
                 else if (lexeme[0] == '\'' && lexeme[2] == '\'' && strlen(lexeme) == 3)
                 {
                     token.kind                          = TOK_LITERAL;
+                    token.value.literal.type            = LIT_CHAR;
                     token.value.literal.value.charValue = lexeme[1];
                     token.lexeme                        = lexeme;
                 }
@@ -263,8 +269,9 @@ Token* lexer(MemoryArena* arena, char** line, int count)
                 else if (lexeme[0] == '\"' && lexeme[strlen(lexeme) - 1] == '\"' &&
                          strlen(lexeme) >= 2)
                 {
-                    token.kind     = TOK_LITERAL;
-                    size_t str_len = strlen(lexeme) - 2;
+                    token.kind               = TOK_LITERAL;
+                    token.value.literal.type = LIT_STRING;
+                    size_t str_len           = strlen(lexeme) - 2;
 
                     // Allocate space for the string contents (excluding quotes) in the Arena
                     token.value.literal.value.stringValue = (char*) arena_alloc(arena, str_len + 1);
@@ -305,6 +312,17 @@ Token* lexer(MemoryArena* arena, char** line, int count)
     return tokens;
 }
 
+// The arena cannot resize in place, so growing copies the tokens into a fresh block
+static Token* grow_tokens(MemoryArena* arena, const Token* items, int count, int capacity)
+{
+    Token* grown = (Token*) arena_calloc(arena, capacity, sizeof(Token));
+    if (grown != NULL)
+    {
+        memcpy(grown, items, (size_t) count * sizeof(Token));
+    }
+    return grown;
+}
+
 TokenVector* run_lexer(MemoryArena* arena, FILE* input_file, int* total_count)
 {
     TokenVector* token_vector = (TokenVector*) arena_alloc(arena, sizeof(TokenVector));
@@ -327,7 +345,11 @@ TokenVector* run_lexer(MemoryArena* arena, FILE* input_file, int* total_count)
         char** line       = NULL;
         int    numLexemes = 0;
 
-        line                  = getLexemesInLine(arena, buffer, &numLexemes);
+        line = getLexemesInLine(arena, buffer, &numLexemes);
+        if (numLexemes == 0)
+        {
+            continue; // blank or comment-only line
+        }
         Token* tokens_in_line = lexer(arena, line, numLexemes);
 
         if (tokens_in_line == NULL)
@@ -339,8 +361,8 @@ TokenVector* run_lexer(MemoryArena* arena, FILE* input_file, int* total_count)
             if (*total_count >= token_vector->capacity)
             {
                 token_vector->capacity *= 2;
-                token_vector->items =
-                    (Token*) arena_realloc(arena, token_vector->items, token_vector->capacity);
+                token_vector->items = grow_tokens(arena, token_vector->items, *total_count,
+                                                  token_vector->capacity);
                 if (token_vector->items == NULL)
                 {
                     LOG_ERROR("Failed to allocate memory for tokens");
@@ -357,7 +379,7 @@ TokenVector* run_lexer(MemoryArena* arena, FILE* input_file, int* total_count)
     {
         token_vector->capacity++;
         token_vector->items =
-            (Token*) arena_realloc(arena, token_vector->items, token_vector->capacity);
+            grow_tokens(arena, token_vector->items, *total_count, token_vector->capacity);
         if (token_vector->items == NULL)
         {
             LOG_ERROR("Failed to allocate memory for tokens");
@@ -0,0 +1,566 @@
+#include "arena_allocator.h"
+#include "bytecode.h"
+#include "instruction_format_table.h"
+#include "logger.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALL_REGISTERS 0xFF
+#define REG_BIT(reg) ((uint8_t) (1u << (reg)))
+
+/*
+ *   What one instruction does to r0..r7. `def` only holds registers it certainly overwrites, so
+ *   liveness stays sound; `may_def` also holds anything it might change. `implicit` are registers
+ *   read without naming them (cmp reads r0 and r1; call, ret, halt and anything not modelled here
+ *   read everything), which can never be renamed.
+ * */
+typedef struct
+{
+    uint8_t use;
+    uint8_t def;
+    uint8_t may_def;
+    uint8_t implicit;
+} RegisterEffect;
+
+typedef struct
+{
+    int     start; // first line
+    int     end;   // one past the last line
+    int     successors[2];
+    int     successor_count;
+    bool    exits_unknown; // jump through a register: everything is live out
+    uint8_t use;
+    uint8_t def;
+    uint8_t live_in;
+    uint8_t live_out;
+} LiveBlock;
+
+/*
+ *   Scratch for one optimize_coalesce call, allocated once for the program's size (which only
+ *   shrinks) and reused by every pass. Labels are indexed once; label_line maps each label's
+ *   position to its current line and is refreshed as blocks are rebuilt.
+ * */
+typedef struct
+{
+    Program*     program;
+    SymbolTable* labels;     // label -> its position among the program's labels
+    int*         label_line; // label position -> line index
+    LiveBlock*   blocks;
+    int          block_count;
+    int*         block_of;   // line -> block
+    uint8_t*     live_after; // line -> registers live right after it
+    uint8_t*     claimed;    // line -> already inside a rewrite made this pass
+    uint8_t*     dropped;    // line -> removed when the pass ends
+} Liveness;
+
+static bool general_register(const Instruction* instruction, int index, uint8_t* out)
+{
+    const int operand_count = instruction->operand_types[0] == OT_NONE
+                                  ? 0
+                                  : opcode_info[instruction->opcode].operand_count;
+    const Operand* operand  = &instruction->operands[index];
+    if (index >= operand_count || operand->type != OT_REGISTER || operand->value.reg > REG_R7)
+    {
+        return false;
+    }
+    *out = (uint8_t) operand->value.reg;
+    return true;
+}
+
+static RegisterEffect register_effect(const Instruction* instruction)
+{
+    RegisterEffect effect = {0, 0, 0, 0};
+    uint8_t        first  = 0;
+    uint8_t        second = 0;
+    const bool     has_first  = general_register(instruction, 0, &first);
+    const bool     has_second = general_register(instruction, 1, &second);
+
+    switch (instruction->opcode)
+    {
+    case OP_MOV:
+    case OP_LOAD_ADDR:
+    case OP_MOVQ:
+    case OP_POP:
+        effect.def = has_first ? REG_BIT(first) : 0;
+        effect.use = has_second ? REG_BIT(second) : 0;
+        break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_MOD:
+    case OP_AND:
+    case OP_OR:
+    case OP_NOT:
+        effect.def = has_first ? REG_BIT(first) : 0;
+        effect.use = (uint8_t) (effect.def | (has_second ? REG_BIT(second) : 0));
+        break;
+    case OP_CMP:
+        effect.implicit = REG_BIT(REG_R0) | REG_BIT(REG_R1);
+        break;
+    case OP_JZ:
+    case OP_JNZ:
+    case OP_JEQ:
+    case OP_JGT:
+    case OP_JGE:
+    case OP_JLT:
+    case OP_JLE:
+    case OP_JMP:
+    case OP_PUSH:
+    case OP_PRINT_CHR:
+    case OP_PRINT_STR:
+        effect.use = has_first ? REG_BIT(first) : 0;
+        break;
+    default:
+        // call, ret, halt and the heap/bulk/vector opcodes: assume the worst
+        effect.use      = (uint8_t) ((has_first ? REG_BIT(first) : 0) |
+                                (has_second ? REG_BIT(second) : 0));
+        effect.implicit = ALL_REGISTERS;
+        effect.may_def  = ALL_REGISTERS;
+        break;
+    }
+    effect.use |= effect.implicit;
+    effect.may_def |= effect.def;
+    return effect;
+}
+
+static bool is_instruction(const Program* program, int line)
+{
+    return program->lines[line].type == LINE_INSTRUCTION;
+}
+
+static Instruction* instruction_at(Program* program, int line)
+{
+    return &program->lines[line].value.instruction;
+}
+
+static bool ends_block(Opcode opcode)
+{
+    return (opcode >= OP_JZ && opcode <= OP_JMP) || opcode == OP_RET || opcode == OP_HALT;
+}
+
+static int8_t index_labels(Liveness* live, MemoryArena* arena)
+{
+    uint32_t position = 0;
+    for (int i = 0; i < live->program->count; i++)
+    {
+        const Line* line = &live->program->lines[i];
+        if (line->type != LINE_LABEL_DEF)
+        {
+            continue;
+        }
+        if (!symbol_table_add(arena, &live->labels, line->value.label, position++))
+        {
+            LOG_ERROR("Label '%s' is defined more than once\n", line->value.label);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool alloc_scratch(Liveness* live)
+{
+    const size_t lines = (size_t) live->program->count + 1;
+    live->label_line   = malloc(lines * sizeof(int));
+    live->blocks       = malloc(lines * sizeof(LiveBlock));
+    live->block_of     = malloc(lines * sizeof(int));
+    live->live_after   = malloc(lines);
+    live->claimed      = malloc(lines);
+    live->dropped      = malloc(lines);
+    return live->label_line != NULL && live->blocks != NULL && live->block_of != NULL &&
+           live->live_after != NULL && live->claimed != NULL && live->dropped != NULL;
+}
+
+static void free_scratch(Liveness* live)
+{
+    free(live->label_line);
+    free(live->blocks);
+    free(live->block_of);
+    free(live->live_after);
+    free(live->claimed);
+    free(live->dropped);
+    symbol_table_clear(&live->labels);
+}
+
+static void build_blocks(Liveness* live)
+{
+    Program* program  = live->program;
+    int      label    = 0;
+    bool     open     = false;
+    live->block_count = 0;
+    memset(live->blocks, 0, (size_t) (program->count + 1) * sizeof(LiveBlock));
+    memset(live->claimed, 0, (size_t) program->count + 1);
+    memset(live->dropped, 0, (size_t) program->count + 1);
+
+    for (int i = 0; i < program->count; i++)
+    {
+        const Line* line = &program->lines[i];
+        if (line->type == LINE_LABEL_DEF)
+        {
+            live->label_line[label++] = i;
+            open                      = false;
+        }
+        if (!open)
+        {
+            live->blocks[live->block_count++].start = i;
+            open                                    = true;
+        }
+        live->block_of[i]                           = live->block_count - 1;
+        live->blocks[live->block_count - 1].end     = i + 1;
+        if (line->type == LINE_INSTRUCTION && ends_block(line->value.instruction.opcode))
+        {
+            open = false;
+        }
+    }
+}
+
+static void link_block(Liveness* live, int b)
+{
+    LiveBlock* block = &live->blocks[b];
+    int        last  = block->end - 1;
+    while (last >= block->start && !is_instruction(live->program, last))
+    {
+        last--;
+    }
+
+    const Opcode opcode = last >= block->start ? instruction_at(live->program, last)->opcode
+                                               : OP_UNKNOWN;
+    if (opcode >= OP_JZ && opcode <= OP_JMP)
+    {
+        const Operand* target = &instruction_at(live->program, last)->operands[0];
+        uint32_t       label;
+        if (target->type == OT_SYMBOL &&
+            symbol_table_lookup(live->labels, target->value.symbol, &label))
+        {
+            block->successors[block->successor_count++] = live->block_of[live->label_line[label]];
+        }
+        else
+        {
+            block->exits_unknown = true;
+        }
+    }
+    if (opcode != OP_JMP && opcode != OP_RET && opcode != OP_HALT && b + 1 < live->block_count)
+    {
+        block->successors[block->successor_count++] = b + 1;
+    }
+}
+
+/*
+ *   Per-block use/def, then the usual backward fixed point, then live_after for every line.
+ * */
+static void compute_liveness(Liveness* live)
+{
+    Program* program = live->program;
+    for (int b = 0; b < live->block_count; b++)
+    {
+        LiveBlock* block = &live->blocks[b];
+        for (int i = block->end - 1; i >= block->start; i--)
+        {
+            if (is_instruction(program, i))
+            {
+                const RegisterEffect effect = register_effect(instruction_at(program, i));
+                block->use = (uint8_t) (effect.use | (block->use & ~effect.def));
+                block->def |= effect.def;
+            }
+        }
+        link_block(live, b);
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int b = live->block_count - 1; b >= 0; b--)
+        {
+            LiveBlock* block = &live->blocks[b];
+            uint8_t    out   = block->exits_unknown ? ALL_REGISTERS : 0;
+            for (int s = 0; s < block->successor_count; s++)
+            {
+                out |= live->blocks[block->successors[s]].live_in;
+            }
+            const uint8_t in = (uint8_t) (block->use | (out & ~block->def));
+            if (out != block->live_out || in != block->live_in)
+            {
+                block->live_out = out;
+                block->live_in  = in;
+                changed         = true;
+            }
+        }
+    }
+
+    for (int b = 0; b < live->block_count; b++)
+    {
+        uint8_t current = live->blocks[b].live_out;
+        for (int i = live->blocks[b].end - 1; i >= live->blocks[b].start; i--)
+        {
+            live->live_after[i] = current;
+            if (is_instruction(program, i))
+            {
+                const RegisterEffect effect = register_effect(instruction_at(program, i));
+                current = (uint8_t) (effect.use | (current & ~effect.def));
+            }
+        }
+    }
+}
+
+/*
+ *   Every rewrite made in one pass covers a run of lines no other rewrite of that pass touches.
+ *   A rewrite only changes liveness inside its own run, or makes it smaller outside it, so the
+ *   analysis the pass started from stays sound for all of them.
+ * */
+static void claim(Liveness* live, int from, int to)
+{
+    memset(&live->claimed[from], 1, (size_t) (to - from + 1));
+}
+
+static void drop_line(Liveness* live, int line)
+{
+    live->claimed[line] = 1;
+    live->dropped[line] = 1;
+}
+
+static void compact(Liveness* live)
+{
+    Program* program = live->program;
+    int      out     = 0;
+    for (int i = 0; i < program->count; i++)
+    {
+        if (!live->dropped[i])
+        {
+            program->lines[out++] = program->lines[i];
+        }
+    }
+    program->count = out;
+}
+
+// mov/load_addr/movq into a register nothing reads before it is overwritten
+static bool remove_dead_moves(Liveness* live, OptimizerStats* stats)
+{
+    Program* program = live->program;
+    bool     changed = false;
+    for (int i = 0; i < program->count; i++)
+    {
+        if (!is_instruction(program, i))
+        {
+            continue;
+        }
+        const Instruction* instruction = instruction_at(program, i);
+        uint8_t            dest;
+        if ((instruction->opcode == OP_MOV || instruction->opcode == OP_LOAD_ADDR ||
+             instruction->opcode == OP_MOVQ) &&
+            general_register(instruction, 0, &dest) && !(live->live_after[i] & REG_BIT(dest)))
+        {
+            stats->bytes_saved += bytecode_fixed_size(instruction->opcode);
+            stats->instructions_removed++;
+            drop_line(live, i);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static void rename_register(Instruction* instruction, uint8_t from, uint8_t to)
+{
+    for (int k = 0; k < 2; k++)
+    {
+        uint8_t reg;
+        if (general_register(instruction, k, &reg) && reg == from)
+        {
+            instruction->operands[k].value.reg = (Register) to;
+        }
+    }
+}
+
+/*
+ *   `mov d, s` with s dead afterwards: the rest of d's live range, if it ends inside the block
+ *   and nothing in it touches s or reads d implicitly, can use s instead and the copy goes.
+ *   Checked with apply == false first, then done with apply == true. Returns the number of
+ *   instructions renamed, or -1 when the copy cannot go; `last` receives the range's last line.
+ * */
+static int coalesce_range(Liveness* live, int mov, uint8_t d, uint8_t s, bool apply, int* last)
+{
+    Program*         program = live->program;
+    const LiveBlock* block   = &live->blocks[live->block_of[mov]];
+    int              renamed = 0;
+    for (int j = mov + 1; j < block->end; j++)
+    {
+        if (live->claimed[j])
+        {
+            return -1;
+        }
+        if (!is_instruction(program, j))
+        {
+            continue;
+        }
+        Instruction*         instruction = instruction_at(program, j);
+        const RegisterEffect effect      = register_effect(instruction);
+        *last                            = j;
+        if ((effect.implicit & REG_BIT(d)) || (effect.may_def & REG_BIT(s)))
+        {
+            return -1;
+        }
+        if ((effect.def & REG_BIT(d)) && !(effect.use & REG_BIT(d)))
+        {
+            return renamed;
+        }
+        if (apply)
+        {
+            rename_register(instruction, d, s);
+        }
+        renamed += (effect.use & REG_BIT(d)) != 0;
+        if (!(live->live_after[j] & REG_BIT(d)))
+        {
+            return renamed;
+        }
+    }
+    return -1;
+}
+
+static bool coalesce_copies(Liveness* live, OptimizerStats* stats)
+{
+    Program* program = live->program;
+    bool     changed = false;
+    for (int i = 0; i < program->count; i++)
+    {
+        if (!is_instruction(program, i) || live->claimed[i])
+        {
+            continue;
+        }
+        const Instruction* mov  = instruction_at(program, i);
+        int                last = i;
+        uint8_t            d, s;
+        if (mov->opcode != OP_MOV || !general_register(mov, 0, &d) ||
+            !general_register(mov, 1, &s) || d == s || (live->live_after[i] & REG_BIT(s)) ||
+            coalesce_range(live, i, d, s, false, &last) < 0)
+        {
+            continue;
+        }
+
+        stats->instructions_rewritten += (uint32_t) coalesce_range(live, i, d, s, true, &last);
+        stats->bytes_saved += bytecode_fixed_size(OP_MOV);
+        stats->instructions_removed++;
+        claim(live, i, last);
+        drop_line(live, i);
+        changed = true;
+    }
+    return changed;
+}
+
+/*
+ *   push rX ... pop rY inside one block, with the pushes and pops between balanced, no call or
+ *   ret, and rX unchanged: the push goes and the pop becomes mov rY, rX (or goes too if Y == X).
+ *   Returns the pop's line, or -1 when the push at `p` has no such pop.
+ * */
+static int matching_pop(Liveness* live, int p, uint8_t x)
+{
+    Program* program = live->program;
+    int      depth   = 0;
+    for (int j = p + 1; j < live->blocks[live->block_of[p]].end; j++)
+    {
+        if (live->claimed[j])
+        {
+            return -1;
+        }
+        if (!is_instruction(program, j))
+        {
+            continue;
+        }
+        const Instruction* instruction = instruction_at(program, j);
+        uint8_t            y;
+        if (instruction->opcode == OP_POP && depth == 0)
+        {
+            return general_register(instruction, 0, &y) ? j : -1;
+        }
+        if (instruction->opcode == OP_CALL || instruction->opcode == OP_RET ||
+            (register_effect(instruction).may_def & REG_BIT(x)))
+        {
+            return -1;
+        }
+        depth += instruction->opcode == OP_PUSH;
+        depth -= instruction->opcode == OP_POP;
+    }
+    return -1;
+}
+
+static bool remove_spills(Liveness* live, OptimizerStats* stats)
+{
+    Program* program = live->program;
+    bool     changed = false;
+    for (int p = 0; p < program->count; p++)
+    {
+        uint8_t x, y;
+        if (!is_instruction(program, p) || live->claimed[p] ||
+            instruction_at(program, p)->opcode != OP_PUSH ||
+            !general_register(instruction_at(program, p), 0, &x))
+        {
+            continue;
+        }
+        const int pop = matching_pop(live, p, x);
+        if (pop < 0)
+        {
+            continue;
+        }
+
+        Instruction* instruction = instruction_at(program, pop);
+        if (!general_register(instruction, 0, &y))
+        {
+            continue;
+        }
+        instruction->opcode           = OP_MOV;
+        instruction->operands[1]      = instruction_at(program, p)->operands[0];
+        instruction->operand_types[1] = OT_REGISTER;
+        claim(live, p, pop);
+        if (y == x)
+        {
+            drop_line(live, pop);
+            stats->instructions_removed++;
+            stats->bytes_saved += bytecode_fixed_size(OP_POP);
+        }
+        else
+        {
+            stats->instructions_rewritten++;
+        }
+        drop_line(live, p);
+        stats->instructions_removed++;
+        stats->bytes_saved += bytecode_fixed_size(OP_PUSH);
+        stats->spills_removed++;
+        changed = true;
+    }
+    return changed;
+}
+
+int8_t optimize_coalesce(Program* program, MemoryArena* arena, OptimizerStats* stats)
+{
+    Liveness live = {.program = program, .labels = symbol_table_init()};
+    if (!alloc_scratch(&live))
+    {
+        LOG_ERROR("Unable to allocate the liveness analysis of %d lines\n", program->count);
+        free_scratch(&live);
+        return -1;
+    }
+    if (index_labels(&live, arena) != 0)
+    {
+        free_scratch(&live);
+        return -1;
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        build_blocks(&live);
+        compute_liveness(&live);
+
+        // spills first: coalescing into a pushed register would turn a redundant spill real
+        changed = remove_dead_moves(&live, stats);
+        changed |= remove_spills(&live, stats);
+        changed |= coalesce_copies(&live, stats);
+        compact(&live);
+    }
+    free_scratch(&live);
+    return 0;
+}
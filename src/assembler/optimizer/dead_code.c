@@ -0,0 +1,224 @@
+#include "arena_allocator.h"
+#include "bytecode.h"
+#include "instruction_format_table.h"
+#include "logger.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DATA_ITEM_ALIGN 8
+#define POOL_WORD_SIZE 8
+
+typedef struct
+{
+    const Program* program;
+    SymbolTable*   names;    // label or data item name -> line index
+    uint8_t*       live;     // instructions reached, and labels/data items referenced
+    int*           worklist; // label lines still to walk from
+    int            pending;
+} Reachability;
+
+static bool is_data_item(const Line* line)
+{
+    return line->type == LINE_DIRECTIVE && (line->value.directive.type == DIRECTIVE_DATA ||
+                                            line->value.directive.type == DIRECTIVE_RODATA);
+}
+
+static int8_t index_names(Reachability* reach, MemoryArena* arena)
+{
+    for (int i = 0; i < reach->program->count; i++)
+    {
+        const Line* line = &reach->program->lines[i];
+        const char* name = NULL;
+        if (line->type == LINE_LABEL_DEF)
+        {
+            name = line->value.label;
+        }
+        else if (is_data_item(line) && line->value.directive.operands[0].type == OT_SYMBOL)
+        {
+            name = line->value.directive.operands[0].value.symbol;
+        }
+        if (name != NULL && !symbol_table_add(arena, &reach->names, name, (uint32_t) i))
+        {
+            LOG_ERROR("Symbol '%s' is defined more than once\n", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Marks whatever `name` defines as used; a code label is queued to be walked from
+static void reference(Reachability* reach, const char* name)
+{
+    uint32_t index;
+    if (!symbol_table_lookup(reach->names, name, &index) || reach->live[index])
+    {
+        return;
+    }
+    reach->live[index] = 1;
+    if (reach->program->lines[index].type == LINE_LABEL_DEF)
+    {
+        reach->worklist[reach->pending++] = (int) index;
+    }
+}
+
+/*
+ *   Follows straight-line code from `from` until it cannot fall through. Every symbol a reached
+ *   instruction names counts as used, which also keeps address-taken labels (load_addr r1, f)
+ *   alive for jumps through registers.
+ * */
+static void walk(Reachability* reach, int from)
+{
+    for (int i = from; i < reach->program->count; i++)
+    {
+        const Line* line = &reach->program->lines[i];
+        if (line->type != LINE_INSTRUCTION)
+        {
+            continue;
+        }
+        if (reach->live[i])
+        {
+            return;
+        }
+        reach->live[i] = 1;
+
+        const Instruction* instruction = &line->value.instruction;
+        const int operand_count        = instruction->operand_types[0] == OT_NONE
+                                             ? 0
+                                             : opcode_info[instruction->opcode].operand_count;
+        for (int j = 0; j < operand_count; j++)
+        {
+            if (instruction->operands[j].type == OT_SYMBOL)
+            {
+                reference(reach, instruction->operands[j].value.symbol);
+            }
+        }
+
+        if (instruction->opcode == OP_JMP || instruction->opcode == OP_RET ||
+            instruction->opcode == OP_HALT)
+        {
+            return;
+        }
+    }
+}
+
+static uint32_t item_size(const ParsedDirective* item)
+{
+    const Operand* value = &item->operands[1];
+    uint32_t       len;
+    switch (value->type)
+    {
+    case OT_IMMEDIATE_STR:
+        len = (uint32_t) strlen(value->value.literal.value.stringValue) + 1;
+        break;
+    case OT_IMMEDIATE_CHR:
+        len = item->type == DIRECTIVE_RODATA ? POOL_WORD_SIZE : 1;
+        break;
+    default:
+        len = POOL_WORD_SIZE;
+        break;
+    }
+    return item->type == DIRECTIVE_DATA ? (len + DATA_ITEM_ALIGN - 1) & ~(DATA_ITEM_ALIGN - 1)
+                                        : len;
+}
+
+/*
+ *   Roots are the .start label (the first instruction when there is none, matching the
+ *   emitter's default entry point) and every .global name.
+ * */
+static void mark_roots(Reachability* reach)
+{
+    bool has_start = false;
+    for (int i = 0; i < reach->program->count; i++)
+    {
+        const Line* line = &reach->program->lines[i];
+        if (line->type != LINE_DIRECTIVE || line->value.directive.operands[0].type != OT_SYMBOL)
+        {
+            continue;
+        }
+        const Directive type = line->value.directive.type;
+        if (type == DIRECTIVE_START || type == DIRECTIVE_GLOBAL)
+        {
+            reference(reach, line->value.directive.operands[0].value.symbol);
+            has_start |= type == DIRECTIVE_START;
+        }
+    }
+    if (!has_start)
+    {
+        walk(reach, 0);
+    }
+}
+
+/*
+ *   .data items are laid out back to back in source order, and code may index from one item into
+ *   the ones after it whatever labels sit between them, so once a .data item is referenced every
+ *   later one is kept. Only unreferenced items before the first referenced one can go.
+ * */
+static void keep_data_tail(Reachability* reach)
+{
+    bool in_tail = false;
+    for (int i = 0; i < reach->program->count; i++)
+    {
+        const Line* line = &reach->program->lines[i];
+        if (line->type == LINE_DIRECTIVE && line->value.directive.type == DIRECTIVE_DATA)
+        {
+            in_tail |= reach->live[i];
+            reach->live[i] = in_tail;
+        }
+    }
+}
+
+int8_t optimize_dead_code(Program* program, MemoryArena* arena, OptimizerStats* stats)
+{
+    Reachability reach = {.program = program, .names = symbol_table_init(), .pending = 0};
+    reach.live         = arena_calloc(arena, program->count + 1, sizeof(uint8_t));
+    reach.worklist     = arena_calloc(arena, program->count + 1, sizeof(int));
+    if (reach.live == NULL || reach.worklist == NULL)
+    {
+        LOG_ERROR("Unable to allocate the dead code analysis of %d lines\n", program->count);
+        return -1;
+    }
+    if (index_names(&reach, arena) != 0)
+    {
+        symbol_table_clear(&reach.names);
+        return -1;
+    }
+
+    mark_roots(&reach);
+    while (reach.pending > 0)
+    {
+        walk(&reach, reach.worklist[--reach.pending] + 1);
+    }
+    symbol_table_clear(&reach.names);
+    keep_data_tail(&reach);
+
+    int out = 0;
+    for (int i = 0; i < program->count; i++)
+    {
+        const Line* line = &program->lines[i];
+        if (reach.live[i] || (line->type == LINE_DIRECTIVE && !is_data_item(line)))
+        {
+            program->lines[out++] = *line;
+            continue;
+        }
+        switch (line->type)
+        {
+        case LINE_INSTRUCTION:
+            stats->instructions_removed++;
+            stats->bytes_saved += bytecode_fixed_size(line->value.instruction.opcode);
+            break;
+        case LINE_LABEL_DEF:
+            stats->labels_removed++;
+            break;
+        case LINE_DIRECTIVE:
+            stats->data_items_removed++;
+            stats->bytes_saved += item_size(&line->value.directive);
+            break;
+        }
+    }
+    program->count = out;
+    return 0;
+}
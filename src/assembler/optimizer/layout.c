@@ -0,0 +1,444 @@
+#include "arena_allocator.h"
+#include "bytecode.h"
+#include "logger.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "symbol_table.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_BLOCK (-1)
+#define PROFILE_LINE_SIZE 128
+#define LAYOUT_LABEL_SIZE 32
+
+typedef struct
+{
+    int      start; // first line
+    int      end;   // one past the last line
+    int      last;  // line of the last instruction, NO_BLOCK when there is none
+    Opcode   exit;  // opcode of a closing jump/ret/halt, OP_UNKNOWN when the block runs on
+    uint32_t offset;
+    uint64_t count;
+    int      fallthrough;
+    int      target;
+    bool     pinned; // runs off the end of the code, so it has to stay last
+
+    // placement decisions
+    const char* label;       // label the block starts with
+    bool        new_label;   // made up here: emit a label line in front of the block
+    bool        drop_exit;   // closing jmp names the next block
+    char*       append_jump; // label of a fall-through successor that is no longer next
+} LayoutBlock;
+
+typedef struct
+{
+    Program*             program;
+    MemoryArena*         arena;
+    const LayoutProfile* profile;
+    SymbolTable*         labels; // label -> block
+    LayoutBlock*         blocks;
+    int                  block_count;
+    uint32_t             code_size;
+    int*                 order;
+    int                  placed_count;
+    bool*                placed;
+    int                  made_up_labels;
+} Layout;
+
+static bool is_jump(Opcode opcode)
+{
+    return opcode >= OP_JZ && opcode <= OP_JMP;
+}
+
+static bool is_conditional(Opcode opcode)
+{
+    return opcode >= OP_JZ && opcode < OP_JMP;
+}
+
+static bool ends_block(Opcode opcode)
+{
+    return is_jump(opcode) || opcode == OP_RET || opcode == OP_HALT;
+}
+
+static Opcode inverted(Opcode opcode)
+{
+    switch (opcode)
+    {
+    case OP_JZ:
+    case OP_JEQ:
+        return OP_JNZ;
+    case OP_JNZ:
+        return OP_JZ;
+    case OP_JGT:
+        return OP_JLE;
+    case OP_JLE:
+        return OP_JGT;
+    case OP_JGE:
+        return OP_JLT;
+    case OP_JLT:
+        return OP_JGE;
+    default:
+        return opcode;
+    }
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    const ProfileEntry* left  = a;
+    const ProfileEntry* right = b;
+    return (left->offset > right->offset) - (left->offset < right->offset);
+}
+
+static bool profile_line(const char* line, ProfileEntry* out)
+{
+    char* end;
+    out->offset = (uint32_t) strtoul(line, &end, 0);
+    if (end == line)
+    {
+        return false;
+    }
+    const char* count = end;
+    out->count        = strtoull(count, &end, 10);
+    while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+    {
+        end++;
+    }
+    return end != count && *end == '\0';
+}
+
+static bool is_comment(const char* line)
+{
+    while (*line == ' ' || *line == '\t')
+    {
+        line++;
+    }
+    return *line == '#' || *line == '\n' || *line == '\r' || *line == '\0';
+}
+
+int8_t profile_read(FILE* in, MemoryArena* arena, LayoutProfile* out)
+{
+    char line[PROFILE_LINE_SIZE];
+    int  count = 0;
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        count += !is_comment(line);
+    }
+    rewind(in);
+
+    out->entries = count > 0 ? arena_calloc(arena, count, sizeof(ProfileEntry)) : NULL;
+    out->count   = 0;
+    for (int number = 1; fgets(line, sizeof(line), in) != NULL; number++)
+    {
+        if (is_comment(line))
+        {
+            continue;
+        }
+        if (out->count == count || !profile_line(line, &out->entries[out->count]))
+        {
+            LOG_ERROR("Malformed profile line %d: %s\n", number, line);
+            return -1;
+        }
+        out->count++;
+    }
+    if (out->count > 0)
+    {
+        qsort(out->entries, out->count, sizeof(ProfileEntry), compare_entries);
+    }
+    return 0;
+}
+
+// Count of the last profiled block starting at or before `offset`
+static uint64_t profile_count(const LayoutProfile* profile, uint32_t offset)
+{
+    int      low   = 0;
+    int      high  = profile->count - 1;
+    uint64_t count = 0;
+    while (low <= high)
+    {
+        const int mid = low + (high - low) / 2;
+        if (profile->entries[mid].offset <= offset)
+        {
+            count = profile->entries[mid].count;
+            low   = mid + 1;
+        }
+        else
+        {
+            high = mid - 1;
+        }
+    }
+    return count;
+}
+
+/*
+ *   Blocks start at each label and at the first instruction after a jump, ret or halt; directives
+ *   stay with the block they follow. Offsets are those of the program as it stands, which is what
+ *   the profiled image was built from.
+ * */
+static int8_t build_blocks(Layout* layout)
+{
+    Program* program    = layout->program;
+    layout->blocks      = arena_calloc(layout->arena, program->count + 1, sizeof(LayoutBlock));
+    layout->block_count = 0;
+
+    uint32_t offset = 0;
+    bool     open   = false;
+    for (int i = 0; i < program->count; i++)
+    {
+        const Line* line = &program->lines[i];
+        if (line->type == LINE_LABEL_DEF || (line->type == LINE_INSTRUCTION && !open) ||
+            layout->block_count == 0)
+        {
+            LayoutBlock* block = &layout->blocks[layout->block_count++];
+            block->start       = i;
+            block->last        = NO_BLOCK;
+            block->exit        = OP_UNKNOWN;
+            block->offset      = offset;
+            open               = true;
+            if (line->type == LINE_LABEL_DEF)
+            {
+                block->label = line->value.label;
+                if (!symbol_table_add(layout->arena, &layout->labels, line->value.label,
+                                      (uint32_t) layout->block_count - 1))
+                {
+                    LOG_ERROR("Label '%s' is defined more than once\n", line->value.label);
+                    return -1;
+                }
+            }
+        }
+
+        LayoutBlock* block = &layout->blocks[layout->block_count - 1];
+        block->end         = i + 1;
+        if (line->type == LINE_INSTRUCTION)
+        {
+            const Opcode opcode = line->value.instruction.opcode;
+            block->last         = i;
+            offset += bytecode_fixed_size(opcode);
+            if (ends_block(opcode))
+            {
+                block->exit = opcode;
+                open        = false;
+            }
+        }
+    }
+    layout->code_size = offset;
+    return 0;
+}
+
+static void link_blocks(Layout* layout)
+{
+    for (int b = 0; b < layout->block_count; b++)
+    {
+        LayoutBlock* block = &layout->blocks[b];
+        block->count       = profile_count(layout->profile, block->offset);
+        block->target      = NO_BLOCK;
+        block->fallthrough = NO_BLOCK;
+
+        uint32_t target;
+        if (is_jump(block->exit))
+        {
+            const Instruction* jump    = &layout->program->lines[block->last].value.instruction;
+            const Operand*     operand = &jump->operands[0];
+            if (operand->type == OT_SYMBOL &&
+                symbol_table_lookup(layout->labels, operand->value.symbol, &target))
+            {
+                block->target = (int) target;
+            }
+        }
+        if (block->exit != OP_JMP && block->exit != OP_RET && block->exit != OP_HALT)
+        {
+            block->fallthrough = b + 1 < layout->block_count ? b + 1 : NO_BLOCK;
+            block->pinned      = block->fallthrough == NO_BLOCK;
+        }
+    }
+}
+
+// A cold block is only chained after another cold one, so it never splits a hot path
+static bool chainable(const Layout* layout, int from, int to)
+{
+    return to != NO_BLOCK && !layout->placed[to] && !layout->blocks[to].pinned &&
+           (layout->blocks[to].count > 0 || layout->blocks[from].count == 0);
+}
+
+static int preferred_next(const Layout* layout, int b)
+{
+    const LayoutBlock* block = &layout->blocks[b];
+    const bool         fall  = chainable(layout, b, block->fallthrough);
+    const bool         jump  = chainable(layout, b, block->target);
+    if (fall && jump)
+    {
+        return layout->blocks[block->target].count > layout->blocks[block->fallthrough].count
+                   ? block->target
+                   : block->fallthrough;
+    }
+    return fall ? block->fallthrough : jump ? block->target : NO_BLOCK;
+}
+
+static void place_chain(Layout* layout, int b)
+{
+    while (b != NO_BLOCK && !layout->placed[b])
+    {
+        layout->placed[b]                     = true;
+        layout->order[layout->placed_count++] = b;
+        b                                     = preferred_next(layout, b);
+    }
+}
+
+static int hottest_unplaced(const Layout* layout)
+{
+    int best = NO_BLOCK;
+    for (int b = 0; b < layout->block_count; b++)
+    {
+        const LayoutBlock* block = &layout->blocks[b];
+        if (!layout->placed[b] && !block->pinned && block->count > 0 &&
+            (best == NO_BLOCK || block->count > layout->blocks[best].count))
+        {
+            best = b;
+        }
+    }
+    return best;
+}
+
+static char* label_of(Layout* layout, int b)
+{
+    LayoutBlock* block = &layout->blocks[b];
+    if (block->label == NULL)
+    {
+        // '.' cannot appear in a source identifier, so this never clashes with a user label
+        char name[LAYOUT_LABEL_SIZE];
+        snprintf(name, sizeof(name), "layout.%d", layout->made_up_labels++);
+        block->label     = arena_strdup(layout->arena, name);
+        block->new_label = true;
+    }
+    return arena_strdup(layout->arena, block->label);
+}
+
+/*
+ *   Fixes up the end of every block for what now follows it: a jmp to the next block goes, a
+ *   conditional branch to the next block is inverted to name the old fall-through instead, and
+ *   any other fall-through that is no longer next gets an explicit jmp.
+ * */
+static void fix_exits(Layout* layout, OptimizerStats* stats)
+{
+    for (int i = 0; i < layout->placed_count; i++)
+    {
+        LayoutBlock* block = &layout->blocks[layout->order[i]];
+        const int    next  = i + 1 < layout->placed_count ? layout->order[i + 1] : NO_BLOCK;
+        if (block->exit == OP_JMP && block->target != NO_BLOCK && block->target == next)
+        {
+            block->drop_exit = true;
+            stats->instructions_removed++;
+            stats->bytes_saved += bytecode_fixed_size(OP_JMP);
+            continue;
+        }
+        if (block->fallthrough == NO_BLOCK || block->fallthrough == next)
+        {
+            continue;
+        }
+        if (is_conditional(block->exit) && block->target != NO_BLOCK && block->target == next)
+        {
+            Line*        line                = &layout->program->lines[block->last];
+            Instruction* branch              = &line->value.instruction;
+            branch->opcode                   = inverted(branch->opcode);
+            branch->operands[0].value.symbol = label_of(layout, block->fallthrough);
+            stats->branches_inverted++;
+            continue;
+        }
+        block->append_jump = label_of(layout, block->fallthrough);
+        stats->jumps_inserted++;
+    }
+}
+
+static void emit_order(Layout* layout)
+{
+    Program*  program  = layout->program;
+    const int capacity = program->count + 2 * layout->block_count + 1;
+    Line*     lines    = arena_calloc(layout->arena, capacity, sizeof(Line));
+    int       out      = 0;
+    for (int i = 0; i < layout->placed_count; i++)
+    {
+        const LayoutBlock* block = &layout->blocks[layout->order[i]];
+        if (block->new_label)
+        {
+            lines[out].type          = LINE_LABEL_DEF;
+            lines[out++].value.label = block->label;
+        }
+        for (int line = block->start; line < block->end; line++)
+        {
+            if (!(block->drop_exit && line == block->last))
+            {
+                lines[out++] = program->lines[line];
+            }
+        }
+        if (block->append_jump != NULL)
+        {
+            Instruction* jump              = &lines[out].value.instruction;
+            lines[out++].type              = LINE_INSTRUCTION;
+            jump->opcode                   = OP_JMP;
+            jump->operand_types[0]         = OT_SYMBOL;
+            jump->operand_types[1]         = OT_NONE;
+            jump->operands[0].type         = OT_SYMBOL;
+            jump->operands[0].value.symbol = block->append_jump;
+            jump->operands[1].type         = OT_NONE;
+        }
+    }
+    program->lines   = lines;
+    program->count   = out;
+    program->capcity = capacity;
+}
+
+int8_t optimize_layout(Program* program, MemoryArena* arena, const LayoutProfile* profile,
+                       OptimizerStats* stats)
+{
+    Layout layout = {
+        .program = program, .arena = arena, .profile = profile, .labels = symbol_table_init()};
+    if (program->count == 0 || build_blocks(&layout) != 0)
+    {
+        symbol_table_clear(&layout.labels);
+        return program->count == 0 ? 0 : -1;
+    }
+    if (profile->count == 0 || profile->entries[profile->count - 1].offset >= layout.code_size)
+    {
+        LOG_WARN("Profile does not match this program (built with a different source or -O "
+                 "setting?); keeping source order\n");
+        symbol_table_clear(&layout.labels);
+        return 0;
+    }
+
+    link_blocks(&layout);
+    layout.order  = arena_calloc(arena, layout.block_count, sizeof(int));
+    layout.placed = arena_calloc(arena, layout.block_count, sizeof(bool));
+
+    // The entry block stays first: without .start the image enters at the first instruction
+    place_chain(&layout, 0);
+    for (int b = hottest_unplaced(&layout); b != NO_BLOCK; b = hottest_unplaced(&layout))
+    {
+        place_chain(&layout, b);
+    }
+    for (int b = 0; b < layout.block_count; b++)
+    {
+        if (!layout.blocks[b].pinned)
+        {
+            place_chain(&layout, b);
+        }
+    }
+    if (!layout.placed[layout.block_count - 1])
+    {
+        layout.placed[layout.block_count - 1] = true;
+        layout.order[layout.placed_count++]   = layout.block_count - 1;
+    }
+
+    for (int i = 0; i < layout.placed_count; i++)
+    {
+        stats->blocks_moved += layout.order[i] != i;
+    }
+    fix_exits(&layout, stats);
+    emit_order(&layout);
+    symbol_table_clear(&layout.labels);
+
+    LOG_INFO("Layout moved %u block(s), inverted %u branch(es) and inserted %u jump(s)\n",
+             stats->blocks_moved, stats->branches_inverted, stats->jumps_inserted);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#include "optimizer.h"
+#include "arena_allocator.h"
+#include "assembler_context.h"
+#include "logger.h"
+#include <stdint.h>
+
+int8_t optimize_program(AssemblerContext* asm_ctx, MemoryArena* arena, OptimizerStats* stats)
+{
+    int8_t status = optimize_dead_code(&asm_ctx->program, arena, stats);
+    if (status == 0)
+    {
+        status = optimize_coalesce(&asm_ctx->program, arena, stats);
+    }
+    if (status == 0)
+    {
+        status = optimize_peephole(&asm_ctx->program, stats);
+    }
+    if (status != 0)
+    {
+        return status;
+    }
+
+    LOG_INFO("Optimizer removed %u instruction(s), %u label(s), %u data item(s) and %u spill(s), "
+             "rewrote %u instruction(s) and saved %u bytes\n",
+             stats->instructions_removed, stats->labels_removed, stats->data_items_removed,
+             stats->spills_removed, stats->instructions_rewritten, stats->bytes_saved);
+    return 0;
+}
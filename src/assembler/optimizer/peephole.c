@@ -0,0 +1,324 @@
+#include "bytecode.h"
+#include "logger.h"
+#include "optimizer.h"
+#include "parser.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ *   A rule looks at `window` adjacent instructions starting at lines[at]. On a match it rewrites
+ *   them in place and sets *keep to how many of them stay; the rest of the window is dropped.
+ *   Every rule shrinks the program, so repeating the sweep always terminates.
+ * */
+typedef struct
+{
+    const char* name;
+    int         window;
+    bool (*rewrite)(Line* lines, int at, int count, int* keep);
+} PeepholeRule;
+
+static Instruction* instruction_at(Line* lines, int index)
+{
+    return &lines[index].value.instruction;
+}
+
+static bool is_register(const Instruction* instruction, int index)
+{
+    return instruction->operands[index].type == OT_REGISTER;
+}
+
+static bool is_immediate(const Instruction* instruction, int index)
+{
+    return instruction->operands[index].type == OT_IMMEDIATE_INT;
+}
+
+static bool same_register(const Instruction* a, int a_index, const Instruction* b, int b_index)
+{
+    return is_register(a, a_index) && is_register(b, b_index) &&
+           a->operands[a_index].value.reg == b->operands[b_index].value.reg;
+}
+
+// The VM sign-extends the 32-bit immediate field, so fold with the value it will actually see
+static int64_t immediate(const Instruction* instruction, int index)
+{
+    return (int32_t) (uint32_t) instruction->operands[index].value.literal.value.longValue;
+}
+
+static void set_immediate(Instruction* instruction, int index, int64_t value)
+{
+    instruction->operand_types[index]                          = OT_IMMEDIATE_INT;
+    instruction->operands[index].type                          = OT_IMMEDIATE_INT;
+    instruction->operands[index].value.literal.type            = LIT_INTEGER;
+    instruction->operands[index].value.literal.value.longValue = value;
+}
+
+static bool fits_immediate(int64_t value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static bool is_jump(Opcode opcode)
+{
+    return opcode >= OP_JZ && opcode <= OP_JMP;
+}
+
+static bool writes_all_flags(Opcode opcode)
+{
+    return opcode >= OP_ADD && opcode <= OP_CMP;
+}
+
+/*
+ *   Whether the flags left by lines[from - 1] can never be read: scanning forward in straight
+ *   line code, something redefines them (or the program halts) before any jump, call, return or
+ *   label that could expose them.
+ * */
+static bool flags_dead_after(const Line* lines, int from, int count)
+{
+    for (int i = from; i < count; i++)
+    {
+        if (lines[i].type == LINE_DIRECTIVE)
+        {
+            continue;
+        }
+        if (lines[i].type != LINE_INSTRUCTION)
+        {
+            return false;
+        }
+        const Opcode opcode = lines[i].value.instruction.opcode;
+        if (writes_all_flags(opcode) || opcode == OP_HALT)
+        {
+            return true;
+        }
+        if (is_jump(opcode) || opcode == OP_CALL || opcode == OP_RET)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+// mov rX, rX
+static bool rewrite_self_move(Line* lines, int at, int count, int* keep)
+{
+    (void) count;
+    const Instruction* mov = instruction_at(lines, at);
+    if (mov->opcode != OP_MOV || !same_register(mov, 0, mov, 1))
+    {
+        return false;
+    }
+    *keep = 0;
+    return true;
+}
+
+// jmp/jcc L where L labels the next instruction
+static bool rewrite_branch_to_next(Line* lines, int at, int count, int* keep)
+{
+    const Instruction* jump = instruction_at(lines, at);
+    if (!is_jump(jump->opcode) || jump->operands[0].type != OT_SYMBOL)
+    {
+        return false;
+    }
+    for (int i = at + 1; i < count && lines[i].type == LINE_LABEL_DEF; i++)
+    {
+        if (strcmp(lines[i].value.label, jump->operands[0].value.symbol) == 0)
+        {
+            *keep = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// push rX; pop rY  ->  mov rY, rX, or nothing when X == Y
+static bool rewrite_push_pop(Line* lines, int at, int count, int* keep)
+{
+    (void) count;
+    Instruction*       push = instruction_at(lines, at);
+    const Instruction* pop  = instruction_at(lines, at + 1);
+    if (push->opcode != OP_PUSH || pop->opcode != OP_POP || !is_register(push, 0) ||
+        !is_register(pop, 0))
+    {
+        return false;
+    }
+    if (same_register(push, 0, pop, 0))
+    {
+        *keep = 0;
+        return true;
+    }
+
+    const Operand source   = push->operands[0];
+    push->opcode           = OP_MOV;
+    push->operands[0]      = pop->operands[0];
+    push->operands[1]      = source;
+    push->operand_types[0] = OT_REGISTER;
+    push->operand_types[1] = OT_REGISTER;
+    *keep                  = 1;
+    return true;
+}
+
+// mov rX, a; mov rX, b  ->  mov rX, b, unless b reads rX
+static bool rewrite_overwritten_mov(Line* lines, int at, int count, int* keep)
+{
+    (void) count;
+    Instruction*       first  = instruction_at(lines, at);
+    const Instruction* second = instruction_at(lines, at + 1);
+    if (first->opcode != OP_MOV || second->opcode != OP_MOV ||
+        !same_register(first, 0, second, 0) || same_register(first, 0, second, 1))
+    {
+        return false;
+    }
+    *first = *second;
+    *keep  = 1;
+    return true;
+}
+
+// add/sub rX, a; add/sub rX, b  ->  add rX, a +- b
+static bool rewrite_add_chain(Line* lines, int at, int count, int* keep)
+{
+    Instruction*       first  = instruction_at(lines, at);
+    const Instruction* second = instruction_at(lines, at + 1);
+    if ((first->opcode != OP_ADD && first->opcode != OP_SUB) ||
+        (second->opcode != OP_ADD && second->opcode != OP_SUB) ||
+        !same_register(first, 0, second, 0) || !is_immediate(first, 1) || !is_immediate(second, 1))
+    {
+        return false;
+    }
+
+    const int64_t a     = first->opcode == OP_ADD ? immediate(first, 1) : -immediate(first, 1);
+    const int64_t b     = second->opcode == OP_ADD ? immediate(second, 1) : -immediate(second, 1);
+    const int64_t total = a + b;
+    if (!fits_immediate(total) || !flags_dead_after(lines, at + 2, count))
+    {
+        return false;
+    }
+
+    first->opcode = OP_ADD;
+    set_immediate(first, 1, total);
+    *keep = total == 0 ? 0 : 1;
+    return true;
+}
+
+// mov rX, a; op rX, b  ->  mov rX, (a op b) for add, sub, mul, and, or
+static bool rewrite_fold_into_mov(Line* lines, int at, int count, int* keep)
+{
+    Instruction*       mov = instruction_at(lines, at);
+    const Instruction* op  = instruction_at(lines, at + 1);
+    if (mov->opcode != OP_MOV || !same_register(mov, 0, op, 0) || !is_immediate(mov, 1) ||
+        !is_immediate(op, 1))
+    {
+        return false;
+    }
+
+    const int64_t a = immediate(mov, 1);
+    const int64_t b = immediate(op, 1);
+    int64_t       folded;
+    switch (op->opcode)
+    {
+    case OP_ADD:
+        folded = a + b;
+        break;
+    case OP_SUB:
+        folded = a - b;
+        break;
+    case OP_MUL:
+        folded = a * b;
+        break;
+    case OP_AND:
+        folded = a & b;
+        break;
+    case OP_OR:
+        folded = a | b;
+        break;
+    default:
+        return false;
+    }
+    if (!fits_immediate(folded) || !flags_dead_after(lines, at + 2, count))
+    {
+        return false;
+    }
+
+    set_immediate(mov, 1, folded);
+    *keep = 1;
+    return true;
+}
+
+static const PeepholeRule peephole_rules[] = {
+    {"self move", 1, rewrite_self_move},
+    {"branch to next instruction", 1, rewrite_branch_to_next},
+    {"push/pop pair", 2, rewrite_push_pop},
+    {"overwritten mov", 2, rewrite_overwritten_mov},
+    {"add/sub chain", 2, rewrite_add_chain},
+    {"fold into mov", 2, rewrite_fold_into_mov},
+};
+
+#define PEEPHOLE_RULE_COUNT (int) (sizeof(peephole_rules) / sizeof(peephole_rules[0]))
+
+static bool window_fits(const Line* lines, int at, int count, int window)
+{
+    if (at + window > count)
+    {
+        return false;
+    }
+    for (int i = at; i < at + window; i++)
+    {
+        if (lines[i].type != LINE_INSTRUCTION)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One pass over the program, compacting kept lines towards the front. Returns whether it changed
+static bool peephole_sweep(Program* program, OptimizerStats* stats)
+{
+    Line* lines   = program->lines;
+    int   out     = 0;
+    bool  changed = false;
+
+    for (int i = 0; i < program->count;)
+    {
+        int consumed = 0;
+        int keep     = 0;
+        for (int r = 0; r < PEEPHOLE_RULE_COUNT && consumed == 0; r++)
+        {
+            const PeepholeRule* rule = &peephole_rules[r];
+            if (window_fits(lines, i, program->count, rule->window) &&
+                rule->rewrite(lines, i, program->count, &keep))
+            {
+                LOG_DEBUG("peephole: %s at line %d\n", rule->name, i);
+                consumed = rule->window;
+            }
+        }
+
+        if (consumed == 0)
+        {
+            lines[out++] = lines[i++];
+            continue;
+        }
+        for (int k = 0; k < keep; k++)
+        {
+            lines[out++] = lines[i + k];
+        }
+        for (int k = keep; k < consumed; k++)
+        {
+            stats->bytes_saved += bytecode_fixed_size(lines[i + k].value.instruction.opcode);
+        }
+        stats->instructions_removed += (uint32_t) (consumed - keep);
+        stats->instructions_rewritten += (uint32_t) keep;
+        i += consumed;
+        changed = true;
+    }
+
+    program->count = out;
+    return changed;
+}
+
+int8_t optimize_peephole(Program* program, OptimizerStats* stats)
+{
+    while (peephole_sweep(program, stats))
+    {
+    }
+    return 0;
+}
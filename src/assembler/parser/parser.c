@@ -271,42 +271,36 @@ int8_t parse_directive(TokenStream* stream, MemoryArena* arena, ParsedDirective*
 {
     Token token = peek(stream);
 
-    bool is_valid_operand = peek(stream).kind == TOK_IDENTIFIER ||
-                            peek(stream).kind == TOK_LITERAL || peek(stream).kind == TOK_REGISTER;
     if (token.kind == TOK_DIRECTIVE)
     {
-        out->type = token.value.directive;
+        out->type             = token.value.directive;
+        out->operands[0].type = OT_NONE;
+        out->operands[1].type = OT_NONE;
         consume(stream);
-        if (is_valid_operand)
+
+        // Up to two comma separated operands, e.g. `.rodata greeting, "hello"`
+        for (int i = 0; i < 2; i++)
         {
-            Operand operand_1;
-            int8_t  status = parse_operand(stream, arena, &operand_1);
-            if (status != 0)
+            token = peek(stream);
+            if (token.kind == TOK_SEPARATOR && token.value.sep == SEP_COMMA)
             {
-                LOG_ERROR("Error while parsing operand!");
-                return -1;
+                consume(stream);
+                token = peek(stream);
             }
-            out->operands[0] = operand_1;
-            if (is_valid_operand)
+            bool is_valid_operand = token.kind == TOK_IDENTIFIER || token.kind == TOK_LITERAL ||
+                                    token.kind == TOK_REGISTER;
+            if (!is_valid_operand)
             {
-                Operand operand_2;
-                status = parse_operand(stream, arena, &operand_2);
-                if (status != 0)
-                {
-                    LOG_ERROR("Error while parsing operand!");
-                    return -1;
-                }
-                out->operands[1] = operand_2;
+                break;
             }
-            else
+
+            int8_t status = parse_operand(stream, arena, &out->operands[i]);
+            if (status != 0)
             {
-                out->operands[1].type = OT_NONE;
+                LOG_ERROR("Error while parsing operand!");
+                return -1;
             }
         }
-        else
-        {
-            out->operands[0].type = OT_NONE;
-        }
         return 0;
     }
     else
@@ -357,7 +351,7 @@ int8_t parse_operand(TokenStream* stream, MemoryArena* arena, Operand* out)
         {
         case LIT_INTEGER:
         {
-            bool status = parse_integer(stream, (uint32_t*) &out->value.literal.value.longValue);
+            bool status = parse_integer(stream, &out->value.literal.value.longValue);
             if (!status)
             {
                 LOG_ERROR("Failed to parse integer literal!");
@@ -405,7 +399,10 @@ int8_t parse_operand(TokenStream* stream, MemoryArena* arena, Operand* out)
     return 0;
 }
 
-bool parse_integer(TokenStream* stream, uint32_t* out)
+/*
+ *   Integer operands keep all 64 bits here; only MOVQ can encode more than 32 of them.
+ * */
+bool parse_integer(TokenStream* stream, long* out)
 {
     if (stream == NULL || stream->current == NULL)
     {
@@ -413,12 +410,7 @@ bool parse_integer(TokenStream* stream, uint32_t* out)
         return false;
     }
     Token token = peek(stream);
-    long  val   = token.value.literal.value.longValue;
-    if (val < INT32_MIN || val > UINT32_MAX)
-    {
-        return false;
-    }
-    *out = (uint32_t) val;
+    *out        = token.value.literal.value.longValue;
     consume(stream);
     return true;
 }
@@ -452,6 +444,7 @@ int8_t parse_char(TokenStream* stream, char* out)
     Token token        = peek(stream);
     char  char_literal = token.value.literal.value.charValue;
     *out               = char_literal;
+    consume(stream);
     return 0;
 }
 
@@ -1,6 +1,7 @@
 #ifndef ASSEMBLER_CONTEXT_H
 #define ASSEMBLER_CONTEXT_H
 #include "arena_allocator.h"
+#include "constant_pool.h"
 #include "parser.h"
 #include "symbol_table.h"
 #include <stddef.h>
@@ -11,20 +12,25 @@ typedef struct
     uint32_t location_counter;
     uint32_t code_start;
     size_t   code_size;
+    uint32_t entry_point;
 
     uint32_t data_start;
+    uint32_t data_size;
     uint32_t rodata_start;
+    uint32_t rodata_size;
 
     uint32_t initial_hp;
     uint32_t initial_sp;
 
     Program       program;
     SymbolTable** symbol_table;
+    ConstantPool  constant_pool; // contents of the rodata section
 
     uint8_t* memory;
 
 } AssemblerContext;
 
-AssemblerContext* asm_init(MemoryArena*);
+AssemblerContext* asm_ctx_init(MemoryArena*);
+void              asm_ctx_release(AssemblerContext*);
 
 #endif // !ASSEMBLER_CONTEXT_H
@@ -0,0 +1,28 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "vm.h"
+#include <stdint.h>
+
+// Longest compact instruction: opcode, metadata, two register bytes and a 64-bit SLEB128
+#define BYTECODE_COMPACT_MAX_SIZE 14
+
+/*
+ *   Version 2 ("compact") code stream. Each instruction is
+ *
+ *       opcode | metadata | register bytes | immediate
+ *
+ *   where the metadata byte is omitted for 0-operand instructions, a register byte is present only
+ *   for operands in a register mode, and the immediate is present only when an operand needs one.
+ *   Immediates are SLEB128 of the signed imm32 (of the full imm64 for MOVQ), so small and small
+ *   negative constants take one byte.
+ *
+ *   The loader expands a compact stream into the fixed 8-byte form before running it, and branch
+ *   targets in a compact image are the addresses of that expanded form.
+ * */
+uint32_t bytecode_fixed_size(uint8_t opcode);
+int8_t   bytecode_compact_encode(const uint8_t* fixed, uint8_t* out, uint32_t* out_len);
+int8_t   bytecode_compact_expand(const uint8_t* in, uint32_t in_len, uint8_t* out, uint32_t out_cap,
+                                 uint32_t* out_len);
+
+#endif // !BYTECODE_H
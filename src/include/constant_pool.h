@@ -0,0 +1,38 @@
+#ifndef CONSTANT_POOL_H
+#define CONSTANT_POOL_H
+
+#include "arena_allocator.h"
+#include "uthash.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    const char*    string; // NUL-terminated, owned by the arena; NULL for integer entries
+    uint32_t       len;
+    int64_t        integer;
+    uint32_t       offset; // from the start of the pool, set by constant_pool_layout
+    UT_hash_handle hh;
+} ConstantPoolEntry;
+
+/*
+ *   Read-only constants of one image. Identical strings and integers are stored once, and a string
+ *   that is a suffix of a longer one ("world" in "hello world") points into it instead of getting
+ *   its own bytes. Integers are 8-byte aligned words placed first, strings follow unaligned.
+ * */
+typedef struct
+{
+    ConstantPoolEntry* strings;
+    ConstantPoolEntry* integers;
+    uint32_t           size;
+} ConstantPool;
+
+void   constant_pool_init(ConstantPool*);
+void   constant_pool_add_string(MemoryArena*, ConstantPool*, const char*);
+void   constant_pool_add_integer(MemoryArena*, ConstantPool*, int64_t);
+int8_t constant_pool_layout(ConstantPool*, uint8_t* out, uint32_t capacity);
+bool   constant_pool_string_offset(ConstantPool*, const char*, uint32_t*);
+bool   constant_pool_integer_offset(ConstantPool*, int64_t, uint32_t*);
+void   constant_pool_clear(ConstantPool*);
+
+#endif // !CONSTANT_POOL_H
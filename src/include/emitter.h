@@ -0,0 +1,21 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include "arena_allocator.h"
+#include "assembler_context.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ *   Turns asm_ctx->program into a bytecode image. Pass one lays out labels and data, pass two
+ *   encodes instructions into asm_ctx->memory in the fixed form, and the writer emits a version 1,
+ *   2 or 3 (sectioned) image. compact_code selects the compact code encoding; version 2 implies it
+ *   and version 1 cannot hold it. BYTECODE_FLAG_WIDE may be or-ed into the version.
+ * */
+int8_t emit_layout(AssemblerContext*, MemoryArena*);
+int8_t emit_code(AssemblerContext*);
+int8_t emit_write(AssemblerContext*, FILE*, uint16_t version, bool compact_code);
+int8_t emit_program(AssemblerContext*, MemoryArena*, FILE*, uint16_t version, bool compact_code);
+
+#endif // !EMITTER_H
@@ -43,6 +43,14 @@ typedef enum
     REG_SP      = 0x08,
     REG_BP      = 0x09,
     REG_HP      = 0x0a,
+    REG_V0      = 0x0b,
+    REG_V1      = 0x0c,
+    REG_V2      = 0x0d,
+    REG_V3      = 0x0e,
+    REG_V4      = 0x0f,
+    REG_V5      = 0x10,
+    REG_V6      = 0x11,
+    REG_V7      = 0x12,
     REG_UNKNOWN = 0xFF
 } Register;
 
@@ -82,6 +90,7 @@ typedef enum
     OT_IMMEDIATE_STR,
     OT_SYMBOL,
     OT_ANY_SOURCE,
+    OT_VECTOR_REGISTER, // opcode tables only: the parser marks v0-v7 as OT_REGISTER
     OT_NONE
 } OperandType;
 
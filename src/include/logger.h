@@ -1,19 +1,59 @@
-#define LOG_ERROR(fmt, ...)                                                                        \
-    log_message(LOG_LEVEL_ERROR, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)                                                                         \
-    log_message(LOG_LEVEL_WARN, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)                                                                         \
-    log_message(LOG_LEVEL_INFO, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-
-// Optional: Use conditional compilation to eliminate high-volume debug logs in production
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+
+/*
+ *   Levels above LOG_COMPILE_LEVEL are compiled out: their macros expand to a branch that is never
+ *   taken, so the call is dropped and the arguments are never evaluated. Debug builds keep every
+ *   level, other builds stop at INFO; define LOG_COMPILE_LEVEL (1 for errors only through 5 for
+ *   trace, numbers because the preprocessor cannot see LogLevel) to choose, e.g. with
+ *   -DBITLANG_LOG_LEVEL=1.
+ *
+ *   Levels that are compiled in are still checked against g_compiler_log_level at run time,
+ *   before any argument is evaluated.
+ * */
+#ifndef LOG_COMPILE_LEVEL
 #ifdef COMPILER_DEBUG_BUILD
-#define LOG_DEBUG(fmt, ...)                                                                        \
-    log_message(LOG_LEVEL_DEBUG, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
-#define LOG_TRACE(fmt, ...)                                                                        \
-    log_message(LOG_LEVEL_TRACE, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)
+#define LOG_COMPILE_LEVEL 5
 #else
-#define LOG_DEBUG(fmt, ...) (void) 0
-#define LOG_TRACE(fmt, ...) (void) 0
+#define LOG_COMPILE_LEVEL 3
+#endif
+#endif
+
+#define LOG_AT(level, fmt, ...)                                                                    \
+    ((level) <= g_compiler_log_level                                                               \
+         ? log_message(level, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__)                    \
+         : (void) 0)
+
+// A call that is never made: the arguments still count as used, but nothing is evaluated
+#define LOG_OFF(level, fmt, ...)                                                                   \
+    (0 ? log_message(level, __FILE__, __LINE__, __func__, fmt, ##__VA_ARGS__) : (void) 0)
+
+#if LOG_COMPILE_LEVEL >= 1
+#define LOG_ERROR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) LOG_OFF(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL >= 2
+#define LOG_WARN(fmt, ...) LOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) LOG_OFF(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL >= 3
+#define LOG_INFO(fmt, ...) LOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) LOG_OFF(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL >= 4
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) LOG_OFF(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#endif
+#if LOG_COMPILE_LEVEL >= 5
+#define LOG_TRACE(fmt, ...) LOG_AT(LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
+#else
+#define LOG_TRACE(fmt, ...) LOG_OFF(LOG_LEVEL_TRACE, fmt, ##__VA_ARGS__)
 #endif
 
 typedef enum
@@ -29,5 +69,20 @@ typedef enum
 
 extern LogLevel g_compiler_log_level;
 
+/*
+ *   log_message does not format or write anything itself. It copies the format pointer and the
+ *   arguments the format names (strings by value) into a ring buffer owned by the calling
+ *   thread, and a background thread formats the records of every ring in time order and writes
+ *   them out. fmt must therefore be a string literal, or at least outlive the process's logging.
+ *
+ *   log_flush returns once everything logged before the call has been written. An ERROR record
+ *   is flushed before log_message returns, so the last diagnostics before a crash are not lost;
+ *   the lower levels never wait. Records still queued at exit are written by an atexit handler.
+ *   log_set_sink redirects output (NULL is stderr, the default).
+ * */
 void log_message(LogLevel level, const char* file, int line, const char* func, const char* fmt,
                  ...);
+void log_flush(void);
+void log_set_sink(FILE* sink);
+
+#endif // !LOGGER_H
@@ -0,0 +1,73 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "arena_allocator.h"
+#include "assembler_context.h"
+#include "parser.h"
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct
+{
+    uint32_t instructions_removed;
+    uint32_t instructions_rewritten;
+    uint32_t labels_removed;
+    uint32_t data_items_removed;
+    uint32_t spills_removed; // push/pop pairs taken off the stack
+    uint32_t blocks_moved;
+    uint32_t branches_inverted;
+    uint32_t jumps_inserted;
+    uint32_t bytes_saved; // code bytes, plus data item sizes before pooling
+} OptimizerStats;
+
+typedef struct
+{
+    uint32_t offset; // block start, bytes from CODE_START
+    uint64_t count;  // executions of its first instruction
+} ProfileEntry;
+
+// What `vm run --profile` wrote (see vm_profile.h), sorted by offset
+typedef struct
+{
+    ProfileEntry* entries;
+    int           count;
+} LayoutProfile;
+
+/*
+ *   The -O pipeline, run between run_parser and the emitter. Each pass rewrites asm_ctx->program
+ *   in place and adds what it changed to stats.
+ * */
+int8_t optimize_program(AssemblerContext*, MemoryArena*, OptimizerStats*);
+
+/*
+ *   Rewrites windows of adjacent instructions with the rules in peephole_rules until none
+ *   applies. A label between two instructions ends the window, since a jump may land there.
+ * */
+int8_t optimize_peephole(Program*, OptimizerStats*);
+
+/*
+ *   Whole-program reachability from the .start label and every .global name. Instructions no
+ *   path reaches, labels nothing reachable names and .data/.rodata items nothing reachable uses
+ *   are removed, except .data items anywhere after a used one, which code can index into.
+ * */
+int8_t optimize_dead_code(Program*, MemoryArena*, OptimizerStats*);
+
+/*
+ *   Register liveness over basic blocks of r0..r7. Moves into a dead register are dropped, a
+ *   copy whose source dies is coalesced by renaming the rest of the destination's block-local
+ *   live range, and a push/pop pair around code that leaves the pushed register alone becomes a
+ *   mov or nothing.
+ * */
+int8_t optimize_coalesce(Program*, MemoryArena*, OptimizerStats*);
+
+/*
+ *   Profile-guided block order. The profile must come from an image built from the same source
+ *   with the same -O setting, so the program laid out as-is has the offsets it names. Starting
+ *   at the entry block, each block is followed by its hottest successor, so hot paths fall
+ *   through; never-executed blocks go to the end. Conditional branches are inverted when their
+ *   target is placed next, and jumps are added or dropped to keep every fall-through edge.
+ * */
+int8_t profile_read(FILE*, MemoryArena*, LayoutProfile*);
+int8_t optimize_layout(Program*, MemoryArena*, const LayoutProfile*, OptimizerStats*);
+
+#endif // !OPTIMIZER_H
@@ -46,6 +46,51 @@ typedef enum
     OP_PUSH = 0x17,
     OP_POP  = 0x18,
     OP_HALT = 0x19,
+    // Heap
+    OP_ALLOC   = 0x1A,
+    OP_FREE    = 0x1B,
+    OP_REALLOC = 0x1C,
+    // Bulk memory (byte count in R2)
+    OP_MEMCPY = 0x1D,
+    OP_MEMSET = 0x1E,
+    OP_MEMCMP = 0x1F,
+    OP_MEMCHR = 0x20,
+    OP_STRLEN = 0x21,
+    // Vector (128-bit registers v0-v7)
+    OP_VLOAD    = 0x22,
+    OP_VSTORE   = 0x23,
+    OP_VSPLAT8  = 0x24,
+    OP_VSPLAT32 = 0x25,
+    OP_VADD8    = 0x26,
+    OP_VADD32   = 0x27,
+    OP_VSUB8    = 0x28,
+    OP_VSUB32   = 0x29,
+    OP_VMUL32   = 0x2A,
+    OP_VAND     = 0x2B,
+    OP_VOR      = 0x2C,
+    OP_VCMPEQ8  = 0x2D,
+    OP_VCMPEQ32 = 0x2E,
+    OP_VSUM8    = 0x2F,
+    OP_VSUM32   = 0x30,
+    // Wide immediate (16-byte encoding)
+    OP_MOVQ = 0x31,
+    // Guest threads and channels; yield through recv may switch threads
+    OP_SPAWN = 0x32,
+    OP_CHAN  = 0x33,
+    OP_YIELD = 0x34,
+    OP_JOIN  = 0x35,
+    OP_SEND  = 0x36,
+    OP_RECV  = 0x37,
+    // Host pipes between VMs; a full or empty pipe parks the VM in IO_WAIT
+    OP_PSEND = 0x38,
+    OP_PRECV = 0x39,
+    // Host function by id; arguments in r0-r7, result in r0
+    OP_CALLNATIVE = 0x3A,
+    // Files; under the scheduler each one is an io_uring submission
+    OP_OPEN  = 0x3B,
+    OP_READ  = 0x3C,
+    OP_WRITE = 0x3D,
+    OP_CLOSE = 0x3E,
     // Unknown
     OP_UNKNOWN = 0xFF
 } Opcode;
@@ -109,7 +154,7 @@ void consume_new_line();
 int8_t parse_operand(TokenStream*, MemoryArena*, Operand*);
 #include "assembler_context.h"
 
-bool parse_integer(TokenStream*, uint32_t*);
+bool parse_integer(TokenStream*, long*);
 
 bool parse_address(TokenStream*, uint32_t*);
 
@@ -1,6 +1,10 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
 #include "arena_allocator.h"
 #include "uthash.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct
 {
@@ -11,4 +15,7 @@ typedef struct
 
 SymbolTable* symbol_table_init();
 bool         symbol_table_add(MemoryArena*, SymbolTable**, const char*, uint32_t);
-uint32_t     symbol_table_lookup(SymbolTable*, const char*);
+bool         symbol_table_lookup(SymbolTable*, const char*, uint32_t*);
+void         symbol_table_clear(SymbolTable**);
+
+#endif // !SYMBOL_TABLE_H
@@ -2,6 +2,7 @@
 #define VM_H
 
 #include "parser.h"
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -14,6 +15,7 @@
 // CODE: 512 KB
 #define CODE_START 0x000000
 #define CODE_SIZE 0x080000
+#define CODE_SLOTS (CODE_SIZE / INSTRUCTION_SIZE) // a power of two, so a slot can be masked
 
 // RODATA: 256 KB
 #define RODATA_START 0x080000
@@ -26,16 +28,55 @@
 // HEAP: 3.5 MB
 #define HEAP_START 0x100000
 #define HEAP_SIZE 0x3C0000
+#define HEAP_END (HEAP_START + HEAP_SIZE)
+
+// HEAP ALLOCATOR
+#define VM_HEAP_CLASS_COUNT 10
+
+// REGISTERS
+#define VM_REGISTER_COUNT 8
+
+// VECTOR REGISTERS
+#define VM_VECTOR_REGISTER_COUNT 8
+#define VM_VECTOR_SIZE 16
+
+// BULK MEMORY: implicit byte count operand of memcpy/memset/memcmp/memchr
+#define VM_BULK_COUNT_REG REG_R2
+
+// Fuel of a fresh context: effectively no budget
+#define VM_FUEL_UNLIMITED INT64_MAX
 
 // STACK: 512 KB
 #define STACK_START 0x4C0000
 #define STACK_SIZE 0x080000
+#define STACK_END (STACK_START + STACK_SIZE)
+
+// GUEST THREADS: once one is spawned, thread n's stack is the n-th slice down from STACK_END
+// (main is thread 0)
+#define VM_THREAD_MAX 16
+#define VM_THREAD_STACK_SIZE (STACK_SIZE / VM_THREAD_MAX)
+#define VM_CHANNEL_MAX 16
+#define VM_CHANNEL_CAPACITY 16
+
+// HOST PIPES (vm_pipe.h)
+#define VM_PIPE_MAX 8
+
+// NATIVE FUNCTIONS: ids 0..VM_NATIVE_MAX - 1 for CALLNATIVE
+#define VM_NATIVE_MAX 64
+
+// GUEST FILES (vm_io.h): handles 1..VM_FILE_MAX
+#define VM_FILE_MAX 16
+
+// STACK FRAMES
+#define STACK_SLOT_SIZE 4
+#define STACK_FRAME_SIZE 8 // saved bp + return address
 
 // UTILITY MACORS
 #define OPCODE_SIZE 1
 #define OPERAND_SIZE 1
 #define MEMORY_LIMIT 5242880
 #define INSTRUCTION_SIZE 8
+#define EXTENDED_INSTRUCTION_SIZE 16 // MOVQ: high immediate half in a trailing word
 #define META_OP2_IMM 0x01 // bit 0
 #define OPCODE_INDEX 0
 #define OPERAND_1_INDEX 1
@@ -51,22 +92,50 @@
 
 #define GET_GLOBAL_FLAG(metadata_byte) ((metadata_byte >> 7) & 0b1)
 
+#define MAKE_METADATA(dest_mode, src_mode)                                                         \
+    ((uint8_t) ((((dest_mode) & METADATA_MASK) << 4) | (((src_mode) & METADATA_MASK) << 1)))
+
+// One unsigned compare covers both overflow (below stack_limit) and underflow (past stack_base)
+#define STACK_RANGE_OK(ctx, addr, len)                                                             \
+    ((uint32_t) ((addr) - (ctx)->stack_limit) <=                                                   \
+     (uint32_t) ((ctx)->stack_base - (ctx)->stack_limit - (len)))
+
 #define VM_OPERAND_1_INDEX 0
 #define VM_OPERAND_2_INDEX 1
 #define VM_IMM_OPERAND_INDEX 2
 #define LSB_MASK 0xFF
-#define BYTECODE_HEADER_SIZE 18
+#define BYTECODE_HEADER_SIZE 22 // versions 1 and 2
 #define BYTECODE_MAGIC 0x564D4259
-#define BYTECODE_SUPPORTED_VERSION 1
+#define BYTECODE_SUPPORTED_VERSION 1 // fixed 8-byte instructions
+#define BYTECODE_COMPACT_VERSION 2   // variable-length instructions, see bytecode.h
+#define BYTECODE_SECTIONED_VERSION 3 // section table, see BytecodeSection
+#define BYTECODE_VERSION_MASK 0x00FF // low byte: format version, high byte: mode flags
+#define BYTECODE_FLAG_WIDE 0x0100    // 64-bit registers and arithmetic
+#define BYTECODE_SECTIONED_HEADER_SIZE 12
+#define BYTECODE_SECTION_ENTRY_SIZE 12
+#define BYTECODE_MAX_SECTIONS 3
+#define BYTECODE_MAX_ALIGN_LOG2 12
+#define BYTECODE_SECTION_COMPACT 0x01 // code section uses the version 2 encoding
 // types
 typedef enum
 {
     VM_STATE_RUNNING,
     VM_STATE_HALTED,
     VM_STATE_FATAL_ERROR,
-    VM_STATE_SOFT_ERROR
+    VM_STATE_SOFT_ERROR,
+    VM_STATE_YIELDED, // fuel ran out at a block boundary; vm_resume continues from pc
+    VM_STATE_IO_WAIT  // the output sink would block; pc is back on the instruction to retry
 } VMState;
 
+// Why vm_step_n / vm_run_until handed control back
+typedef enum
+{
+    VM_RUN_HALTED,
+    VM_RUN_BUDGET_EXHAUSTED,
+    VM_RUN_IO_WAIT,
+    VM_RUN_ERROR // ctx->last_error has the code
+} VMRunResult;
+
 typedef enum
 {
     // --- 0-99: FATAL ERRORS (Immediate system halt required) ---
@@ -86,7 +155,7 @@ typedef enum
     // --- 100-199: NON-FATAL ERRORS (Recoverable, returns control) ---
 
     // Memory/Stack Errors
-    VM_ERR_STACK_OVERFLOW       = 100, // Push exceeded STACK_START
+    VM_ERR_STACK_OVERFLOW       = 100, // Push exceeded the running thread's stack
     VM_ERR_STACK_UNDERFLOW      = 101, // Pop on an empty stack
     VM_ERR_HEAP_OUT_OF_BOUNDS   = 102, // Access outside HEAP segment
     VM_ERR_MEMORY_OUT_OF_BOUNDS = 103,
@@ -98,27 +167,37 @@ typedef enum
     VM_ERR_ILLEGAL_OPERATION       = 113,
 
     // I/O Errors (if you add I/O)
-    VM_ERR_IO_READ_FAILED = 120, // Failed to read from an open stream
+    VM_ERR_IO_READ_FAILED  = 120, // Failed to read from an open stream
+    VM_ERR_IO_WRITE_FAILED = 121,
+    VM_ERR_IO_WOULD_BLOCK  = 122, // from a VMWriteFn or a pipe; the VM parks in VM_STATE_IO_WAIT
+    VM_ERR_INVALID_PIPE    = 123, // psend/precv on a port with no pipe attached
+    VM_ERR_INVALID_NATIVE  = 124, // callnative of an id with no function registered
+
+    // Guest thread errors
+    VM_ERR_INVALID_THREAD  = 125, // join of a thread that does not exist, or of itself
+    VM_ERR_INVALID_CHANNEL = 126,
+    VM_ERR_DEADLOCK        = 127, // every guest thread is blocked on a join or a channel
 
 } VMErrorState;
+typedef enum
+{
+    VM_FLAG_ZERO     = 0,
+    VM_FLAG_SIGN     = 1,
+    VM_FLAG_CARRY    = 2,
+    VM_FLAG_OVERFLOW = 3
+} VMFlag;
+
 typedef struct
 {
     VMErrorState error_state;
     uint32_t     instruction_address;
 } VMError;
 
-typedef struct
+typedef union
 {
-    VMState      state;
-    uint32_t     registers[8];
-    uint8_t*     memory;
-    const size_t memory_size;
-    uint32_t     pc;
-    uint32_t     sp;
-    uint32_t     bp;
-    uint32_t     hp;
-    uint32_t     flags[4];
-} VMContext;
+    _Alignas(VM_VECTOR_SIZE) uint8_t u8[VM_VECTOR_SIZE];
+    uint32_t u32[VM_VECTOR_SIZE / 4];
+} VMVector;
 
 typedef enum
 {
@@ -153,6 +232,171 @@ typedef struct
     VMOperand operands[2];
 } DecodedInstruction;
 
+// Allocator state for the guest heap. All links are guest addresses, 0 meaning "none".
+typedef struct
+{
+    uint32_t bins[VM_HEAP_CLASS_COUNT]; // segregated free lists of small blocks
+    uint32_t large_free;                // coalescing free list of large blocks
+} VMHeap;
+
+/*
+ *   Where PRINT_CHR and PRINT_STR go. Takes all len bytes (plus a newline when end_line is set)
+ *   and returns VM_EXIT_SUCCESS, or takes nothing and returns VM_ERR_IO_WOULD_BLOCK or another
+ *   error. NULL means stdout.
+ * */
+typedef int8_t (*VMWriteFn)(void* user, const uint8_t* data, uint32_t len, bool end_line);
+
+typedef enum
+{
+    VM_THREAD_FREE = 0,
+    VM_THREAD_READY,
+    VM_THREAD_BLOCKED,
+    VM_THREAD_DONE, // halted, waiting to be joined
+} VMThreadState;
+
+typedef enum
+{
+    VM_WAIT_NONE = 0,
+    VM_WAIT_JOIN,
+    VM_WAIT_SEND,
+    VM_WAIT_RECV,
+} VMThreadWait;
+
+// A guest thread's saved register file. The running thread's registers live in the VMContext.
+typedef struct
+{
+    uint64_t      registers[VM_REGISTER_COUNT];
+    uint32_t      pc;
+    uint32_t      sp;
+    uint32_t      bp;
+    uint32_t      flags[4];
+    VMThreadState state;
+    VMThreadWait  wait;
+    uint32_t      wait_id;    // thread being joined, or channel waited on
+    uint64_t      exit_value; // r0 when it halted
+} VMThread;
+
+typedef struct
+{
+    uint64_t values[VM_CHANNEL_CAPACITY];
+    uint32_t head;
+    uint32_t count;
+    uint32_t capacity; // 0 while the channel does not exist
+} VMChannel;
+
+// Guest threads and channels of one context (vm_threads.h)
+typedef struct
+{
+    VMThread  threads[VM_THREAD_MAX];
+    VMChannel channels[VM_CHANNEL_MAX]; // channel id n is channels[n - 1]
+    uint32_t  current;                  // thread whose registers are live in the context
+    uint32_t  live;                     // threads not free, 0 until the first spawn
+} VMThreadTable;
+
+typedef struct VMImage VMImage; // shared, read-only program or snapshot (vm_image.h)
+typedef struct VMPipe  VMPipe;  // host channel between VMs (vm_pipe.h)
+typedef struct VMIoRing VMIoRing; // a scheduler worker's io_uring (vm_io.h)
+
+// Second operand of OPEN: what the guest wants to do with the file
+typedef enum
+{
+    VM_OPEN_READ   = 0,
+    VM_OPEN_WRITE  = 1, // created if missing, truncated otherwise
+    VM_OPEN_APPEND = 2, // created if missing
+} VMOpenMode;
+
+typedef struct
+{
+    int  fd;
+    bool open;
+    bool owned; // opened by the guest, so closed with the context; else lent by the host
+} VMFile;
+
+typedef enum
+{
+    VM_IO_IDLE = 0,
+    VM_IO_IN_FLIGHT,
+    VM_IO_DONE,
+} VMIoState;
+
+// The one I/O operation a context can have outstanding on a ring
+typedef struct
+{
+    _Atomic uint32_t state;  // VMIoState; DONE is stored by the worker that reaps the completion
+    uint32_t         pc;     // instruction that submitted it, which collects the result
+    uint32_t         thread; // guest thread that submitted it
+    VMIoRing*        ring;   // where it was submitted, so any worker can cancel it
+    int64_t          result; // what the system call returned, -errno on failure
+} VMIoRequest;
+
+/*
+ *   A host function behind CALLNATIVE. Arguments are r0..r7 in registers, which is the context's
+ *   own register file: the function leaves its result in registers[0] (truncated to the word
+ *   size afterwards) and may change the others. Guest buffers are reached with vm_guest_pointer.
+ *   Returns VM_EXIT_SUCCESS or an error code, which the VM handles like an instruction's.
+ * */
+typedef struct VMContext VMContext;
+typedef int8_t (*VMNativeFn)(VMContext* ctx, uint64_t* registers);
+
+struct VMContext
+{
+    VMState      state;
+    uint64_t     registers[VM_REGISTER_COUNT]; // addresses and byte counts use the low 32 bits
+    uint64_t     word_mask; // UINT32_MAX, or UINT64_MAX when the image is BYTECODE_FLAG_WIDE
+    uint8_t*     memory;
+    const size_t memory_size;
+    uint32_t     pc;
+    uint32_t     sp;
+    uint32_t     bp;
+    uint32_t     stack_base;  // top of the running thread's stack, where its sp starts
+    uint32_t     stack_limit; // lowest address that thread's stack may reach
+    uint32_t     hp;
+    uint32_t     flags[4];
+    VMHeap       heap;
+    VMVector     vregisters[VM_VECTOR_REGISTER_COUNT];
+    bool         verified; // image passed vm_verify, so the fast handler set runs it
+    uint32_t     code_size;   // bytes of fixed-form code at CODE_START
+    uint32_t     entry_point; // from CODE_START
+    uint64_t*    profile;     // executions per code slot while profiling (vm_profile.h), or NULL
+
+    /*
+     *   Instruction budget. Each time execution enters a basic block (start, resume, any jump,
+     *   call or ret, taken or not) the whole block is charged from block_cost; entering with
+     *   fuel <= 0 stops the VM in VM_STATE_YIELDED instead. A run can overdraw by at most one
+     *   block. Set fuel before run_vm or vm_resume.
+     *
+     *   block_cost has CODE_SLOTS entries whatever the code size, 0 past the code, so charging a
+     *   block needs no bounds check; block_cost_len is the number of slots holding code.
+     * */
+    int64_t      fuel;
+    uint32_t*    block_cost; // per code slot: instructions through the next jump/call/ret/halt
+    uint32_t     block_cost_len;
+
+    VMWriteFn    write;
+    void*        write_user;
+    int8_t       last_error; // code behind VM_STATE_FATAL_ERROR or VM_STATE_SOFT_ERROR
+
+    VMThreadTable threads; // inert until the first spawn
+    VMPipe*       pipes[VM_PIPE_MAX]; // host-owned, see vm_attach_pipe
+
+    // VM_NATIVE_MAX entries, NULL where nothing is registered; the image's table for contexts
+    // made from one (vm_image_register_native), otherwise any host array or NULL
+    const VMNativeFn* natives;
+
+    VMFile      files[VM_FILE_MAX]; // guest file handle n is files[n - 1]
+    VMIoRing*   io;                 // ring of the worker running the context, NULL to block
+    VMIoRequest io_request;
+
+    /*
+     *   Set for contexts made by vm_create_from_image or vm_fork: memory is a private mapping of
+     *   the image and the per-slot tables below belong to it. predecoded[slot] is the decoded
+     *   instruction at that code slot, valid only where predecode_status[slot] is VM_EXIT_SUCCESS.
+     * */
+    VMImage*                  image;
+    const DecodedInstruction* predecoded;
+    const int8_t*             predecode_status;
+};
+
 typedef enum
 {
     VM_VT_INT,
@@ -170,52 +414,113 @@ typedef struct
     } value;
 } ResolvedValue;
 
+typedef enum
+{
+    BYTECODE_SECTION_CODE = 1,
+    BYTECODE_SECTION_RODATA,
+    BYTECODE_SECTION_DATA
+} BytecodeSectionType;
+
+/*
+ *   One entry of the version 3 section table. On disk: type, flags, align_log2 and a reserved byte,
+ *   then the u32 file offset and u32 size. The payload starts at a multiple of 1 << align_log2 so
+ *   it can be read (or mapped) straight into its segment.
+ * */
+typedef struct
+{
+    uint8_t  type;
+    uint8_t  flags;
+    uint8_t  align_log2;
+    uint32_t offset;
+    uint32_t size;
+} BytecodeSection;
+
+/*
+ *   Versions 1 and 2 have a fixed header followed by code, rodata and data back to back; version 3
+ *   has magic, version, u16 section_count and entry_point followed by the section table. Either way
+ *   parse_header fills in `sections`, so the loader only deals with the table.
+ * */
 typedef struct
 {
-    uint32_t magic_number;
-    uint16_t version_number;
-    uint32_t code_len;
-    uint32_t entry_point;
-    uint32_t rodata_len;
-    uint32_t data_len;
+    uint32_t        magic_number;
+    uint16_t        version_number;
+    uint32_t        code_len;
+    uint32_t        entry_point;
+    uint32_t        rodata_len;
+    uint32_t        data_len;
+    uint16_t        section_count;
+    BytecodeSection sections[BYTECODE_MAX_SECTIONS];
 } BytecodeFileHeader;
 
 int8_t handle_print_chr(VMContext*, DecodedInstruction);
 int8_t handle_print_str(VMContext*, DecodedInstruction);
 int8_t handle_mov(VMContext*, DecodedInstruction);
+int8_t handle_movq(VMContext*, DecodedInstruction);
 int8_t handle_load_addr(VMContext*, DecodedInstruction);
-// int8_t handle_mul(VMContext*, DecodedInstruction);
-// int8_t handle_div(VMContext*, DecodedInstruction);
-// int8_t handle_mod(VMContext*, DecodedInstruction);
-// int8_t handle_and(VMContext*, DecodedInstruction);
-// int8_t handle_or(VMContext*, DecodedInstruction);
-// int8_t handle_not(VMContext*, DecodedInstruction);
-// int8_t handle_unknown(VMContext*, DecodedInstruction);
-// int8_t handle_cmp(VMContext*, DecodedInstruction);
-// int8_t handle_jz(VMContext*, DecodedInstruction);
-// int8_t handle_jnz(VMContext*, DecodedInstruction);
-// int8_t handle_jeq(VMContext*, DecodedInstruction);
-// int8_t handle_jgt(VMContext*, DecodedInstruction);
-// int8_t handle_jge(VMContext*, DecodedInstruction);
-// int8_t handle_jlt(VMContext*, DecodedInstruction);
-// int8_t handle_jle(VMContext*, DecodedInstruction);
-// int8_t handle_jmp(VMContext*, DecodedInstruction);
-// int8_t handle_call(VMContext*, DecodedInstruction);
-// int8_t handle_ret(VMContext*, DecodedInstruction);
-// int8_t handle_push(VMContext*, DecodedInstruction);
-// int8_t handle_pop(VMContext*, DecodedInstruction);
+int8_t handle_add(VMContext*, DecodedInstruction);
+int8_t handle_sub(VMContext*, DecodedInstruction);
+int8_t handle_mul(VMContext*, DecodedInstruction);
+int8_t handle_div(VMContext*, DecodedInstruction);
+int8_t handle_mod(VMContext*, DecodedInstruction);
+int8_t handle_and(VMContext*, DecodedInstruction);
+int8_t handle_or(VMContext*, DecodedInstruction);
+int8_t handle_not(VMContext*, DecodedInstruction);
+int8_t handle_cmp(VMContext*, DecodedInstruction);
+int8_t handle_jz(VMContext*, DecodedInstruction);
+int8_t handle_jnz(VMContext*, DecodedInstruction);
+int8_t handle_jeq(VMContext*, DecodedInstruction);
+int8_t handle_jgt(VMContext*, DecodedInstruction);
+int8_t handle_jge(VMContext*, DecodedInstruction);
+int8_t handle_jlt(VMContext*, DecodedInstruction);
+int8_t handle_jle(VMContext*, DecodedInstruction);
+int8_t handle_jmp(VMContext*, DecodedInstruction);
+int8_t handle_call(VMContext*, DecodedInstruction);
+int8_t handle_ret(VMContext*, DecodedInstruction);
+int8_t handle_push(VMContext*, DecodedInstruction);
+int8_t handle_pop(VMContext*, DecodedInstruction);
 int8_t handle_halt(VMContext*, DecodedInstruction);
+int8_t handle_alloc(VMContext*, DecodedInstruction);
+int8_t handle_free(VMContext*, DecodedInstruction);
+int8_t handle_realloc(VMContext*, DecodedInstruction);
+int8_t handle_memcpy(VMContext*, DecodedInstruction);
+int8_t handle_memset(VMContext*, DecodedInstruction);
+int8_t handle_memcmp(VMContext*, DecodedInstruction);
+int8_t handle_memchr(VMContext*, DecodedInstruction);
+int8_t handle_strlen(VMContext*, DecodedInstruction);
+int8_t handle_vload(VMContext*, DecodedInstruction);
+int8_t handle_vstore(VMContext*, DecodedInstruction);
+int8_t handle_vsplat(VMContext*, DecodedInstruction);
+int8_t handle_vector_lanes(VMContext*, DecodedInstruction);
+int8_t handle_vsum(VMContext*, DecodedInstruction);
+int8_t handle_spawn(VMContext*, DecodedInstruction);
+int8_t handle_chan(VMContext*, DecodedInstruction);
+int8_t handle_yield(VMContext*, DecodedInstruction);
+int8_t handle_join(VMContext*, DecodedInstruction);
+int8_t handle_send(VMContext*, DecodedInstruction);
+int8_t handle_recv(VMContext*, DecodedInstruction);
+int8_t handle_psend(VMContext*, DecodedInstruction);
+int8_t handle_precv(VMContext*, DecodedInstruction);
+int8_t handle_callnative(VMContext*, DecodedInstruction);
+int8_t handle_open(VMContext*, DecodedInstruction);
+int8_t handle_read(VMContext*, DecodedInstruction);
+int8_t handle_write(VMContext*, DecodedInstruction);
+int8_t handle_close(VMContext*, DecodedInstruction);
 typedef int8_t (*InstructionHandler)(VMContext*, DecodedInstruction);
 
 extern InstructionHandler opcode_handler[256];
 // functions
-VMContext* vm_create();
-void       vm_destroy(VMContext*);
-int8_t     load_bytecode(VMContext*, const char*);
-int8_t     fetch_instruction(VMContext*, uint8_t*);
-int8_t     decode_instruction(VMContext*, const uint8_t*, DecodedInstruction*);
-int8_t     run_vm(VMContext*, const char*);
-int8_t     execute_bytecode(VMContext*, DecodedInstruction*);
-uint32_t   vm_allocate_string(VMContext*, const char*);
-void       set_vm_error_state(VMContext*, VMError*, int8_t);
-#endif // !VM_H0,  // MSB
+VMContext*  vm_create();
+void        vm_destroy(VMContext*);
+int8_t      load_bytecode(VMContext*, const char*);
+int8_t      fetch_instruction(VMContext*, uint8_t*);
+int8_t      decode_instruction(VMContext*, const uint8_t*, DecodedInstruction*);
+int8_t      run_vm(VMContext*, const char*);
+int8_t      vm_resume(VMContext*);
+int8_t      vm_load(VMContext*, const char*);
+VMRunResult vm_step_n(VMContext*, uint64_t);
+VMRunResult vm_run_until(VMContext*);
+void        vm_terminate(VMContext*, int8_t, uint32_t);
+int8_t      execute_bytecode(VMContext*, DecodedInstruction*);
+uint32_t    vm_allocate_string(VMContext*, const char*);
+void        set_vm_error_state(VMContext*, VMError*, int8_t);
+#endif // !VM_H
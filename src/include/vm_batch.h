@@ -0,0 +1,31 @@
+#ifndef VM_BATCH_H
+#define VM_BATCH_H
+
+#include "vm.h"
+#include "vm_image.h"
+#include <stdint.h>
+
+/*
+ *   Runs one image over many input records. Each host thread makes a single instance of the image
+ *   and, for every record it takes, resets it (vm_image_reset), copies the record into guest
+ *   memory at input_at, runs it to completion and copies output_size bytes at output_at back out.
+ *   Records are handed out in small chunks from a shared counter, so threads that draw cheap
+ *   records take more of them.
+ *
+ *   Records are independent: none sees another's memory, registers or heap. What they print goes
+ *   to stdout.
+ * */
+typedef struct
+{
+    uint32_t input_at;    // guest address each input is copied to; must be writable
+    uint32_t input_size;  // bytes per input record
+    uint32_t output_at;   // guest address each output is read from once the record halts
+    uint32_t output_size; // bytes per output record
+    uint64_t fuel;        // instructions a record may run, 0 for no limit
+    uint32_t threads;     // host threads, 0 for one per online CPU
+} VMBatchLayout;
+
+int8_t vm_run_batch(VMImage*, const VMBatchLayout*, const void* inputs, void* outputs,
+                    uint32_t count, VMRunResult* results);
+
+#endif // !VM_BATCH_H
@@ -0,0 +1,72 @@
+#ifndef VM_CFG_H
+#define VM_CFG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CFG_NO_BLOCK UINT32_MAX
+#define CFG_MAX_SUCCESSORS 2
+
+// Block flags
+#define CFG_BLOCK_REACHABLE 0x01   // reached from the entry block along static edges
+#define CFG_BLOCK_LOOP_HEADER 0x02 // target of at least one back edge
+#define CFG_BLOCK_CALL 0x04        // ends in call; successors are the callee and the return site
+#define CFG_BLOCK_RETURN 0x08      // ends in ret
+#define CFG_BLOCK_HALT 0x10        // ends in halt
+#define CFG_BLOCK_INDIRECT 0x20    // ends in a jump through a register, successors unknown
+
+/*
+ *   A maximal straight-line run of instructions in the fixed 8-byte encoding. Offsets are from
+ *   CODE_START. `exec_count` is not touched by the builder; it is there for profilers.
+ * */
+typedef struct
+{
+    uint32_t start;
+    uint32_t end; // one past the last instruction
+    uint32_t instruction_count;
+    uint32_t successors[CFG_MAX_SUCCESSORS];
+    uint8_t  successor_count;
+    uint8_t  flags;
+    uint32_t first_predecessor; // index into ControlFlowGraph.predecessors
+    uint32_t predecessor_count;
+    uint32_t idom;        // immediate dominator, CFG_NO_BLOCK for the entry and unreachable blocks
+    uint32_t loop_header; // header of the innermost loop containing the block, or CFG_NO_BLOCK
+    uint16_t loop_depth;
+    uint64_t exec_count;
+} CfgBlock;
+
+typedef struct
+{
+    uint32_t header;
+    uint32_t block_count; // including the header
+    uint32_t back_edges;
+} CfgLoop;
+
+typedef struct
+{
+    CfgBlock* blocks; // in code order
+    uint32_t  block_count;
+    uint32_t  entry;
+    uint32_t* predecessors;
+    CfgLoop*  loops;
+    uint32_t  loop_count;
+    uint32_t* block_at; // code offset / INSTRUCTION_SIZE -> block index
+    uint32_t  code_len;
+} ControlFlowGraph;
+
+/*
+ *   Builds the CFG of `code_len` bytes of fixed-form code. Blocks start at the entry point, at
+ *   every static branch or call target (where the assembler had a label) and after every jump,
+ *   call, ret and halt. Dominators use the Cooper-Harvey-Kennedy iteration over reverse
+ *   postorder; a natural loop is every block that reaches a back edge without passing its header,
+ *   and loops sharing a header are merged.
+ *
+ *   Returns VM_EXIT_SUCCESS, VM_ERR_INVALID_BYTECODE for code that cannot be walked, or
+ *   VM_ERR_MEMORY_ALLOCATION_FAILED. The graph owns its arrays until cfg_free.
+ * */
+int8_t   cfg_build(ControlFlowGraph*, const uint8_t* code, uint32_t code_len, uint32_t entry_point);
+void     cfg_free(ControlFlowGraph*);
+uint32_t cfg_block_containing(const ControlFlowGraph*, uint32_t offset);
+bool     cfg_dominates(const ControlFlowGraph*, uint32_t dominator, uint32_t block);
+
+#endif // !VM_CFG_H
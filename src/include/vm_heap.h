@@ -0,0 +1,23 @@
+#ifndef VM_HEAP_H
+#define VM_HEAP_H
+
+#include "vm.h"
+#include <stdint.h>
+
+// Block header bits; block sizes are multiples of VM_HEAP_ALIGN so the low bits are free
+#define VM_HEAP_ALIGN 8
+#define VM_HEAP_HEADER_SIZE 4
+#define VM_HEAP_MIN_BLOCK 16
+#define VM_HEAP_SMALL_MAX 512
+#define VM_HEAP_BLOCK_USED 0x1 // allocated, or parked in a size-class bin
+#define VM_HEAP_PREV_FREE 0x2  // previous block is a free large block with a valid footer
+#define VM_HEAP_BINNED 0x4     // small block sitting in a size-class bin
+#define VM_HEAP_FLAG_MASK 0x7
+
+void     vm_heap_init(VMContext*);
+uint32_t vm_heap_alloc(VMContext*, uint32_t);
+int8_t   vm_heap_free(VMContext*, uint32_t);
+uint32_t vm_heap_realloc(VMContext*, uint32_t, uint32_t);
+uint32_t vm_heap_usable_size(VMContext*, uint32_t);
+
+#endif // !VM_HEAP_H
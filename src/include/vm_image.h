@@ -0,0 +1,38 @@
+#ifndef VM_IMAGE_H
+#define VM_IMAGE_H
+
+#include "vm.h"
+#include <stdint.h>
+
+/*
+ *   A program loaded, verified and decoded once, for any number of VM instances. The image keeps
+ *   the initial memory (code, rodata, data) in an in-memory file; every instance maps it private,
+ *   so code and rodata pages stay shared and data, heap and stack pages are copied only when an
+ *   instance first writes them. Block costs and predecoded instructions are shared as well.
+ *
+ *   Images are reference counted: each instance holds a reference, so the creator may release
+ *   its own as soon as the instances exist.
+ *
+ *   vm_snapshot builds the same kind of image from a context that has already run for a while,
+ *   say through an expensive setup phase, and vm_fork starts a new context from it exactly where
+ *   the snapshot was taken. Forks never see each other's writes. They start with the default
+ *   output sink and no pipes attached, since a sink's user pointer and a pipe end each serve a
+ *   single context; the host sets those on every fork that needs them.
+ *
+ *   Native functions for CALLNATIVE are registered on the image, once, and every instance calls
+ *   through the image's table. A snapshot starts with the table its context was using.
+ *
+ *   vm_image_reset returns an instance to the image's state in place, which is much cheaper than
+ *   destroying it and creating another; vm_run_batch (vm_batch.h) is built on it.
+ * */
+VMImage*   vm_image_load(const char* file_name);
+VMImage*   vm_snapshot(VMContext*);
+VMImage*   vm_image_retain(VMImage*);
+void       vm_image_release(VMImage*);
+VMContext* vm_create_from_image(VMImage*);
+VMContext* vm_fork(VMImage* snapshot);
+int8_t     vm_image_register_native(VMImage*, uint32_t id, VMNativeFn);
+int8_t     vm_image_reset(VMContext*, uint32_t keep_at, uint32_t keep_len);
+void       vm_image_detach(VMContext*);
+
+#endif // !VM_IMAGE_H
@@ -0,0 +1,35 @@
+#ifndef VM_IO_H
+#define VM_IO_H
+
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *   Guest file I/O. OPEN, READ, WRITE and CLOSE work on small per-context handles; the host can
+ *   lend a descriptor of its own (a pipe, a socket) with vm_attach_file.
+ *
+ *   When a context runs on a scheduler worker, ctx->io is that worker's io_uring. An I/O
+ *   instruction then only submits its operation and returns VM_ERR_IO_WOULD_BLOCK, so the VM
+ *   parks in IO_WAIT (or switches guest thread) and the worker carries on with other VMs. The
+ *   worker reaps completions between slices; when the instruction runs again it collects its
+ *   result. Without a ring, because the context is run directly or io_uring is unavailable, the
+ *   same instructions make the ordinary blocking system calls.
+ *
+ *   A context that halts, fails, is reset or is destroyed with an operation in flight has it
+ *   cancelled first (vm_io_cancel), so the kernel never writes into memory that is no longer the
+ *   guest's. Workers drain their ring before they stop.
+ * */
+VMIoRing* vm_io_ring_create(uint32_t entries);
+void      vm_io_ring_destroy(VMIoRing*);
+uint32_t  vm_io_ring_reap(VMIoRing*);
+void      vm_io_ring_drain(VMIoRing*);
+void      vm_io_cancel(VMContext*);
+uint32_t  vm_attach_file(VMContext*, int fd);
+void      vm_close_files(VMContext*);
+int8_t    vm_io_open(VMContext*, uint32_t path, uint64_t mode, int64_t* result);
+int8_t    vm_io_read(VMContext*, uint64_t handle, uint32_t address, uint32_t len, int64_t* result);
+int8_t    vm_io_write(VMContext*, uint64_t handle, uint32_t address, uint32_t len, int64_t* result);
+int8_t    vm_io_close(VMContext*, uint64_t handle, int64_t* result);
+
+#endif // !VM_IO_H
@@ -0,0 +1,33 @@
+#ifndef VM_PIPE_H
+#define VM_PIPE_H
+
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *   Host channels between VM instances: bounded, lock-free rings of fixed-size messages in a
+ *   shared mapping. A VM reaches a pipe through one of its VM_PIPE_MAX ports (vm_attach_pipe);
+ *   psend copies a message out of guest memory straight into the ring and precv copies one back
+ *   into guest memory. A full or empty pipe parks the VM in VM_STATE_IO_WAIT, as output does.
+ *
+ *   VM_PIPE_SPSC allows one producer and one consumer; VM_PIPE_MPSC allows any number of
+ *   producers and one consumer. The host may send and receive too, counting as one of them.
+ * */
+
+typedef enum
+{
+    VM_PIPE_SPSC = 0,
+    VM_PIPE_MPSC,
+} VMPipeMode;
+
+typedef struct VMPipe VMPipe;
+
+VMPipe*  vm_pipe_create(VMPipeMode mode, uint32_t slot_count, uint32_t message_size);
+void     vm_pipe_destroy(VMPipe*);
+bool     vm_pipe_send(VMPipe*, const void* message);
+bool     vm_pipe_recv(VMPipe*, void* message);
+uint32_t vm_pipe_message_size(const VMPipe*);
+int8_t   vm_attach_pipe(VMContext*, uint32_t port, VMPipe*);
+
+#endif // !VM_PIPE_H
@@ -0,0 +1,24 @@
+#ifndef VM_PROFILE_H
+#define VM_PROFILE_H
+
+#include "vm.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define VM_PROFILE_SLOTS (CODE_SIZE / INSTRUCTION_SIZE)
+
+/*
+ *   Execution counting for profile-guided layout. While ctx->profile is set, run_vm counts every
+ *   instruction it fetches. vm_profile_write then prints one line per basic block of the loaded
+ *   code (see vm_cfg.h):
+ *
+ *       0x<block offset from CODE_START> <times its first instruction ran>
+ *
+ *   Images carry no label names, so the profile is keyed by offset; `asm build --profile` maps
+ *   the offsets back to labels by laying the same source out the same way. Lines starting with
+ *   '#' are comments.
+ * */
+int8_t vm_profile_enable(VMContext*);
+int8_t vm_profile_write(const VMContext*, FILE*);
+
+#endif // !VM_PROFILE_H
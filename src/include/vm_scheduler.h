@@ -0,0 +1,38 @@
+#ifndef VM_SCHEDULER_H
+#define VM_SCHEDULER_H
+
+#include "vm.h"
+#include <stdint.h>
+
+/*
+ *   Runs many VMs on a fixed pool of worker threads. Each worker owns a work-stealing deque of
+ *   tasks; a worker takes a task, runs it for one slice with vm_step_n and, if the budget ran
+ *   out, puts it back on its own deque. Idle workers steal from the others.
+ *
+ *   A VMContext is only ever touched by one worker at a time, and the scheduler gives each one
+ *   its own output buffer, so VMs never share mutable state.
+ *
+ *   Each worker also owns an io_uring (vm_io.h). A VM waiting on file I/O goes back on a deque
+ *   like a preempted one, and the worker runs other VMs until the kernel completes it.
+ * */
+
+// One VM to run. Fill in vm (already through vm_load) and zero the rest before submitting.
+typedef struct
+{
+    VMContext*  vm;
+    VMRunResult result;     // how it finished: VM_RUN_HALTED or VM_RUN_ERROR
+    uint32_t    slices;     // times it was scheduled
+    char*       output;     // everything it printed; free with vm_task_release
+    uint32_t    output_len;
+    uint32_t    output_cap;
+} VMTask;
+
+typedef struct VMScheduler VMScheduler;
+
+VMScheduler* vm_scheduler_create(uint32_t worker_count, uint64_t slice);
+int8_t       vm_scheduler_submit(VMScheduler*, VMTask*);
+int8_t       vm_scheduler_run(VMScheduler*);
+void         vm_scheduler_destroy(VMScheduler*);
+void         vm_task_release(VMTask*);
+
+#endif // !VM_SCHEDULER_H
@@ -0,0 +1,23 @@
+#ifndef VM_SIMD_H
+#define VM_SIMD_H
+
+#include "vm.h"
+#include <stdint.h>
+
+// Lane-wise kernels behind the vector opcodes: dest = dest <op> src.
+// SSE2 when the compiler targets it, plain loops otherwise.
+void     vm_vec_add8(VMVector*, const VMVector*);
+void     vm_vec_add32(VMVector*, const VMVector*);
+void     vm_vec_sub8(VMVector*, const VMVector*);
+void     vm_vec_sub32(VMVector*, const VMVector*);
+void     vm_vec_mul32(VMVector*, const VMVector*);
+void     vm_vec_and(VMVector*, const VMVector*);
+void     vm_vec_or(VMVector*, const VMVector*);
+void     vm_vec_cmpeq8(VMVector*, const VMVector*);
+void     vm_vec_cmpeq32(VMVector*, const VMVector*);
+void     vm_vec_splat8(VMVector*, uint8_t);
+void     vm_vec_splat32(VMVector*, uint32_t);
+uint32_t vm_vec_sum8(const VMVector*);
+uint32_t vm_vec_sum32(const VMVector*);
+
+#endif // !VM_SIMD_H
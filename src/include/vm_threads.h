@@ -0,0 +1,24 @@
+#ifndef VM_THREADS_H
+#define VM_THREADS_H
+
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Opcodes after which another thread may be running
+static inline bool vm_thread_switch_point(uint8_t opcode)
+{
+    return opcode >= OP_YIELD && opcode <= OP_RECV;
+}
+
+int8_t     vm_thread_spawn(VMContext*, uint32_t entry, uint32_t* id);
+bool       vm_thread_switch(VMContext*);
+int8_t     vm_thread_block(VMContext*, VMThreadWait, uint32_t id);
+void       vm_thread_wake(VMContext*, VMThreadWait, uint32_t id);
+int8_t     vm_thread_exit(VMContext*);
+uint32_t   vm_channel_create(VMContext*, uint64_t capacity);
+VMChannel* vm_channel(VMContext*, uint64_t id);
+bool       vm_channel_send(VMChannel*, uint64_t value);
+bool       vm_channel_recv(VMChannel*, uint64_t* out);
+
+#endif // !VM_THREADS_H
@@ -2,12 +2,84 @@
 #define VM_UTILS_H
 
 #include "vm.h"
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t size;
+    bool     writable;
+} VMSegment;
 
 uint32_t vm_allocate_string(VMContext*, const char*);
 void     populate_operand(VMOperand*, uint8_t, uint32_t);
-void     vm_print_string(VMContext*, uint32_t);
+int8_t   vm_print_string(VMContext*, uint32_t);
+int8_t   vm_write_output(VMContext*, const uint8_t*, uint32_t, bool);
 int8_t   read_header_u16(FILE*, uint16_t*);
 int8_t   read_header_u32(FILE*, uint32_t*);
 int8_t   parse_header(BytecodeFileHeader*, FILE*);
+int8_t   vm_read_operand(VMContext*, const VMOperand*, uint64_t*);
+int8_t   vm_branch_target(VMContext*, const VMOperand*, uint32_t*);
+int8_t   vm_check_dynamic_target(const VMContext*, uint32_t);
+int8_t   vm_stack_fault(const VMContext*, uint32_t);
+void     vm_set_flags(VMContext*, uint64_t, bool, bool);
+
+const VMSegment* vm_segment_of(uint32_t);
+int8_t           vm_check_range(uint32_t, uint32_t, bool);
+uint8_t*         vm_guest_pointer(VMContext*, uint64_t, uint64_t, bool);
+
+// Unaligned little-endian accessors into guest memory. Callers do the bounds checks.
+static inline uint32_t vm_load_u32(const VMContext* ctx, uint32_t address)
+{
+    uint32_t value;
+    memcpy(&value, ctx->memory + address, sizeof(uint32_t));
+    return value;
+}
+
+static inline void vm_store_u32(VMContext* ctx, uint32_t address, uint32_t value)
+{
+    memcpy(ctx->memory + address, &value, sizeof(uint32_t));
+}
+
+static inline uint64_t vm_load_u64(const VMContext* ctx, uint32_t address)
+{
+    uint64_t value;
+    memcpy(&value, ctx->memory + address, sizeof(uint64_t));
+    return value;
+}
+
+static inline void vm_store_u64(VMContext* ctx, uint32_t address, uint64_t value)
+{
+    memcpy(ctx->memory + address, &value, sizeof(uint64_t));
+}
+
+// Register width in bytes: what memory operands, PUSH and POP move in the current mode
+static inline uint32_t vm_word_size(const VMContext* ctx)
+{
+    return ctx->word_mask == UINT32_MAX ? sizeof(uint32_t) : sizeof(uint64_t);
+}
+
+static inline uint64_t vm_sign_bit(const VMContext* ctx)
+{
+    return ctx->word_mask ^ (ctx->word_mask >> 1);
+}
+
+static inline uint64_t vm_load_word(const VMContext* ctx, uint32_t address)
+{
+    return ctx->word_mask == UINT32_MAX ? vm_load_u32(ctx, address) : vm_load_u64(ctx, address);
+}
+
+static inline void vm_store_word(VMContext* ctx, uint32_t address, uint64_t value)
+{
+    if (ctx->word_mask == UINT32_MAX)
+    {
+        vm_store_u32(ctx, address, (uint32_t) value);
+    }
+    else
+    {
+        vm_store_u64(ctx, address, value);
+    }
+}
 #endif
@@ -0,0 +1,22 @@
+#ifndef VM_VERIFIER_H
+#define VM_VERIFIER_H
+
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *   One pass over the loaded code, run by load_bytecode. An image passes when every instruction
+ *   has a known opcode and fits in the code, each operand uses a mode its opcode accepts with a
+ *   register id below VM_REGISTER_COUNT (VM_VECTOR_REGISTER_COUNT for v-registers), immediate
+ *   data addresses leave room for a full word, and the entry point and every static branch
+ *   target start an instruction.
+ *
+ *   Verified images run on the fast handler set, which trusts those properties; anything else
+ *   keeps the checked handlers.
+ * */
+bool   vm_verify(const VMContext*, uint32_t code_len, uint32_t entry_point);
+int8_t vm_check_registers(const DecodedInstruction*);
+bool   vm_static_branch_target(const uint8_t* instruction, uint32_t pc, uint32_t* out);
+
+#endif // !VM_VERIFIER_H
@@ -1,15 +1,163 @@
 #include "arena_allocator.h"
+#include "assembler_context.h"
+#include "emitter.h"
 #include "lexer.h"
 #include "logger.h"
 #include "opcodes.h"
+#include "optimizer.h"
 #include "parser.h"
 #include "token_stream.h"
 #include "vm.h"
+#include "vm_profile.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define INITIAL_TOKEN_CAPACITY 256
+#define BUILD_LINE_CAPACITY 8192
+
+/*
+ *   vm run <image> --profile <file>: counts block executions and writes them for asm build
+ *   --profile (format in vm_profile.h).
+ * */
+static int8_t write_profile(const VMContext* ctx, const char* path)
+{
+    FILE* profile_file = fopen(path, "w");
+    if (profile_file == NULL)
+    {
+        LOG_ERROR("Failed to create %s\n", path);
+        return VM_ERR_IO_WRITE_FAILED;
+    }
+    int8_t status = vm_profile_write(ctx, profile_file);
+    fclose(profile_file);
+    return status;
+}
+
+static int8_t layout_from_profile(AssemblerContext* asm_ctx, MemoryArena* arena, const char* path,
+                                  OptimizerStats* stats)
+{
+    FILE* profile_file = fopen(path, "r");
+    if (profile_file == NULL)
+    {
+        LOG_ERROR("Failed to open %s\n", path);
+        return -1;
+    }
+    LayoutProfile profile;
+    int8_t        status = profile_read(profile_file, arena, &profile);
+    fclose(profile_file);
+    if (status == 0)
+    {
+        status = optimize_layout(&asm_ctx->program, arena, &profile, stats);
+    }
+    return status;
+}
+
+/*
+ *   asm build <input> <output> [--compact] [--wide] [--legacy] [-O] [--profile <file>]
+ *
+ *   Writes a sectioned (version 3) image; --legacy writes version 1, or version 2 with --compact.
+ *   -O runs the optimizer pipeline over the parsed program before it is encoded. --profile takes
+ *   what `vm run --profile` wrote for a build of the same source and -O setting and reorders the
+ *   code hot path first.
+ * */
+static int assemble_file(int argc, char* argv[])
+{
+    uint16_t flags    = 0;
+    bool     compact  = false;
+    bool     legacy   = false;
+    bool     optimize = false;
+    char*    profile  = NULL;
+    for (int i = 5; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--compact") == 0)
+        {
+            compact = true;
+        }
+        else if (strcmp(argv[i], "--wide") == 0)
+        {
+            flags |= BYTECODE_FLAG_WIDE;
+        }
+        else if (strcmp(argv[i], "--legacy") == 0)
+        {
+            legacy = true;
+        }
+        else if (strcmp(argv[i], "-O") == 0)
+        {
+            optimize = true;
+        }
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profile = argv[++i];
+        }
+        else
+        {
+            LOG_ERROR("Unknown option %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE* input_file = fopen(argv[3], "r");
+    if (input_file == NULL)
+    {
+        LOG_ERROR("Failed to open %s\n", argv[3]);
+        return EXIT_FAILURE;
+    }
+
+    MemoryArena arena;
+    arena_init(&arena, MEM_SIZE + 8 * MAX_ARENA_SIZE);
+
+    int          token_count  = 0;
+    TokenVector* token_vector = run_lexer(&arena, input_file, &token_count);
+    fclose(input_file);
+    if (token_vector == NULL || token_vector->items == NULL)
+    {
+        LOG_ERROR("Lexing failed.\n");
+        arena_free(&arena);
+        return EXIT_FAILURE;
+    }
+
+    AssemblerContext* asm_ctx = asm_ctx_init(&arena);
+    TokenStream*      stream  = build_token_stream(&arena, token_vector->items, token_count);
+    asm_ctx->program.capcity  = BUILD_LINE_CAPACITY;
+    if (run_parser(&arena, stream, &asm_ctx->program) != 0)
+    {
+        arena_free(&arena);
+        return EXIT_FAILURE;
+    }
+
+    OptimizerStats stats = {0};
+    if (optimize && optimize_program(asm_ctx, &arena, &stats) != 0)
+    {
+        asm_ctx_release(asm_ctx);
+        arena_free(&arena);
+        return EXIT_FAILURE;
+    }
+    if (profile != NULL && layout_from_profile(asm_ctx, &arena, profile, &stats) != 0)
+    {
+        asm_ctx_release(asm_ctx);
+        arena_free(&arena);
+        return EXIT_FAILURE;
+    }
+
+    FILE* output_file = fopen(argv[4], "wb");
+    if (output_file == NULL)
+    {
+        LOG_ERROR("Failed to create %s\n", argv[4]);
+        arena_free(&arena);
+        return EXIT_FAILURE;
+    }
+    uint16_t format = BYTECODE_SECTIONED_VERSION;
+    if (legacy)
+    {
+        format = compact ? BYTECODE_COMPACT_VERSION : BYTECODE_SUPPORTED_VERSION;
+    }
+    int8_t status = emit_program(asm_ctx, &arena, output_file, format | flags, compact);
+    fclose(output_file);
+    asm_ctx_release(asm_ctx);
+    arena_free(&arena);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 int main(int argc, char* argv[])
 {
@@ -27,6 +175,16 @@ int main(int argc, char* argv[])
         {
             VMContext* ctx             = vm_create();
             char*      input_file_path = argv[3];
+            char*      profile_path    = NULL;
+            if (argc >= 6 && strcmp(argv[4], "--profile") == 0)
+            {
+                profile_path = argv[5];
+                if (vm_profile_enable(ctx) != VM_EXIT_SUCCESS)
+                {
+                    vm_destroy(ctx);
+                    return EXIT_FAILURE;
+                }
+            }
             LOG_INFO("Input file: %s", input_file_path); // Replaced fprintf(stderr, ...)
             int8_t status = run_vm(ctx, argv[3]);
             if (status != VM_EXIT_SUCCESS)
@@ -38,8 +196,12 @@ int main(int argc, char* argv[])
             else
             {
                 LOG_INFO("VM finished execution successfully.\n", VM_EXIT_SUCCESS);
+                if (profile_path != NULL)
+                {
+                    status = write_profile(ctx, profile_path);
+                }
                 vm_destroy(ctx);
-                return VM_EXIT_SUCCESS;
+                return status;
             }
         }
     }
@@ -47,6 +209,10 @@ int main(int argc, char* argv[])
     TokenStream* stream;
     if (strcmp(argv[1], "asm") == 0)
     {
+        if (strcmp(argv[2], "build") == 0 && argc >= 5)
+        {
+            return assemble_file(argc, argv);
+        }
         if (strcmp(argv[2], "run") == 0)
         {
             MemoryArena arena;
@@ -11,7 +11,14 @@ const OpcodeEntry opcode_table[256] = {
     {"or", 0x0a},        {"not", 0x0b},       {"cmp", 0x0c}, {"jz", 0x0d},        {"jnz", 0x0e},
     {"jeq", 0x0f},       {"jgt", 0x10},       {"jge", 0x11}, {"jlt", 0x12},       {"jle", 0x13},
     {"jmp", 0x14},       {"call", 0x15},      {"ret", 0x16}, {"push", 0x17},      {"pop", 0x18},
-    {"halt", 0x19}};
+    {"halt", 0x19},      {"alloc", 0x1a},     {"free", 0x1b}, {"realloc", 0x1c},   {"memcpy", 0x1d},
+    {"memset", 0x1e},    {"memcmp", 0x1f},    {"memchr", 0x20}, {"strlen", 0x21},   {"vload", 0x22},
+    {"vstore", 0x23},    {"vsplat8", 0x24},   {"vsplat32", 0x25}, {"vadd8", 0x26},  {"vadd32", 0x27},
+    {"vsub8", 0x28},     {"vsub32", 0x29},    {"vmul32", 0x2a}, {"vand", 0x2b},     {"vor", 0x2c},
+    {"vcmpeq8", 0x2d},   {"vcmpeq32", 0x2e},  {"vsum8", 0x2f},  {"vsum32", 0x30},
+    {"movq", 0x31},      {"spawn", 0x32},     {"chan", 0x33},  {"yield", 0x34},    {"join", 0x35},
+    {"send", 0x36},      {"recv", 0x37},      {"psend", 0x38}, {"precv", 0x39},
+    {"callnative", 0x3a}, {"open", 0x3b},     {"read", 0x3c}, {"write", 0x3d},    {"close", 0x3e}};
 
 Opcode opcode_lookup(const char* s)
 {
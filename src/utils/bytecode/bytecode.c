@@ -0,0 +1,204 @@
+#include "bytecode.h"
+#include "instruction_format_table.h"
+#include "logger.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+static bool mode_has_register(VMAddressingMode mode)
+{
+    return mode == VM_AM_REG_DIRECT || mode == VM_AM_REG_INDIRECT || mode == VM_AM_BASE_OFFSET;
+}
+
+static bool mode_has_immediate(VMAddressingMode mode)
+{
+    return mode == VM_AM_IMM_INT || mode == VM_AM_IMM_ADDR || mode == VM_AM_PC_RELATIVE ||
+           mode == VM_AM_BASE_OFFSET;
+}
+
+// Modes of operand 0 and 1 exactly as decode_instruction would see them
+static void operand_modes(uint8_t metadata, int operand_count, VMAddressingMode modes[2])
+{
+    modes[0] = operand_count >= 1 ? (VMAddressingMode) GET_DEST_MODE(metadata) : VM_AM_NONE;
+    modes[1] = operand_count == 2 ? (VMAddressingMode) GET_SRC_MODE(metadata) : VM_AM_NONE;
+}
+
+static uint32_t write_sleb128(uint8_t* out, int64_t value)
+{
+    uint32_t length = 0;
+    bool     more   = true;
+    while (more)
+    {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        more = !((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)));
+        out[length++] = more ? (byte | 0x80) : byte;
+    }
+    return length;
+}
+
+static bool read_sleb128(const uint8_t* in, uint32_t in_len, uint32_t* pos, int64_t* out)
+{
+    uint64_t result = 0;
+    uint32_t shift  = 0;
+    uint8_t  byte;
+    do
+    {
+        if (*pos >= in_len || shift >= 64)
+        {
+            return false;
+        }
+        byte = in[(*pos)++];
+        result |= (uint64_t) (byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    if (shift < 64 && (byte & 0x40))
+    {
+        result |= ~(uint64_t) 0 << shift;
+    }
+    *out = (int64_t) result;
+    return true;
+}
+
+uint32_t bytecode_fixed_size(uint8_t opcode)
+{
+    return opcode == OP_MOVQ ? EXTENDED_INSTRUCTION_SIZE : INSTRUCTION_SIZE;
+}
+
+/*
+ *   Encodes one fixed-form instruction (8 bytes, 16 for MOVQ) into its compact form.
+ * */
+int8_t bytecode_compact_encode(const uint8_t* fixed, uint8_t* out, uint32_t* out_len)
+{
+    const uint8_t     opcode = fixed[OPCODE_INDEX];
+    const OpcodeInfo* info   = &opcode_info[opcode];
+    if (info->name == NULL)
+    {
+        LOG_ERROR("Cannot encode unknown opcode 0x%X\n", opcode);
+        return VM_ERR_OPCODE_NOT_FOUND;
+    }
+
+    uint32_t length = 0;
+    out[length++]   = opcode;
+    if (info->operand_count == 0)
+    {
+        *out_len = length;
+        return VM_EXIT_SUCCESS;
+    }
+
+    const uint8_t    metadata = fixed[METADATA_INDEX];
+    VMAddressingMode modes[2];
+    bool             needs_immediate = false;
+    operand_modes(metadata, info->operand_count, modes);
+
+    out[length++] = metadata;
+    for (int i = 0; i < info->operand_count; i++)
+    {
+        if (mode_has_register(modes[i]))
+        {
+            out[length++] = fixed[OPERAND_1_INDEX + i];
+        }
+        needs_immediate |= mode_has_immediate(modes[i]);
+    }
+
+    if (needs_immediate)
+    {
+        uint32_t low;
+        memcpy(&low, &fixed[IMMEDIATE_VALUE_START], sizeof(uint32_t));
+        int64_t value = (int32_t) low;
+        if (opcode == OP_MOVQ)
+        {
+            uint32_t high;
+            memcpy(&high, &fixed[INSTRUCTION_SIZE], sizeof(uint32_t));
+            value = (int64_t) (((uint64_t) high << 32) | low);
+        }
+        length += write_sleb128(&out[length], value);
+    }
+
+    *out_len = length;
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Expands a whole compact code stream into fixed-form instructions at out.
+ * */
+int8_t bytecode_compact_expand(const uint8_t* in, uint32_t in_len, uint8_t* out, uint32_t out_cap,
+                               uint32_t* out_len)
+{
+    uint32_t pos     = 0;
+    uint32_t written = 0;
+
+    while (pos < in_len)
+    {
+        const uint32_t    start  = pos;
+        const uint8_t     opcode = in[pos++];
+        const OpcodeInfo* info   = &opcode_info[opcode];
+        if (info->name == NULL)
+        {
+            LOG_ERROR("Unknown opcode 0x%X at compact offset %u\n", opcode, start);
+            return VM_ERR_OPCODE_NOT_FOUND;
+        }
+
+        const uint32_t size = bytecode_fixed_size(opcode);
+        if (size > out_cap - written)
+        {
+            LOG_ERROR("Expanded code does not fit in %u bytes\n", out_cap);
+            return VM_ERR_BYTECODE_TOO_LARGE;
+        }
+
+        uint8_t* slot = out + written;
+        memset(slot, 0, size);
+        slot[OPCODE_INDEX] = opcode;
+        written += size;
+        if (info->operand_count == 0)
+        {
+            continue;
+        }
+
+        if (pos >= in_len)
+        {
+            LOG_ERROR("Truncated instruction at compact offset %u\n", start);
+            return VM_ERR_INVALID_BYTECODE;
+        }
+        const uint8_t    metadata = in[pos++];
+        VMAddressingMode modes[2];
+        bool             needs_immediate = false;
+        operand_modes(metadata, info->operand_count, modes);
+
+        slot[METADATA_INDEX] = metadata;
+        for (int i = 0; i < info->operand_count; i++)
+        {
+            if (mode_has_register(modes[i]))
+            {
+                if (pos >= in_len)
+                {
+                    LOG_ERROR("Truncated instruction at compact offset %u\n", start);
+                    return VM_ERR_INVALID_BYTECODE;
+                }
+                slot[OPERAND_1_INDEX + i] = in[pos++];
+            }
+            needs_immediate |= mode_has_immediate(modes[i]);
+        }
+
+        if (needs_immediate)
+        {
+            int64_t value;
+            if (!read_sleb128(in, in_len, &pos, &value))
+            {
+                LOG_ERROR("Malformed immediate at compact offset %u\n", start);
+                return VM_ERR_INVALID_BYTECODE;
+            }
+            uint32_t low  = (uint32_t) value;
+            uint32_t high = (uint32_t) ((uint64_t) value >> 32);
+            memcpy(&slot[IMMEDIATE_VALUE_START], &low, sizeof(uint32_t));
+            if (opcode == OP_MOVQ)
+            {
+                memcpy(&slot[INSTRUCTION_SIZE], &high, sizeof(uint32_t));
+            }
+        }
+    }
+
+    *out_len = written;
+    return VM_EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+#include "constant_pool.h"
+#include "arena_allocator.h"
+#include "logger.h"
+#include "uthash.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_WORD_SIZE 8
+
+// Every suffix of a placed string, keyed by its bytes including the terminator
+typedef struct
+{
+    uint32_t       offset;
+    UT_hash_handle hh;
+} PoolSuffix;
+
+void constant_pool_init(ConstantPool* pool)
+{
+    pool->strings  = NULL;
+    pool->integers = NULL;
+    pool->size     = 0;
+}
+
+void constant_pool_add_string(MemoryArena* arena, ConstantPool* pool, const char* string)
+{
+    ConstantPoolEntry* entry = NULL;
+    const uint32_t     len   = (uint32_t) strlen(string);
+
+    HASH_FIND(hh, pool->strings, string, len + 1, entry);
+    if (entry != NULL)
+    {
+        return;
+    }
+
+    entry         = arena_alloc(arena, sizeof(ConstantPoolEntry));
+    entry->string = string;
+    entry->len    = len;
+    entry->offset = 0;
+    HASH_ADD_KEYPTR(hh, pool->strings, entry->string, len + 1, entry);
+}
+
+void constant_pool_add_integer(MemoryArena* arena, ConstantPool* pool, int64_t value)
+{
+    ConstantPoolEntry* entry = NULL;
+
+    HASH_FIND(hh, pool->integers, &value, sizeof(value), entry);
+    if (entry != NULL)
+    {
+        return;
+    }
+
+    entry          = arena_alloc(arena, sizeof(ConstantPoolEntry));
+    entry->string  = NULL;
+    entry->integer = value;
+    entry->offset  = 0;
+    HASH_ADD(hh, pool->integers, integer, sizeof(value), entry);
+}
+
+// Longest first, so a string is always placed before anything that could share its tail
+static int compare_by_length(const void* a, const void* b)
+{
+    const ConstantPoolEntry* x = *(const ConstantPoolEntry* const*) a;
+    const ConstantPoolEntry* y = *(const ConstantPoolEntry* const*) b;
+    if (x->len != y->len)
+    {
+        return x->len < y->len ? 1 : -1;
+    }
+    return strcmp(x->string, y->string);
+}
+
+static int8_t layout_strings(ConstantPool* pool, uint8_t* out, uint32_t capacity, uint32_t* size)
+{
+    const uint32_t count = HASH_COUNT(pool->strings);
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    size_t             suffix_capacity = 0;
+    ConstantPoolEntry* entry;
+    ConstantPoolEntry* tmp;
+    HASH_ITER(hh, pool->strings, entry, tmp)
+    {
+        suffix_capacity += entry->len + 1;
+    }
+
+    ConstantPoolEntry** sorted   = malloc(count * sizeof(ConstantPoolEntry*));
+    PoolSuffix*         suffixes = malloc(suffix_capacity * sizeof(PoolSuffix));
+    if (sorted == NULL || suffixes == NULL)
+    {
+        LOG_ERROR("Out of memory while laying out the constant pool\n");
+        free(sorted);
+        free(suffixes);
+        return -1;
+    }
+
+    uint32_t index = 0;
+    HASH_ITER(hh, pool->strings, entry, tmp)
+    {
+        sorted[index++] = entry;
+    }
+    qsort(sorted, count, sizeof(ConstantPoolEntry*), compare_by_length);
+
+    PoolSuffix* placed = NULL;
+    size_t      used   = 0;
+    int8_t      status = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ConstantPoolEntry* string = sorted[i];
+        PoolSuffix*        shared = NULL;
+
+        HASH_FIND(hh, placed, string->string, string->len + 1, shared);
+        if (shared != NULL)
+        {
+            string->offset = shared->offset;
+            continue;
+        }
+
+        if (string->len + 1 > capacity - *size)
+        {
+            LOG_ERROR("Constant pool does not fit in %u bytes\n", capacity);
+            status = -1;
+            break;
+        }
+        memcpy(out + *size, string->string, string->len + 1);
+        string->offset = *size;
+
+        for (uint32_t k = 0; k <= string->len; k++)
+        {
+            const char*    key     = string->string + k;
+            const uint32_t key_len = string->len + 1 - k;
+            HASH_FIND(hh, placed, key, key_len, shared);
+            if (shared == NULL)
+            {
+                PoolSuffix* suffix = &suffixes[used++];
+                suffix->offset     = *size + k;
+                HASH_ADD_KEYPTR(hh, placed, key, key_len, suffix);
+            }
+        }
+        *size += string->len + 1;
+    }
+
+    HASH_CLEAR(hh, placed);
+    free(suffixes);
+    free(sorted);
+    return status;
+}
+
+/*
+ *   Assigns every entry its offset and writes the pool to out. Call once, after the last add.
+ * */
+int8_t constant_pool_layout(ConstantPool* pool, uint8_t* out, uint32_t capacity)
+{
+    uint32_t           size = 0;
+    ConstantPoolEntry* entry;
+    ConstantPoolEntry* tmp;
+
+    HASH_ITER(hh, pool->integers, entry, tmp)
+    {
+        if (POOL_WORD_SIZE > capacity - size)
+        {
+            LOG_ERROR("Constant pool does not fit in %u bytes\n", capacity);
+            return -1;
+        }
+        entry->offset = size;
+        memcpy(out + size, &entry->integer, POOL_WORD_SIZE);
+        size += POOL_WORD_SIZE;
+    }
+
+    int8_t status = layout_strings(pool, out, capacity, &size);
+    pool->size    = size;
+    return status;
+}
+
+bool constant_pool_string_offset(ConstantPool* pool, const char* string, uint32_t* out)
+{
+    ConstantPoolEntry* entry = NULL;
+    HASH_FIND(hh, pool->strings, string, strlen(string) + 1, entry);
+    if (entry == NULL)
+    {
+        return false;
+    }
+    *out = entry->offset;
+    return true;
+}
+
+bool constant_pool_integer_offset(ConstantPool* pool, int64_t value, uint32_t* out)
+{
+    ConstantPoolEntry* entry = NULL;
+    HASH_FIND(hh, pool->integers, &value, sizeof(value), entry);
+    if (entry == NULL)
+    {
+        return false;
+    }
+    *out = entry->offset;
+    return true;
+}
+
+// Entries live in the arena; this only releases uthash's bucket arrays
+void constant_pool_clear(ConstantPool* pool)
+{
+    HASH_CLEAR(hh, pool->strings);
+    HASH_CLEAR(hh, pool->integers);
+}
@@ -1,51 +1,832 @@
+#define _POSIX_C_SOURCE 200809L
 #include "logger.h"
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_CACHE_LINE 64
+#define LOG_RING_SLOTS 256 // records per thread, a power of two
+#define LOG_RECORD_SIZE 256
+#define LOG_SPEC_MAX 32
+#define LOG_LINE_MAX 1024
+#define LOG_OUTPUT_SIZE (64 * 1024)
+#define LOG_IDLE_WAIT_NS 100000000L
 
 // Set your default level here. E.g., INFO shows errors, warnings, and general info.
 LogLevel g_compiler_log_level = LOG_LEVEL_DEBUG;
 
-void log_message(LogLevel level, const char* file, int line, const char* func, const char* fmt, ...)
+/*
+ *   A record is the call site and the raw arguments. The payload holds them in format order,
+ *   each in its widest type (int64_t, uint64_t, double, long double or a pointer), strings as
+ *   their bytes and a NUL. What does not fit is dropped: strings are cut short, and values read
+ *   back past payload_len come out as zero.
+ * */
+typedef struct
+{
+    uint64_t    time; // CLOCK_MONOTONIC, so the writer can put the rings back into one order
+    const char* file;
+    const char* func;
+    const char* fmt;
+    int32_t     line;
+    uint16_t    level;
+    uint16_t    payload_len;
+} LogHeader;
+
+#define LOG_PAYLOAD_SIZE (LOG_RECORD_SIZE - sizeof(LogHeader))
+
+typedef struct
+{
+    LogHeader header;
+    uint8_t   payload[LOG_PAYLOAD_SIZE];
+} LogRecord;
+
+/*
+ *   One per logging thread: a Lamport ring with the thread as the only producer and the writer
+ *   as the only consumer, the two indices on their own cache lines as in pipe.c. Rings are
+ *   pushed on the front of a list that only the writer unlinks from, once a ring's thread has
+ *   exited and the ring is empty.
+ * */
+typedef struct LogRing
+{
+    _Alignas(LOG_CACHE_LINE) _Atomic uint64_t tail;
+    _Alignas(LOG_CACHE_LINE) _Atomic uint64_t head;
+    _Alignas(LOG_CACHE_LINE) _Atomic bool orphaned;
+    struct LogRing* _Atomic next;
+    LogRecord               slots[LOG_RING_SLOTS];
+} LogRing;
+
+typedef enum
+{
+    LOG_ARG_NONE,
+    LOG_ARG_SIGNED,
+    LOG_ARG_UNSIGNED,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_LONG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER,
+    LOG_ARG_COUNT, // %n: takes a pointer, prints nothing
+} LogArgKind;
+
+typedef struct
+{
+    char       conversion; // 'd', 's', '%', ...; 0 when the specification is malformed
+    char       length[3];  // "", "hh", "h", "l", "ll", "j", "z", "t" or "L"
+    uint8_t    stars;      // '*' widths and precisions, each an int before the value
+    LogArgKind kind;
+    size_t     len; // of the whole specification, '%' included
+} FormatSpec;
+
+static pthread_once_t         log_once    = PTHREAD_ONCE_INIT;
+static pthread_mutex_t        log_lock    = PTHREAD_MUTEX_INITIALIZER; // sleep, flush, shutdown
+static pthread_cond_t         log_wake    = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t         log_flushed = PTHREAD_COND_INITIALIZER;
+static pthread_key_t          log_ring_key;
+static pthread_t              log_writer_thread;
+static LogRing* _Atomic       log_rings;
+static _Atomic bool           log_running; // false: log_message formats and writes synchronously
+static _Atomic bool           log_sleeping;
+static _Atomic(FILE*)         log_sink;
+static bool                   log_stopping;
+static uint64_t               log_flush_requested;
+static uint64_t               log_flush_done;
+static _Thread_local LogRing* log_thread_ring;
+
+// =================================================================
+// Format specifications
+// =================================================================
+
+/*
+ *   Parses the specification starting at the '%' in text. Handles flags, '*' or digit width and
+ *   precision, the C99 length modifiers and every conversion printf knows.
+ * */
+static void parse_spec(const char* text, FormatSpec* spec)
 {
-    if (level > g_compiler_log_level)
+    const char* cursor = text + 1;
+    memset(spec, 0, sizeof(FormatSpec));
+    while (*cursor != '\0' && strchr("-+ #0'", *cursor) != NULL)
     {
-        return;
+        cursor++;
+    }
+    for (int field = 0; field < 2; field++) // width, then precision
+    {
+        if (field == 1 && *cursor != '.')
+        {
+            break;
+        }
+        cursor += field;
+        if (*cursor == '*')
+        {
+            spec->stars++;
+            cursor++;
+        }
+        while (*cursor >= '0' && *cursor <= '9')
+        {
+            cursor++;
+        }
+    }
+    size_t length = 0;
+    while (length < 2 && *cursor != '\0' && strchr("hljztL", *cursor) != NULL)
+    {
+        spec->length[length++] = *cursor++;
     }
 
-    // Determine the level string
-    const char* level_str;
-    switch (level)
+    spec->conversion = *cursor;
+    switch (*cursor)
     {
-    case LOG_LEVEL_ERROR:
-        level_str = "ERROR";
+    case 'd':
+    case 'i':
+    case 'c':
+        spec->kind = LOG_ARG_SIGNED;
         break;
-    case LOG_LEVEL_WARN:
-        level_str = "WARN ";
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        spec->kind = LOG_ARG_UNSIGNED;
         break;
-    case LOG_LEVEL_INFO:
-        level_str = "INFO ";
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->kind = spec->length[0] == 'L' ? LOG_ARG_LONG_DOUBLE : LOG_ARG_DOUBLE;
         break;
-    case LOG_LEVEL_DEBUG:
-        level_str = "DEBUG";
+    case 's':
+        spec->kind = LOG_ARG_STRING;
         break;
-    case LOG_LEVEL_TRACE:
-        level_str = "TRACE";
+    case 'p':
+        spec->kind = LOG_ARG_POINTER;
         break;
-    case LOG_LEVEL_NONE:
+    case 'n':
+        spec->kind = LOG_ARG_COUNT;
+        break;
+    case '%':
+        spec->kind = LOG_ARG_NONE;
+        break;
+    default:
+        spec->conversion = 0;
         return;
+    }
+    spec->len = (size_t) (cursor + 1 - text);
+}
+
+// =================================================================
+// Capturing arguments
+// =================================================================
+
+static void payload_put(LogRecord* record, const void* value, size_t size)
+{
+    if (record->header.payload_len + size <= LOG_PAYLOAD_SIZE)
+    {
+        memcpy(record->payload + record->header.payload_len, value, size);
+        record->header.payload_len += (uint16_t) size;
+    }
+    else
+    {
+        record->header.payload_len = LOG_PAYLOAD_SIZE; // later values read as zero
+    }
+}
+
+static void payload_put_string(LogRecord* record, const char* text)
+{
+    size_t room = LOG_PAYLOAD_SIZE - record->header.payload_len;
+    if (room == 0)
+    {
+        return;
+    }
+    text        = text != NULL ? text : "(null)";
+    size_t len  = strnlen(text, room - 1);
+    uint8_t* to = record->payload + record->header.payload_len;
+    memcpy(to, text, len);
+    to[len] = '\0';
+    record->header.payload_len += (uint16_t) (len + 1);
+}
+
+static int64_t take_signed(const char* length, va_list* args)
+{
+    switch (length[0])
+    {
+    case 'l':
+        return length[1] == 'l' ? va_arg(*args, long long) : va_arg(*args, long);
+    case 'j':
+        return va_arg(*args, intmax_t);
+    case 'z':
+        return (int64_t) va_arg(*args, size_t);
+    case 't':
+        return va_arg(*args, ptrdiff_t);
+    default:
+        return va_arg(*args, int); // char and short arrive promoted
+    }
+}
+
+static uint64_t take_unsigned(const char* length, va_list* args)
+{
+    switch (length[0])
+    {
+    case 'l':
+        return length[1] == 'l' ? va_arg(*args, unsigned long long) : va_arg(*args, unsigned long);
+    case 'j':
+        return va_arg(*args, uintmax_t);
+    case 'z':
+        return va_arg(*args, size_t);
+    case 't':
+        return (uint64_t) va_arg(*args, ptrdiff_t);
+    default:
+        return va_arg(*args, unsigned int);
+    }
+}
+
+static void capture(LogRecord* record, const char* fmt, va_list* args)
+{
+    for (const char* text = strchr(fmt, '%'); text != NULL; text = strchr(text, '%'))
+    {
+        FormatSpec spec;
+        parse_spec(text, &spec);
+        if (spec.conversion == 0)
+        {
+            return; // printed as it stands; nothing after it can be trusted
+        }
+        text += spec.len;
+        for (uint8_t i = 0; i < spec.stars; i++)
+        {
+            int64_t star = va_arg(*args, int);
+            payload_put(record, &star, sizeof(star));
+        }
+
+        switch (spec.kind)
+        {
+        case LOG_ARG_SIGNED:
+        {
+            int64_t value = take_signed(spec.length, args);
+            payload_put(record, &value, sizeof(value));
+            break;
+        }
+        case LOG_ARG_UNSIGNED:
+        {
+            uint64_t value = take_unsigned(spec.length, args);
+            payload_put(record, &value, sizeof(value));
+            break;
+        }
+        case LOG_ARG_DOUBLE:
+        {
+            double value = va_arg(*args, double);
+            payload_put(record, &value, sizeof(value));
+            break;
+        }
+        case LOG_ARG_LONG_DOUBLE:
+        {
+            long double value = va_arg(*args, long double);
+            payload_put(record, &value, sizeof(value));
+            break;
+        }
+        case LOG_ARG_STRING:
+            payload_put_string(record, va_arg(*args, const char*));
+            break;
+        case LOG_ARG_POINTER:
+        {
+            const void* value = va_arg(*args, const void*);
+            payload_put(record, &value, sizeof(value));
+            break;
+        }
+        case LOG_ARG_COUNT:
+            (void) va_arg(*args, void*);
+            break;
+        case LOG_ARG_NONE:
+            break;
+        }
+    }
+}
+
+// =================================================================
+// Formatting records
+// =================================================================
+
+typedef struct
+{
+    const LogRecord* record;
+    size_t           offset;
+} PayloadReader;
+
+static void payload_get(PayloadReader* reader, void* value, size_t size)
+{
+    if (reader->offset + size <= reader->record->header.payload_len)
+    {
+        memcpy(value, reader->record->payload + reader->offset, size);
+        reader->offset += size;
+    }
+    else
+    {
+        memset(value, 0, size);
+        reader->offset = reader->record->header.payload_len;
+    }
+}
+
+static const char* payload_get_string(PayloadReader* reader)
+{
+    if (reader->offset >= reader->record->header.payload_len)
+    {
+        return "";
+    }
+    const char* text = (const char*) reader->record->payload + reader->offset;
+    reader->offset += strlen(text) + 1;
+    return text;
+}
+
+typedef struct
+{
+    char*  text;
+    size_t len;
+    size_t cap;
+} LineBuffer;
+
+static void line_append(LineBuffer* line, const char* text, size_t len)
+{
+    size_t room = line->cap - 1 - line->len;
+    len         = len < room ? len : room;
+    memcpy(line->text + line->len, text, len);
+    line->len += len;
+    line->text[line->len] = '\0';
+}
+
+static void line_advance(LineBuffer* line, int written)
+{
+    if (written > 0)
+    {
+        size_t room = line->cap - 1 - line->len;
+        line->len += (size_t) written < room ? (size_t) written : room;
+    }
+}
+
+// snprintf of one value behind the specification's '*' arguments, if any
+#define LOG_PRINT_ONE(line, spec, format, stars, value)                                            \
+    line_advance(line, (spec)->stars == 0                                                          \
+                           ? snprintf((line)->text + (line)->len, (line)->cap - (line)->len,       \
+                                      format, value)                                               \
+                       : (spec)->stars == 1                                                        \
+                           ? snprintf((line)->text + (line)->len, (line)->cap - (line)->len,       \
+                                      format, stars[0], value)                                     \
+                           : snprintf((line)->text + (line)->len, (line)->cap - (line)->len,       \
+                                      format, stars[0], stars[1], value))
+
+static void print_signed(LineBuffer* line, const FormatSpec* spec, const char* text,
+                         const int* stars, int64_t value)
+{
+    switch (spec->length[0])
+    {
+    case 'l':
+        if (spec->length[1] == 'l')
+        {
+            LOG_PRINT_ONE(line, spec, text, stars, (long long) value);
+        }
+        else
+        {
+            LOG_PRINT_ONE(line, spec, text, stars, (long) value);
+        }
+        break;
+    case 'j':
+        LOG_PRINT_ONE(line, spec, text, stars, (intmax_t) value);
+        break;
+    case 'z':
+        LOG_PRINT_ONE(line, spec, text, stars, (size_t) value);
+        break;
+    case 't':
+        LOG_PRINT_ONE(line, spec, text, stars, (ptrdiff_t) value);
+        break;
     default:
+        LOG_PRINT_ONE(line, spec, text, stars, (int) value);
+        break;
+    }
+}
+
+static void print_unsigned(LineBuffer* line, const FormatSpec* spec, const char* text,
+                           const int* stars, uint64_t value)
+{
+    switch (spec->length[0])
+    {
+    case 'l':
+        if (spec->length[1] == 'l')
+        {
+            LOG_PRINT_ONE(line, spec, text, stars, (unsigned long long) value);
+        }
+        else
+        {
+            LOG_PRINT_ONE(line, spec, text, stars, (unsigned long) value);
+        }
+        break;
+    case 'j':
+        LOG_PRINT_ONE(line, spec, text, stars, (uintmax_t) value);
+        break;
+    case 'z':
+        LOG_PRINT_ONE(line, spec, text, stars, (size_t) value);
+        break;
+    case 't':
+        LOG_PRINT_ONE(line, spec, text, stars, (ptrdiff_t) value);
+        break;
+    default:
+        LOG_PRINT_ONE(line, spec, text, stars, (unsigned int) value);
+        break;
+    }
+}
+
+static void print_message(LineBuffer* line, const LogRecord* record)
+{
+    PayloadReader reader = {record, 0};
+    const char*   text   = record->header.fmt;
+    for (const char* percent = strchr(text, '%'); percent != NULL; percent = strchr(text, '%'))
+    {
+        FormatSpec spec;
+        parse_spec(percent, &spec);
+        line_append(line, text, (size_t) (percent - text));
+        if (spec.conversion == 0 || spec.len >= LOG_SPEC_MAX)
+        {
+            text = percent; // printed as it stands
+            break;
+        }
+        text = percent + spec.len;
+
+        char spec_text[LOG_SPEC_MAX];
+        memcpy(spec_text, percent, spec.len);
+        spec_text[spec.len] = '\0';
+        int stars[2]        = {0, 0};
+        for (uint8_t i = 0; i < spec.stars; i++)
+        {
+            int64_t star;
+            payload_get(&reader, &star, sizeof(star));
+            stars[i] = (int) star;
+        }
+
+        switch (spec.kind)
+        {
+        case LOG_ARG_SIGNED:
+        {
+            int64_t value;
+            payload_get(&reader, &value, sizeof(value));
+            print_signed(line, &spec, spec_text, stars, value);
+            break;
+        }
+        case LOG_ARG_UNSIGNED:
+        {
+            uint64_t value;
+            payload_get(&reader, &value, sizeof(value));
+            print_unsigned(line, &spec, spec_text, stars, value);
+            break;
+        }
+        case LOG_ARG_DOUBLE:
+        {
+            double value;
+            payload_get(&reader, &value, sizeof(value));
+            LOG_PRINT_ONE(line, &spec, spec_text, stars, value);
+            break;
+        }
+        case LOG_ARG_LONG_DOUBLE:
+        {
+            long double value;
+            payload_get(&reader, &value, sizeof(value));
+            LOG_PRINT_ONE(line, &spec, spec_text, stars, value);
+            break;
+        }
+        case LOG_ARG_STRING:
+            LOG_PRINT_ONE(line, &spec, spec_text, stars, payload_get_string(&reader));
+            break;
+        case LOG_ARG_POINTER:
+        {
+            const void* value;
+            payload_get(&reader, &value, sizeof(value));
+            LOG_PRINT_ONE(line, &spec, spec_text, stars, value);
+            break;
+        }
+        case LOG_ARG_NONE:
+            line_append(line, "%", 1);
+            break;
+        case LOG_ARG_COUNT:
+            break;
+        }
+    }
+    line_append(line, text, strlen(text));
+}
+
+/*
+ *   The line log_message has always printed: "[LEVEL] file:line func() - message\n".
+ * */
+static size_t format_record(const LogRecord* record, char* out, size_t cap)
+{
+    static const char* const level_names[] = {
+        [LOG_LEVEL_ERROR] = "ERROR", [LOG_LEVEL_WARN] = "WARN ",  [LOG_LEVEL_INFO] = "INFO ",
+        [LOG_LEVEL_DEBUG] = "DEBUG", [LOG_LEVEL_TRACE] = "TRACE",
+    };
+    LineBuffer line = {out, 0, cap};
+    out[0]          = '\0';
+    line_advance(&line, snprintf(out, cap, "[%s] %s:%d %s() - ", level_names[record->header.level],
+                                 record->header.file, record->header.line, record->header.func));
+    print_message(&line, record);
+    line_append(&line, "\n", 1);
+    return line.len;
+}
+
+static FILE* current_sink(void)
+{
+    FILE* sink = atomic_load_explicit(&log_sink, memory_order_acquire);
+    return sink != NULL ? sink : stderr;
+}
+
+// =================================================================
+// The writer thread
+// =================================================================
+
+static bool ring_empty(LogRing* ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_relaxed) ==
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+/*
+ *   The writer's check before it sleeps. The tail load is seq_cst, like the tail store and the
+ *   log_sleeping load in log_message: with acquire here, the writer could miss a record
+ *   published just after it set log_sleeping while the logger missed log_sleeping.
+ * */
+static bool any_queued(void)
+{
+    for (LogRing* ring = atomic_load(&log_rings); ring != NULL; ring = atomic_load(&ring->next))
+    {
+        if (atomic_load_explicit(&ring->head, memory_order_relaxed) != atomic_load(&ring->tail))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ *   Writes out every queued record, oldest first across all rings, in as few writes as the
+ *   output buffer allows. Returns whether there was anything.
+ * */
+static bool drain(char* output)
+{
+    size_t used  = 0;
+    bool   wrote = false;
+    for (;;)
+    {
+        LogRing* oldest = NULL;
+        uint64_t time   = UINT64_MAX;
+        for (LogRing* ring = atomic_load(&log_rings); ring != NULL;
+             ring          = atomic_load(&ring->next))
+        {
+            uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            if (head != atomic_load_explicit(&ring->tail, memory_order_acquire) &&
+                ring->slots[head & (LOG_RING_SLOTS - 1)].header.time < time)
+            {
+                oldest = ring;
+                time   = ring->slots[head & (LOG_RING_SLOTS - 1)].header.time;
+            }
+        }
+        if (oldest == NULL)
+        {
+            break;
+        }
+        if (LOG_OUTPUT_SIZE - used < LOG_LINE_MAX)
+        {
+            fwrite(output, 1, used, current_sink());
+            used = 0;
+        }
+        uint64_t head = atomic_load_explicit(&oldest->head, memory_order_relaxed);
+        used += format_record(&oldest->slots[head & (LOG_RING_SLOTS - 1)], output + used,
+                              LOG_LINE_MAX);
+        atomic_store_explicit(&oldest->head, head + 1, memory_order_release);
+        wrote = true;
+    }
+    if (used > 0)
+    {
+        fwrite(output, 1, used, current_sink());
+    }
+    if (wrote)
+    {
+        fflush(current_sink());
+    }
+    return wrote;
+}
+
+// Frees the rings of threads that have exited once the writer has emptied them
+static void reap_rings(void)
+{
+    pthread_mutex_lock(&log_lock);
+    LogRing* _Atomic* link = &log_rings;
+    for (LogRing* ring = atomic_load(link); ring != NULL; ring = atomic_load(link))
+    {
+        if (atomic_load(&ring->orphaned) && ring_empty(ring))
+        {
+            atomic_store(link, atomic_load(&ring->next));
+            free(ring);
+        }
+        else
+        {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&log_lock);
+}
+
+static void* log_writer(void* arg)
+{
+    (void) arg;
+    char* output = malloc(LOG_OUTPUT_SIZE);
+    if (output == NULL)
+    {
+        return NULL;
+    }
+    for (;;)
+    {
+        pthread_mutex_lock(&log_lock);
+        uint64_t flush = log_flush_requested;
+        bool     stop  = log_stopping;
+        pthread_mutex_unlock(&log_lock);
+
+        bool wrote = drain(output);
+        reap_rings();
+
+        pthread_mutex_lock(&log_lock);
+        log_flush_done = flush;
+        pthread_cond_broadcast(&log_flushed);
+        if (stop && !wrote)
+        {
+            pthread_mutex_unlock(&log_lock);
+            break;
+        }
+        if (!wrote && !log_stopping && log_flush_requested == flush)
+        {
+            // Loggers check log_sleeping after publishing, so one of us sees the other
+            atomic_store(&log_sleeping, true);
+            if (!any_queued())
+            {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += LOG_IDLE_WAIT_NS;
+                deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+                deadline.tv_nsec %= 1000000000L;
+                pthread_cond_timedwait(&log_wake, &log_lock, &deadline);
+            }
+            atomic_store(&log_sleeping, false);
+        }
+        pthread_mutex_unlock(&log_lock);
+    }
+    free(output);
+    return NULL;
+}
+
+static void wake_writer(void)
+{
+    pthread_mutex_lock(&log_lock);
+    pthread_cond_signal(&log_wake);
+    pthread_mutex_unlock(&log_lock);
+}
+
+// Runs at exit: writes whatever is still queued, then logging goes synchronous
+static void log_shutdown(void)
+{
+    if (!atomic_load(&log_running))
+    {
         return;
     }
+    pthread_mutex_lock(&log_lock);
+    log_stopping = true;
+    pthread_cond_signal(&log_wake);
+    pthread_mutex_unlock(&log_lock);
+    pthread_join(log_writer_thread, NULL);
+    atomic_store(&log_running, false);
+}
+
+static void orphan_ring(void* ring)
+{
+    atomic_store(&((LogRing*) ring)->orphaned, true);
+}
+
+static void log_init(void)
+{
+    if (pthread_key_create(&log_ring_key, orphan_ring) != 0)
+    {
+        return;
+    }
+    if (pthread_create(&log_writer_thread, NULL, log_writer, NULL) == 0)
+    {
+        atomic_store(&log_running, true);
+        atexit(log_shutdown);
+    }
+}
+
+// =================================================================
+// Logging
+// =================================================================
 
-    // Print Context to stderr (Standard Error)
-    fprintf(stderr, "[%s] %s:%d %s() - ", level_str, file, line, func);
+static LogRing* thread_ring(void)
+{
+    if (log_thread_ring != NULL)
+    {
+        return log_thread_ring;
+    }
+    LogRing* ring = aligned_alloc(LOG_CACHE_LINE, sizeof(LogRing));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->orphaned, false);
+    pthread_setspecific(log_ring_key, ring);
+
+    pthread_mutex_lock(&log_lock);
+    atomic_init(&ring->next, atomic_load(&log_rings));
+    atomic_store(&log_rings, ring);
+    pthread_mutex_unlock(&log_lock);
+    log_thread_ring = ring;
+    return ring;
+}
+
+static void fill_record(LogRecord* record, LogLevel level, const char* file, int line,
+                        const char* func, const char* fmt, va_list* args)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    record->header.time        = (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+    record->header.file        = file;
+    record->header.func        = func;
+    record->header.fmt         = fmt;
+    record->header.line        = line;
+    record->header.level       = (uint16_t) level;
+    record->header.payload_len = 0;
+    capture(record, fmt, args);
+}
+
+void log_message(LogLevel level, const char* file, int line, const char* func, const char* fmt, ...)
+{
+    if (level > g_compiler_log_level || level < LOG_LEVEL_ERROR || level >= LOG_LEVEL_NONE)
+    {
+        return;
+    }
+    pthread_once(&log_once, log_init);
 
-    // Print the actual log message using vfprintf
     va_list args;
     va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
+    LogRing* ring = atomic_load_explicit(&log_running, memory_order_relaxed) ? thread_ring() : NULL;
+    if (ring == NULL)
+    {
+        // No writer thread (it could not start, or the process is exiting): write it here
+        LogRecord record;
+        char      text[LOG_LINE_MAX];
+        fill_record(&record, level, file, line, func, fmt, &args);
+        fwrite(text, 1, format_record(&record, text, sizeof(text)), current_sink());
+        va_end(args);
+        return;
+    }
+
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= LOG_RING_SLOTS)
+    {
+        wake_writer(); // full: only now does logging wait on anyone
+        sched_yield();
+    }
+    fill_record(&ring->slots[tail & (LOG_RING_SLOTS - 1)], level, file, line, func, fmt, &args);
     va_end(args);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_seq_cst);
+    if (level == LOG_LEVEL_ERROR)
+    {
+        // Often the last thing a failing process says: it must not sit in the ring at a crash
+        log_flush();
+    }
+    else if (atomic_load(&log_sleeping))
+    {
+        wake_writer();
+    }
+}
+
+void log_flush(void)
+{
+    if (!atomic_load(&log_running))
+    {
+        fflush(current_sink());
+        return;
+    }
+    pthread_mutex_lock(&log_lock);
+    uint64_t ticket = ++log_flush_requested;
+    pthread_cond_signal(&log_wake);
+    while (log_flush_done < ticket && !log_stopping)
+    {
+        pthread_cond_wait(&log_flushed, &log_lock);
+    }
+    pthread_mutex_unlock(&log_lock);
+}
 
-    fprintf(stderr, "\n");
+void log_set_sink(FILE* sink)
+{
+    log_flush();
+    atomic_store_explicit(&log_sink, sink, memory_order_release);
 }
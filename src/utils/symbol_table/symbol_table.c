@@ -30,9 +30,17 @@ bool symbol_table_add(MemoryArena* arena, SymbolTable** symbol_table, const char
     return true;
 }
 
-uint32_t symbol_table_get(SymbolTable* symbol_table, const char* symbol)
+bool symbol_table_lookup(SymbolTable* symbol_table, const char* symbol, uint32_t* out)
 {
     SymbolTable* st = NULL;
     HASH_FIND_STR(symbol_table, symbol, st);
-    return st->address;
+    if (st == NULL)
+    {
+        return false;
+    }
+    *out = st->address;
+    return true;
 }
+
+// Entries live in the arena; this only releases uthash's bucket array
+void symbol_table_clear(SymbolTable** symbol_table) { HASH_CLEAR(hh, *symbol_table); }
@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm_batch.h"
+#include "logger.h"
+#include "vm.h"
+#include "vm_image.h"
+#include "vm_utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BATCH_CHUNK 64
+#define BATCH_MAX_THREADS 256
+#define BATCH_MAX_KEEP (64 * 1024)
+
+typedef struct
+{
+    VMImage*             image;
+    const VMBatchLayout* layout;
+    const uint8_t*       inputs;
+    uint8_t*             outputs;
+    VMRunResult*         results;
+    uint32_t             count;
+    uint32_t             keep_at; // pages vm_image_reset copies back rather than drops
+    uint32_t             keep_len;
+    _Atomic uint32_t     next; // first record nobody has taken yet
+    _Atomic uint32_t     done;
+} BatchJob;
+
+static VMRunResult run_record(VMContext* ctx, const BatchJob* job, uint32_t record)
+{
+    const VMBatchLayout* layout = job->layout;
+    memcpy(ctx->memory + layout->input_at, job->inputs + (size_t) record * layout->input_size,
+           layout->input_size);
+    return vm_step_n(ctx, layout->fuel ? layout->fuel : UINT64_MAX);
+}
+
+// Only a record that halted has an output; the others, including any whose reset failed, get zeros
+static void store_output(const VMContext* ctx, const BatchJob* job, uint32_t record,
+                         VMRunResult result)
+{
+    const VMBatchLayout* layout = job->layout;
+    uint8_t*             output = job->outputs + (size_t) record * layout->output_size;
+    if (result == VM_RUN_HALTED)
+    {
+        memcpy(output, ctx->memory + layout->output_at, layout->output_size);
+    }
+    else
+    {
+        memset(output, 0, layout->output_size);
+    }
+}
+
+static void* batch_worker(void* arg)
+{
+    BatchJob*  job = arg;
+    VMContext* ctx = vm_create_from_image(job->image);
+    if (ctx == NULL)
+    {
+        return NULL; // the other threads take its share
+    }
+    bool fresh = true;
+    for (;;)
+    {
+        uint32_t first = atomic_fetch_add_explicit(&job->next, BATCH_CHUNK, memory_order_relaxed);
+        if (first >= job->count)
+        {
+            break;
+        }
+        uint32_t last = job->count - first > BATCH_CHUNK ? first + BATCH_CHUNK : job->count;
+        for (uint32_t record = first; record < last; record++)
+        {
+            VMRunResult result = VM_RUN_ERROR;
+            if (fresh || vm_image_reset(ctx, job->keep_at, job->keep_len) == VM_EXIT_SUCCESS)
+            {
+                result = run_record(ctx, job, record);
+            }
+            store_output(ctx, job, record, result);
+            if (job->results != NULL)
+            {
+                job->results[record] = result;
+            }
+            fresh = false;
+        }
+        atomic_fetch_add_explicit(&job->done, last - first, memory_order_relaxed);
+    }
+    vm_destroy(ctx);
+    return NULL;
+}
+
+/*
+ *   Runs image once per record: inputs holds count records of layout->input_size bytes, outputs
+ *   receives count records of layout->output_size bytes. A record that does not halt (error,
+ *   fuel spent) gets a zeroed output, and its VMRunResult in results when results is not NULL.
+ *   Returns VM_EXIT_SUCCESS once every record has run, whatever each one's outcome.
+ * */
+int8_t vm_run_batch(VMImage* image, const VMBatchLayout* layout, const void* inputs,
+                    void* outputs, uint32_t count, VMRunResult* results)
+{
+    int8_t status = vm_check_range(layout->input_at, layout->input_size, true);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        status = vm_check_range(layout->output_at, layout->output_size, false);
+    }
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    uint32_t threads = layout->threads;
+    if (threads == 0)
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads     = online > 1 ? (uint32_t) online : 1;
+    }
+    uint32_t chunks = count / BATCH_CHUNK + 1;
+    threads         = threads > chunks ? chunks : threads;
+    threads         = threads > BATCH_MAX_THREADS ? BATCH_MAX_THREADS : threads;
+
+    BatchJob job = {
+        .image   = image,
+        .layout  = layout,
+        .inputs  = inputs,
+        .outputs = outputs,
+        .results = results,
+        .count   = count,
+    };
+    // Every record rewrites its input and reads its output, so their pages are worth keeping
+    // mapped; both when they sit close together, else just the input's
+    uint64_t input_end  = (uint64_t) layout->input_at + layout->input_size;
+    uint64_t output_end = (uint64_t) layout->output_at + layout->output_size;
+    uint32_t keep_at    = layout->input_at;
+    uint64_t keep_end   = input_end > output_end ? input_end : output_end;
+    keep_at             = layout->output_at < keep_at ? layout->output_at : keep_at;
+    if (keep_end - keep_at > BATCH_MAX_KEEP)
+    {
+        keep_at  = layout->input_at;
+        keep_end = input_end;
+    }
+    job.keep_at  = keep_at;
+    job.keep_len = (uint32_t) (keep_end - keep_at);
+    atomic_init(&job.next, 0);
+    atomic_init(&job.done, 0);
+
+    // The calling thread works as thread 0
+    pthread_t helpers[BATCH_MAX_THREADS];
+    bool      started[BATCH_MAX_THREADS] = {false};
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        started[i] = pthread_create(&helpers[i], NULL, batch_worker, &job) == 0;
+        if (!started[i])
+        {
+            LOG_WARN("Unable to start batch thread %u\n", i);
+        }
+    }
+    batch_worker(&job);
+    for (uint32_t i = 1; i < threads; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(helpers[i], NULL);
+        }
+    }
+
+    if (atomic_load_explicit(&job.done, memory_order_relaxed) < count)
+    {
+        LOG_ERROR("Unable to create an instance to run the batch on\n");
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+    return VM_EXIT_SUCCESS;
+}
@@ -0,0 +1,457 @@
+#include "vm_cfg.h"
+#include "bytecode.h"
+#include "instruction_format_table.h"
+#include "logger.h"
+#include "vm.h"
+#include "vm_verifier.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool ends_block(uint8_t opcode)
+{
+    return opcode_info[opcode].operands[0] == OT_SYMBOL || opcode == OP_RET || opcode == OP_HALT;
+}
+
+// Code offset of the branch target, or false when it is dynamic or not an instruction start
+static bool block_target(const uint8_t* code, uint32_t pc, const uint8_t* starts, uint32_t code_len,
+                         uint32_t* out)
+{
+    uint32_t target;
+    if (!vm_static_branch_target(code + pc, pc, &target) || target >= code_len ||
+        target % INSTRUCTION_SIZE != 0 || !starts[target / INSTRUCTION_SIZE])
+    {
+        return false;
+    }
+    *out = target;
+    return true;
+}
+
+static void add_successor(CfgBlock* block, uint32_t successor)
+{
+    if (block->successor_count == 1 && block->successors[0] == successor)
+    {
+        return;
+    }
+    block->successors[block->successor_count++] = successor;
+}
+
+static void link_block(ControlFlowGraph* cfg, CfgBlock* block, const uint8_t* code,
+                       const uint8_t* starts, uint32_t last)
+{
+    const uint8_t opcode = code[last];
+    uint32_t      target;
+    switch (opcode)
+    {
+    case OP_RET:
+        block->flags |= CFG_BLOCK_RETURN;
+        return;
+    case OP_HALT:
+        block->flags |= CFG_BLOCK_HALT;
+        return;
+    case OP_CALL:
+        block->flags |= CFG_BLOCK_CALL;
+        break;
+    default:
+        break;
+    }
+
+    if (opcode_info[opcode].operands[0] == OT_SYMBOL)
+    {
+        if (block_target(code, last, starts, cfg->code_len, &target))
+        {
+            add_successor(block, cfg->block_at[target / INSTRUCTION_SIZE]);
+        }
+        else
+        {
+            block->flags |= CFG_BLOCK_INDIRECT;
+        }
+    }
+    if (opcode != OP_JMP && block->end < cfg->code_len)
+    {
+        add_successor(block, cfg->block_at[block->end / INSTRUCTION_SIZE]);
+    }
+}
+
+/*
+ *   Walks the code once, marking instruction starts and block leaders. Fails if an instruction
+ *   runs past the end or the entry point is not an instruction.
+ * */
+static int8_t find_leaders(const uint8_t* code, uint32_t code_len, uint32_t entry_point,
+                           uint8_t* starts, uint8_t* leaders)
+{
+    for (uint32_t pc = 0; pc < code_len; pc += bytecode_fixed_size(code[pc]))
+    {
+        const uint32_t size = bytecode_fixed_size(code[pc]);
+        if (size > code_len - pc)
+        {
+            LOG_ERROR("Instruction at 0x%X runs past the end of the code\n", CODE_START + pc);
+            return VM_ERR_INVALID_BYTECODE;
+        }
+        starts[pc / INSTRUCTION_SIZE] = 1;
+        if (ends_block(code[pc]) && pc + size < code_len)
+        {
+            leaders[(pc + size) / INSTRUCTION_SIZE] = 1;
+        }
+    }
+
+    for (uint32_t pc = 0; pc < code_len; pc += bytecode_fixed_size(code[pc]))
+    {
+        uint32_t target;
+        if (opcode_info[code[pc]].operands[0] == OT_SYMBOL &&
+            block_target(code, pc, starts, code_len, &target))
+        {
+            leaders[target / INSTRUCTION_SIZE] = 1;
+        }
+    }
+
+    if (entry_point % INSTRUCTION_SIZE != 0 || !starts[entry_point / INSTRUCTION_SIZE])
+    {
+        LOG_ERROR("Entry point 0x%X is not an instruction\n", CODE_START + entry_point);
+        return VM_ERR_INVALID_BYTECODE;
+    }
+    leaders[0]                              = 1;
+    leaders[entry_point / INSTRUCTION_SIZE] = 1;
+    return VM_EXIT_SUCCESS;
+}
+
+static int8_t build_blocks(ControlFlowGraph* cfg, const uint8_t* code, const uint8_t* starts,
+                           const uint8_t* leaders)
+{
+    const uint32_t slots = cfg->code_len / INSTRUCTION_SIZE;
+    for (uint32_t i = 0; i < slots; i++)
+    {
+        cfg->block_count += leaders[i];
+    }
+
+    cfg->blocks = calloc(cfg->block_count, sizeof(CfgBlock));
+    if (cfg->blocks == NULL)
+    {
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    uint32_t index = CFG_NO_BLOCK;
+    for (uint32_t pc = 0; pc < cfg->code_len; pc += bytecode_fixed_size(code[pc]))
+    {
+        if (leaders[pc / INSTRUCTION_SIZE])
+        {
+            CfgBlock* block    = &cfg->blocks[++index];
+            block->start       = pc;
+            block->idom        = CFG_NO_BLOCK;
+            block->loop_header = CFG_NO_BLOCK;
+        }
+        CfgBlock* block = &cfg->blocks[index];
+        block->end      = pc + bytecode_fixed_size(code[pc]);
+        block->instruction_count++;
+        for (uint32_t slot = pc; slot < block->end; slot += INSTRUCTION_SIZE)
+        {
+            cfg->block_at[slot / INSTRUCTION_SIZE] = index;
+        }
+    }
+
+    for (uint32_t b = 0; b < cfg->block_count; b++)
+    {
+        CfgBlock* block = &cfg->blocks[b];
+        uint32_t  last  = block->start;
+        for (uint32_t pc = block->start; pc < block->end; pc += bytecode_fixed_size(code[pc]))
+        {
+            last = pc;
+        }
+        link_block(cfg, block, code, starts, last);
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+static int8_t link_predecessors(ControlFlowGraph* cfg)
+{
+    uint32_t edges = 0;
+    for (uint32_t b = 0; b < cfg->block_count; b++)
+    {
+        for (uint8_t s = 0; s < cfg->blocks[b].successor_count; s++)
+        {
+            cfg->blocks[cfg->blocks[b].successors[s]].predecessor_count++;
+            edges++;
+        }
+    }
+
+    cfg->predecessors = malloc((edges > 0 ? edges : 1) * sizeof(uint32_t));
+    if (cfg->predecessors == NULL)
+    {
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    uint32_t next = 0;
+    for (uint32_t b = 0; b < cfg->block_count; b++)
+    {
+        cfg->blocks[b].first_predecessor = next;
+        next += cfg->blocks[b].predecessor_count;
+        cfg->blocks[b].predecessor_count = 0;
+    }
+    for (uint32_t b = 0; b < cfg->block_count; b++)
+    {
+        for (uint8_t s = 0; s < cfg->blocks[b].successor_count; s++)
+        {
+            CfgBlock* successor = &cfg->blocks[cfg->blocks[b].successors[s]];
+            cfg->predecessors[successor->first_predecessor + successor->predecessor_count++] = b;
+        }
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Depth-first walk from the entry block with an explicit stack. Fills `order` with reachable
+ *   blocks in reverse postorder and `rpo` with each block's position in it.
+ * */
+static uint32_t reverse_postorder(ControlFlowGraph* cfg, uint32_t* order, uint32_t* rpo,
+                                  uint32_t* stack, uint8_t* next_edge)
+{
+    uint32_t depth    = 0;
+    uint32_t finished = cfg->block_count;
+
+    stack[depth++] = cfg->entry;
+    cfg->blocks[cfg->entry].flags |= CFG_BLOCK_REACHABLE;
+    while (depth > 0)
+    {
+        const uint32_t b     = stack[depth - 1];
+        CfgBlock*      block = &cfg->blocks[b];
+        if (next_edge[b] < block->successor_count)
+        {
+            const uint32_t successor = block->successors[next_edge[b]++];
+            if (!(cfg->blocks[successor].flags & CFG_BLOCK_REACHABLE))
+            {
+                cfg->blocks[successor].flags |= CFG_BLOCK_REACHABLE;
+                stack[depth++] = successor;
+            }
+            continue;
+        }
+        order[--finished] = b;
+        depth--;
+    }
+
+    // Reachable blocks were written to the tail of `order`; move them to the front
+    const uint32_t reachable = cfg->block_count - finished;
+    memmove(order, order + finished, reachable * sizeof(uint32_t));
+    for (uint32_t i = 0; i < reachable; i++)
+    {
+        rpo[order[i]] = i;
+    }
+    return reachable;
+}
+
+static uint32_t intersect(const ControlFlowGraph* cfg, const uint32_t* rpo, uint32_t a, uint32_t b)
+{
+    while (a != b)
+    {
+        while (rpo[a] > rpo[b])
+        {
+            a = cfg->blocks[a].idom;
+        }
+        while (rpo[b] > rpo[a])
+        {
+            b = cfg->blocks[b].idom;
+        }
+    }
+    return a;
+}
+
+static void compute_dominators(ControlFlowGraph* cfg, const uint32_t* order, const uint32_t* rpo,
+                               uint32_t reachable)
+{
+    CfgBlock* blocks = cfg->blocks;
+
+    // The entry is its own idom while iterating so intersect can stop there
+    blocks[cfg->entry].idom = cfg->entry;
+    bool changed            = true;
+    while (changed)
+    {
+        changed = false;
+        for (uint32_t i = 1; i < reachable; i++)
+        {
+            CfgBlock* block    = &blocks[order[i]];
+            uint32_t  new_idom = CFG_NO_BLOCK;
+            for (uint32_t p = 0; p < block->predecessor_count; p++)
+            {
+                const uint32_t pred = cfg->predecessors[block->first_predecessor + p];
+                if (blocks[pred].idom == CFG_NO_BLOCK)
+                {
+                    continue;
+                }
+                new_idom = new_idom == CFG_NO_BLOCK ? pred : intersect(cfg, rpo, pred, new_idom);
+            }
+            if (block->idom != new_idom)
+            {
+                block->idom = new_idom;
+                changed     = true;
+            }
+        }
+    }
+    blocks[cfg->entry].idom = CFG_NO_BLOCK;
+}
+
+/*
+ *   One natural loop per header: the header plus every block that reaches one of its back edges
+ *   without passing through it. `mark` stamps membership per loop so it never needs clearing.
+ *   Headers are visited in reverse postorder, so an enclosing loop is always seen before the loops
+ *   nested in it and the last header written to a block is its innermost one.
+ * */
+static int8_t find_loops(ControlFlowGraph* cfg, const uint32_t* order, uint32_t reachable,
+                         uint32_t* stack, uint32_t* mark, uint32_t* body)
+{
+    cfg->loops = malloc(reachable * sizeof(CfgLoop));
+    if (cfg->loops == NULL)
+    {
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    for (uint32_t i = 0; i < reachable; i++)
+    {
+        const uint32_t header = order[i];
+        CfgBlock*      block  = &cfg->blocks[header];
+        CfgLoop        loop   = {header, 1, 0};
+        const uint32_t stamp  = cfg->loop_count + 1;
+        uint32_t       depth  = 0;
+
+        mark[header] = stamp;
+        body[0]      = header;
+        for (uint32_t p = 0; p < block->predecessor_count; p++)
+        {
+            const uint32_t latch = cfg->predecessors[block->first_predecessor + p];
+            if (!cfg_dominates(cfg, header, latch))
+            {
+                continue;
+            }
+            loop.back_edges++;
+            if (mark[latch] != stamp)
+            {
+                mark[latch]              = stamp;
+                body[loop.block_count++] = latch;
+                stack[depth++]           = latch;
+            }
+        }
+        if (loop.back_edges == 0)
+        {
+            continue;
+        }
+
+        while (depth > 0)
+        {
+            const CfgBlock* member = &cfg->blocks[stack[--depth]];
+            for (uint32_t p = 0; p < member->predecessor_count; p++)
+            {
+                const uint32_t pred = cfg->predecessors[member->first_predecessor + p];
+                if (mark[pred] != stamp && (cfg->blocks[pred].flags & CFG_BLOCK_REACHABLE))
+                {
+                    mark[pred]               = stamp;
+                    body[loop.block_count++] = pred;
+                    stack[depth++]           = pred;
+                }
+            }
+        }
+
+        block->flags |= CFG_BLOCK_LOOP_HEADER;
+        for (uint32_t m = 0; m < loop.block_count; m++)
+        {
+            CfgBlock* member    = &cfg->blocks[body[m]];
+            member->loop_header = header;
+            member->loop_depth++;
+        }
+        cfg->loops[cfg->loop_count++] = loop;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t cfg_build(ControlFlowGraph* cfg, const uint8_t* code, uint32_t code_len,
+                 uint32_t entry_point)
+{
+    memset(cfg, 0, sizeof(ControlFlowGraph));
+    if (code_len == 0 || code_len % INSTRUCTION_SIZE != 0 || entry_point >= code_len)
+    {
+        LOG_ERROR("Cannot build a CFG over %u bytes of code\n", code_len);
+        return VM_ERR_INVALID_BYTECODE;
+    }
+
+    const uint32_t slots = code_len / INSTRUCTION_SIZE;
+    cfg->code_len        = code_len;
+    cfg->block_at        = malloc(slots * sizeof(uint32_t));
+    uint8_t*  flags      = calloc(2 * slots, 1);
+    uint32_t* scratch    = malloc(4 * slots * sizeof(uint32_t));
+    if (cfg->block_at == NULL || flags == NULL || scratch == NULL)
+    {
+        free(flags);
+        free(scratch);
+        cfg_free(cfg);
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    uint8_t* starts  = flags;
+    uint8_t* leaders = flags + slots;
+    int8_t   status  = find_leaders(code, code_len, entry_point, starts, leaders);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        status = build_blocks(cfg, code, starts, leaders);
+    }
+    if (status == VM_EXIT_SUCCESS)
+    {
+        status = link_predecessors(cfg);
+    }
+    if (status == VM_EXIT_SUCCESS)
+    {
+        uint32_t* order = scratch;
+        uint32_t* rpo   = scratch + slots;
+        uint32_t* stack = scratch + 2 * slots;
+        uint32_t* mark  = scratch + 3 * slots;
+
+        cfg->entry = cfg->block_at[entry_point / INSTRUCTION_SIZE];
+        memset(leaders, 0, slots); // reused as the DFS edge cursor
+        const uint32_t reachable = reverse_postorder(cfg, order, rpo, stack, leaders);
+        compute_dominators(cfg, order, rpo, reachable);
+
+        memset(mark, 0, slots * sizeof(uint32_t));
+        status = find_loops(cfg, order, reachable, stack, mark, rpo);
+    }
+
+    free(flags);
+    free(scratch);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        cfg_free(cfg);
+    }
+    return status;
+}
+
+void cfg_free(ControlFlowGraph* cfg)
+{
+    free(cfg->blocks);
+    free(cfg->predecessors);
+    free(cfg->loops);
+    free(cfg->block_at);
+    memset(cfg, 0, sizeof(ControlFlowGraph));
+}
+
+// Block holding the instruction at `offset`, or CFG_NO_BLOCK past the end of the code
+uint32_t cfg_block_containing(const ControlFlowGraph* cfg, uint32_t offset)
+{
+    if (offset >= cfg->code_len)
+    {
+        return CFG_NO_BLOCK;
+    }
+    return cfg->block_at[offset / INSTRUCTION_SIZE];
+}
+
+// Every block dominates itself; unreachable blocks are dominated by nothing
+bool cfg_dominates(const ControlFlowGraph* cfg, uint32_t dominator, uint32_t block)
+{
+    if (!(cfg->blocks[block].flags & CFG_BLOCK_REACHABLE))
+    {
+        return false;
+    }
+    for (uint32_t b = block; b != CFG_NO_BLOCK; b = cfg->blocks[b].idom)
+    {
+        if (b == dominator)
+        {
+            return true;
+        }
+    }
+    return false;
+}
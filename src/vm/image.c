@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include "vm_image.h"
+#include "instruction_format_table.h"
+#include "logger.h"
+#include "vm.h"
+#include "vm_io.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define IMAGE_PAGE_SIZE 4096
+
+struct VMImage
+{
+    _Atomic uint32_t    refs;
+    int                 memory_fd;
+    const uint8_t*      pristine; // read-only view of memory_fd, for vm_image_reset
+    VMContext           initial; // the context every instance starts as
+    DecodedInstruction* predecoded;
+    int8_t*             predecode_status;
+    uint32_t*           block_cost;
+    VMImage*            base; // owner of the tables above when they are borrowed, or NULL
+    VMNativeFn          natives[VM_NATIVE_MAX];
+};
+
+/*
+ *   Copies the loaded memory into an in-memory file. All-zero pages are left as holes, so the
+ *   file only holds what the image actually put there.
+ * */
+static int create_memory_file(const uint8_t* memory)
+{
+    int fd = memfd_create("bitlang-image", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        // Kernels without memfd: an unlinked temporary file maps the same way
+        FILE* file = tmpfile();
+        fd         = file != NULL ? dup(fileno(file)) : -1;
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+    }
+    if (fd < 0 || ftruncate(fd, MEM_SIZE) != 0)
+    {
+        LOG_ERROR("Unable to create the image memory file\n");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    static const uint8_t zero_page[IMAGE_PAGE_SIZE];
+    for (uint32_t offset = 0; offset < MEM_SIZE; offset += IMAGE_PAGE_SIZE)
+    {
+        if (memcmp(memory + offset, zero_page, IMAGE_PAGE_SIZE) == 0)
+        {
+            continue;
+        }
+        if (pwrite(fd, memory + offset, IMAGE_PAGE_SIZE, offset) != IMAGE_PAGE_SIZE)
+        {
+            LOG_ERROR("Unable to write the image memory file\n");
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/*
+ *   Decodes every code slot once. Slots that are not instructions (the second word of a MOVQ,
+ *   data placed in code) keep the error decoding them would give, reported only if reached.
+ * */
+static int8_t predecode(VMImage* image, VMContext* loaded)
+{
+    const uint32_t slots    = loaded->code_size / INSTRUCTION_SIZE;
+    image->predecoded       = calloc(slots, sizeof(DecodedInstruction));
+    image->predecode_status = calloc(slots, sizeof(int8_t));
+    if (image->predecoded == NULL || image->predecode_status == NULL)
+    {
+        LOG_ERROR("Unable to allocate the predecoded code of %u slots\n", slots);
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    for (uint32_t slot = 0; slot < slots; slot++)
+    {
+        const uint8_t* raw = loaded->memory + CODE_START + slot * INSTRUCTION_SIZE;
+        if (opcode_info[raw[OPCODE_INDEX]].name == NULL)
+        {
+            image->predecode_status[slot] = VM_ERR_OPCODE_NOT_FOUND;
+            continue;
+        }
+        image->predecode_status[slot] = decode_instruction(loaded, raw, &image->predecoded[slot]);
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+static void image_free(VMImage* image)
+{
+    if (image->pristine != NULL)
+    {
+        munmap((void*) image->pristine, MEM_SIZE);
+    }
+    if (image->memory_fd >= 0)
+    {
+        close(image->memory_fd);
+    }
+    if (image->base != NULL)
+    {
+        vm_image_release(image->base);
+    }
+    else
+    {
+        free(image->predecoded);
+        free(image->predecode_status);
+        free(image->block_cost);
+    }
+    free(image);
+}
+
+/*
+ *   An image holding ctx's memory and state as they are now, without any per-slot tables yet.
+ * */
+static VMImage* image_from_context(const VMContext* ctx)
+{
+    VMImage* image = calloc(1, sizeof(VMImage));
+    if (image == NULL)
+    {
+        LOG_ERROR("Unable to allocate an image\n");
+        return NULL;
+    }
+    atomic_init(&image->refs, 1);
+    image->memory_fd = create_memory_file(ctx->memory);
+    if (image->memory_fd < 0)
+    {
+        free(image);
+        return NULL;
+    }
+    void* pristine = mmap(NULL, MEM_SIZE, PROT_READ, MAP_SHARED, image->memory_fd, 0);
+    if (pristine == MAP_FAILED)
+    {
+        LOG_ERROR("Unable to map the image memory\n");
+        image_free(image);
+        return NULL;
+    }
+    image->pristine = pristine;
+
+    memcpy(&image->initial, ctx, sizeof(VMContext));
+    image->initial.memory           = NULL;
+    image->initial.profile          = NULL;
+    image->initial.block_cost       = NULL;
+    image->initial.image            = NULL;
+    image->initial.predecoded       = NULL;
+    image->initial.predecode_status = NULL;
+    image->initial.natives          = NULL;
+    image->initial.io               = NULL;
+    // A sink's user pointer and a pipe end serve one context; hosts attach their own per fork
+    image->initial.write            = NULL;
+    image->initial.write_user       = NULL;
+    memset(image->initial.pipes, 0, sizeof(image->initial.pipes));
+    // Descriptors and I/O in flight belong to ctx alone; instances start with no files open
+    memset(image->initial.files, 0, sizeof(image->initial.files));
+    atomic_init(&image->initial.io_request.state, VM_IO_IDLE);
+    if (ctx->natives != NULL)
+    {
+        memcpy(image->natives, ctx->natives, sizeof(image->natives));
+    }
+    return image;
+}
+
+/*
+ *   Loads file_name the same way vm_load does, then keeps the result. Returns NULL on any error.
+ * */
+VMImage* vm_image_load(const char* file_name)
+{
+    VMContext* loaded = vm_create();
+    if (loaded == NULL)
+    {
+        return NULL;
+    }
+    memset(loaded->memory, 0, MEM_SIZE);
+    if (load_bytecode(loaded, file_name) != VM_EXIT_SUCCESS)
+    {
+        LOG_ERROR("Unable to build an image from %s\n", file_name);
+        vm_destroy(loaded);
+        return NULL;
+    }
+    loaded->state = VM_STATE_YIELDED;
+
+    VMImage* image = image_from_context(loaded);
+    if (image == NULL)
+    {
+        vm_destroy(loaded);
+        return NULL;
+    }
+    image->block_cost  = loaded->block_cost;
+    loaded->block_cost = NULL;
+    if (predecode(image, loaded) != VM_EXIT_SUCCESS)
+    {
+        image_free(image);
+        vm_destroy(loaded);
+        return NULL;
+    }
+    vm_destroy(loaded);
+    return image;
+}
+
+/*
+ *   Captures ctx (registers, pc, flags, heap state, memory) as an image. ctx keeps running
+ *   unaffected. A context that already came from an image shares that image's tables; any other
+ *   gets its code predecoded here. The profile is not carried over.
+ * */
+VMImage* vm_snapshot(VMContext* ctx)
+{
+    if (ctx->state == VM_STATE_RUNNING)
+    {
+        LOG_ERROR("Cannot snapshot a context while it is running\n");
+        return NULL;
+    }
+    VMImage* image = image_from_context(ctx);
+    if (image == NULL)
+    {
+        return NULL;
+    }
+
+    if (ctx->image != NULL)
+    {
+        image->base             = vm_image_retain(ctx->image);
+        image->block_cost       = ctx->image->block_cost;
+        image->predecoded       = ctx->image->predecoded;
+        image->predecode_status = ctx->image->predecode_status;
+        return image;
+    }
+
+    image->block_cost = calloc(CODE_SLOTS, sizeof(uint32_t));
+    if (image->block_cost == NULL)
+    {
+        LOG_ERROR("Unable to copy the block costs of a snapshot\n");
+        image_free(image);
+        return NULL;
+    }
+    if (ctx->block_cost_len > 0)
+    {
+        memcpy(image->block_cost, ctx->block_cost, ctx->block_cost_len * sizeof(uint32_t));
+    }
+    if (predecode(image, ctx) != VM_EXIT_SUCCESS)
+    {
+        image_free(image);
+        return NULL;
+    }
+    return image;
+}
+
+VMImage* vm_image_retain(VMImage* image)
+{
+    atomic_fetch_add_explicit(&image->refs, 1, memory_order_relaxed);
+    return image;
+}
+
+void vm_image_release(VMImage* image)
+{
+    if (image != NULL && atomic_fetch_sub_explicit(&image->refs, 1, memory_order_acq_rel) == 1)
+    {
+        image_free(image);
+    }
+}
+
+/*
+ *   A new instance in the image's state: yielded at the entry point for vm_image_load, or
+ *   wherever the context was for vm_snapshot.
+ * */
+VMContext* vm_create_from_image(VMImage* image)
+{
+    VMContext* ctx = malloc(sizeof(VMContext));
+    if (ctx == NULL)
+    {
+        LOG_ERROR("Unable to allocate memory for VM State\n");
+        return NULL;
+    }
+    memcpy(ctx, &image->initial, sizeof(VMContext));
+
+    void* memory = mmap(NULL, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, image->memory_fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        LOG_ERROR("Unable to map the image memory\n");
+        free(ctx);
+        return NULL;
+    }
+    ctx->memory           = memory;
+    ctx->image            = vm_image_retain(image);
+    ctx->block_cost       = image->block_cost;
+    ctx->predecoded       = image->predecoded;
+    ctx->predecode_status = image->predecode_status;
+    ctx->natives          = image->natives;
+    return ctx;
+}
+
+/*
+ *   Makes fn what CALLNATIVE id calls in every instance of the image, present and future. Register
+ *   before instances start running: the table is read without synchronisation.
+ * */
+int8_t vm_image_register_native(VMImage* image, uint32_t id, VMNativeFn fn)
+{
+    if (id >= VM_NATIVE_MAX)
+    {
+        LOG_ERROR("Native function id %u is out of range\n", id);
+        return VM_ERR_INVALID_NATIVE;
+    }
+    image->natives[id] = fn;
+    return VM_EXIT_SUCCESS;
+}
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t end;
+} PageSpan;
+
+// The whole pages under address..address + len - 1, clipped to the writable segments
+static PageSpan page_span(uint32_t address, uint32_t len)
+{
+    PageSpan span = {0, 0};
+    if (len > 0 && address < MEM_SIZE)
+    {
+        uint64_t end = ((uint64_t) address + len + IMAGE_PAGE_SIZE - 1) & ~(IMAGE_PAGE_SIZE - 1ull);
+        span.start   = address & ~(IMAGE_PAGE_SIZE - 1u);
+        span.start   = span.start < DATA_START ? DATA_START : span.start;
+        span.end     = end < MEM_SIZE ? (uint32_t) end : MEM_SIZE;
+        span.end     = span.end < span.start ? span.start : span.end;
+    }
+    return span;
+}
+
+static int8_t drop_pages(VMContext* ctx, uint32_t start, uint32_t end)
+{
+    if (start < end && madvise(ctx->memory + start, end - start, MADV_DONTNEED) != 0)
+    {
+        LOG_ERROR("Unable to drop the written pages of an instance\n");
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Puts an instance back in its image's state without remapping it. Code and rodata are never
+ *   written, so only data, heap and stack need restoring: the instance's private copies of those
+ *   pages are dropped and read as the image's again on next touch. Dropped pages cost a page
+ *   fault each time they are touched again, so the pages under keep_at..keep_at + keep_len - 1
+ *   (a region the host rewrites every run) and the page the stack starts on are copied back from
+ *   the image instead and stay mapped. keep_len may be 0.
+ *
+ *   Registers, heap and threads are copied back in. The host's settings (output sink, pipes,
+ *   natives, profile) stay; I/O still in flight is cancelled, files the guest opened are closed
+ *   and lent ones forgotten.
+ * */
+int8_t vm_image_reset(VMContext* ctx, uint32_t keep_at, uint32_t keep_len)
+{
+    VMImage* image = ctx->image;
+    if (image == NULL || ctx->state == VM_STATE_RUNNING)
+    {
+        LOG_ERROR("Only an idle context made from an image can be reset\n");
+        return VM_ERR_ILLEGAL_OPERATION;
+    }
+    vm_close_files(ctx);
+
+    PageSpan kept[2] = {page_span(keep_at, keep_len), page_span(image->initial.sp - 1, 1)};
+    if (kept[1].start < kept[0].start)
+    {
+        PageSpan first = kept[1];
+        kept[1]        = kept[0];
+        kept[0]        = first;
+    }
+    uint32_t cursor = DATA_START;
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        if (kept[i].start == kept[i].end)
+        {
+            continue;
+        }
+        if (drop_pages(ctx, cursor, kept[i].start) != VM_EXIT_SUCCESS)
+        {
+            return VM_ERR_MEMORY_ALLOCATION_FAILED;
+        }
+        uint32_t from = kept[i].start > cursor ? kept[i].start : cursor;
+        if (from < kept[i].end)
+        {
+            memcpy(ctx->memory + from, image->pristine + from, kept[i].end - from);
+            cursor = kept[i].end;
+        }
+    }
+    if (drop_pages(ctx, cursor, MEM_SIZE) != VM_EXIT_SUCCESS)
+    {
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    uint8_t*          memory     = ctx->memory;
+    uint64_t*         profile    = ctx->profile;
+    VMWriteFn         write      = ctx->write;
+    void*             write_user = ctx->write_user;
+    const VMNativeFn* natives    = ctx->natives;
+    VMIoRing*         io         = ctx->io;
+    VMPipe*           pipes[VM_PIPE_MAX];
+    memcpy(pipes, ctx->pipes, sizeof(pipes));
+
+    memcpy(ctx, &image->initial, sizeof(VMContext));
+    ctx->memory           = memory;
+    ctx->profile          = profile;
+    ctx->write            = write;
+    ctx->write_user       = write_user;
+    ctx->natives          = natives;
+    ctx->io               = io;
+    ctx->image            = image;
+    ctx->block_cost       = image->block_cost;
+    ctx->predecoded       = image->predecoded;
+    ctx->predecode_status = image->predecode_status;
+    memcpy(ctx->pipes, pipes, sizeof(pipes));
+    return VM_EXIT_SUCCESS;
+}
+
+VMContext* vm_fork(VMImage* snapshot)
+{
+    return vm_create_from_image(snapshot);
+}
+
+/*
+ *   Called by vm_destroy: unmaps the instance's memory and drops its reference.
+ * */
+void vm_image_detach(VMContext* ctx)
+{
+    munmap(ctx->memory, MEM_SIZE);
+    vm_image_release(ctx->image);
+    ctx->memory           = NULL;
+    ctx->image            = NULL;
+    ctx->block_cost       = NULL;
+    ctx->block_cost_len   = 0;
+    ctx->predecoded       = NULL;
+    ctx->predecode_status = NULL;
+    ctx->natives          = NULL;
+}
@@ -23,7 +23,7 @@ const OpcodeInfo opcode_info[256] = {
     [OP_AND] = {"and", 2, {OT_REGISTER, OT_ANY_SOURCE}},
     [OP_OR]  = {"or", 2, {OT_REGISTER, OT_ANY_SOURCE}},
     [OP_NOT] = {"not", 1, {OT_REGISTER, OT_NONE}},
-    [OP_CMP] = {"cmp", 0, {OT_NONE, OT_NONE}},
+    [OP_CMP] = {"cmp", 0, {OT_NONE, OT_NONE}}, // implicit: compares R0 with R1
 
     // --- Control Flow (All jumps/calls target a label/symbol) ---
     [OP_JZ]   = {"jz", 1, {OT_SYMBOL, OT_NONE}},
@@ -43,5 +43,58 @@ const OpcodeInfo opcode_info[256] = {
 
     [OP_HALT] = {"halt", 0, {OT_NONE, OT_NONE}},
 
+    // --- Heap ---
+    [OP_ALLOC]   = {"alloc", 2, {OT_REGISTER, OT_ANY_SOURCE}},
+    [OP_FREE]    = {"free", 1, {OT_REGISTER, OT_NONE}},
+    [OP_REALLOC] = {"realloc", 2, {OT_REGISTER, OT_ANY_SOURCE}},
+
+    // --- Bulk Memory (byte count implicit in R2) ---
+    [OP_MEMCPY] = {"memcpy", 2, {OT_REGISTER, OT_REGISTER}},
+    [OP_MEMSET] = {"memset", 2, {OT_REGISTER, OT_ANY_SOURCE}},
+    [OP_MEMCMP] = {"memcmp", 2, {OT_REGISTER, OT_REGISTER}},
+    [OP_MEMCHR] = {"memchr", 2, {OT_REGISTER, OT_ANY_SOURCE}},
+    [OP_STRLEN] = {"strlen", 2, {OT_REGISTER, OT_REGISTER}},
+
+    // --- Vector (operand bytes hold v0-v7 as 0-7; addresses and scalars in r0-r7) ---
+    [OP_VLOAD]    = {"vload", 2, {OT_VECTOR_REGISTER, OT_REGISTER}},
+    [OP_VSTORE]   = {"vstore", 2, {OT_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VSPLAT8]  = {"vsplat8", 2, {OT_VECTOR_REGISTER, OT_ANY_SOURCE}},
+    [OP_VSPLAT32] = {"vsplat32", 2, {OT_VECTOR_REGISTER, OT_ANY_SOURCE}},
+    [OP_VADD8]    = {"vadd8", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VADD32]   = {"vadd32", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VSUB8]    = {"vsub8", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VSUB32]   = {"vsub32", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VMUL32]   = {"vmul32", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VAND]     = {"vand", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VOR]      = {"vor", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VCMPEQ8]  = {"vcmpeq8", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VCMPEQ32] = {"vcmpeq32", 2, {OT_VECTOR_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VSUM8]    = {"vsum8", 2, {OT_REGISTER, OT_VECTOR_REGISTER}},
+    [OP_VSUM32]   = {"vsum32", 2, {OT_REGISTER, OT_VECTOR_REGISTER}},
+
+    // --- Wide immediate (16 bytes: imm32 holds the low half, the next word the high half) ---
+    [OP_MOVQ] = {"movq", 2, {OT_REGISTER, OT_IMMEDIATE_INT}},
+
+    // --- Guest threads (thread and channel ids in registers) ---
+    [OP_SPAWN] = {"spawn", 2, {OT_REGISTER, OT_SYMBOL}},
+    [OP_CHAN]  = {"chan", 2, {OT_REGISTER, OT_ANY_SOURCE}},
+    [OP_YIELD] = {"yield", 0, {OT_NONE, OT_NONE}},
+    [OP_JOIN]  = {"join", 1, {OT_REGISTER, OT_NONE}},
+    [OP_SEND]  = {"send", 2, {OT_REGISTER, OT_ANY_SOURCE}},
+    [OP_RECV]  = {"recv", 2, {OT_REGISTER, OT_REGISTER}},
+
+    // --- Host pipes (port number, then the guest address of the message) ---
+    [OP_PSEND] = {"psend", 2, {OT_REGISTER, OT_REGISTER}},
+    [OP_PRECV] = {"precv", 2, {OT_REGISTER, OT_REGISTER}},
+
+    // --- Host functions (native id) ---
+    [OP_CALLNATIVE] = {"callnative", 1, {OT_IMMEDIATE_INT, OT_NONE}},
+
+    // --- Files (handle or result register, then a guest address; byte count or mode in R2) ---
+    [OP_OPEN]  = {"open", 2, {OT_REGISTER, OT_REGISTER}},
+    [OP_READ]  = {"read", 2, {OT_REGISTER, OT_REGISTER}},
+    [OP_WRITE] = {"write", 2, {OT_REGISTER, OT_REGISTER}},
+    [OP_CLOSE] = {"close", 1, {OT_REGISTER, OT_NONE}},
+
     // --- Unknown ---
     [OP_UNKNOWN] = {"unknown", 0, {OT_NONE, OT_NONE}}};
@@ -0,0 +1,545 @@
+#define _GNU_SOURCE
+#include "vm_io.h"
+#include "logger.h"
+#include "vm.h"
+#include "vm_utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define IO_FILE_PERMISSIONS 0644
+
+/*
+ *   An io_uring set up with the raw system calls. The worker that owns the ring submits to it and
+ *   reaps it; the only other user is vm_io_cancel, run by whichever worker sees a context finish,
+ *   so lock is almost never contended. The kernel side of each queue is read with acquire and
+ *   published with release, as the io_uring ABI requires.
+ *
+ *   Each completion carries the address of the VMIoRequest that submitted it. Reaping stores the
+ *   result and then marks the request DONE with a release store, so the request can be collected
+ *   on whichever worker runs its context next. One entry is always kept free for a cancel.
+ * */
+struct VMIoRing
+{
+    pthread_mutex_t      lock;
+    int                  fd;
+    uint32_t             entries;
+    uint32_t             in_flight;
+    _Atomic uint32_t*    sq_head;
+    _Atomic uint32_t*    sq_tail;
+    uint32_t             sq_mask;
+    uint32_t*            sq_array;
+    struct io_uring_sqe* sqes;
+    _Atomic uint32_t*    cq_head;
+    _Atomic uint32_t*    cq_tail;
+    uint32_t             cq_mask;
+    struct io_uring_cqe* cqes;
+    void*                sq_ring;
+    size_t               sq_ring_size;
+    void*                cq_ring; // sq_ring itself with IORING_FEAT_SINGLE_MMAP
+    size_t               cq_ring_size;
+    size_t               sqes_size;
+};
+
+static int ring_enter(const VMIoRing* ring, uint32_t to_submit)
+{
+    return (int) syscall(__NR_io_uring_enter, ring->fd, to_submit, 0, 0, NULL, 0);
+}
+
+// Sleeps until at least one completion is waiting
+static int ring_wait(const VMIoRing* ring)
+{
+    return (int) syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+/*
+ *   Returns NULL when the kernel has no io_uring or refuses one; guest I/O then blocks instead.
+ * */
+VMIoRing* vm_io_ring_create(uint32_t entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+    {
+        LOG_WARN("io_uring is unavailable (%s); guest I/O will block\n", strerror(errno));
+        return NULL;
+    }
+
+    VMIoRing* ring = calloc(1, sizeof(VMIoRing));
+    if (ring == NULL)
+    {
+        LOG_ERROR("Unable to allocate an I/O ring\n");
+        close(fd);
+        return NULL;
+    }
+    pthread_mutex_init(&ring->lock, NULL);
+    ring->fd           = fd;
+    ring->entries      = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size    = params.sq_entries * sizeof(struct io_uring_sqe);
+    bool single_mmap   = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ring->cq_ring_size > ring->sq_ring_size)
+    {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+
+    const int protection = PROT_READ | PROT_WRITE;
+    const int flags      = MAP_SHARED | MAP_POPULATE;
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, protection, flags, fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = single_mmap ? ring->sq_ring
+                                : mmap(NULL, ring->cq_ring_size, protection, flags, fd,
+                                       IORING_OFF_CQ_RING);
+    ring->sqes    = mmap(NULL, ring->sqes_size, protection, flags, fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        LOG_ERROR("Unable to map the io_uring queues\n");
+        vm_io_ring_destroy(ring);
+        return NULL;
+    }
+
+    uint8_t* sq    = ring->sq_ring;
+    uint8_t* cq    = ring->cq_ring;
+    ring->sq_head  = (_Atomic uint32_t*) (sq + params.sq_off.head);
+    ring->sq_tail  = (_Atomic uint32_t*) (sq + params.sq_off.tail);
+    ring->sq_mask  = *(uint32_t*) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*) (sq + params.sq_off.array);
+    ring->cq_head  = (_Atomic uint32_t*) (cq + params.cq_off.head);
+    ring->cq_tail  = (_Atomic uint32_t*) (cq + params.cq_off.tail);
+    ring->cq_mask  = *(uint32_t*) (cq + params.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+    return ring;
+}
+
+/*
+ *   Cancels and waits for whatever is still in flight first, so the kernel never completes into
+ *   a request after the ring is gone.
+ * */
+void vm_io_ring_destroy(VMIoRing* ring)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    vm_io_ring_drain(ring);
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+    {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->fd);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring);
+}
+
+// Queues one operation and tells the kernel about it. Called with lock held and an entry free.
+static void ring_push(VMIoRing* ring, const struct io_uring_sqe* sqe)
+{
+    uint32_t tail  = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    uint32_t index = tail & ring->sq_mask;
+    ring->sqes[index]     = *sqe;
+    ring->sq_array[index] = index;
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+    ring->in_flight++;
+
+    // A refused enter leaves the entry queued; vm_io_ring_reap offers it again
+    if (ring_enter(ring, 1) < 0)
+    {
+        LOG_WARN("io_uring_enter failed (%s); retrying later\n", strerror(errno));
+    }
+}
+
+/*
+ *   False when every entry but the one kept for a cancel is taken; the caller retries later.
+ * */
+static bool ring_submit(VMIoRing* ring, const struct io_uring_sqe* sqe)
+{
+    pthread_mutex_lock(&ring->lock);
+    bool queued = ring->in_flight + 1 < ring->entries;
+    if (queued)
+    {
+        ring_push(ring, sqe);
+    }
+    pthread_mutex_unlock(&ring->lock);
+    return queued;
+}
+
+static uint32_t ring_reap(VMIoRing* ring)
+{
+    uint32_t unsubmitted = atomic_load_explicit(ring->sq_tail, memory_order_relaxed) -
+                           atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    if (unsubmitted > 0)
+    {
+        ring_enter(ring, unsubmitted);
+    }
+
+    uint32_t head  = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    uint32_t tail  = atomic_load_explicit(ring->cq_tail, memory_order_acquire);
+    uint32_t count = 0;
+    for (; head != tail; head++, count++)
+    {
+        const struct io_uring_cqe* cqe     = &ring->cqes[head & ring->cq_mask];
+        VMIoRequest*               request = (VMIoRequest*) (uintptr_t) cqe->user_data;
+        request->result                    = cqe->res;
+        atomic_store_explicit(&request->state, VM_IO_DONE, memory_order_release);
+    }
+    atomic_store_explicit(ring->cq_head, head, memory_order_release);
+    ring->in_flight -= count;
+    return count;
+}
+
+/*
+ *   Hands every finished operation back to its request. Returns how many there were. Cheap when
+ *   nothing finished: no system call unless submissions are still waiting for the kernel.
+ * */
+uint32_t vm_io_ring_reap(VMIoRing* ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    uint32_t count = ring_reap(ring);
+    pthread_mutex_unlock(&ring->lock);
+    return count;
+}
+
+/*
+ *   Asks the kernel to cancel the operation whose user_data is target (any operation with
+ *   IORING_ASYNC_CANCEL_ANY), using the entry kept free for it. The cancel completes into
+ *   *cancel. Called with lock held.
+ * */
+static void ring_cancel(VMIoRing* ring, const VMIoRequest* target, uint32_t flags,
+                        VMIoRequest* cancel)
+{
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode       = IORING_OP_ASYNC_CANCEL;
+    sqe.fd           = -1;
+    sqe.addr         = (uint64_t) (uintptr_t) target;
+    sqe.cancel_flags = flags;
+    sqe.user_data    = (uint64_t) (uintptr_t) cancel;
+    atomic_init(&cancel->state, VM_IO_IN_FLIGHT);
+    ring_push(ring, &sqe);
+}
+
+/*
+ *   Cancels everything still in flight on ring and waits until the kernel has completed all of
+ *   it. Workers call it before they stop. A kernel without IORING_ASYNC_CANCEL_ANY refuses the
+ *   cancel, and the wait then lasts until the operations finish on their own.
+ * */
+void vm_io_ring_drain(VMIoRing* ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    if (ring->in_flight > 0)
+    {
+        VMIoRequest cancel;
+        ring_cancel(ring, NULL, IORING_ASYNC_CANCEL_ANY, &cancel);
+        while (ring->in_flight > 0)
+        {
+            ring_wait(ring);
+            ring_reap(ring);
+        }
+    }
+    pthread_mutex_unlock(&ring->lock);
+}
+
+/*
+ *   Takes back the operation ctx has in flight, if any, and returns once the kernel is done with
+ *   it: it can no longer write into guest memory or complete into a later request. Safe from any
+ *   thread, since the request remembers its ring. Called whenever a context halts, fails, is reset
+ *   or is destroyed.
+ * */
+void vm_io_cancel(VMContext* ctx)
+{
+    VMIoRequest* request = &ctx->io_request;
+    if (atomic_load_explicit(&request->state, memory_order_acquire) == VM_IO_IN_FLIGHT)
+    {
+        VMIoRing* ring = request->ring;
+        pthread_mutex_lock(&ring->lock);
+        if (atomic_load_explicit(&request->state, memory_order_relaxed) == VM_IO_IN_FLIGHT)
+        {
+            VMIoRequest cancel;
+            ring_cancel(ring, request, 0, &cancel);
+            while (atomic_load_explicit(&request->state, memory_order_relaxed) == VM_IO_IN_FLIGHT ||
+                   atomic_load_explicit(&cancel.state, memory_order_relaxed) == VM_IO_IN_FLIGHT)
+            {
+                ring_wait(ring);
+                ring_reap(ring);
+            }
+        }
+        pthread_mutex_unlock(&ring->lock);
+    }
+    atomic_store_explicit(&request->state, VM_IO_IDLE, memory_order_relaxed);
+}
+
+/*
+ *   Lends the host descriptor fd to the guest. Returns its handle, or 0 when every handle is
+ *   taken. The guest closing the handle does not close fd.
+ * */
+uint32_t vm_attach_file(VMContext* ctx, int fd)
+{
+    for (uint32_t i = 0; i < VM_FILE_MAX; i++)
+    {
+        if (!ctx->files[i].open)
+        {
+            ctx->files[i] = (VMFile){.fd = fd, .open = true, .owned = false};
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Cancels the request in flight, closes what the guest opened and forgets what the host lent.
+// Called by vm_destroy and vm_image_reset.
+void vm_close_files(VMContext* ctx)
+{
+    vm_io_cancel(ctx);
+    for (uint32_t i = 0; i < VM_FILE_MAX; i++)
+    {
+        if (ctx->files[i].open && ctx->files[i].owned)
+        {
+            close(ctx->files[i].fd);
+        }
+        ctx->files[i] = (VMFile){0};
+    }
+}
+
+static bool has_free_file(const VMContext* ctx)
+{
+    for (uint32_t i = 0; i < VM_FILE_MAX; i++)
+    {
+        if (!ctx->files[i].open)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static VMFile* guest_file(VMContext* ctx, uint64_t handle)
+{
+    if (handle == 0 || handle > VM_FILE_MAX || !ctx->files[handle - 1].open)
+    {
+        return NULL;
+    }
+    return &ctx->files[handle - 1];
+}
+
+/*
+ *   If this instruction already has a request out, says what the instruction should do now:
+ *   wait (VM_ERR_IO_WOULD_BLOCK) or finish with the request's result. Also makes the instruction
+ *   wait while another guest thread's request holds the context's one slot. Returns false when
+ *   the instruction should start a new operation.
+ * */
+static bool io_collect(VMContext* ctx, int8_t* status, int64_t* result)
+{
+    VMIoRequest* request = &ctx->io_request;
+    uint32_t     state   = atomic_load_explicit(&request->state, memory_order_acquire);
+    if (state == VM_IO_IDLE)
+    {
+        return false;
+    }
+    bool mine = request->pc == ctx->pc - INSTRUCTION_SIZE;
+    mine      = mine && request->thread == ctx->threads.current;
+    if (state == VM_IO_IN_FLIGHT || !mine)
+    {
+        *status = VM_ERR_IO_WOULD_BLOCK;
+        return true;
+    }
+    *result = request->result;
+    atomic_store_explicit(&request->state, VM_IO_IDLE, memory_order_relaxed);
+    *status = VM_EXIT_SUCCESS;
+    return true;
+}
+
+static int64_t blocking_call(const struct io_uring_sqe* sqe)
+{
+    void*   buffer = (void*) (uintptr_t) sqe->addr;
+    int64_t result;
+    switch (sqe->opcode)
+    {
+    case IORING_OP_OPENAT:
+        result = openat(sqe->fd, buffer, (int) sqe->open_flags, (mode_t) sqe->len);
+        break;
+    case IORING_OP_READ:
+        result = read(sqe->fd, buffer, sqe->len);
+        break;
+    case IORING_OP_WRITE:
+        result = write(sqe->fd, buffer, sqe->len);
+        break;
+    default:
+        result = close(sqe->fd);
+        break;
+    }
+    return result < 0 ? -errno : result;
+}
+
+/*
+ *   Runs sqe: on the context's ring if it has one, leaving the instruction to wait for the
+ *   completion, otherwise right here.
+ * */
+static int8_t io_start(VMContext* ctx, struct io_uring_sqe* sqe, int64_t* result)
+{
+    if (ctx->io == NULL)
+    {
+        *result = blocking_call(sqe);
+        return VM_EXIT_SUCCESS;
+    }
+
+    VMIoRequest* request = &ctx->io_request;
+    request->pc          = ctx->pc - INSTRUCTION_SIZE;
+    request->thread      = ctx->threads.current;
+    request->ring        = ctx->io;
+    sqe->user_data       = (uint64_t) (uintptr_t) request;
+    atomic_store_explicit(&request->state, VM_IO_IN_FLIGHT, memory_order_relaxed);
+    if (!ring_submit(ctx->io, sqe))
+    {
+        atomic_store_explicit(&request->state, VM_IO_IDLE, memory_order_relaxed);
+    }
+    return VM_ERR_IO_WOULD_BLOCK;
+}
+
+static void prepare(struct io_uring_sqe* sqe, uint8_t opcode, int fd, const void* buffer,
+                    uint32_t len)
+{
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd     = fd;
+    sqe->addr   = (uint64_t) (uintptr_t) buffer;
+    sqe->len    = len;
+    sqe->off    = (uint64_t) -1; // the file's own position, so pipes and sockets work too
+}
+
+/*
+ *   open: path is a NUL-terminated guest string, mode a VMOpenMode. result is the new handle.
+ * */
+int8_t vm_io_open(VMContext* ctx, uint32_t path, uint64_t mode, int64_t* result)
+{
+    int8_t status;
+    if (!io_collect(ctx, &status, result))
+    {
+        const VMSegment* segment = vm_segment_of(path);
+        uint32_t         limit   = segment != NULL ? segment->start + segment->size - path : 0;
+        if (segment == NULL || memchr(ctx->memory + path, '\0', limit) == NULL)
+        {
+            LOG_ERROR("Path at 0x%X is not a string\n", path);
+            return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+        }
+
+        static const int open_flags[] = {
+            [VM_OPEN_READ]   = O_RDONLY,
+            [VM_OPEN_WRITE]  = O_WRONLY | O_CREAT | O_TRUNC,
+            [VM_OPEN_APPEND] = O_WRONLY | O_CREAT | O_APPEND,
+        };
+        if (mode > VM_OPEN_APPEND || !has_free_file(ctx))
+        {
+            *result = mode > VM_OPEN_APPEND ? -EINVAL : -EMFILE;
+            return VM_EXIT_SUCCESS;
+        }
+
+        struct io_uring_sqe sqe;
+        prepare(&sqe, IORING_OP_OPENAT, AT_FDCWD, ctx->memory + path, IO_FILE_PERMISSIONS);
+        sqe.off        = 0;
+        sqe.open_flags = (uint32_t) (open_flags[mode] | O_CLOEXEC);
+        status         = io_start(ctx, &sqe, result);
+    }
+    if (status == VM_EXIT_SUCCESS && *result >= 0)
+    {
+        uint32_t handle = vm_attach_file(ctx, (int) *result);
+        if (handle == 0)
+        {
+            close((int) *result);
+            *result = -EMFILE;
+            return VM_EXIT_SUCCESS;
+        }
+        ctx->files[handle - 1].owned = true;
+        *result                      = handle;
+    }
+    return status;
+}
+
+/*
+ *   read and write move up to len bytes between the file and guest memory at address, straight
+ *   from and into the VM's memory. result is the byte count, 0 at end of file for a read.
+ * */
+static int8_t io_transfer(VMContext* ctx, uint8_t opcode, uint64_t handle, uint32_t address,
+                          uint32_t len, int64_t* result)
+{
+    int8_t status;
+    if (io_collect(ctx, &status, result))
+    {
+        return status;
+    }
+    status = vm_check_range(address, len, opcode == IORING_OP_READ);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+    const VMFile* file = guest_file(ctx, handle);
+    if (file == NULL)
+    {
+        *result = -EBADF;
+        return VM_EXIT_SUCCESS;
+    }
+
+    struct io_uring_sqe sqe;
+    prepare(&sqe, opcode, file->fd, ctx->memory + address, len);
+    return io_start(ctx, &sqe, result);
+}
+
+int8_t vm_io_read(VMContext* ctx, uint64_t handle, uint32_t address, uint32_t len, int64_t* result)
+{
+    return io_transfer(ctx, IORING_OP_READ, handle, address, len, result);
+}
+
+int8_t vm_io_write(VMContext* ctx, uint64_t handle, uint32_t address, uint32_t len, int64_t* result)
+{
+    return io_transfer(ctx, IORING_OP_WRITE, handle, address, len, result);
+}
+
+/*
+ *   The handle is free again as soon as the close is under way. Closing a lent descriptor only
+ *   gives the handle back.
+ * */
+int8_t vm_io_close(VMContext* ctx, uint64_t handle, int64_t* result)
+{
+    int8_t status;
+    if (io_collect(ctx, &status, result))
+    {
+        return status;
+    }
+    VMFile* file = guest_file(ctx, handle);
+    if (file == NULL || !file->owned)
+    {
+        *result = file == NULL ? -EBADF : 0;
+        if (file != NULL)
+        {
+            *file = (VMFile){0};
+        }
+        return VM_EXIT_SUCCESS;
+    }
+
+    struct io_uring_sqe sqe;
+    prepare(&sqe, IORING_OP_CLOSE, file->fd, NULL, 0);
+    sqe.off = 0;
+    status  = io_start(ctx, &sqe, result);
+    if (status == VM_EXIT_SUCCESS || ctx->io_request.state == VM_IO_IN_FLIGHT)
+    {
+        *file = (VMFile){0};
+    }
+    return status;
+}
@@ -0,0 +1,210 @@
+#define _GNU_SOURCE
+#include "vm_pipe.h"
+#include "logger.h"
+#include "vm.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define PIPE_CACHE_LINE 64
+#define PIPE_MAX_SLOTS (1u << 20)
+#define PIPE_MAX_MESSAGE_SIZE HEAP_SIZE
+
+/*
+ *   A pipe is one MAP_SHARED mapping: this header, then for MPSC a sequence number per slot, then
+ *   the slots. Indices only grow; a slot is index & mask. The producer and consumer ends sit on
+ *   their own cache lines, each next to the copy of the other end's index it last read, so a side
+ *   only touches the other's line when the ring looks full or empty from where it stands.
+ *
+ *   SPSC is the classic Lamport ring: the producer publishes tail with a release store after
+ *   copying the message in, the consumer publishes head after copying it out.
+ *
+ *   MPSC is Vyukov's bounded queue with a single consumer. Producers claim a slot by advancing
+ *   tail with a CAS, and the slot's sequence number says whose turn it is: index when it is free
+ *   for the producer of that lap, index + 1 once the message is in, index + slot count once the
+ *   consumer has taken it. The consumer never races anyone, so it needs no CAS.
+ * */
+struct VMPipe
+{
+    _Alignas(PIPE_CACHE_LINE) _Atomic uint64_t tail; // next index a producer writes
+    uint64_t head_cache;                             // SPSC producer's last look at head
+    _Alignas(PIPE_CACHE_LINE) _Atomic uint64_t head; // next index the consumer reads
+    uint64_t tail_cache;                             // SPSC consumer's last look at tail
+    _Alignas(PIPE_CACHE_LINE) VMPipeMode mode;
+    uint64_t          mask;
+    uint32_t          message_size;
+    size_t            mapping_size;
+    _Atomic uint64_t* sequence; // MPSC only
+    uint8_t*          slots;
+};
+
+static inline uint8_t* pipe_slot(const VMPipe* pipe, uint64_t index)
+{
+    return pipe->slots + (index & pipe->mask) * pipe->message_size;
+}
+
+/*
+ *   slot_count is rounded up to a power of two. Returns NULL on bad sizes or when the mapping
+ *   cannot be made.
+ * */
+VMPipe* vm_pipe_create(VMPipeMode mode, uint32_t slot_count, uint32_t message_size)
+{
+    if (slot_count == 0 || slot_count > PIPE_MAX_SLOTS || message_size == 0 ||
+        message_size > PIPE_MAX_MESSAGE_SIZE)
+    {
+        LOG_ERROR("A pipe needs 1..%u slots of 1..%u bytes\n", PIPE_MAX_SLOTS,
+                  PIPE_MAX_MESSAGE_SIZE);
+        return NULL;
+    }
+    uint64_t capacity = 1;
+    while (capacity < slot_count)
+    {
+        capacity *= 2;
+    }
+
+    size_t sequence_offset = sizeof(VMPipe);
+    size_t sequence_size   = mode == VM_PIPE_MPSC ? capacity * sizeof(uint64_t) : 0;
+    size_t slots_offset    = sequence_offset + sequence_size;
+    size_t mapping_size    = slots_offset + capacity * message_size;
+    void*  mapping =
+        mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        LOG_ERROR("Unable to map a pipe of %zu bytes\n", mapping_size);
+        return NULL;
+    }
+
+    VMPipe* pipe = mapping;
+    atomic_init(&pipe->tail, 0);
+    atomic_init(&pipe->head, 0);
+    pipe->head_cache   = 0;
+    pipe->tail_cache   = 0;
+    pipe->mode         = mode;
+    pipe->mask         = capacity - 1;
+    pipe->message_size = message_size;
+    pipe->mapping_size = mapping_size;
+    pipe->sequence     = sequence_size ? (void*) ((uint8_t*) mapping + sequence_offset) : NULL;
+    pipe->slots        = (uint8_t*) mapping + slots_offset;
+    for (uint64_t i = 0; pipe->sequence != NULL && i < capacity; i++)
+    {
+        atomic_init(&pipe->sequence[i], i);
+    }
+    return pipe;
+}
+
+void vm_pipe_destroy(VMPipe* pipe)
+{
+    if (pipe != NULL)
+    {
+        munmap(pipe, pipe->mapping_size);
+    }
+}
+
+static bool spsc_send(VMPipe* pipe, const void* message)
+{
+    uint64_t tail = atomic_load_explicit(&pipe->tail, memory_order_relaxed);
+    if (tail - pipe->head_cache > pipe->mask)
+    {
+        pipe->head_cache = atomic_load_explicit(&pipe->head, memory_order_acquire);
+        if (tail - pipe->head_cache > pipe->mask)
+        {
+            return false;
+        }
+    }
+    memcpy(pipe_slot(pipe, tail), message, pipe->message_size);
+    atomic_store_explicit(&pipe->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static bool mpsc_send(VMPipe* pipe, const void* message)
+{
+    uint64_t tail = atomic_load_explicit(&pipe->tail, memory_order_relaxed);
+    for (;;)
+    {
+        uint64_t sequence =
+            atomic_load_explicit(&pipe->sequence[tail & pipe->mask], memory_order_acquire);
+        int64_t lap = (int64_t) (sequence - tail);
+        if (lap < 0)
+        {
+            return false; // the consumer has not emptied this slot since the last lap
+        }
+        if (lap > 0)
+        {
+            tail = atomic_load_explicit(&pipe->tail, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&pipe->tail, &tail, tail + 1,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    memcpy(pipe_slot(pipe, tail), message, pipe->message_size);
+    atomic_store_explicit(&pipe->sequence[tail & pipe->mask], tail + 1, memory_order_release);
+    return true;
+}
+
+/*
+ *   Copies message_size bytes from message into the pipe. Returns false, copying nothing, when
+ *   the pipe is full.
+ * */
+bool vm_pipe_send(VMPipe* pipe, const void* message)
+{
+    return pipe->mode == VM_PIPE_MPSC ? mpsc_send(pipe, message) : spsc_send(pipe, message);
+}
+
+/*
+ *   Copies the oldest message out into message. Returns false, copying nothing, when the pipe is
+ *   empty. Only one thread may receive from a pipe at a time.
+ * */
+bool vm_pipe_recv(VMPipe* pipe, void* message)
+{
+    uint64_t head = atomic_load_explicit(&pipe->head, memory_order_relaxed);
+    if (pipe->mode == VM_PIPE_MPSC)
+    {
+        _Atomic uint64_t* sequence = &pipe->sequence[head & pipe->mask];
+        if (atomic_load_explicit(sequence, memory_order_acquire) != head + 1)
+        {
+            return false;
+        }
+        memcpy(message, pipe_slot(pipe, head), pipe->message_size);
+        atomic_store_explicit(sequence, head + pipe->mask + 1, memory_order_release);
+        atomic_store_explicit(&pipe->head, head + 1, memory_order_relaxed);
+        return true;
+    }
+
+    if (head == pipe->tail_cache)
+    {
+        pipe->tail_cache = atomic_load_explicit(&pipe->tail, memory_order_acquire);
+        if (head == pipe->tail_cache)
+        {
+            return false;
+        }
+    }
+    memcpy(message, pipe_slot(pipe, head), pipe->message_size);
+    atomic_store_explicit(&pipe->head, head + 1, memory_order_release);
+    return true;
+}
+
+uint32_t vm_pipe_message_size(const VMPipe* pipe)
+{
+    return pipe->message_size;
+}
+
+/*
+ *   Connects pipe to port (0..VM_PIPE_MAX - 1) of ctx, replacing whatever was there; NULL
+ *   disconnects it. The pipe must outlive every context attached to it. A fork starts with no
+ *   ports until the host attaches them; only vm_image_reset keeps an instance's pipes.
+ * */
+int8_t vm_attach_pipe(VMContext* ctx, uint32_t port, VMPipe* pipe)
+{
+    if (port >= VM_PIPE_MAX)
+    {
+        LOG_ERROR("Pipe port %u is out of range\n", port);
+        return VM_ERR_INVALID_PIPE;
+    }
+    ctx->pipes[port] = pipe;
+    return VM_EXIT_SUCCESS;
+}
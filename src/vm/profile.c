@@ -0,0 +1,56 @@
+#include "vm_profile.h"
+#include "logger.h"
+#include "vm.h"
+#include "vm_cfg.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int8_t vm_profile_enable(VMContext* ctx)
+{
+    if (ctx->profile != NULL)
+    {
+        memset(ctx->profile, 0, VM_PROFILE_SLOTS * sizeof(uint64_t));
+        return VM_EXIT_SUCCESS;
+    }
+    ctx->profile = calloc(VM_PROFILE_SLOTS, sizeof(uint64_t));
+    if (ctx->profile == NULL)
+    {
+        LOG_ERROR("Unable to allocate the profile counters\n");
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t vm_profile_write(const VMContext* ctx, FILE* out)
+{
+    if (ctx->profile == NULL)
+    {
+        LOG_ERROR("Profiling was not enabled for this run\n");
+        return VM_ERR_ILLEGAL_OPERATION;
+    }
+
+    ControlFlowGraph cfg;
+    int8_t status = cfg_build(&cfg, ctx->memory + CODE_START, ctx->code_size, ctx->entry_point);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    fprintf(out, "# block offset, executions\n");
+    for (uint32_t b = 0; b < cfg.block_count; b++)
+    {
+        CfgBlock* block   = &cfg.blocks[b];
+        block->exec_count = ctx->profile[block->start / INSTRUCTION_SIZE];
+        fprintf(out, "0x%06X %llu\n", block->start, (unsigned long long) block->exec_count);
+    }
+    cfg_free(&cfg);
+
+    if (ferror(out))
+    {
+        LOG_ERROR("Failed to write the profile\n");
+        return VM_ERR_IO_WRITE_FAILED;
+    }
+    return VM_EXIT_SUCCESS;
+}
@@ -0,0 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+#include "vm_scheduler.h"
+#include "logger.h"
+#include "vm.h"
+#include "vm_io.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCHEDULER_CACHE_LINE 64
+#define TASK_OUTPUT_MIN_CAPACITY 64
+#define WORKER_IO_ENTRIES 64
+
+/*
+ *   Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models").
+ *   Only the owner pushes, at the bottom; everyone, owner included, takes from the top. Taking
+ *   from the top on the owner's side too makes each worker round-robin over its own tasks, which
+ *   is what preemption is for; the owner-side LIFO pop is not needed.
+ *
+ *   The ring holds every task of the run, so a push can never find it full and it never grows.
+ * */
+typedef struct
+{
+    _Alignas(SCHEDULER_CACHE_LINE) _Atomic int64_t top;
+    _Alignas(SCHEDULER_CACHE_LINE) _Atomic int64_t bottom;
+    _Atomic(VMTask*)* slots;
+    int64_t           mask;
+} TaskDeque;
+
+typedef struct
+{
+    TaskDeque    deque;
+    VMScheduler* scheduler;
+    VMIoRing*    io; // guest file I/O of whatever this worker runs, NULL to block instead
+    uint32_t     index;
+    pthread_t    thread;
+    bool         started;
+} SchedulerWorker;
+
+struct VMScheduler
+{
+    SchedulerWorker* workers;
+    uint32_t         worker_count;
+    uint64_t         slice;
+    VMTask**         pending;
+    uint32_t         pending_count;
+    uint32_t         pending_cap;
+    _Atomic uint32_t remaining;
+};
+
+static void deque_push(TaskDeque* deque, VMTask* task)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    atomic_store_explicit(&deque->slots[bottom & deque->mask], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+/*
+ *   NULL when the deque is empty or another worker won the race for the top task.
+ * */
+static VMTask* deque_steal(TaskDeque* deque)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+    {
+        return NULL;
+    }
+    VMTask* task = atomic_load_explicit(&deque->slots[top & deque->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+    {
+        return NULL;
+    }
+    return task;
+}
+
+/*
+ *   The VMWriteFn installed on every scheduled VM: output is appended to the task's own buffer,
+ *   kept NUL-terminated.
+ * */
+static int8_t task_write(void* user, const uint8_t* data, uint32_t len, bool end_line)
+{
+    VMTask*  task   = user;
+    uint32_t needed = task->output_len + len + (end_line ? 1 : 0) + 1;
+    if (needed > task->output_cap)
+    {
+        uint32_t capacity = task->output_cap ? task->output_cap * 2 : TASK_OUTPUT_MIN_CAPACITY;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        char* output = realloc(task->output, capacity);
+        if (output == NULL)
+        {
+            LOG_ERROR("Unable to grow a task output buffer to %u bytes\n", capacity);
+            return VM_ERR_MEMORY_ALLOCATION_FAILED;
+        }
+        task->output     = output;
+        task->output_cap = capacity;
+    }
+    memcpy(task->output + task->output_len, data, len);
+    task->output_len += len;
+    if (end_line)
+    {
+        task->output[task->output_len++] = '\n';
+    }
+    task->output[task->output_len] = '\0';
+    return VM_EXIT_SUCCESS;
+}
+
+static VMTask* find_task(SchedulerWorker* self)
+{
+    VMScheduler* scheduler = self->scheduler;
+    for (uint32_t i = 0; i < scheduler->worker_count; i++)
+    {
+        uint32_t victim = (self->index + i) % scheduler->worker_count;
+        VMTask*  task   = deque_steal(&scheduler->workers[victim].deque);
+        if (task != NULL)
+        {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void* worker_main(void* arg)
+{
+    SchedulerWorker* self      = arg;
+    VMScheduler*     scheduler = self->scheduler;
+    while (atomic_load_explicit(&scheduler->remaining, memory_order_acquire) > 0)
+    {
+        if (self->io != NULL)
+        {
+            vm_io_ring_reap(self->io);
+        }
+        VMTask* task = find_task(self);
+        if (task == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+
+        task->vm->io       = self->io;
+        VMRunResult result = vm_step_n(task->vm, scheduler->slice);
+        task->vm->io       = NULL;
+        task->slices++;
+        if (result == VM_RUN_BUDGET_EXHAUSTED || result == VM_RUN_IO_WAIT)
+        {
+            deque_push(&self->deque, task);
+            continue;
+        }
+        task->result = result;
+        atomic_fetch_sub_explicit(&scheduler->remaining, 1, memory_order_release);
+    }
+    if (self->io != NULL)
+    {
+        vm_io_ring_drain(self->io);
+    }
+    return NULL;
+}
+
+/*
+ *   slice: instructions a VM may run before it goes back on a deque (block granularity, see
+ *   VMContext.fuel).
+ * */
+VMScheduler* vm_scheduler_create(uint32_t worker_count, uint64_t slice)
+{
+    if (worker_count == 0 || slice == 0)
+    {
+        LOG_ERROR("A scheduler needs at least one worker and a non-zero slice\n");
+        return NULL;
+    }
+    VMScheduler* scheduler = calloc(1, sizeof(VMScheduler));
+    if (scheduler == NULL)
+    {
+        LOG_ERROR("Unable to allocate the scheduler\n");
+        return NULL;
+    }
+    // Over-aligned so two workers' deque indices never share a cache line
+    size_t workers_size = worker_count * sizeof(SchedulerWorker);
+    scheduler->workers  = aligned_alloc(SCHEDULER_CACHE_LINE, workers_size);
+    if (scheduler->workers == NULL)
+    {
+        LOG_ERROR("Unable to allocate %u scheduler workers\n", worker_count);
+        free(scheduler);
+        return NULL;
+    }
+    memset(scheduler->workers, 0, workers_size);
+    scheduler->worker_count = worker_count;
+    scheduler->slice        = slice;
+    for (uint32_t i = 0; i < worker_count; i++)
+    {
+        scheduler->workers[i].scheduler = scheduler;
+        scheduler->workers[i].index     = i;
+        scheduler->workers[i].io        = vm_io_ring_create(WORKER_IO_ENTRIES);
+    }
+    return scheduler;
+}
+
+/*
+ *   Queues a task for the next vm_scheduler_run. The scheduler takes over task->vm's output sink.
+ * */
+int8_t vm_scheduler_submit(VMScheduler* scheduler, VMTask* task)
+{
+    if (scheduler->pending_count == scheduler->pending_cap)
+    {
+        uint32_t capacity = scheduler->pending_cap ? scheduler->pending_cap * 2 : 16;
+        VMTask** pending  = realloc(scheduler->pending, capacity * sizeof(VMTask*));
+        if (pending == NULL)
+        {
+            LOG_ERROR("Unable to queue more than %u tasks\n", scheduler->pending_cap);
+            return VM_ERR_MEMORY_ALLOCATION_FAILED;
+        }
+        scheduler->pending     = pending;
+        scheduler->pending_cap = capacity;
+    }
+    task->vm->write      = task_write;
+    task->vm->write_user = task;
+    scheduler->pending[scheduler->pending_count++] = task;
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Runs every submitted task to completion and returns once all of them have halted or failed.
+ *   The calling thread works as worker 0.
+ * */
+int8_t vm_scheduler_run(VMScheduler* scheduler)
+{
+    int64_t capacity = 1;
+    while (capacity < scheduler->pending_count)
+    {
+        capacity *= 2;
+    }
+    for (uint32_t i = 0; i < scheduler->worker_count; i++)
+    {
+        TaskDeque* deque = &scheduler->workers[i].deque;
+        free(deque->slots);
+        deque->slots = calloc((size_t) capacity, sizeof(VMTask*));
+        if (deque->slots == NULL)
+        {
+            LOG_ERROR("Unable to allocate a deque of %ld tasks\n", (long) capacity);
+            return VM_ERR_MEMORY_ALLOCATION_FAILED;
+        }
+        deque->mask = capacity - 1;
+        atomic_store(&deque->top, 0);
+        atomic_store(&deque->bottom, 0);
+    }
+    for (uint32_t i = 0; i < scheduler->pending_count; i++)
+    {
+        deque_push(&scheduler->workers[i % scheduler->worker_count].deque, scheduler->pending[i]);
+    }
+    atomic_store(&scheduler->remaining, scheduler->pending_count);
+    scheduler->pending_count = 0;
+
+    // Tasks of a worker that fails to start are stolen by the others
+    for (uint32_t i = 1; i < scheduler->worker_count; i++)
+    {
+        SchedulerWorker* worker = &scheduler->workers[i];
+        worker->started = pthread_create(&worker->thread, NULL, worker_main, worker) == 0;
+        if (!worker->started)
+        {
+            LOG_WARN("Unable to start scheduler worker %u\n", i);
+        }
+    }
+    worker_main(&scheduler->workers[0]);
+    for (uint32_t i = 1; i < scheduler->worker_count; i++)
+    {
+        if (scheduler->workers[i].started)
+        {
+            pthread_join(scheduler->workers[i].thread, NULL);
+        }
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+void vm_scheduler_destroy(VMScheduler* scheduler)
+{
+    if (scheduler == NULL)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < scheduler->worker_count; i++)
+    {
+        free(scheduler->workers[i].deque.slots);
+        vm_io_ring_destroy(scheduler->workers[i].io);
+    }
+    free(scheduler->workers);
+    free(scheduler->pending);
+    free(scheduler);
+}
+
+void vm_task_release(VMTask* task)
+{
+    free(task->output);
+    task->output     = NULL;
+    task->output_len = 0;
+    task->output_cap = 0;
+}
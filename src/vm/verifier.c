@@ -0,0 +1,232 @@
+#include "vm_verifier.h"
+#include "bytecode.h"
+#include "instruction_format_table.h"
+#include "logger.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool mode_has_register(VMAddressingMode mode)
+{
+    return mode == VM_AM_REG_DIRECT || mode == VM_AM_REG_INDIRECT || mode == VM_AM_BASE_OFFSET;
+}
+
+static bool mode_is_known(VMAddressingMode mode)
+{
+    return mode == VM_AM_REG_DIRECT || mode == VM_AM_IMM_INT || mode == VM_AM_IMM_ADDR ||
+           mode == VM_AM_REG_INDIRECT || mode == VM_AM_BASE_OFFSET || mode == VM_AM_PC_RELATIVE;
+}
+
+static VMAddressingMode operand_mode(const uint8_t* instruction, int index)
+{
+    const uint8_t metadata = instruction[METADATA_INDEX];
+    return (VMAddressingMode) (index == 0 ? GET_DEST_MODE(metadata) : GET_SRC_MODE(metadata));
+}
+
+static uint32_t operand_immediate(const uint8_t* instruction)
+{
+    uint32_t imm;
+    memcpy(&imm, &instruction[IMMEDIATE_VALUE_START], sizeof(uint32_t));
+    return imm;
+}
+
+/*
+ *   Whether operand `index` of `opcode` names a v-register, which is bounded by
+ *   VM_VECTOR_REGISTER_COUNT rather than VM_REGISTER_COUNT.
+ * */
+static bool is_vector_operand(uint8_t opcode, int index)
+{
+    return opcode_info[opcode].operands[index] == OT_VECTOR_REGISTER;
+}
+
+/*
+ *   Returns why operand `index` is unacceptable for its opcode, or NULL when it is fine.
+ * */
+static const char* check_operand(const uint8_t* instruction, int index, OperandType expected)
+{
+    const VMAddressingMode mode = operand_mode(instruction, index);
+
+    switch (expected)
+    {
+    case OT_REGISTER:
+    case OT_VECTOR_REGISTER:
+        if (mode != VM_AM_REG_DIRECT)
+        {
+            return "operand must be a register";
+        }
+        break;
+    case OT_IMMEDIATE_INT:
+        if (mode != VM_AM_IMM_INT)
+        {
+            return "operand must be an immediate";
+        }
+        break;
+    case OT_SYMBOL:
+        if (mode != VM_AM_IMM_ADDR && mode != VM_AM_PC_RELATIVE && mode != VM_AM_REG_DIRECT)
+        {
+            return "branch target has an unusable mode";
+        }
+        break;
+    case OT_ANY_SOURCE:
+        if (!mode_is_known(mode))
+        {
+            return "unknown addressing mode";
+        }
+        if (mode == VM_AM_IMM_ADDR && operand_immediate(instruction) > MEM_SIZE - sizeof(uint64_t))
+        {
+            return "immediate address out of range";
+        }
+        break;
+    default:
+        return "opcode table has an unexpected operand type";
+    }
+
+    if (mode_has_register(mode) && instruction[OPERAND_1_INDEX + index] >= VM_REGISTER_COUNT)
+    {
+        return "register id out of range";
+    }
+    if (is_vector_operand(instruction[OPCODE_INDEX], index) &&
+        instruction[OPERAND_1_INDEX + index] >= VM_VECTOR_REGISTER_COUNT)
+    {
+        return "vector register id out of range";
+    }
+    return NULL;
+}
+
+/*
+ *   Static target of a branch operand as a code offset, or false when it is only known at run
+ *   time. PC-relative targets are taken from the end of the instruction, where pc points once it
+ *   has been fetched.
+ * */
+bool vm_static_branch_target(const uint8_t* instruction, uint32_t pc, uint32_t* out)
+{
+    switch (operand_mode(instruction, 0))
+    {
+    case VM_AM_IMM_ADDR:
+        *out = operand_immediate(instruction) - CODE_START;
+        return true;
+    case VM_AM_PC_RELATIVE:
+        *out = pc + INSTRUCTION_SIZE + operand_immediate(instruction);
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool is_instruction_start(const uint8_t* starts, uint32_t code_len, uint32_t offset)
+{
+    return offset < code_len && offset % INSTRUCTION_SIZE == 0 && starts[offset / INSTRUCTION_SIZE];
+}
+
+bool vm_verify(const VMContext* ctx, uint32_t code_len, uint32_t entry_point)
+{
+    const uint8_t* code   = ctx->memory + CODE_START;
+    const char*    reason = NULL;
+    uint32_t       pc     = 0;
+
+    if (code_len == 0 || code_len % INSTRUCTION_SIZE != 0)
+    {
+        LOG_WARN("Code length %u is not a whole number of instructions\n", code_len);
+        return false;
+    }
+
+    uint8_t* starts = calloc(code_len / INSTRUCTION_SIZE, 1);
+    if (starts == NULL)
+    {
+        return false;
+    }
+
+    // Pass 1: instruction boundaries, opcodes and operands
+    for (pc = 0; pc < code_len && reason == NULL; pc += bytecode_fixed_size(code[pc]))
+    {
+        const uint8_t     opcode = code[pc];
+        const OpcodeInfo* info   = &opcode_info[opcode];
+        if (info->name == NULL || opcode == OP_UNKNOWN || opcode_handler[opcode] == NULL)
+        {
+            reason = "unknown opcode";
+            break;
+        }
+        if (bytecode_fixed_size(opcode) > code_len - pc)
+        {
+            reason = "instruction runs past the end of the code";
+            break;
+        }
+        starts[pc / INSTRUCTION_SIZE] = 1;
+
+        for (int i = 0; i < info->operand_count && reason == NULL; i++)
+        {
+            reason = check_operand(code + pc, i, info->operands[i]);
+        }
+    }
+
+    // Pass 2: every static branch target and the entry point land on an instruction
+    if (reason == NULL && !is_instruction_start(starts, code_len, entry_point))
+    {
+        reason = "entry point is not an instruction";
+        pc     = entry_point;
+    }
+    for (uint32_t at = 0; at < code_len && reason == NULL; at += bytecode_fixed_size(code[at]))
+    {
+        uint32_t target;
+        if (opcode_info[code[at]].operands[0] == OT_SYMBOL &&
+            vm_static_branch_target(code + at, at, &target) &&
+            !is_instruction_start(starts, code_len, target))
+        {
+            reason = "branch target is not an instruction";
+            pc     = at;
+        }
+    }
+    free(starts);
+
+    if (reason != NULL)
+    {
+        LOG_WARN("Image not verified (%s at 0x%X), using checked handlers\n", reason,
+                 CODE_START + pc);
+        return false;
+    }
+    return true;
+}
+
+/*
+ *   Checked-path guard for images that were not verified: register bytes index registers[] and
+ *   vregisters[] directly, so they are bounded here before any handler runs.
+ * */
+int8_t vm_check_registers(const DecodedInstruction* instruction)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        const VMOperand* operand = &instruction->operands[i];
+        uint8_t          reg_id;
+        if (is_vector_operand(instruction->opcode, i))
+        {
+            // Vector handlers index vregisters[] whatever the operand's mode says
+            if (operand->mode != VM_AM_REG_DIRECT ||
+                operand->value.reg_id >= VM_VECTOR_REGISTER_COUNT)
+            {
+                LOG_ERROR("Vector register id %u does not exist\n", operand->value.reg_id);
+                return VM_ERR_REGISTER_NOT_FOUND;
+            }
+            continue;
+        }
+        switch (operand->mode)
+        {
+        case VM_AM_REG_DIRECT:
+        case VM_AM_REG_INDIRECT:
+            reg_id = operand->value.reg_id;
+            break;
+        case VM_AM_BASE_OFFSET:
+            reg_id = operand->value.base_and_offset.reg_id;
+            break;
+        default:
+            continue;
+        }
+        if (reg_id >= VM_REGISTER_COUNT)
+        {
+            LOG_ERROR("Register id %u does not exist\n", reg_id);
+            return VM_ERR_REGISTER_NOT_FOUND;
+        }
+    }
+    return VM_EXIT_SUCCESS;
+}
@@ -1,9 +1,17 @@
 // LOCAL LIBRARY
 #include "vm.h"
+#include "bytecode.h"
 #include "instruction_format_table.h"
 #include "lexer.h"
 #include "logger.h"
+#include "vm_heap.h"
+#include "vm_image.h"
+#include "vm_io.h"
+#include "vm_pipe.h"
+#include "vm_simd.h"
+#include "vm_threads.h"
 #include "vm_utils.h"
+#include "vm_verifier.h"
 
 // STANDARD LIBRARY
 #include <stdbool.h>
@@ -16,27 +24,89 @@ InstructionHandler opcode_handler[256] = {[OP_PRINT_CHR] = handle_print_chr,
                                           [OP_PRINT_STR] = handle_print_str,
                                           [OP_MOV]       = handle_mov,
                                           [OP_LOAD_ADDR] = handle_load_addr,
-                                          // [OP_MUL]       = handle_mul,
-                                          // [OP_DIV]       = handle_div,
-                                          // [OP_MOD]       = handle_mod,
-                                          // [OP_AND]       = handle_and,
-                                          // [OP_OR]        = handle_or,
-                                          // [OP_NOT]       = handle_not,
-                                          // [OP_CMP]       = handle_cmp,
-                                          // [OP_JZ]        = handle_jz,
-                                          // [OP_JNZ]       = handle_jnz,
-                                          // [OP_JEQ]       = handle_jeq,
-                                          // [OP_JGT]       = handle_jgt,
-                                          // [OP_JGE]       = handle_jge,
-                                          // [OP_JLT]       = handle_jlt,
-                                          // [OP_JLE]       = handle_jle,
-                                          // [OP_JMP]       = handle_jmp,
-                                          // [OP_CALL]      = handle_call,
-                                          // [OP_RET]       = handle_ret,
-                                          // [OP_PUSH]      = handle_push,
-                                          // [OP_POP]       = handle_pop,
-                                          // [OP_UNKNOWN]   = handle_unknown
-                                          [OP_HALT] = handle_halt};
+                                          [OP_ADD]       = handle_add,
+                                          [OP_SUB]       = handle_sub,
+                                          [OP_MUL]       = handle_mul,
+                                          [OP_DIV]       = handle_div,
+                                          [OP_MOD]       = handle_mod,
+                                          [OP_AND]       = handle_and,
+                                          [OP_OR]        = handle_or,
+                                          [OP_NOT]       = handle_not,
+                                          [OP_CMP]       = handle_cmp,
+                                          [OP_JZ]        = handle_jz,
+                                          [OP_JNZ]       = handle_jnz,
+                                          [OP_JEQ]       = handle_jeq,
+                                          [OP_JGT]       = handle_jgt,
+                                          [OP_JGE]       = handle_jge,
+                                          [OP_JLT]       = handle_jlt,
+                                          [OP_JLE]       = handle_jle,
+                                          [OP_JMP]       = handle_jmp,
+                                          [OP_CALL]      = handle_call,
+                                          [OP_RET]       = handle_ret,
+                                          [OP_PUSH]      = handle_push,
+                                          [OP_POP]       = handle_pop,
+                                          [OP_HALT]      = handle_halt,
+                                          [OP_ALLOC]     = handle_alloc,
+                                          [OP_FREE]      = handle_free,
+                                          [OP_REALLOC]   = handle_realloc,
+                                          [OP_MEMCPY]    = handle_memcpy,
+                                          [OP_MEMSET]    = handle_memset,
+                                          [OP_MEMCMP]    = handle_memcmp,
+                                          [OP_MEMCHR]    = handle_memchr,
+                                          [OP_STRLEN]    = handle_strlen,
+                                          [OP_VLOAD]     = handle_vload,
+                                          [OP_VSTORE]    = handle_vstore,
+                                          [OP_VSPLAT8]   = handle_vsplat,
+                                          [OP_VSPLAT32]  = handle_vsplat,
+                                          [OP_VADD8]     = handle_vector_lanes,
+                                          [OP_VADD32]    = handle_vector_lanes,
+                                          [OP_VSUB8]     = handle_vector_lanes,
+                                          [OP_VSUB32]    = handle_vector_lanes,
+                                          [OP_VMUL32]    = handle_vector_lanes,
+                                          [OP_VAND]      = handle_vector_lanes,
+                                          [OP_VOR]       = handle_vector_lanes,
+                                          [OP_VCMPEQ8]   = handle_vector_lanes,
+                                          [OP_VCMPEQ32]  = handle_vector_lanes,
+                                          [OP_VSUM8]     = handle_vsum,
+                                          [OP_VSUM32]    = handle_vsum,
+                                          [OP_MOVQ]      = handle_movq,
+                                          [OP_SPAWN]     = handle_spawn,
+                                          [OP_CHAN]      = handle_chan,
+                                          [OP_YIELD]     = handle_yield,
+                                          [OP_JOIN]      = handle_join,
+                                          [OP_SEND]      = handle_send,
+                                          [OP_RECV]      = handle_recv,
+                                          [OP_PSEND]     = handle_psend,
+                                          [OP_PRECV]     = handle_precv,
+                                          [OP_CALLNATIVE] = handle_callnative,
+                                          [OP_OPEN]      = handle_open,
+                                          [OP_READ]      = handle_read,
+                                          [OP_WRITE]     = handle_write,
+                                          [OP_CLOSE]     = handle_close};
+
+static int8_t handle_mov_verified(VMContext*, DecodedInstruction);
+static int8_t handle_movq_verified(VMContext*, DecodedInstruction);
+static int8_t handle_load_addr_verified(VMContext*, DecodedInstruction);
+static int8_t handle_print_str_verified(VMContext*, DecodedInstruction);
+static int8_t handle_branch_verified(VMContext*, DecodedInstruction);
+
+/*
+ *   Handlers used instead of opcode_handler for images that passed vm_verify. Opcodes without an
+ *   entry here have nothing the verifier can prove and keep their checked handler.
+ * */
+static const InstructionHandler verified_handler[256] = {
+    [OP_MOV]       = handle_mov_verified,
+    [OP_MOVQ]      = handle_movq_verified,
+    [OP_LOAD_ADDR] = handle_load_addr_verified,
+    [OP_PRINT_STR] = handle_print_str_verified,
+    [OP_JZ]        = handle_branch_verified,
+    [OP_JNZ]       = handle_branch_verified,
+    [OP_JEQ]       = handle_branch_verified,
+    [OP_JGT]       = handle_branch_verified,
+    [OP_JGE]       = handle_branch_verified,
+    [OP_JLT]       = handle_branch_verified,
+    [OP_JLE]       = handle_branch_verified,
+    [OP_JMP]       = handle_branch_verified};
 
 /*
  *   Creates initial vm state
@@ -57,7 +127,11 @@ VMContext* vm_create()
         return NULL;
     }
 
-    ctx->state = VM_STATE_HALTED;
+    ctx->state       = VM_STATE_HALTED;
+    ctx->word_mask   = UINT32_MAX;
+    ctx->fuel        = VM_FUEL_UNLIMITED;
+    ctx->stack_base  = STACK_END;
+    ctx->stack_limit = STACK_START;
     return ctx;
 }
 
@@ -66,11 +140,18 @@ void vm_destroy(VMContext* ctx)
     printf("DEBUG: vm_destroy called.\n");
     if (ctx)
     {
+        vm_close_files(ctx);
+        if (ctx->image)
+        {
+            vm_image_detach(ctx);
+        }
         if (ctx->memory)
         {
             free(ctx->memory);
             printf("DEBUG: ctx->memory freed.\n");
         }
+        free(ctx->profile);
+        free(ctx->block_cost);
         free(ctx);
         printf("DEBUG: ctx freed.\n");
     }
@@ -80,23 +161,161 @@ void vm_destroy(VMContext* ctx)
     }
 }
 
+/*
+ *   Stops ctx for good. The process keeps running and the caller still owns ctx; it is up to
+ *   the host whether a fatal guest error is fatal for it too.
+ * */
 void vm_terminate(VMContext* ctx, int8_t error_code, uint32_t pc)
 {
-    ctx->state = VM_STATE_FATAL_ERROR;
+    ctx->state      = VM_STATE_FATAL_ERROR;
+    ctx->last_error = error_code;
     LOG_ERROR("FATAL ERROR %d at PC: 0x%X\n", error_code, pc);
-    vm_destroy(ctx);
-    exit(error_code);
+}
+
+static int8_t read_segment(VMContext* ctx, FILE* bytecode_file, uint32_t start, uint32_t len)
+{
+    if (fread(&ctx->memory[start], 1, len, bytecode_file) != len)
+    {
+        LOG_ERROR("Segment at 0x%X seems to be truncated.\n", start);
+        return VM_ERR_INVALID_BYTECODE;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Version 2 images are expanded into the fixed 8-byte form once, here, so the dispatch loop only
+ *   ever sees one encoding.
+ * */
+static int8_t load_compact_code(VMContext* ctx, FILE* bytecode_file, uint32_t code_len,
+                                uint32_t* expanded_len)
+{
+    uint8_t* compact = (uint8_t*) malloc(code_len);
+    if (compact == NULL)
+    {
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    int8_t status = VM_ERR_INVALID_BYTECODE;
+    if (fread(compact, 1, code_len, bytecode_file) == code_len)
+    {
+        status = bytecode_compact_expand(compact, code_len, &ctx->memory[CODE_START], CODE_SIZE,
+                                         expanded_len);
+    }
+    else
+    {
+        LOG_ERROR("Code segments seems to be truncated.\n");
+    }
+    free(compact);
+    return status;
+}
+
+/*
+ *   Places one section at the start of its segment with a single read. `seen` collects the section
+ *   types already loaded so a duplicate cannot overwrite an earlier one, and `code_len` receives
+ *   the length of the code as it sits in memory.
+ * */
+static int8_t load_section(VMContext* ctx, FILE* bytecode_file, const BytecodeSection* section,
+                           uint8_t* seen, uint32_t* code_len)
+{
+    uint32_t start;
+    switch (section->type)
+    {
+    case BYTECODE_SECTION_CODE:
+        start = CODE_START;
+        break;
+    case BYTECODE_SECTION_RODATA:
+        start = RODATA_START;
+        break;
+    case BYTECODE_SECTION_DATA:
+        start = DATA_START;
+        break;
+    default:
+        LOG_ERROR("Unknown section type %u\n", section->type);
+        return VM_ERR_INVALID_BYTECODE;
+    }
+
+    const uint8_t known_flags = section->type == BYTECODE_SECTION_CODE ? BYTECODE_SECTION_COMPACT : 0;
+    if ((*seen & (1u << section->type)) || (section->flags & ~known_flags) != 0 ||
+        section->align_log2 > BYTECODE_MAX_ALIGN_LOG2 ||
+        (section->offset & ((1u << section->align_log2) - 1)) != 0)
+    {
+        LOG_ERROR("Malformed entry for section type %u\n", section->type);
+        return VM_ERR_INVALID_BYTECODE;
+    }
+    *seen |= (uint8_t) (1u << section->type);
+
+    if (fseek(bytecode_file, section->offset, SEEK_SET) != 0)
+    {
+        LOG_ERROR("Section at file offset %u is out of range\n", section->offset);
+        return VM_ERR_INVALID_BYTECODE;
+    }
+    if (section->flags & BYTECODE_SECTION_COMPACT)
+    {
+        return load_compact_code(ctx, bytecode_file, section->size, code_len);
+    }
+    if (section->type == BYTECODE_SECTION_CODE)
+    {
+        *code_len = section->size;
+    }
+    return read_segment(ctx, bytecode_file, start, section->size);
+}
+
+/*
+ *   block_cost[slot]: instructions from that slot through the next jump, call, ret or halt. One
+ *   backward pass, with each slot first holding the width of the instruction starting there (0 for
+ *   the second word of a MOVQ). Only instruction starts end up nonzero, which is what
+ *   vm_check_dynamic_target relies on.
+ * */
+static int8_t compute_block_costs(VMContext* ctx, uint32_t code_len)
+{
+    const uint32_t slots = code_len / INSTRUCTION_SIZE;
+    free(ctx->block_cost);
+    ctx->block_cost_len = 0;
+    ctx->block_cost     = calloc(CODE_SLOTS, sizeof(uint32_t));
+    if (ctx->block_cost == NULL)
+    {
+        LOG_ERROR("Unable to allocate the block cost table\n");
+        return VM_ERR_MEMORY_ALLOCATION_FAILED;
+    }
+
+    const uint8_t* code = ctx->memory + CODE_START;
+    for (uint32_t slot = 0; slot < slots;)
+    {
+        const uint8_t opcode  = code[slot * INSTRUCTION_SIZE];
+        ctx->block_cost[slot] = bytecode_fixed_size(opcode) / INSTRUCTION_SIZE;
+        slot += ctx->block_cost[slot];
+    }
+    for (uint32_t slot = slots; slot-- > 0;)
+    {
+        const uint32_t width = ctx->block_cost[slot];
+        if (width == 0)
+        {
+            continue;
+        }
+        const uint8_t  opcode = code[slot * INSTRUCTION_SIZE];
+        const bool     ends   = (opcode >= OP_JZ && opcode <= OP_RET) || opcode == OP_HALT ||
+                            vm_thread_switch_point(opcode);
+        const uint32_t next   = slot + width;
+        ctx->block_cost[slot] = 1 + (ends || next >= slots ? 0 : ctx->block_cost[next]);
+    }
+    ctx->block_cost_len = slots;
+    return VM_EXIT_SUCCESS;
 }
 
 int8_t load_bytecode(VMContext* ctx, const char* file_name)
 {
     BytecodeFileHeader header;
 
+    if (ctx->image != NULL)
+    {
+        LOG_ERROR("A context created from an image cannot load another program\n");
+        return VM_ERR_ILLEGAL_OPERATION;
+    }
+
     FILE* bytecode_file = fopen(file_name, "rb");
     if (!bytecode_file)
     {
-        LOG_ERROR("Failed to open file %s, check if the file exists and try again.\n");
-        fclose(bytecode_file);
+        LOG_ERROR("Failed to open file %s, check if the file exists and try again.\n", file_name);
         return VM_ERR_IO_READ_FAILED;
     }
 
@@ -122,7 +341,11 @@ int8_t load_bytecode(VMContext* ctx, const char* file_name)
         return VM_ERR_INVALID_BYTECODE;
     }
 
-    if (header.version_number != BYTECODE_SUPPORTED_VERSION)
+    uint16_t format = header.version_number & BYTECODE_VERSION_MASK;
+    if (header.magic_number != BYTECODE_MAGIC ||
+        (format != BYTECODE_SUPPORTED_VERSION && format != BYTECODE_COMPACT_VERSION &&
+         format != BYTECODE_SECTIONED_VERSION) ||
+        (header.version_number & ~(BYTECODE_VERSION_MASK | BYTECODE_FLAG_WIDE)) != 0)
     {
         LOG_ERROR("Unsupported bytecode version.\n");
         fclose(bytecode_file);
@@ -143,22 +366,33 @@ int8_t load_bytecode(VMContext* ctx, const char* file_name)
         return VM_ERR_INVALID_BYTECODE;
     }
 
-    size_t bytes_read = fread(&ctx->memory[CODE_START], 1, header.code_len, bytecode_file);
-    if (bytes_read != header.code_len)
+    uint8_t  seen     = 0;
+    uint32_t code_len = 0;
+    for (uint16_t i = 0; i < header.section_count && status == VM_EXIT_SUCCESS; i++)
     {
-        LOG_ERROR("Code segments seems to be truncated.\n");
+        status = load_section(ctx, bytecode_file, &header.sections[i], &seen, &code_len);
+    }
+    if (status != VM_EXIT_SUCCESS)
+    {
+        LOG_ERROR("Failed to load %s\n", file_name);
         fclose(bytecode_file);
-        return VM_ERR_INVALID_BYTECODE;
+        return status;
     }
 
-    ctx->pc = CODE_START + header.entry_point;
-    ctx->sp = STACK_START + STACK_SIZE;
-    ctx->bp = STACK_START + STACK_SIZE;
-    ctx->hp = HEAP_START;
+    ctx->pc          = CODE_START + header.entry_point;
+    ctx->sp          = STACK_START + STACK_SIZE;
+    ctx->bp          = STACK_START + STACK_SIZE;
+    ctx->stack_base  = STACK_END;
+    ctx->stack_limit = STACK_START;
+    ctx->word_mask   = (header.version_number & BYTECODE_FLAG_WIDE) ? UINT64_MAX : UINT32_MAX;
+    ctx->verified    = vm_verify(ctx, code_len, header.entry_point);
+    ctx->code_size   = code_len;
+    ctx->entry_point = header.entry_point;
+    vm_heap_init(ctx);
 
     fclose(bytecode_file);
 
-    return VM_EXIT_SUCCESS;
+    return compute_block_costs(ctx, code_len);
 }
 
 int8_t fetch_instruction(VMContext* ctx, uint8_t* out)
@@ -214,7 +448,7 @@ int8_t decode_instruction(VMContext* ctx, const uint8_t* instruction, DecodedIns
     if (info->operand_count == 2)
     {
         VMAddressingMode src_mode = GET_SRC_MODE(out->metadata_flags);
-        printf("DEBUG: src_mode calculated: %u\n", src_mode);
+        LOG_TRACE("src_mode calculated: %u\n", src_mode);
         out->operands[1].mode = src_mode;
         uint8_t raw_id_byte_1 = instruction[OPERAND_2_INDEX];
         populate_operand(&out->operands[1], raw_id_byte_1, imm_addr_or_val);
@@ -226,30 +460,62 @@ int8_t decode_instruction(VMContext* ctx, const uint8_t* instruction, DecodedIns
     return VM_EXIT_SUCCESS;
 }
 
-int8_t run_vm(VMContext* ctx, const char* file_name)
+/*
+ *   Charges the block starting at pc against ctx->fuel, or yields when the budget is spent.
+ *   Called on entry to every block, so straight-line code pays nothing per instruction, and the
+ *   charge itself is one table load, a subtraction and a sign test: the slot is masked into the
+ *   CODE_SLOTS-entry table instead of bounds checked. A pc outside the code is charged whatever
+ *   its masked slot holds; the fetch that follows fails anyway.
+ * */
+static inline void vm_enter_block(VMContext* ctx)
 {
-    // VMError            error_state;
-    DecodedInstruction decoded_instruction;
-
-    uint8_t raw_instruction[INSTRUCTION_SIZE];
-    int8_t  status;
+    if (__builtin_expect(ctx->fuel <= 0, 0))
+    {
+        ctx->state = VM_STATE_YIELDED;
+        return;
+    }
+    ctx->fuel -= ctx->block_cost[((ctx->pc - CODE_START) / INSTRUCTION_SIZE) & (CODE_SLOTS - 1)];
+}
 
-    if (ctx->state != VM_STATE_HALTED)
+/*
+ *   Fetches and decodes the instruction at pc and moves pc past it. Code of an image-backed
+ *   context comes from the image's predecoded table instead.
+ * */
+static inline int8_t next_instruction(VMContext* ctx, DecodedInstruction* out)
+{
+    if (ctx->predecoded != NULL && ctx->pc < CODE_START + ctx->code_size &&
+        ctx->pc % INSTRUCTION_SIZE == 0)
     {
-        LOG_WARN("VM is not in HALTED state. Starting anyway.");
+        const uint32_t slot = (ctx->pc - CODE_START) / INSTRUCTION_SIZE;
+        ctx->pc += INSTRUCTION_SIZE;
+        *out = ctx->predecoded[slot];
+        return ctx->predecode_status[slot];
     }
 
-    ctx->state = VM_STATE_RUNNING;
-    status     = load_bytecode(ctx, file_name);
+    uint8_t raw_instruction[INSTRUCTION_SIZE];
+    int8_t  status = fetch_instruction(ctx, raw_instruction);
     if (status != VM_EXIT_SUCCESS)
     {
-        LOG_ERROR("Error %d while loading bytecode\n", status);
-        vm_terminate(ctx, status, ctx->pc - INSTRUCTION_SIZE);
+        return status;
     }
+    return decode_instruction(ctx, raw_instruction, out);
+}
+
+static int8_t run_instructions(VMContext* ctx)
+{
+    DecodedInstruction decoded_instruction;
+    int8_t             status;
+
+    vm_enter_block(ctx);
     while (ctx->state == VM_STATE_RUNNING)
     {
-        // Fetch
-        status = fetch_instruction(ctx, raw_instruction);
+        if (ctx->profile != NULL && ctx->pc < CODE_START + CODE_SIZE)
+        {
+            ctx->profile[(ctx->pc - CODE_START) / INSTRUCTION_SIZE]++;
+        }
+
+        // Fetch and decode
+        status = next_instruction(ctx, &decoded_instruction);
         if (status != VM_EXIT_SUCCESS)
         {
             if (status == VM_ERR_PC_OUT_OF_BOUNDS)
@@ -258,13 +524,7 @@ int8_t run_vm(VMContext* ctx, const char* file_name)
                 break;
             }
             vm_terminate(ctx, status, ctx->pc - INSTRUCTION_SIZE);
-        }
-
-        // Decode
-        status = decode_instruction(ctx, raw_instruction, &decoded_instruction);
-        if (status != VM_EXIT_SUCCESS)
-        {
-            vm_terminate(ctx, status, ctx->pc - INSTRUCTION_SIZE);
+            return status;
         }
 
         // Execute
@@ -273,13 +533,29 @@ int8_t run_vm(VMContext* ctx, const char* file_name)
         {
             uint32_t instruction_pc = ctx->pc - INSTRUCTION_SIZE;
 
+            if (status == VM_ERR_IO_WOULD_BLOCK)
+            {
+                // Only the print, pipe and file instructions get here, and they leave pc alone.
+                // Other guest threads run meanwhile; the instruction is retried when this thread's
+                // turn comes back.
+                ctx->pc = instruction_pc;
+                if (vm_thread_switch(ctx))
+                {
+                    vm_enter_block(ctx);
+                    continue;
+                }
+                ctx->state = VM_STATE_IO_WAIT;
+                return VM_EXIT_SUCCESS;
+            }
             if (status > VM_EXIT_SUCCESS && status <= VM_ERR_UNKNOWN)
             {
                 vm_terminate(ctx, status, instruction_pc);
+                return status;
             }
             else if (status >= VM_ERR_STACK_OVERFLOW)
             {
-                ctx->state = VM_STATE_SOFT_ERROR;
+                ctx->state      = VM_STATE_SOFT_ERROR;
+                ctx->last_error = status;
                 LOG_ERROR("Soft error %d at PC: 0x%X\n", status, instruction_pc);
                 return status;
             }
@@ -287,25 +563,150 @@ int8_t run_vm(VMContext* ctx, const char* file_name)
             {
                 LOG_ERROR("Unknown status code (%d) returned from execute routine", status);
                 vm_terminate(ctx, VM_ERR_UNKNOWN, instruction_pc);
+                return VM_ERR_UNKNOWN;
             }
         }
     }
     return VM_EXIT_SUCCESS;
 }
 
+/*
+ *   A VM that stops for good takes back its file I/O still in flight, which a guest thread that
+ *   never got to collect it may have left behind.
+ * */
+static int8_t execute_loop(VMContext* ctx)
+{
+    int8_t status = run_instructions(ctx);
+    if (ctx->state != VM_STATE_YIELDED && ctx->state != VM_STATE_IO_WAIT)
+    {
+        vm_io_cancel(ctx);
+    }
+    return status;
+}
+
+/*
+ *   Loads file_name and runs it until it halts, fails or runs out of fuel. In the last case the
+ *   state is VM_STATE_YIELDED and vm_resume picks up where it stopped.
+ * */
+int8_t run_vm(VMContext* ctx, const char* file_name)
+{
+    if (ctx->state != VM_STATE_HALTED)
+    {
+        LOG_WARN("VM is not in HALTED state. Starting anyway.");
+    }
+
+    int8_t status = vm_load(ctx, file_name);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+    ctx->state = VM_STATE_RUNNING;
+    return execute_loop(ctx);
+}
+
+int8_t vm_resume(VMContext* ctx)
+{
+    if (ctx->state != VM_STATE_YIELDED)
+    {
+        LOG_ERROR("Only a yielded VM can be resumed (state %d)\n", ctx->state);
+        return VM_ERR_ILLEGAL_OPERATION;
+    }
+    ctx->state = VM_STATE_RUNNING;
+    return execute_loop(ctx);
+}
+
+/*
+ *   Loads file_name without running it: on success the VM is yielded at the entry point, ready
+ *   for vm_step_n or vm_run_until.
+ * */
+int8_t vm_load(VMContext* ctx, const char* file_name)
+{
+    int8_t status = load_bytecode(ctx, file_name);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        LOG_ERROR("Error %d while loading bytecode\n", status);
+        vm_terminate(ctx, status, ctx->pc);
+        return status;
+    }
+    ctx->state = VM_STATE_YIELDED;
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Grants a fresh budget of n instructions (block granularity, see ctx->fuel) and runs.
+ * */
+VMRunResult vm_step_n(VMContext* ctx, uint64_t n)
+{
+    ctx->fuel = n > (uint64_t) VM_FUEL_UNLIMITED ? VM_FUEL_UNLIMITED : (int64_t) n;
+    return vm_run_until(ctx);
+}
+
+/*
+ *   Continues a yielded or I/O-waiting VM until it halts, fails, blocks on output or spends
+ *   whatever fuel it was left with. On a VM that already finished it only reports how.
+ * */
+VMRunResult vm_run_until(VMContext* ctx)
+{
+    switch (ctx->state)
+    {
+    case VM_STATE_YIELDED:
+    case VM_STATE_IO_WAIT:
+        ctx->state = VM_STATE_RUNNING;
+        execute_loop(ctx);
+        break;
+    case VM_STATE_RUNNING:
+        LOG_ERROR("vm_run_until called on a VM that is already running\n");
+        return VM_RUN_ERROR;
+    default:
+        break;
+    }
+
+    switch (ctx->state)
+    {
+    case VM_STATE_HALTED:
+        return VM_RUN_HALTED;
+    case VM_STATE_YIELDED:
+        return VM_RUN_BUDGET_EXHAUSTED;
+    case VM_STATE_IO_WAIT:
+        return VM_RUN_IO_WAIT;
+    default:
+        return VM_RUN_ERROR;
+    }
+}
+
 int8_t execute_bytecode(VMContext* ctx, DecodedInstruction* instruction)
 {
     VMState state = ctx->state;
     LOG_DEBUG("VM State: %d\n", state);
     Opcode opcode = instruction->opcode;
     LOG_DEBUG("Opcode: %x\n", opcode);
-    int8_t status = opcode_handler[opcode](ctx, *instruction);
-    if (status != VM_EXIT_SUCCESS)
+    InstructionHandler handler = opcode_handler[opcode];
+    if (ctx->verified)
+    {
+        if (verified_handler[opcode] != NULL)
+        {
+            handler = verified_handler[opcode];
+        }
+    }
+    else
+    {
+        int8_t status = vm_check_registers(instruction);
+        if (status != VM_EXIT_SUCCESS)
+        {
+            return status;
+        }
+    }
+    if (handler == NULL)
+    {
+        LOG_ERROR("No handler registered for opcode %d\n", opcode);
+        return VM_ERR_OPCODE_NOT_FOUND;
+    }
+    int8_t status = handler(ctx, *instruction);
+    if (status != VM_EXIT_SUCCESS && status != VM_ERR_IO_WOULD_BLOCK)
     {
         LOG_ERROR("VM exited with error code %d\n", status);
-        return status;
     }
-    return VM_EXIT_SUCCESS;
+    return status;
 }
 
 int8_t handle_print_chr(VMContext* ctx, DecodedInstruction instruction)
@@ -317,14 +718,9 @@ int8_t handle_print_chr(VMContext* ctx, DecodedInstruction instruction)
     {
         uint8_t reg_id = instruction.operands[0].value.reg_id;
         uint8_t chr    = (uint8_t) (ctx->registers[reg_id] & LSB_MASK);
-        fprintf(stdout, "%c", (char) chr);
-    }
-    else
-    {
-        return VM_ERR_ILLEGAL_OPERATION;
+        return vm_write_output(ctx, &chr, 1, false);
     }
-
-    return VM_EXIT_SUCCESS;
+    return VM_ERR_ILLEGAL_OPERATION;
 }
 
 int8_t handle_print_str(VMContext* ctx, DecodedInstruction instruction)
@@ -337,7 +733,7 @@ int8_t handle_print_str(VMContext* ctx, DecodedInstruction instruction)
         const uint32_t address = ctx->registers[reg_id];
         if (address < MEM_SIZE)
         {
-            vm_print_string(ctx, address);
+            return vm_print_string(ctx, address);
         }
     }
     else if (mode == VM_AM_IMM_ADDR)
@@ -345,7 +741,7 @@ int8_t handle_print_str(VMContext* ctx, DecodedInstruction instruction)
         uint32_t address = instruction.operands[0].value.address_or_value;
         if (address < MEM_SIZE)
         {
-            vm_print_string(ctx, address);
+            return vm_print_string(ctx, address);
         }
     }
     else
@@ -357,71 +753,23 @@ int8_t handle_print_str(VMContext* ctx, DecodedInstruction instruction)
 
 int8_t handle_mov(VMContext* ctx, DecodedInstruction instruction)
 {
-    uint8_t  dest_register_id = instruction.operands[0].value.reg_id;
-    uint32_t imm_addr_or_val  = instruction.operands[1].value.address_or_value;
+    uint8_t dest_register_id = instruction.operands[0].value.reg_id;
     switch (instruction.operands[1].mode)
     {
-
     case VM_AM_REG_DIRECT:
-    {
-        uint8_t  src_reg_id              = instruction.operands[1].value.reg_id;
-        uint32_t src_data                = ctx->registers[src_reg_id];
-        ctx->registers[dest_register_id] = src_data;
-        break;
-    }
     case VM_AM_IMM_INT:
-    {
-        ctx->registers[dest_register_id] = imm_addr_or_val;
-        break;
-    }
     case VM_AM_IMM_ADDR:
-    {
-        uint32_t address = imm_addr_or_val;
-        if (address > MEM_SIZE)
-        {
-            LOG_ERROR("Cannot access past the memory boundry\n");
-            return VM_ERR_MEMORY_OUT_OF_BOUNDS;
-        }
-        else
-        {
-            uint8_t* src_data_ptr = ctx->memory + address;
-            memcpy(&ctx->registers[dest_register_id], src_data_ptr, sizeof(uint32_t));
-            break;
-        }
-    }
     case VM_AM_REG_INDIRECT:
-    {
-        uint8_t  src_reg_id = instruction.operands[1].value.reg_id;
-        uint32_t address    = ctx->registers[src_reg_id];
-        if (address > MEM_SIZE)
-        {
-            LOG_ERROR("Cannot access past the memory boundry\n");
-            return VM_ERR_MEMORY_OUT_OF_BOUNDS;
-        }
-        else
-        {
-            uint8_t* src_data_ptr = ctx->memory + address;
-            memcpy(&ctx->registers[dest_register_id], src_data_ptr, sizeof(uint32_t));
-            break;
-        }
-    }
-
     case VM_AM_BASE_OFFSET:
     {
-        uint8_t  src_reg_id   = instruction.operands[1].value.reg_id;
-        uint32_t base_address = ctx->registers[src_reg_id];
-        uint32_t offset       = imm_addr_or_val;
-        if (base_address >= MEM_SIZE || base_address + offset >= MEM_SIZE)
-        {
-            LOG_ERROR("Cannot access past memory boundry\n");
-            return VM_ERR_MEMORY_OUT_OF_BOUNDS;
-        }
-        else
+        uint64_t src_data;
+        int8_t   status = vm_read_operand(ctx, &instruction.operands[1], &src_data);
+        if (status != VM_EXIT_SUCCESS)
         {
-            uint8_t* src_data_ptr = ctx->memory + (base_address + offset);
-            memcpy(&ctx->registers[dest_register_id], src_data_ptr, sizeof(uint32_t));
-            break;
+            return status;
         }
+        ctx->registers[dest_register_id] = src_data;
+        break;
     }
 
     case VM_AM_PC_RELATIVE:
@@ -433,11 +781,32 @@ int8_t handle_mov(VMContext* ctx, DecodedInstruction instruction)
     return VM_EXIT_SUCCESS;
 }
 
+/*
+ *   MOVQ rD, imm64 is the one 16-byte instruction: its imm32 field holds the low half of the
+ *   constant and the first four bytes of the following word hold the high half. In 32-bit mode
+ *   the constant is truncated like any other result.
+ * */
+int8_t handle_movq(VMContext* ctx, DecodedInstruction instruction)
+{
+    if (ctx->pc > MEM_SIZE - INSTRUCTION_SIZE)
+    {
+        LOG_ERROR("MOVQ at 0x%X is missing its immediate word\n", ctx->pc - INSTRUCTION_SIZE);
+        return VM_ERR_PC_OUT_OF_BOUNDS;
+    }
+
+    uint64_t high = vm_load_u32(ctx, ctx->pc);
+    uint64_t low  = instruction.operands[1].value.address_or_value;
+    ctx->pc += EXTENDED_INSTRUCTION_SIZE - INSTRUCTION_SIZE;
+
+    ctx->registers[instruction.operands[0].value.reg_id] = ((high << 32) | low) & ctx->word_mask;
+    return VM_EXIT_SUCCESS;
+}
+
 int8_t handle_load_addr(VMContext* ctx, DecodedInstruction instruction)
 {
     uint8_t  dest_register_id   = instruction.operands[0].value.reg_id;
     uint32_t imm_addr_or_offset = instruction.operands[1].value.address_or_value;
-    switch (instruction.operands->mode)
+    switch (instruction.operands[1].mode)
     {
 
     case VM_AM_REG_DIRECT:
@@ -461,7 +830,7 @@ int8_t handle_load_addr(VMContext* ctx, DecodedInstruction instruction)
     }
     case VM_AM_REG_INDIRECT:
     {
-        uint8_t  src_reg_id = instruction.operands[0].value.reg_id;
+        uint8_t  src_reg_id = instruction.operands[1].value.reg_id;
         uint32_t address    = ctx->registers[src_reg_id];
         if (address >= MEM_SIZE)
         {
@@ -486,7 +855,7 @@ int8_t handle_load_addr(VMContext* ctx, DecodedInstruction instruction)
         }
         else
         {
-            ctx->registers[src_reg_id] = (base_address + offset);
+            ctx->registers[dest_register_id] = (base_address + offset);
             break;
         }
     }
@@ -503,12 +872,957 @@ int8_t handle_load_addr(VMContext* ctx, DecodedInstruction instruction)
     return VM_EXIT_SUCCESS;
 }
 
-int8_t handle_halt(VMContext* ctx, DecodedInstruction instruction)
+/*
+ *   Shared body of the two-operand arithmetic/logic instructions: dest = dest <op> source.
+ *   Arithmetic is done natively in 64 bits and masked down to the register width, so carry and
+ *   overflow come out at bit 31 or bit 63 depending on the image's mode.
+ * */
+static int8_t execute_alu(VMContext* ctx, DecodedInstruction instruction)
 {
-    if (instruction.opcode == OP_HALT && ctx->state != VM_STATE_HALTED)
+    const uint64_t mask             = ctx->word_mask;
+    const uint64_t sign             = vm_sign_bit(ctx);
+    uint8_t        dest_register_id = instruction.operands[0].value.reg_id;
+    uint64_t       lhs              = ctx->registers[dest_register_id];
+    uint64_t       rhs              = 0;
+    uint64_t       result           = 0;
+    bool           carry            = false;
+    bool           overflow         = false;
+
+    if (instruction.operands[1].mode != VM_AM_NONE)
     {
-        ctx->state = VM_STATE_HALTED;
-        return VM_EXIT_SUCCESS;
+        int8_t status = vm_read_operand(ctx, &instruction.operands[1], &rhs);
+        if (status != VM_EXIT_SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    switch (instruction.opcode)
+    {
+    case OP_ADD:
+        result   = (lhs + rhs) & mask;
+        carry    = result < lhs;
+        overflow = ((lhs ^ result) & (rhs ^ result) & sign) != 0;
+        break;
+    case OP_SUB:
+        result   = (lhs - rhs) & mask;
+        carry    = lhs < rhs;
+        overflow = ((lhs ^ rhs) & (lhs ^ result) & sign) != 0;
+        break;
+    case OP_MUL:
+        result = (lhs * rhs) & mask;
+        break;
+    case OP_DIV:
+    case OP_MOD:
+        if (rhs == 0)
+        {
+            LOG_ERROR("Division by zero\n");
+            return VM_ERR_DIVIDE_BY_ZERO;
+        }
+        result = instruction.opcode == OP_DIV ? lhs / rhs : lhs % rhs;
+        break;
+    case OP_AND:
+        result = lhs & rhs;
+        break;
+    case OP_OR:
+        result = lhs | rhs;
+        break;
+    case OP_NOT:
+        result = ~lhs & mask;
+        break;
+    default:
+        return VM_ERR_ILLEGAL_OPERATION;
+    }
+
+    ctx->registers[dest_register_id] = result;
+    vm_set_flags(ctx, result, carry, overflow);
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_add(VMContext* ctx, DecodedInstruction instruction)
+{
+    return execute_alu(ctx, instruction);
+}
+
+int8_t handle_sub(VMContext* ctx, DecodedInstruction instruction)
+{
+    return execute_alu(ctx, instruction);
+}
+
+int8_t handle_mul(VMContext* ctx, DecodedInstruction instruction)
+{
+    return execute_alu(ctx, instruction);
+}
+
+int8_t handle_div(VMContext* ctx, DecodedInstruction instruction)
+{
+    return execute_alu(ctx, instruction);
+}
+
+int8_t handle_mod(VMContext* ctx, DecodedInstruction instruction)
+{
+    return execute_alu(ctx, instruction);
+}
+
+int8_t handle_and(VMContext* ctx, DecodedInstruction instruction)
+{
+    return execute_alu(ctx, instruction);
+}
+
+int8_t handle_or(VMContext* ctx, DecodedInstruction instruction)
+{
+    return execute_alu(ctx, instruction);
+}
+
+int8_t handle_not(VMContext* ctx, DecodedInstruction instruction)
+{
+    return execute_alu(ctx, instruction);
+}
+
+/*
+ *   CMP takes no operands: it compares R0 against R1 and only updates the flags.
+ * */
+int8_t handle_cmp(VMContext* ctx, DecodedInstruction instruction)
+{
+    (void) instruction;
+    uint64_t lhs    = ctx->registers[REG_R0];
+    uint64_t rhs    = ctx->registers[REG_R1];
+    uint64_t result = (lhs - rhs) & ctx->word_mask;
+    vm_set_flags(ctx, result, lhs < rhs, ((lhs ^ rhs) & (lhs ^ result) & vm_sign_bit(ctx)) != 0);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Whether the conditional jump `opcode` is taken for the current flags. jgt/jge/jlt/jle are the
+ *   signed comparisons, so "less" is sign != overflow.
+ * */
+static bool branch_taken(const VMContext* ctx, Opcode opcode)
+{
+    const bool zero = ctx->flags[VM_FLAG_ZERO];
+    const bool less = ctx->flags[VM_FLAG_SIGN] != ctx->flags[VM_FLAG_OVERFLOW];
+    switch (opcode)
+    {
+    case OP_JZ:
+    case OP_JEQ:
+        return zero;
+    case OP_JNZ:
+        return !zero;
+    case OP_JGT:
+        return !zero && !less;
+    case OP_JGE:
+        return !less;
+    case OP_JLT:
+        return less;
+    case OP_JLE:
+        return zero || less;
+    default:
+        return true;
+    }
+}
+
+static int8_t jump_if(VMContext* ctx, DecodedInstruction instruction, bool condition)
+{
+    if (!condition)
+    {
+        vm_enter_block(ctx);
+        return VM_EXIT_SUCCESS;
+    }
+
+    uint32_t target;
+    int8_t   status = vm_branch_target(ctx, &instruction.operands[0], &target);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+    ctx->pc = target;
+    vm_enter_block(ctx);
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_jz(VMContext* ctx, DecodedInstruction instruction)
+{
+    return jump_if(ctx, instruction, branch_taken(ctx, OP_JZ));
+}
+
+int8_t handle_jnz(VMContext* ctx, DecodedInstruction instruction)
+{
+    return jump_if(ctx, instruction, branch_taken(ctx, OP_JNZ));
+}
+
+int8_t handle_jeq(VMContext* ctx, DecodedInstruction instruction)
+{
+    return jump_if(ctx, instruction, branch_taken(ctx, OP_JEQ));
+}
+
+int8_t handle_jgt(VMContext* ctx, DecodedInstruction instruction)
+{
+    return jump_if(ctx, instruction, branch_taken(ctx, OP_JGT));
+}
+
+int8_t handle_jge(VMContext* ctx, DecodedInstruction instruction)
+{
+    return jump_if(ctx, instruction, branch_taken(ctx, OP_JGE));
+}
+
+int8_t handle_jlt(VMContext* ctx, DecodedInstruction instruction)
+{
+    return jump_if(ctx, instruction, branch_taken(ctx, OP_JLT));
+}
+
+int8_t handle_jle(VMContext* ctx, DecodedInstruction instruction)
+{
+    return jump_if(ctx, instruction, branch_taken(ctx, OP_JLE));
+}
+
+int8_t handle_jmp(VMContext* ctx, DecodedInstruction instruction)
+{
+    return jump_if(ctx, instruction, true);
+}
+
+/*
+ *   CALL lays down a whole frame (saved bp + return address) behind a single stack check.
+ *   bp then points at the frame so RET can unwind it, along with anything pushed inside it.
+ * */
+int8_t handle_call(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint32_t target;
+    int8_t   status = vm_branch_target(ctx, &instruction.operands[0], &target);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    uint32_t frame = ctx->sp - STACK_FRAME_SIZE;
+    if (!STACK_RANGE_OK(ctx, frame, STACK_FRAME_SIZE))
+    {
+        return vm_stack_fault(ctx, frame);
+    }
+
+    vm_store_u32(ctx, frame, ctx->bp);
+    vm_store_u32(ctx, frame + STACK_SLOT_SIZE, ctx->pc);
+    ctx->sp = frame;
+    ctx->bp = frame;
+    ctx->pc = target;
+    vm_enter_block(ctx);
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_ret(VMContext* ctx, DecodedInstruction instruction)
+{
+    (void) instruction;
+    uint32_t frame = ctx->bp;
+    if (!STACK_RANGE_OK(ctx, frame, STACK_FRAME_SIZE))
+    {
+        return vm_stack_fault(ctx, frame);
+    }
+
+    uint32_t target = vm_load_u32(ctx, frame + STACK_SLOT_SIZE);
+    if (ctx->verified)
+    {
+        int8_t status = vm_check_dynamic_target(ctx, target);
+        if (status != VM_EXIT_SUCCESS)
+        {
+            return status;
+        }
+    }
+
+    ctx->bp = vm_load_u32(ctx, frame);
+    ctx->pc = target;
+    ctx->sp = frame + STACK_FRAME_SIZE;
+    vm_enter_block(ctx);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   PUSH and POP move one register-width slot: 4 bytes, or 8 in 64-bit mode.
+ * */
+int8_t handle_push(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint64_t value;
+    int8_t   status = vm_read_operand(ctx, &instruction.operands[0], &value);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    uint32_t slot_size = vm_word_size(ctx);
+    uint32_t slot      = ctx->sp - slot_size;
+    if (!STACK_RANGE_OK(ctx, slot, slot_size))
+    {
+        return vm_stack_fault(ctx, slot);
+    }
+
+    vm_store_word(ctx, slot, value);
+    ctx->sp = slot;
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_pop(VMContext* ctx, DecodedInstruction instruction)
+{
+    if (instruction.operands[0].mode != VM_AM_REG_DIRECT)
+    {
+        return VM_ERR_INVALID_ADDRESSING_MODE;
+    }
+
+    uint32_t slot_size = vm_word_size(ctx);
+    uint32_t slot      = ctx->sp;
+    if (!STACK_RANGE_OK(ctx, slot, slot_size))
+    {
+        return vm_stack_fault(ctx, slot);
+    }
+
+    ctx->registers[instruction.operands[0].value.reg_id] = vm_load_word(ctx, slot);
+    ctx->sp                                              = slot + slot_size;
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_halt(VMContext* ctx, DecodedInstruction instruction)
+{
+    if (ctx->threads.live > 0 && ctx->threads.current != 0)
+    {
+        // A spawned thread halting ends only that thread
+        int8_t status = vm_thread_exit(ctx);
+        vm_enter_block(ctx);
+        return status;
+    }
+    if (instruction.opcode == OP_HALT && ctx->state != VM_STATE_HALTED)
+    {
+        ctx->state = VM_STATE_HALTED;
+        return VM_EXIT_SUCCESS;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   ALLOC/REALLOC leave 0 in the destination and set the zero flag when the heap is exhausted.
+ * */
+int8_t handle_alloc(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint8_t  dest_register_id = instruction.operands[0].value.reg_id;
+    uint64_t size;
+    int8_t   status = vm_read_operand(ctx, &instruction.operands[1], &size);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    uint32_t address                 = size > HEAP_SIZE ? 0 : vm_heap_alloc(ctx, (uint32_t) size);
+    ctx->registers[dest_register_id] = address;
+    vm_set_flags(ctx, address, false, false);
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_free(VMContext* ctx, DecodedInstruction instruction)
+{
+    if (instruction.operands[0].mode != VM_AM_REG_DIRECT)
+    {
+        return VM_ERR_INVALID_ADDRESSING_MODE;
+    }
+    return vm_heap_free(ctx, ctx->registers[instruction.operands[0].value.reg_id]);
+}
+
+int8_t handle_realloc(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint8_t  dest_register_id = instruction.operands[0].value.reg_id;
+    uint64_t size;
+    int8_t   status = vm_read_operand(ctx, &instruction.operands[1], &size);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+    if (size > HEAP_SIZE)
+    {
+        vm_set_flags(ctx, 0, false, false);
+        return VM_EXIT_SUCCESS;
+    }
+
+    uint32_t address = vm_heap_realloc(ctx, ctx->registers[dest_register_id], (uint32_t) size);
+    if (address != 0 || size == 0)
+    {
+        ctx->registers[dest_register_id] = address;
+    }
+    vm_set_flags(ctx, address, false, false);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Bulk memory instructions. Each validates its whole range once against the segment map and then
+ *   hands the work to libc, which uses the host's vectorised routines.
+ * */
+int8_t handle_memcpy(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint32_t dest   = ctx->registers[instruction.operands[0].value.reg_id];
+    uint32_t src    = ctx->registers[instruction.operands[1].value.reg_id];
+    uint32_t count  = ctx->registers[VM_BULK_COUNT_REG];
+    int8_t   status = vm_check_range(dest, count, true);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        status = vm_check_range(src, count, false);
+    }
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    memmove(ctx->memory + dest, ctx->memory + src, count);
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_memset(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint32_t dest  = ctx->registers[instruction.operands[0].value.reg_id];
+    uint32_t count = ctx->registers[VM_BULK_COUNT_REG];
+    uint64_t value;
+    int8_t   status = vm_read_operand(ctx, &instruction.operands[1], &value);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        status = vm_check_range(dest, count, true);
+    }
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    memset(ctx->memory + dest, (int) (value & LSB_MASK), count);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Sets the flags as CMP would for the first differing byte, so JEQ/JLT/JGT work afterwards.
+ * */
+int8_t handle_memcmp(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint32_t lhs    = ctx->registers[instruction.operands[0].value.reg_id];
+    uint32_t rhs    = ctx->registers[instruction.operands[1].value.reg_id];
+    uint32_t count  = ctx->registers[VM_BULK_COUNT_REG];
+    int8_t   status = vm_check_range(lhs, count, false);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        status = vm_check_range(rhs, count, false);
+    }
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    int order = memcmp(ctx->memory + lhs, ctx->memory + rhs, count);
+    vm_set_flags(ctx, order < 0 ? UINT64_MAX : (uint64_t) (order > 0), order < 0, false);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Scans R2 bytes from the address in the destination register. The register ends up holding the
+ *   address of the first match, or 0 with the zero flag set when there is none.
+ * */
+int8_t handle_memchr(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint8_t  dest_register_id = instruction.operands[0].value.reg_id;
+    uint32_t start            = ctx->registers[dest_register_id];
+    uint32_t count            = ctx->registers[VM_BULK_COUNT_REG];
+    uint64_t value;
+    int8_t   status = vm_read_operand(ctx, &instruction.operands[1], &value);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        status = vm_check_range(start, count, false);
+    }
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    const uint8_t* match  = memchr(ctx->memory + start, (int) (value & LSB_MASK), count);
+    uint32_t       result = match ? (uint32_t) (match - ctx->memory) : 0;
+    ctx->registers[dest_register_id] = result;
+    vm_set_flags(ctx, result, false, false);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   The terminator must be found before the end of the string's segment.
+ * */
+int8_t handle_strlen(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint32_t         src     = ctx->registers[instruction.operands[1].value.reg_id];
+    const VMSegment* segment = vm_segment_of(src);
+    if (segment == NULL)
+    {
+        return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+    }
+
+    uint32_t       limit      = segment->start + segment->size - src;
+    const uint8_t* terminator = memchr(ctx->memory + src, 0, limit);
+    if (terminator == NULL)
+    {
+        LOG_ERROR("Unterminated string at 0x%X\n", src);
+        return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+    }
+
+    uint32_t length = (uint32_t) (terminator - (ctx->memory + src));
+    ctx->registers[instruction.operands[0].value.reg_id] = length;
+    vm_set_flags(ctx, length, false, false);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Vector instructions. Vector operands carry the v-register index (0-7) in their register byte;
+ *   address and scalar operands are ordinary r-registers.
+ * */
+int8_t handle_vload(VMContext* ctx, DecodedInstruction instruction)
+{
+    VMVector* dest    = &ctx->vregisters[instruction.operands[0].value.reg_id];
+    uint32_t  address = ctx->registers[instruction.operands[1].value.reg_id];
+    int8_t    status  = vm_check_range(address, VM_VECTOR_SIZE, false);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    memcpy(dest->u8, ctx->memory + address, VM_VECTOR_SIZE);
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_vstore(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint32_t        address = ctx->registers[instruction.operands[0].value.reg_id];
+    const VMVector* src     = &ctx->vregisters[instruction.operands[1].value.reg_id];
+    int8_t          status  = vm_check_range(address, VM_VECTOR_SIZE, true);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    memcpy(ctx->memory + address, src->u8, VM_VECTOR_SIZE);
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_vsplat(VMContext* ctx, DecodedInstruction instruction)
+{
+    VMVector* dest = &ctx->vregisters[instruction.operands[0].value.reg_id];
+    uint64_t  value;
+    int8_t    status = vm_read_operand(ctx, &instruction.operands[1], &value);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    if (instruction.opcode == OP_VSPLAT8)
+    {
+        vm_vec_splat8(dest, (uint8_t) (value & LSB_MASK));
+    }
+    else
+    {
+        vm_vec_splat32(dest, (uint32_t) value);
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_vector_lanes(VMContext* ctx, DecodedInstruction instruction)
+{
+    VMVector*       dest = &ctx->vregisters[instruction.operands[0].value.reg_id];
+    const VMVector* src  = &ctx->vregisters[instruction.operands[1].value.reg_id];
+
+    switch (instruction.opcode)
+    {
+    case OP_VADD8:
+        vm_vec_add8(dest, src);
+        break;
+    case OP_VADD32:
+        vm_vec_add32(dest, src);
+        break;
+    case OP_VSUB8:
+        vm_vec_sub8(dest, src);
+        break;
+    case OP_VSUB32:
+        vm_vec_sub32(dest, src);
+        break;
+    case OP_VMUL32:
+        vm_vec_mul32(dest, src);
+        break;
+    case OP_VAND:
+        vm_vec_and(dest, src);
+        break;
+    case OP_VOR:
+        vm_vec_or(dest, src);
+        break;
+    case OP_VCMPEQ8:
+        vm_vec_cmpeq8(dest, src);
+        break;
+    case OP_VCMPEQ32:
+        vm_vec_cmpeq32(dest, src);
+        break;
+    default:
+        return VM_ERR_ILLEGAL_OPERATION;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Horizontal reduction into a scalar register: the unsigned sum of all 8- or 32-bit lanes.
+ * */
+int8_t handle_vsum(VMContext* ctx, DecodedInstruction instruction)
+{
+    const VMVector* src = &ctx->vregisters[instruction.operands[1].value.reg_id];
+    uint32_t sum = instruction.opcode == OP_VSUM8 ? vm_vec_sum8(src) : vm_vec_sum32(src);
+
+    ctx->registers[instruction.operands[0].value.reg_id] = sum;
+    vm_set_flags(ctx, sum, false, false);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   spawn rD, label: starts a guest thread at label (vm_threads.c). rD gets its id, or 0 with
+ *   the zero flag set when every thread slot is taken. The first spawn is a stack overflow when
+ *   the main thread already uses more than its VM_THREAD_STACK_SIZE slice.
+ * */
+int8_t handle_spawn(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint32_t entry;
+    int8_t   status = vm_branch_target(ctx, &instruction.operands[1], &entry);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    uint32_t id;
+    status = vm_thread_spawn(ctx, entry, &id);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    ctx->registers[instruction.operands[0].value.reg_id] = id;
+    vm_set_flags(ctx, id, false, false);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   chan rD, capacity: rD gets a new channel holding up to capacity values, or 0 with the zero
+ *   flag set.
+ * */
+int8_t handle_chan(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint64_t capacity;
+    int8_t   status = vm_read_operand(ctx, &instruction.operands[1], &capacity);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+
+    uint32_t id                                          = vm_channel_create(ctx, capacity);
+    ctx->registers[instruction.operands[0].value.reg_id] = id;
+    vm_set_flags(ctx, id, false, false);
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t handle_yield(VMContext* ctx, DecodedInstruction instruction)
+{
+    (void) instruction;
+    vm_thread_switch(ctx);
+    vm_enter_block(ctx);
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   join rD: waits for thread rD to halt, then rD gets the r0 it halted with and the thread's
+ *   slot is free again.
+ * */
+int8_t handle_join(VMContext* ctx, DecodedInstruction instruction)
+{
+    const uint8_t  reg_id = instruction.operands[0].value.reg_id;
+    const uint64_t id     = ctx->registers[reg_id];
+    if (id == 0 || id >= VM_THREAD_MAX || id == ctx->threads.current ||
+        ctx->threads.threads[id].state == VM_THREAD_FREE)
+    {
+        LOG_ERROR("Thread %lu cannot be joined\n", (unsigned long) id);
+        return VM_ERR_INVALID_THREAD;
+    }
+
+    VMThread* thread = &ctx->threads.threads[id];
+    int8_t    status = VM_EXIT_SUCCESS;
+    if (thread->state == VM_THREAD_DONE)
+    {
+        ctx->registers[reg_id] = thread->exit_value;
+        thread->state          = VM_THREAD_FREE;
+        ctx->threads.live--;
+    }
+    else
+    {
+        status = vm_thread_block(ctx, VM_WAIT_JOIN, (uint32_t) id);
+    }
+    vm_enter_block(ctx);
+    return status;
+}
+
+/*
+ *   send rC, src: appends src to channel rC, first waiting while it is full.
+ * */
+int8_t handle_send(VMContext* ctx, DecodedInstruction instruction)
+{
+    const uint64_t id      = ctx->registers[instruction.operands[0].value.reg_id];
+    VMChannel*     channel = vm_channel(ctx, id);
+    uint64_t       value;
+    int8_t         status = vm_read_operand(ctx, &instruction.operands[1], &value);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+    if (channel == NULL)
+    {
+        LOG_ERROR("Channel %lu does not exist\n", (unsigned long) id);
+        return VM_ERR_INVALID_CHANNEL;
+    }
+
+    if (vm_channel_send(channel, value))
+    {
+        vm_thread_wake(ctx, VM_WAIT_RECV, (uint32_t) id);
+    }
+    else
+    {
+        status = vm_thread_block(ctx, VM_WAIT_SEND, (uint32_t) id);
+    }
+    vm_enter_block(ctx);
+    return status;
+}
+
+/*
+ *   recv rD, rC: takes the oldest value from channel rC into rD, first waiting while it is empty.
+ * */
+int8_t handle_recv(VMContext* ctx, DecodedInstruction instruction)
+{
+    const uint64_t id      = ctx->registers[instruction.operands[1].value.reg_id];
+    VMChannel*     channel = vm_channel(ctx, id);
+    if (channel == NULL)
+    {
+        LOG_ERROR("Channel %lu does not exist\n", (unsigned long) id);
+        return VM_ERR_INVALID_CHANNEL;
+    }
+
+    uint64_t value;
+    int8_t   status = VM_EXIT_SUCCESS;
+    if (vm_channel_recv(channel, &value))
+    {
+        ctx->registers[instruction.operands[0].value.reg_id] = value;
+        vm_thread_wake(ctx, VM_WAIT_SEND, (uint32_t) id);
+    }
+    else
+    {
+        status = vm_thread_block(ctx, VM_WAIT_RECV, (uint32_t) id);
+    }
+    vm_enter_block(ctx);
+    return status;
+}
+
+/*
+ *   psend rP, rA / precv rP, rA: moves one message between guest memory at rA and the pipe on
+ *   port rP. The message is copied once, between the VM's memory and the shared ring.
+ * */
+static int8_t pipe_operands(VMContext* ctx, DecodedInstruction instruction, bool writable,
+                            VMPipe** pipe, uint32_t* address)
+{
+    const uint64_t port = ctx->registers[instruction.operands[0].value.reg_id];
+    *pipe               = port < VM_PIPE_MAX ? ctx->pipes[port] : NULL;
+    if (*pipe == NULL)
+    {
+        LOG_ERROR("No pipe is attached to port %lu\n", (unsigned long) port);
+        return VM_ERR_INVALID_PIPE;
+    }
+    *address = ctx->registers[instruction.operands[1].value.reg_id];
+    return vm_check_range(*address, vm_pipe_message_size(*pipe), writable);
+}
+
+int8_t handle_psend(VMContext* ctx, DecodedInstruction instruction)
+{
+    VMPipe*  pipe;
+    uint32_t address;
+    int8_t   status = pipe_operands(ctx, instruction, false, &pipe, &address);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+    return vm_pipe_send(pipe, ctx->memory + address) ? VM_EXIT_SUCCESS : VM_ERR_IO_WOULD_BLOCK;
+}
+
+int8_t handle_precv(VMContext* ctx, DecodedInstruction instruction)
+{
+    VMPipe*  pipe;
+    uint32_t address;
+    int8_t   status = pipe_operands(ctx, instruction, true, &pipe, &address);
+    if (status != VM_EXIT_SUCCESS)
+    {
+        return status;
+    }
+    return vm_pipe_recv(pipe, ctx->memory + address) ? VM_EXIT_SUCCESS : VM_ERR_IO_WOULD_BLOCK;
+}
+
+/*
+ *   callnative id: one indirect call into the host. The function works on the register file in
+ *   place, so nothing is copied in or out.
+ * */
+int8_t handle_callnative(VMContext* ctx, DecodedInstruction instruction)
+{
+    const uint32_t id       = instruction.operands[0].value.address_or_value;
+    VMNativeFn     function = NULL;
+    if (id < VM_NATIVE_MAX && ctx->natives != NULL)
+    {
+        function = ctx->natives[id];
+    }
+    if (function == NULL)
+    {
+        LOG_ERROR("No native function is registered as %u\n", id);
+        return VM_ERR_INVALID_NATIVE;
+    }
+
+    int8_t status = function(ctx, ctx->registers);
+    ctx->registers[REG_R0] &= ctx->word_mask;
+    return status;
+}
+
+/*
+ *   File instructions. Results follow the system calls: a count, a handle or 0, or -errno, with
+ *   the flags set so that JLT branches on failure.
+ *
+ *   open rD, rA    opens the path string at rA with the VMOpenMode in R2; rD = handle
+ *   read rF, rA    reads up to R2 bytes from handle rF to rA; r0 = bytes read, 0 at end of file
+ *   write rF, rA   writes R2 bytes at rA to handle rF; r0 = bytes written
+ *   close rF       r0 = 0
+ * */
+static void set_io_result(VMContext* ctx, uint8_t reg_id, int64_t result)
+{
+    ctx->registers[reg_id] = (uint64_t) result & ctx->word_mask;
+    vm_set_flags(ctx, (uint64_t) result, false, false);
+}
+
+int8_t handle_open(VMContext* ctx, DecodedInstruction instruction)
+{
+    const uint8_t  reg_id = instruction.operands[0].value.reg_id;
+    const uint32_t path   = ctx->registers[instruction.operands[1].value.reg_id];
+    int64_t        result;
+    int8_t         status = vm_io_open(ctx, path, ctx->registers[VM_BULK_COUNT_REG], &result);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        set_io_result(ctx, reg_id, result);
+    }
+    return status;
+}
+
+int8_t handle_read(VMContext* ctx, DecodedInstruction instruction)
+{
+    const uint64_t handle  = ctx->registers[instruction.operands[0].value.reg_id];
+    const uint32_t address = ctx->registers[instruction.operands[1].value.reg_id];
+    const uint32_t count   = ctx->registers[VM_BULK_COUNT_REG];
+    int64_t        result;
+    int8_t         status = vm_io_read(ctx, handle, address, count, &result);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        set_io_result(ctx, REG_R0, result);
+    }
+    return status;
+}
+
+int8_t handle_write(VMContext* ctx, DecodedInstruction instruction)
+{
+    const uint64_t handle  = ctx->registers[instruction.operands[0].value.reg_id];
+    const uint32_t address = ctx->registers[instruction.operands[1].value.reg_id];
+    const uint32_t count   = ctx->registers[VM_BULK_COUNT_REG];
+    int64_t        result;
+    int8_t         status = vm_io_write(ctx, handle, address, count, &result);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        set_io_result(ctx, REG_R0, result);
+    }
+    return status;
+}
+
+int8_t handle_close(VMContext* ctx, DecodedInstruction instruction)
+{
+    const uint64_t handle = ctx->registers[instruction.operands[0].value.reg_id];
+    int64_t        result;
+    int8_t         status = vm_io_close(ctx, handle, &result);
+    if (status == VM_EXIT_SUCCESS)
+    {
+        set_io_result(ctx, REG_R0, result);
+    }
+    return status;
+}
+
+/*
+ *   Fast handler set. Each one relies on what vm_verify proved for the whole image: register ids
+ *   are in range, immediate data addresses leave room for a word, static branch targets start an
+ *   instruction, and a MOVQ has its second word. Operands only known at run time fall back to the
+ *   checked handler.
+ * */
+static int8_t handle_mov_verified(VMContext* ctx, DecodedInstruction instruction)
+{
+    const VMOperand* src  = &instruction.operands[1];
+    uint64_t*        dest = &ctx->registers[instruction.operands[0].value.reg_id];
+    switch (src->mode)
+    {
+    case VM_AM_REG_DIRECT:
+        *dest = ctx->registers[src->value.reg_id];
+        return VM_EXIT_SUCCESS;
+    case VM_AM_IMM_ADDR:
+        *dest = vm_load_word(ctx, src->value.address_or_value);
+        return VM_EXIT_SUCCESS;
+    default:
+        return handle_mov(ctx, instruction);
+    }
+}
+
+static int8_t handle_movq_verified(VMContext* ctx, DecodedInstruction instruction)
+{
+    uint64_t high = vm_load_u32(ctx, ctx->pc);
+    uint64_t low  = instruction.operands[1].value.address_or_value;
+    ctx->pc += EXTENDED_INSTRUCTION_SIZE - INSTRUCTION_SIZE;
+
+    ctx->registers[instruction.operands[0].value.reg_id] = ((high << 32) | low) & ctx->word_mask;
+    return VM_EXIT_SUCCESS;
+}
+
+static int8_t handle_load_addr_verified(VMContext* ctx, DecodedInstruction instruction)
+{
+    const VMOperand* src  = &instruction.operands[1];
+    uint64_t*        dest = &ctx->registers[instruction.operands[0].value.reg_id];
+    switch (src->mode)
+    {
+    case VM_AM_IMM_ADDR:
+        *dest = src->value.address_or_value;
+        return VM_EXIT_SUCCESS;
+    case VM_AM_PC_RELATIVE:
+        *dest = ctx->pc + src->value.address_or_value;
+        return VM_EXIT_SUCCESS;
+    default:
+        return handle_load_addr(ctx, instruction);
+    }
+}
+
+static int8_t handle_print_str_verified(VMContext* ctx, DecodedInstruction instruction)
+{
+    if (instruction.operands[0].mode == VM_AM_IMM_ADDR)
+    {
+        return vm_print_string(ctx, instruction.operands[0].value.address_or_value);
+    }
+    return handle_print_str(ctx, instruction);
+}
+
+static int8_t handle_branch_verified(VMContext* ctx, DecodedInstruction instruction)
+{
+    if (!branch_taken(ctx, instruction.opcode))
+    {
+        vm_enter_block(ctx);
+        return VM_EXIT_SUCCESS;
+    }
+
+    switch (instruction.operands[0].mode)
+    {
+    case VM_AM_IMM_ADDR:
+        ctx->pc = instruction.operands[0].value.address_or_value;
+        break;
+    case VM_AM_PC_RELATIVE:
+        ctx->pc += instruction.operands[0].value.address_or_value;
+        break;
+    default:
+        return jump_if(ctx, instruction, true);
     }
+    vm_enter_block(ctx);
     return VM_EXIT_SUCCESS;
 }
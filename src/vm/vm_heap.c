@@ -0,0 +1,367 @@
+#include "vm_heap.h"
+#include "logger.h"
+#include "vm_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ *   Guest heap allocator.
+ *
+ *   Blocks live in HEAP_START..HEAP_END and start with a 4-byte header holding the block size
+ *   (header included) and the VM_HEAP_* flag bits. Payloads are 8-byte aligned.
+ *
+ *   Small blocks (<= VM_HEAP_SMALL_MAX) are recycled through per-size-class LIFO bins and never
+ *   coalesced, so alloc/free on them is a couple of loads and stores. Larger blocks go on a
+ *   doubly linked free list with a footer, and are merged with free neighbours on free. Blocks
+ *   that end at ctx->hp are handed back to the untouched top of the heap instead.
+ *
+ *   Free list links live in the payload: next at +4, prev at +8 (large blocks only).
+ * */
+
+static const uint32_t size_classes[VM_HEAP_CLASS_COUNT] = {16,  32,  48,  64,  96,
+                                                           128, 192, 256, 384, 512};
+
+#define HEAP_FIRST_BLOCK (HEAP_START + VM_HEAP_HEADER_SIZE)
+#define LINK_NEXT(block) ((block) + 4)
+#define LINK_PREV(block) ((block) + 8)
+
+static inline uint32_t block_size(uint32_t header) { return header & ~VM_HEAP_FLAG_MASK; }
+
+static uint32_t size_class_ceil(uint32_t size)
+{
+    for (uint32_t i = 0; i < VM_HEAP_CLASS_COUNT; i++)
+    {
+        if (size <= size_classes[i])
+        {
+            return i;
+        }
+    }
+    return VM_HEAP_CLASS_COUNT;
+}
+
+// Blocks handed out by a split may sit between two classes; bin them by the class they can serve
+static uint32_t size_class_floor(uint32_t size)
+{
+    uint32_t index = 0;
+    while (index + 1 < VM_HEAP_CLASS_COUNT && size_classes[index + 1] <= size)
+    {
+        index++;
+    }
+    return index;
+}
+
+static void set_prev_free(VMContext* ctx, uint32_t block, bool prev_free)
+{
+    if (block >= ctx->hp)
+    {
+        return;
+    }
+    uint32_t header = vm_load_u32(ctx, block);
+    header = prev_free ? (header | VM_HEAP_PREV_FREE) : (header & ~VM_HEAP_PREV_FREE);
+    vm_store_u32(ctx, block, header);
+}
+
+static void unlink_large(VMContext* ctx, uint32_t block)
+{
+    uint32_t next = vm_load_u32(ctx, LINK_NEXT(block));
+    uint32_t prev = vm_load_u32(ctx, LINK_PREV(block));
+
+    if (prev != 0)
+    {
+        vm_store_u32(ctx, LINK_NEXT(prev), next);
+    }
+    else
+    {
+        ctx->heap.large_free = next;
+    }
+    if (next != 0)
+    {
+        vm_store_u32(ctx, LINK_PREV(next), prev);
+    }
+}
+
+static void push_large(VMContext* ctx, uint32_t block, uint32_t size)
+{
+    uint32_t head = ctx->heap.large_free;
+
+    vm_store_u32(ctx, block, size);
+    vm_store_u32(ctx, block + size - VM_HEAP_HEADER_SIZE, size);
+    vm_store_u32(ctx, LINK_NEXT(block), head);
+    vm_store_u32(ctx, LINK_PREV(block), 0);
+    if (head != 0)
+    {
+        vm_store_u32(ctx, LINK_PREV(head), block);
+    }
+    ctx->heap.large_free = block;
+    set_prev_free(ctx, block + size, true);
+}
+
+/*
+ *   First fit over the large free list, splitting off the tail when it is big enough to stand alone.
+ * */
+static uint32_t take_from_large(VMContext* ctx, uint32_t needed)
+{
+    for (uint32_t block = ctx->heap.large_free; block != 0;
+         block          = vm_load_u32(ctx, LINK_NEXT(block)))
+    {
+        uint32_t size = block_size(vm_load_u32(ctx, block));
+        if (size < needed)
+        {
+            continue;
+        }
+
+        unlink_large(ctx, block);
+        if (size - needed >= VM_HEAP_MIN_BLOCK)
+        {
+            vm_store_u32(ctx, block, needed | VM_HEAP_BLOCK_USED);
+            push_large(ctx, block + needed, size - needed);
+        }
+        else
+        {
+            vm_store_u32(ctx, block, size | VM_HEAP_BLOCK_USED);
+            set_prev_free(ctx, block + size, false);
+        }
+        return block;
+    }
+    return 0;
+}
+
+static uint32_t carve_top(VMContext* ctx, uint32_t needed)
+{
+    if (needed > HEAP_END - ctx->hp)
+    {
+        return 0;
+    }
+    uint32_t block = ctx->hp;
+    vm_store_u32(ctx, block, needed | VM_HEAP_BLOCK_USED);
+    ctx->hp += needed;
+    return block;
+}
+
+/*
+ *   Returns the block header address for a payload pointer, or 0 if it cannot be a block at all.
+ * */
+static uint32_t block_at(VMContext* ctx, uint32_t address)
+{
+    uint32_t block = address - VM_HEAP_HEADER_SIZE;
+    if (address < HEAP_FIRST_BLOCK + VM_HEAP_HEADER_SIZE || block >= ctx->hp ||
+        (block - HEAP_FIRST_BLOCK) % VM_HEAP_ALIGN != 0)
+    {
+        return 0;
+    }
+    uint32_t size = block_size(vm_load_u32(ctx, block));
+    if (size < VM_HEAP_MIN_BLOCK || size > ctx->hp - block)
+    {
+        return 0;
+    }
+    return block;
+}
+
+/*
+ *   Like block_at, but also 0 for a block that is free or sitting in a bin.
+ * */
+static uint32_t checked_block(VMContext* ctx, uint32_t address)
+{
+    uint32_t block = block_at(ctx, address);
+    if (block == 0)
+    {
+        return 0;
+    }
+    uint32_t header = vm_load_u32(ctx, block);
+    if (!(header & VM_HEAP_BLOCK_USED) || (header & VM_HEAP_BINNED))
+    {
+        return 0;
+    }
+    return block;
+}
+
+static uint32_t block_size_for(uint32_t size)
+{
+    uint32_t needed = (size + VM_HEAP_HEADER_SIZE + VM_HEAP_ALIGN - 1) & ~(VM_HEAP_ALIGN - 1);
+    return needed < VM_HEAP_MIN_BLOCK ? VM_HEAP_MIN_BLOCK : needed;
+}
+
+void vm_heap_init(VMContext* ctx)
+{
+    memset(&ctx->heap, 0, sizeof(VMHeap));
+    ctx->hp = HEAP_FIRST_BLOCK;
+}
+
+uint32_t vm_heap_alloc(VMContext* ctx, uint32_t size)
+{
+    if (size > HEAP_SIZE)
+    {
+        return 0;
+    }
+
+    uint32_t needed = block_size_for(size);
+    if (needed <= VM_HEAP_SMALL_MAX)
+    {
+        uint32_t index = size_class_ceil(needed);
+        uint32_t block = ctx->heap.bins[index];
+        needed         = size_classes[index];
+        if (block != 0)
+        {
+            ctx->heap.bins[index] = vm_load_u32(ctx, LINK_NEXT(block));
+            vm_store_u32(ctx, block, vm_load_u32(ctx, block) & ~VM_HEAP_BINNED);
+            return block + VM_HEAP_HEADER_SIZE;
+        }
+    }
+
+    uint32_t block = take_from_large(ctx, needed);
+    if (block == 0)
+    {
+        block = carve_top(ctx, needed);
+    }
+    if (block == 0)
+    {
+        LOG_WARN("Guest heap exhausted allocating %u bytes\n", size);
+        return 0;
+    }
+    return block + VM_HEAP_HEADER_SIZE;
+}
+
+int8_t vm_heap_free(VMContext* ctx, uint32_t address)
+{
+    if (address == 0)
+    {
+        return VM_EXIT_SUCCESS;
+    }
+
+    uint32_t block = block_at(ctx, address);
+    if (block == 0)
+    {
+        LOG_ERROR("free of 0x%X, which is not a heap block\n", address);
+        return VM_ERR_HEAP_OUT_OF_BOUNDS;
+    }
+
+    uint32_t header = vm_load_u32(ctx, block);
+    uint32_t size   = block_size(header);
+    if (!(header & VM_HEAP_BLOCK_USED) || (header & VM_HEAP_BINNED))
+    {
+        LOG_ERROR("Double free of 0x%X\n", address);
+        return VM_ERR_ILLEGAL_OPERATION;
+    }
+
+    if (size <= VM_HEAP_SMALL_MAX)
+    {
+        uint32_t index = size_class_floor(size);
+        vm_store_u32(ctx, block, header | VM_HEAP_BINNED);
+        vm_store_u32(ctx, LINK_NEXT(block), ctx->heap.bins[index]);
+        ctx->heap.bins[index] = block;
+        return VM_EXIT_SUCCESS;
+    }
+
+    uint32_t next = block + size;
+    if (next < ctx->hp)
+    {
+        uint32_t next_header = vm_load_u32(ctx, next);
+        if (!(next_header & VM_HEAP_BLOCK_USED))
+        {
+            unlink_large(ctx, next);
+            size += block_size(next_header);
+        }
+    }
+
+    if (header & VM_HEAP_PREV_FREE)
+    {
+        uint32_t prev_size = vm_load_u32(ctx, block - VM_HEAP_HEADER_SIZE);
+        block -= prev_size;
+        unlink_large(ctx, block);
+        size += prev_size;
+    }
+
+    if (block + size == ctx->hp)
+    {
+        ctx->hp = block;
+    }
+    else
+    {
+        push_large(ctx, block, size);
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+uint32_t vm_heap_realloc(VMContext* ctx, uint32_t address, uint32_t size)
+{
+    if (address == 0)
+    {
+        return vm_heap_alloc(ctx, size);
+    }
+    if (size == 0)
+    {
+        vm_heap_free(ctx, address);
+        return 0;
+    }
+
+    uint32_t block = checked_block(ctx, address);
+    if (block == 0)
+    {
+        LOG_ERROR("realloc of 0x%X, which is not an allocated heap block\n", address);
+        return 0;
+    }
+    if (size > HEAP_SIZE)
+    {
+        return 0;
+    }
+
+    uint32_t header  = vm_load_u32(ctx, block);
+    uint32_t current = block_size(header);
+    uint32_t needed  = block_size_for(size);
+    if (needed <= current)
+    {
+        return address;
+    }
+
+    // Grow in place into the top of the heap or a free neighbour before falling back to a copy
+    uint32_t next = block + current;
+    if (next == ctx->hp)
+    {
+        if (needed - current <= HEAP_END - ctx->hp)
+        {
+            vm_store_u32(ctx, block, needed | (header & VM_HEAP_FLAG_MASK));
+            ctx->hp = block + needed;
+            return address;
+        }
+    }
+    else
+    {
+        uint32_t next_header = vm_load_u32(ctx, next);
+        uint32_t combined    = current + block_size(next_header);
+        if (!(next_header & VM_HEAP_BLOCK_USED) && combined >= needed)
+        {
+            unlink_large(ctx, next);
+            if (combined - needed >= VM_HEAP_MIN_BLOCK)
+            {
+                vm_store_u32(ctx, block, needed | (header & VM_HEAP_FLAG_MASK));
+                push_large(ctx, block + needed, combined - needed);
+            }
+            else
+            {
+                vm_store_u32(ctx, block, combined | (header & VM_HEAP_FLAG_MASK));
+                set_prev_free(ctx, block + combined, false);
+            }
+            return address;
+        }
+    }
+
+    uint32_t moved = vm_heap_alloc(ctx, size);
+    if (moved == 0)
+    {
+        return 0;
+    }
+    memmove(ctx->memory + moved, ctx->memory + address, current - VM_HEAP_HEADER_SIZE);
+    vm_heap_free(ctx, address);
+    return moved;
+}
+
+uint32_t vm_heap_usable_size(VMContext* ctx, uint32_t address)
+{
+    uint32_t block = checked_block(ctx, address);
+    if (block == 0)
+    {
+        return 0;
+    }
+    return block_size(vm_load_u32(ctx, block)) - VM_HEAP_HEADER_SIZE;
+}
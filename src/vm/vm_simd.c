@@ -0,0 +1,173 @@
+#include "vm_simd.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+#define LOAD(v) _mm_loadu_si128((const __m128i*) (v)->u8)
+#define STORE(v, x) _mm_storeu_si128((__m128i*) (v)->u8, (x))
+
+void vm_vec_add8(VMVector* dest, const VMVector* src)
+{
+    STORE(dest, _mm_add_epi8(LOAD(dest), LOAD(src)));
+}
+
+void vm_vec_add32(VMVector* dest, const VMVector* src)
+{
+    STORE(dest, _mm_add_epi32(LOAD(dest), LOAD(src)));
+}
+
+void vm_vec_sub8(VMVector* dest, const VMVector* src)
+{
+    STORE(dest, _mm_sub_epi8(LOAD(dest), LOAD(src)));
+}
+
+void vm_vec_sub32(VMVector* dest, const VMVector* src)
+{
+    STORE(dest, _mm_sub_epi32(LOAD(dest), LOAD(src)));
+}
+
+/*
+ *   SSE2 has no 32-bit low multiply (pmulld is SSE4.1): multiply even and odd lanes separately
+ *   with pmuludq and interleave the low halves back together.
+ * */
+void vm_vec_mul32(VMVector* dest, const VMVector* src)
+{
+    __m128i a    = LOAD(dest);
+    __m128i b    = LOAD(src);
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd  = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    even         = _mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0));
+    odd          = _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0));
+    STORE(dest, _mm_unpacklo_epi32(even, odd));
+}
+
+void vm_vec_and(VMVector* dest, const VMVector* src)
+{
+    STORE(dest, _mm_and_si128(LOAD(dest), LOAD(src)));
+}
+
+void vm_vec_or(VMVector* dest, const VMVector* src)
+{
+    STORE(dest, _mm_or_si128(LOAD(dest), LOAD(src)));
+}
+
+void vm_vec_cmpeq8(VMVector* dest, const VMVector* src)
+{
+    STORE(dest, _mm_cmpeq_epi8(LOAD(dest), LOAD(src)));
+}
+
+void vm_vec_cmpeq32(VMVector* dest, const VMVector* src)
+{
+    STORE(dest, _mm_cmpeq_epi32(LOAD(dest), LOAD(src)));
+}
+
+void vm_vec_splat8(VMVector* dest, uint8_t value)
+{
+    STORE(dest, _mm_set1_epi8((char) value));
+}
+
+void vm_vec_splat32(VMVector* dest, uint32_t value)
+{
+    STORE(dest, _mm_set1_epi32((int) value));
+}
+
+uint32_t vm_vec_sum8(const VMVector* src)
+{
+    __m128i sums = _mm_sad_epu8(LOAD(src), _mm_setzero_si128());
+    return (uint32_t) (_mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4));
+}
+
+uint32_t vm_vec_sum32(const VMVector* src)
+{
+    __m128i v = LOAD(src);
+    v         = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v         = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t) _mm_cvtsi128_si32(v);
+}
+
+#else // portable fallback
+
+#define LANES8 VM_VECTOR_SIZE
+#define LANES32 (VM_VECTOR_SIZE / 4)
+
+void vm_vec_add8(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES8; i++)
+        dest->u8[i] += src->u8[i];
+}
+
+void vm_vec_add32(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES32; i++)
+        dest->u32[i] += src->u32[i];
+}
+
+void vm_vec_sub8(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES8; i++)
+        dest->u8[i] -= src->u8[i];
+}
+
+void vm_vec_sub32(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES32; i++)
+        dest->u32[i] -= src->u32[i];
+}
+
+void vm_vec_mul32(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES32; i++)
+        dest->u32[i] *= src->u32[i];
+}
+
+void vm_vec_and(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES32; i++)
+        dest->u32[i] &= src->u32[i];
+}
+
+void vm_vec_or(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES32; i++)
+        dest->u32[i] |= src->u32[i];
+}
+
+void vm_vec_cmpeq8(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES8; i++)
+        dest->u8[i] = dest->u8[i] == src->u8[i] ? 0xFF : 0x00;
+}
+
+void vm_vec_cmpeq32(VMVector* dest, const VMVector* src)
+{
+    for (int i = 0; i < LANES32; i++)
+        dest->u32[i] = dest->u32[i] == src->u32[i] ? UINT32_MAX : 0;
+}
+
+void vm_vec_splat8(VMVector* dest, uint8_t value) { memset(dest->u8, value, LANES8); }
+
+void vm_vec_splat32(VMVector* dest, uint32_t value)
+{
+    for (int i = 0; i < LANES32; i++)
+        dest->u32[i] = value;
+}
+
+uint32_t vm_vec_sum8(const VMVector* src)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < LANES8; i++)
+        sum += src->u8[i];
+    return sum;
+}
+
+uint32_t vm_vec_sum32(const VMVector* src)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < LANES32; i++)
+        sum += src->u32[i];
+    return sum;
+}
+
+#endif // __SSE2__
@@ -0,0 +1,223 @@
+#include "vm_threads.h"
+#include "logger.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ *   Green threads inside one VMContext.
+ *
+ *   Scheduling is cooperative and round-robin: the running thread keeps the interpreter until it
+ *   yields, blocks on a join or a channel, halts, or its output would block. A switch saves the
+ *   general registers, pc, sp, bp and flags of one thread and loads those of the next; nothing
+ *   else moves and no host thread is involved. Vector registers, memory and the heap are shared.
+ *
+ *   A blocked thread keeps its pc on the blocking instruction, which runs again once the thread
+ *   is woken. From the first spawn on, every thread, main included, owns the VM_THREAD_STACK_SIZE
+ *   slice of its id: stack_base and stack_limit follow the running thread, so push, pop, call
+ *   and ret fault at the edges of its slice instead of running into a neighbour's stack.
+ * */
+
+static void use_stack_slice(VMContext* ctx, uint32_t id)
+{
+    ctx->stack_base  = STACK_END - id * VM_THREAD_STACK_SIZE;
+    ctx->stack_limit = ctx->stack_base - VM_THREAD_STACK_SIZE;
+}
+
+static void save_thread(const VMContext* ctx, VMThread* thread)
+{
+    memcpy(thread->registers, ctx->registers, sizeof(thread->registers));
+    memcpy(thread->flags, ctx->flags, sizeof(thread->flags));
+    thread->pc = ctx->pc;
+    thread->sp = ctx->sp;
+    thread->bp = ctx->bp;
+}
+
+static void load_thread(VMContext* ctx, const VMThread* thread, uint32_t id)
+{
+    use_stack_slice(ctx, id);
+    memcpy(ctx->registers, thread->registers, sizeof(ctx->registers));
+    memcpy(ctx->flags, thread->flags, sizeof(ctx->flags));
+    ctx->pc = thread->pc;
+    ctx->sp = thread->sp;
+    ctx->bp = thread->bp;
+}
+
+/*
+ *   Starts a thread at entry with a copy of the caller's general registers, so arguments can be
+ *   passed in them, and an empty stack of its own. id gets its id, or 0 when all slots are taken.
+ *
+ *   The first spawn confines the thread that was running all along to the top slice, which fails
+ *   with VM_ERR_STACK_OVERFLOW when its stack has already grown past it.
+ * */
+int8_t vm_thread_spawn(VMContext* ctx, uint32_t entry, uint32_t* id)
+{
+    VMThreadTable* table = &ctx->threads;
+    if (table->live == 0)
+    {
+        if (ctx->sp < STACK_END - VM_THREAD_STACK_SIZE)
+        {
+            LOG_ERROR("Main thread uses more than its %u byte stack, cannot spawn\n",
+                      VM_THREAD_STACK_SIZE);
+            return VM_ERR_STACK_OVERFLOW;
+        }
+        // The thread that was running all along becomes thread 0
+        table->threads[0].state = VM_THREAD_READY;
+        table->current          = 0;
+        table->live             = 1;
+        use_stack_slice(ctx, 0);
+    }
+
+    *id = 0;
+    for (uint32_t slot = 1; slot < VM_THREAD_MAX; slot++)
+    {
+        VMThread* thread = &table->threads[slot];
+        if (thread->state != VM_THREAD_FREE)
+        {
+            continue;
+        }
+        memset(thread, 0, sizeof(VMThread));
+        memcpy(thread->registers, ctx->registers, sizeof(thread->registers));
+        thread->pc    = entry;
+        thread->sp    = STACK_END - slot * VM_THREAD_STACK_SIZE;
+        thread->bp    = thread->sp;
+        thread->state = VM_THREAD_READY;
+        table->live++;
+        *id = slot;
+        break;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   Moves on to the next ready thread after the current one. Returns false, leaving the current
+ *   thread live, when no other thread is ready.
+ * */
+bool vm_thread_switch(VMContext* ctx)
+{
+    VMThreadTable* table = &ctx->threads;
+    for (uint32_t i = 1; i < VM_THREAD_MAX; i++)
+    {
+        uint32_t next = (table->current + i) % VM_THREAD_MAX;
+        if (table->threads[next].state == VM_THREAD_READY)
+        {
+            save_thread(ctx, &table->threads[table->current]);
+            load_thread(ctx, &table->threads[next], next);
+            table->current = next;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ *   Parks the current thread on the instruction it is executing until vm_thread_wake(wait, id).
+ *   Called by handlers, so pc is already past that instruction.
+ * */
+int8_t vm_thread_block(VMContext* ctx, VMThreadWait wait, uint32_t id)
+{
+    VMThread*     self     = &ctx->threads.threads[ctx->threads.current];
+    VMThreadState previous = self->state;
+    self->state            = VM_THREAD_BLOCKED;
+    self->wait             = wait;
+    self->wait_id          = id;
+    ctx->pc -= INSTRUCTION_SIZE;
+    if (vm_thread_switch(ctx))
+    {
+        return VM_EXIT_SUCCESS;
+    }
+
+    ctx->pc += INSTRUCTION_SIZE;
+    self->state = previous;
+    self->wait  = VM_WAIT_NONE;
+    LOG_ERROR("Every guest thread is blocked\n");
+    return VM_ERR_DEADLOCK;
+}
+
+void vm_thread_wake(VMContext* ctx, VMThreadWait wait, uint32_t id)
+{
+    for (uint32_t i = 0; i < VM_THREAD_MAX; i++)
+    {
+        VMThread* thread = &ctx->threads.threads[i];
+        if (thread->state == VM_THREAD_BLOCKED && thread->wait == wait && thread->wait_id == id)
+        {
+            thread->state = VM_THREAD_READY;
+            thread->wait  = VM_WAIT_NONE;
+        }
+    }
+}
+
+/*
+ *   Ends the current thread (never thread 0, whose halt stops the VM) with r0 as its result.
+ * */
+int8_t vm_thread_exit(VMContext* ctx)
+{
+    const uint32_t id   = ctx->threads.current;
+    VMThread*      self = &ctx->threads.threads[id];
+    self->exit_value    = ctx->registers[REG_R0];
+    self->state         = VM_THREAD_DONE;
+    vm_thread_wake(ctx, VM_WAIT_JOIN, id);
+    if (vm_thread_switch(ctx))
+    {
+        return VM_EXIT_SUCCESS;
+    }
+    LOG_ERROR("Thread %u halted while every other guest thread is blocked\n", id);
+    return VM_ERR_DEADLOCK;
+}
+
+/*
+ *   Returns the new channel's id, or 0 when capacity is out of range or all channels exist.
+ * */
+uint32_t vm_channel_create(VMContext* ctx, uint64_t capacity)
+{
+    if (capacity == 0 || capacity > VM_CHANNEL_CAPACITY)
+    {
+        return 0;
+    }
+    for (uint32_t i = 0; i < VM_CHANNEL_MAX; i++)
+    {
+        VMChannel* channel = &ctx->threads.channels[i];
+        if (channel->capacity == 0)
+        {
+            channel->capacity = (uint32_t) capacity;
+            channel->head     = 0;
+            channel->count    = 0;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+VMChannel* vm_channel(VMContext* ctx, uint64_t id)
+{
+    if (id == 0 || id > VM_CHANNEL_MAX || ctx->threads.channels[id - 1].capacity == 0)
+    {
+        return NULL;
+    }
+    return &ctx->threads.channels[id - 1];
+}
+
+// False when the channel is full
+bool vm_channel_send(VMChannel* channel, uint64_t value)
+{
+    if (channel->count == channel->capacity)
+    {
+        return false;
+    }
+    channel->values[(channel->head + channel->count) % channel->capacity] = value;
+    channel->count++;
+    return true;
+}
+
+// False when the channel is empty
+bool vm_channel_recv(VMChannel* channel, uint64_t* out)
+{
+    if (channel->count == 0)
+    {
+        return false;
+    }
+    *out          = channel->values[channel->head];
+    channel->head = (channel->head + 1) % channel->capacity;
+    channel->count--;
+    return true;
+}
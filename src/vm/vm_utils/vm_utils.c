@@ -1,5 +1,7 @@
 #include "vm_utils.h"
 #include "logger.h"
+#include "vm_heap.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -9,17 +11,20 @@ uint32_t vm_allocate_string(VMContext* ctx, const char* host_string)
     size_t len           = strlen(host_string);
     size_t required_size = len + 1;
 
-    if (ctx->hp + required_size >= (HEAP_START + HEAP_SIZE) - 1)
+    if (required_size > HEAP_SIZE)
     {
         LOG_ERROR("Allocation failed. Not enough space in heap\n");
         return 0;
     }
 
-    uint32_t vm_mem_address = ctx->hp + required_size;
+    uint32_t vm_mem_address = vm_heap_alloc(ctx, (uint32_t) required_size);
+    if (vm_mem_address == 0)
+    {
+        LOG_ERROR("Allocation failed. Not enough space in heap\n");
+        return 0;
+    }
     memcpy(&ctx->memory[vm_mem_address], host_string, required_size);
 
-    ctx->hp += required_size;
-
     return vm_mem_address;
 }
 
@@ -51,22 +56,32 @@ void populate_operand(VMOperand* operand, uint8_t raw_id_byte, uint32_t imm_addr
     }
 }
 
-void vm_print_string(VMContext* ctx, uint32_t address)
+/*
+ *   Hands bytes to ctx->write, or to stdout when the host did not install a sink.
+ * */
+int8_t vm_write_output(VMContext* ctx, const uint8_t* data, uint32_t len, bool end_line)
 {
-    uint32_t curr_addr = address;
-    char*    string    = (char*) ctx->memory + address;
-    char*    i         = string;
-    while (*i != '\0' && curr_addr < MEM_SIZE)
+    if (ctx->write != NULL)
     {
-        fprintf(stdout, "%c", *i);
-        i++;
-        curr_addr++;
+        return ctx->write(ctx->write_user, data, len, end_line);
     }
-    fprintf(stdout, "\n");
-    if (curr_addr >= MEM_SIZE)
+    if (fwrite(data, 1, len, stdout) != len || (end_line && fputc('\n', stdout) == EOF))
+    {
+        return VM_ERR_IO_WRITE_FAILED;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t vm_print_string(VMContext* ctx, uint32_t address)
+{
+    const uint8_t* string = ctx->memory + address;
+    const uint8_t* end    = memchr(string, '\0', MEM_SIZE - address);
+    if (end == NULL)
     {
         LOG_WARN("Exited due to pointer crossing memory boundry\n");
+        end = ctx->memory + MEM_SIZE;
     }
+    return vm_write_output(ctx, string, (uint32_t) (end - string), true);
 }
 
 int8_t read_header_u16(FILE* f, uint16_t* out)
@@ -93,23 +108,70 @@ int8_t read_header_u32(FILE* f, uint32_t* out)
     return VM_EXIT_SUCCESS;
 }
 
-int8_t parse_header(BytecodeFileHeader* out, FILE* f)
+static void add_section(BytecodeFileHeader* out, uint8_t type, uint8_t flags, uint32_t offset,
+                        uint32_t size)
+{
+    BytecodeSection* section = &out->sections[out->section_count++];
+    section->type            = type;
+    section->flags           = flags;
+    section->align_log2      = 0;
+    section->offset          = offset;
+    section->size            = size;
+}
+
+/*
+ *   Versions 1 and 2 store code, rodata and data back to back after the header; describe them as
+ *   sections so the loader has a single path.
+ * */
+static int8_t parse_legacy_header(BytecodeFileHeader* out, FILE* f)
 {
     int8_t status;
 
-    status = read_header_u32(f, &out->magic_number);
+    status = read_header_u32(f, &out->code_len);
     if (status == VM_ERR_INVALID_BYTECODE)
     {
         return status;
     }
 
-    status = read_header_u16(f, &out->version_number);
+    status = read_header_u32(f, &out->entry_point);
+    if (status == VM_ERR_INVALID_BYTECODE)
+    {
+        return status;
+    }
+    status = read_header_u32(f, &out->rodata_len);
     if (status == VM_ERR_INVALID_BYTECODE)
     {
         return status;
     }
 
-    status = read_header_u32(f, &out->code_len);
+    status = read_header_u32(f, &out->data_len);
+    if (status == VM_ERR_INVALID_BYTECODE)
+    {
+        return status;
+    }
+
+    const bool     compact = (out->version_number & BYTECODE_VERSION_MASK) ==
+                         BYTECODE_COMPACT_VERSION;
+    const uint64_t rodata  = (uint64_t) BYTECODE_HEADER_SIZE + out->code_len;
+    const uint64_t data    = rodata + out->rodata_len;
+    if (data + out->data_len > UINT32_MAX)
+    {
+        return VM_ERR_INVALID_BYTECODE;
+    }
+
+    out->section_count = 0;
+    add_section(out, BYTECODE_SECTION_CODE, compact ? BYTECODE_SECTION_COMPACT : 0,
+                BYTECODE_HEADER_SIZE, out->code_len);
+    add_section(out, BYTECODE_SECTION_RODATA, 0, (uint32_t) rodata, out->rodata_len);
+    add_section(out, BYTECODE_SECTION_DATA, 0, (uint32_t) data, out->data_len);
+    return VM_EXIT_SUCCESS;
+}
+
+static int8_t parse_section_table(BytecodeFileHeader* out, FILE* f)
+{
+    int8_t status;
+
+    status = read_header_u16(f, &out->section_count);
     if (status == VM_ERR_INVALID_BYTECODE)
     {
         return status;
@@ -120,17 +182,263 @@ int8_t parse_header(BytecodeFileHeader* out, FILE* f)
     {
         return status;
     }
-    status = read_header_u32(f, &out->rodata_len);
+
+    if (out->section_count == 0 || out->section_count > BYTECODE_MAX_SECTIONS)
+    {
+        LOG_ERROR("Bad section count %u\n", out->section_count);
+        return VM_ERR_INVALID_BYTECODE;
+    }
+
+    out->code_len   = 0;
+    out->rodata_len = 0;
+    out->data_len   = 0;
+    for (uint16_t i = 0; i < out->section_count; i++)
+    {
+        BytecodeSection* section = &out->sections[i];
+        uint8_t          b[4];
+        if (fread(b, 1, sizeof(b), f) != sizeof(b))
+        {
+            return VM_ERR_INVALID_BYTECODE;
+        }
+        section->type       = b[0];
+        section->flags      = b[1];
+        section->align_log2 = b[2];
+
+        status = read_header_u32(f, &section->offset);
+        if (status == VM_ERR_INVALID_BYTECODE)
+        {
+            return status;
+        }
+        status = read_header_u32(f, &section->size);
+        if (status == VM_ERR_INVALID_BYTECODE)
+        {
+            return status;
+        }
+
+        switch (section->type)
+        {
+        case BYTECODE_SECTION_CODE:
+            out->code_len = section->size;
+            break;
+        case BYTECODE_SECTION_RODATA:
+            out->rodata_len = section->size;
+            break;
+        case BYTECODE_SECTION_DATA:
+            out->data_len = section->size;
+            break;
+        default:
+            break;
+        }
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+int8_t parse_header(BytecodeFileHeader* out, FILE* f)
+{
+    int8_t status;
+
+    status = read_header_u32(f, &out->magic_number);
     if (status == VM_ERR_INVALID_BYTECODE)
     {
         return status;
     }
 
-    status = read_header_u32(f, &out->data_len);
+    status = read_header_u16(f, &out->version_number);
     if (status == VM_ERR_INVALID_BYTECODE)
     {
         return status;
     }
 
+    if ((out->version_number & BYTECODE_VERSION_MASK) == BYTECODE_SECTIONED_VERSION)
+    {
+        return parse_section_table(out, f);
+    }
+    return parse_legacy_header(out, f);
+}
+
+/*
+ *   Resolves a source operand to a register-width value. Memory operands read one word (4 or 8
+ *   bytes, depending on the mode) from guest memory. In 64-bit mode imm32 is sign-extended, so
+ *   small negative immediates keep working; wider constants come from MOVQ or memory.
+ * */
+int8_t vm_read_operand(VMContext* ctx, const VMOperand* operand, uint64_t* out)
+{
+    const uint32_t word_size = vm_word_size(ctx);
+
+    switch (operand->mode)
+    {
+    case VM_AM_REG_DIRECT:
+        *out = ctx->registers[operand->value.reg_id];
+        return VM_EXIT_SUCCESS;
+    case VM_AM_IMM_INT:
+        *out = (uint64_t) (int64_t) (int32_t) operand->value.address_or_value & ctx->word_mask;
+        return VM_EXIT_SUCCESS;
+    case VM_AM_IMM_ADDR:
+    {
+        uint32_t address = operand->value.address_or_value;
+        if (address > MEM_SIZE - word_size)
+        {
+            LOG_ERROR("Cannot access past the memory boundry\n");
+            return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+        }
+        *out = vm_load_word(ctx, address);
+        return VM_EXIT_SUCCESS;
+    }
+    case VM_AM_REG_INDIRECT:
+    {
+        uint32_t address = ctx->registers[operand->value.reg_id];
+        if (address > MEM_SIZE - word_size)
+        {
+            LOG_ERROR("Cannot access past the memory boundry\n");
+            return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+        }
+        *out = vm_load_word(ctx, address);
+        return VM_EXIT_SUCCESS;
+    }
+    case VM_AM_BASE_OFFSET:
+    {
+        uint32_t base_address = ctx->registers[operand->value.base_and_offset.reg_id];
+        uint32_t address      = base_address + operand->value.base_and_offset.offset;
+        if (base_address >= MEM_SIZE || address > MEM_SIZE - word_size)
+        {
+            LOG_ERROR("Cannot access past memory boundry\n");
+            return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+        }
+        *out = vm_load_word(ctx, address);
+        return VM_EXIT_SUCCESS;
+    }
+    case VM_AM_PC_RELATIVE:
+    case VM_AM_NONE:
+    default:
+        return VM_ERR_INVALID_ADDRESSING_MODE;
+    }
+}
+
+/*
+ *   Resolves the destination of a jump or call. ctx->pc already points past the instruction.
+ * */
+int8_t vm_branch_target(VMContext* ctx, const VMOperand* operand, uint32_t* out)
+{
+    uint32_t target;
+    switch (operand->mode)
+    {
+    case VM_AM_IMM_ADDR:
+        target = operand->value.address_or_value;
+        break;
+    case VM_AM_PC_RELATIVE:
+        target = ctx->pc + operand->value.address_or_value;
+        break;
+    case VM_AM_REG_DIRECT:
+        target = ctx->registers[operand->value.reg_id];
+        if (ctx->verified)
+        {
+            int8_t status = vm_check_dynamic_target(ctx, target);
+            if (status != VM_EXIT_SUCCESS)
+            {
+                return status;
+            }
+        }
+        break;
+    default:
+        return VM_ERR_INVALID_ADDRESSING_MODE;
+    }
+
+    if (target >= CODE_START + CODE_SIZE)
+    {
+        LOG_ERROR("Branch target 0x%X is outside the code segment\n", target);
+        return VM_ERR_PC_OUT_OF_BOUNDS;
+    }
+    *out = target;
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   A verified image runs without per-instruction register checks, so a pc computed at run time
+ *   (a register jump, call or spawn, or a return address) must land on an instruction the
+ *   verifier saw. block_cost is nonzero exactly at those slots.
+ * */
+int8_t vm_check_dynamic_target(const VMContext* ctx, uint32_t target)
+{
+    const uint32_t slot = (target - CODE_START) / INSTRUCTION_SIZE;
+    if ((target - CODE_START) % INSTRUCTION_SIZE != 0 || slot >= ctx->block_cost_len ||
+        ctx->block_cost[slot] == 0)
+    {
+        LOG_ERROR("Branch target 0x%X is not an instruction of the verified code\n", target);
+        return VM_ERR_PC_OUT_OF_BOUNDS;
+    }
     return VM_EXIT_SUCCESS;
 }
+
+/*
+ *   Slow path of STACK_RANGE_OK: works out which end of the running thread's stack was crossed.
+ * */
+int8_t vm_stack_fault(const VMContext* ctx, uint32_t address)
+{
+    return address < ctx->stack_limit ? VM_ERR_STACK_OVERFLOW : VM_ERR_STACK_UNDERFLOW;
+}
+
+/*
+ *   ZF and SF are taken at the current register width, so 32-bit images see the same flags as
+ *   before wide mode existed.
+ * */
+void vm_set_flags(VMContext* ctx, uint64_t result, bool carry, bool overflow)
+{
+    result &= ctx->word_mask;
+
+    ctx->flags[VM_FLAG_ZERO]     = result == 0;
+    ctx->flags[VM_FLAG_SIGN]     = (result & vm_sign_bit(ctx)) != 0;
+    ctx->flags[VM_FLAG_CARRY]    = carry;
+    ctx->flags[VM_FLAG_OVERFLOW] = overflow;
+}
+
+static const VMSegment vm_segments[] = {
+    {CODE_START, CODE_SIZE, false},   {RODATA_START, RODATA_SIZE, false},
+    {DATA_START, DATA_SIZE, true},    {HEAP_START, HEAP_SIZE, true},
+    {STACK_START, STACK_SIZE, true},
+};
+
+const VMSegment* vm_segment_of(uint32_t address)
+{
+    for (size_t i = 0; i < sizeof(vm_segments) / sizeof(vm_segments[0]); i++)
+    {
+        if (address - vm_segments[i].start < vm_segments[i].size)
+        {
+            return &vm_segments[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ *   Checks that [address, address + len) lies inside a single segment, and that the segment is
+ *   writable when asked to. Bulk operations call this once and then work on host pointers.
+ * */
+int8_t vm_check_range(uint32_t address, uint32_t len, bool write)
+{
+    const VMSegment* segment = vm_segment_of(address);
+    if (segment == NULL || len > segment->start + segment->size - address)
+    {
+        LOG_ERROR("Range 0x%X+%u crosses a segment boundry\n", address, len);
+        return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+    }
+    if (write && !segment->writable)
+    {
+        LOG_ERROR("Write to read-only segment at 0x%X\n", address);
+        return VM_ERR_ILLEGAL_OPERATION;
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+/*
+ *   For native functions: the host address of guest bytes address..address + len - 1 after one
+ *   vm_check_range, or NULL when the range is not valid (for writing, when writable is set).
+ * */
+uint8_t* vm_guest_pointer(VMContext* ctx, uint64_t address, uint64_t len, bool writable)
+{
+    if (address > UINT32_MAX || len > UINT32_MAX ||
+        vm_check_range((uint32_t) address, (uint32_t) len, writable) != VM_EXIT_SUCCESS)
+    {
+        return NULL;
+    }
+    return ctx->memory + address;
+}
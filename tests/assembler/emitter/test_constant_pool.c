@@ -0,0 +1,115 @@
+#include "constant_pool.h"
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include <stdint.h>
+#include <string.h>
+
+void run_all_constant_pool_tests(void);
+
+void test_constant_pool_deduplicates(void);
+void test_constant_pool_shares_suffixes(void);
+void test_constant_pool_places_integers_first(void);
+void test_constant_pool_overflow_fails(void);
+
+// =================================================================
+// 1. Adding the same string or integer twice stores it once
+// =================================================================
+void test_constant_pool_deduplicates(void)
+{
+    ConstantPool pool;
+    uint8_t      out[64] = {0};
+    uint32_t     offset;
+    constant_pool_init(&pool);
+
+    constant_pool_add_string(&test_parser_arena, &pool, "repeated message");
+    constant_pool_add_string(&test_parser_arena, &pool, "repeated message");
+    constant_pool_add_integer(&test_parser_arena, &pool, 7);
+    constant_pool_add_integer(&test_parser_arena, &pool, 7);
+
+    TEST_ASSERT_EQUAL_INT8(0, constant_pool_layout(&pool, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_UINT32(8 + sizeof("repeated message"), pool.size);
+    TEST_ASSERT_TRUE(constant_pool_string_offset(&pool, "repeated message", &offset));
+    TEST_ASSERT_EQUAL_STRING("repeated message", (char*) out + offset);
+    TEST_ASSERT_FALSE(constant_pool_string_offset(&pool, "missing", &offset));
+    constant_pool_clear(&pool);
+}
+
+// =================================================================
+// 2. A string that ends another one points into it, whatever the insertion order
+// =================================================================
+void test_constant_pool_shares_suffixes(void)
+{
+    ConstantPool pool;
+    uint8_t      out[64] = {0};
+    uint32_t     whole, tail, empty;
+    constant_pool_init(&pool);
+
+    constant_pool_add_string(&test_parser_arena, &pool, "world");
+    constant_pool_add_string(&test_parser_arena, &pool, "");
+    constant_pool_add_string(&test_parser_arena, &pool, "hello_world");
+
+    TEST_ASSERT_EQUAL_INT8(0, constant_pool_layout(&pool, out, sizeof(out)));
+    TEST_ASSERT_EQUAL_UINT32(sizeof("hello_world"), pool.size);
+    constant_pool_string_offset(&pool, "hello_world", &whole);
+    constant_pool_string_offset(&pool, "world", &tail);
+    constant_pool_string_offset(&pool, "", &empty);
+    TEST_ASSERT_EQUAL_UINT32(whole + 6, tail);
+    TEST_ASSERT_EQUAL_UINT32(whole + 11, empty);
+    TEST_ASSERT_EQUAL_STRING("world", (char*) out + tail);
+    constant_pool_clear(&pool);
+}
+
+// =================================================================
+// 3. Integers are aligned 8-byte words ahead of the strings
+// =================================================================
+void test_constant_pool_places_integers_first(void)
+{
+    ConstantPool pool;
+    uint8_t      out[64] = {0};
+    uint32_t     first, second;
+    int64_t      value;
+    constant_pool_init(&pool);
+
+    constant_pool_add_string(&test_parser_arena, &pool, "abc");
+    constant_pool_add_integer(&test_parser_arena, &pool, -2);
+    constant_pool_add_integer(&test_parser_arena, &pool, 0x123456789LL);
+
+    TEST_ASSERT_EQUAL_INT8(0, constant_pool_layout(&pool, out, sizeof(out)));
+    constant_pool_integer_offset(&pool, -2, &first);
+    constant_pool_integer_offset(&pool, 0x123456789LL, &second);
+    TEST_ASSERT_EQUAL_UINT32(0, first);
+    TEST_ASSERT_EQUAL_UINT32(8, second);
+    memcpy(&value, out + second, sizeof(value));
+    TEST_ASSERT_EQUAL_INT64(0x123456789LL, value);
+    constant_pool_clear(&pool);
+}
+
+// =================================================================
+// 4. A pool larger than its section is an error
+// =================================================================
+void test_constant_pool_overflow_fails(void)
+{
+    ConstantPool pool;
+    uint8_t      out[8] = {0};
+    constant_pool_init(&pool);
+
+    constant_pool_add_string(&test_parser_arena, &pool, "too long for eight");
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status        = constant_pool_layout(&pool, out, sizeof(out));
+    g_compiler_log_level = saved_level;
+
+    TEST_ASSERT_NOT_EQUAL(0, status);
+    constant_pool_clear(&pool);
+}
+
+void run_all_constant_pool_tests(void)
+{
+    RUN_TEST(test_constant_pool_deduplicates);
+    RUN_TEST(test_constant_pool_shares_suffixes);
+    RUN_TEST(test_constant_pool_places_integers_first);
+    RUN_TEST(test_constant_pool_overflow_fails);
+}
@@ -0,0 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+#include "assembler_context.h"
+#include "bytecode.h"
+#include "emitter.h"
+#include "logger.h"
+#include "parser.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void run_all_emitter_tests(void);
+
+void test_emitter_fixed_and_compact_images_agree(void);
+void test_compact_codec_round_trip(void);
+void test_compact_encoding_sizes(void);
+void test_emitter_rejects_undefined_symbol(void);
+void test_emitter_rejects_compact_version_1(void);
+void test_emitter_pools_read_only_constants(void);
+void test_loader_rejects_truncated_compact_code(void);
+void test_emitter_rejects_vector_register_in_scalar_slot(void);
+void test_emitter_rejects_scalar_register_in_vector_slot(void);
+
+static const char* sum_program = ".rodata greeting, \"hi\"\n"
+                                 ".start main\n"
+                                 "helper:\n"
+                                 "ret\n"
+                                 "main:\n"
+                                 "mov r0, 0\n"
+                                 "mov r1, 10\n"
+                                 "loop:\n"
+                                 "add r0, r1\n"
+                                 "sub r1, 1\n"
+                                 "jnz loop\n"
+                                 "call helper\n"
+                                 "load_addr r3, greeting\n"
+                                 "strlen r4, r3\n"
+                                 "movq r5, 0x123456789\n"
+                                 "halt\n";
+
+/*
+ *   Assembles source into a temporary file at path. Returns the emitter status.
+ * */
+static int8_t assemble_to_file(const char* source, uint16_t version, bool compact, char* path)
+{
+    MemoryArena arena;
+    arena_init(&arena, MEM_SIZE + MAX_ARENA_SIZE);
+
+    AssemblerContext* asm_ctx = asm_ctx_init(&arena);
+    TokenStream*      stream  = lex_from_string(&arena, source);
+    asm_ctx->program.capcity  = 100;
+    int8_t status             = run_parser(&arena, stream, &asm_ctx->program);
+
+    int   fd  = mkstemp(path);
+    FILE* out = fdopen(fd, "wb");
+    if (status == 0)
+    {
+        status = emit_program(asm_ctx, &arena, out, version, compact);
+    }
+    fclose(out);
+    asm_ctx_release(asm_ctx);
+    arena_free(&arena);
+    return status;
+}
+
+static long file_size(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long) st.st_size : -1;
+}
+
+// =================================================================
+// 1. The same program assembled as v1, v2 and v3 runs to the same state; v2 is smaller than v1
+// =================================================================
+void test_emitter_fixed_and_compact_images_agree(void)
+{
+    char fixed_path[]     = "/tmp/bitlang_fixed_XXXXXX";
+    char compact_path[]   = "/tmp/bitlang_compact_XXXXXX";
+    char sectioned_path[] = "/tmp/bitlang_sectioned_XXXXXX";
+
+    TEST_ASSERT_EQUAL_INT8(
+        0, assemble_to_file(sum_program, BYTECODE_SUPPORTED_VERSION, false, fixed_path));
+    TEST_ASSERT_EQUAL_INT8(
+        0, assemble_to_file(sum_program, BYTECODE_COMPACT_VERSION, true, compact_path));
+    TEST_ASSERT_EQUAL_INT8(
+        0, assemble_to_file(sum_program, BYTECODE_SECTIONED_VERSION, true, sectioned_path));
+    TEST_ASSERT_LESS_THAN(file_size(fixed_path), file_size(compact_path));
+
+    const char* paths[] = {fixed_path, compact_path, sectioned_path};
+    for (int i = 0; i < 3; i++)
+    {
+        memset(vm_ctx->registers, 0, sizeof(vm_ctx->registers));
+        memset(vm_ctx->memory + RODATA_START, 0, RODATA_SIZE);
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_vm(vm_ctx, paths[i]));
+        TEST_ASSERT_EQUAL_UINT32(55, vm_ctx->registers[REG_R0]);
+        TEST_ASSERT_EQUAL_UINT32(2, vm_ctx->registers[REG_R4]);
+        TEST_ASSERT_EQUAL_HEX64(0x23456789, vm_ctx->registers[REG_R5]);
+        TEST_ASSERT_EQUAL_STRING("hi", (char*) vm_ctx->memory + RODATA_START);
+        unlink(paths[i]);
+    }
+}
+
+// =================================================================
+// 2. Encoding then expanding gives back the fixed-form bytes
+// =================================================================
+void test_compact_codec_round_trip(void)
+{
+    const uint8_t fixed[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, 0xDEADBEEF, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+        TEST_INST(OP_ADD, REG_R1, REG_R2, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+        TEST_INST(OP_MOV, REG_R3, REG_R4, 12, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_BASE_OFFSET)),
+        TEST_INST(OP_JMP, 0, 0, 0x40, MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_REG_DIRECT)),
+        TEST_MOVQ(REG_R6, 0x8000000000000001ULL),
+        TEST_INST(OP_RET, 0, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    uint8_t  compact[sizeof(fixed)];
+    uint8_t  expanded[sizeof(fixed)];
+    uint32_t compact_len = 0;
+    uint32_t expanded_len;
+
+    for (uint32_t pc = 0; pc < sizeof(fixed); pc += bytecode_fixed_size(fixed[pc]))
+    {
+        uint32_t length;
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS,
+                               bytecode_compact_encode(fixed + pc, compact + compact_len, &length));
+        compact_len += length;
+    }
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, bytecode_compact_expand(compact, compact_len, expanded,
+                                                                    sizeof(expanded),
+                                                                    &expanded_len));
+    TEST_ASSERT_EQUAL_UINT32(sizeof(fixed), expanded_len);
+    TEST_ASSERT_EQUAL_MEMORY(fixed, expanded, sizeof(fixed));
+}
+
+// =================================================================
+// 3. 0-operand instructions take one byte, small immediates one byte
+// =================================================================
+void test_compact_encoding_sizes(void)
+{
+    const uint8_t halt[]     = {TEST_INST(OP_HALT, 0, 0, 0, 0)};
+    const uint8_t add_neg[]  = {TEST_INST(OP_ADD, REG_R0, 0, (uint32_t) -1,
+                                          MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT))};
+    const uint8_t push_reg[] = {TEST_INST(OP_PUSH, REG_R3, 0, 0, 0)};
+    uint8_t       out[BYTECODE_COMPACT_MAX_SIZE];
+    uint32_t      length;
+
+    bytecode_compact_encode(halt, out, &length);
+    TEST_ASSERT_EQUAL_UINT32(1, length);
+    bytecode_compact_encode(add_neg, out, &length);
+    TEST_ASSERT_EQUAL_UINT32(4, length);
+    TEST_ASSERT_EQUAL_HEX8(0x7F, out[3]);
+    bytecode_compact_encode(push_reg, out, &length);
+    TEST_ASSERT_EQUAL_UINT32(3, length);
+}
+
+// =================================================================
+// 4. A jump to a label that was never defined is an assembly error
+// =================================================================
+void test_emitter_rejects_undefined_symbol(void)
+{
+    char path[] = "/tmp/bitlang_undefined_XXXXXX";
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status = assemble_to_file("jmp nowhere\nhalt\n", BYTECODE_SUPPORTED_VERSION, false, path);
+    g_compiler_log_level = saved_level;
+    unlink(path);
+
+    TEST_ASSERT_NOT_EQUAL(0, status);
+}
+
+// =================================================================
+// 5. Version 1 has nowhere to record that code is compact
+// =================================================================
+void test_emitter_rejects_compact_version_1(void)
+{
+    char path[] = "/tmp/bitlang_v1_compact_XXXXXX";
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status = assemble_to_file("halt\n", BYTECODE_SUPPORTED_VERSION, true, path);
+    g_compiler_log_level = saved_level;
+    unlink(path);
+
+    TEST_ASSERT_NOT_EQUAL(0, status);
+}
+
+// =================================================================
+// 6. Repeated constants share storage, and string operands point into the pool
+// =================================================================
+void test_emitter_pools_read_only_constants(void)
+{
+    char        path[] = "/tmp/bitlang_pool_XXXXXX";
+    const char* source = ".rodata greeting, \"hello\"\n"
+                         ".rodata tail, \"llo\"\n"
+                         ".rodata answer, 42\n"
+                         ".rodata again, 42\n"
+                         "load_addr r1, \"hello\"\n"
+                         "load_addr r2, greeting\n"
+                         "load_addr r3, tail\n"
+                         "mov r4, again\n"
+                         "strlen r5, r3\n"
+                         "halt\n";
+
+    TEST_ASSERT_EQUAL_INT8(0, assemble_to_file(source, BYTECODE_SECTIONED_VERSION, false, path));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_vm(vm_ctx, path));
+    unlink(path);
+
+    TEST_ASSERT_EQUAL_UINT32(vm_ctx->registers[REG_R1], vm_ctx->registers[REG_R2]);
+    TEST_ASSERT_EQUAL_UINT32(vm_ctx->registers[REG_R1] + 2, vm_ctx->registers[REG_R3]);
+    TEST_ASSERT_EQUAL_UINT32(42, vm_ctx->registers[REG_R4]);
+    TEST_ASSERT_EQUAL_UINT32(3, vm_ctx->registers[REG_R5]);
+}
+
+// =================================================================
+// 7. A compact stream that ends mid-instruction is rejected at load time
+// =================================================================
+void test_loader_rejects_truncated_compact_code(void)
+{
+    char          path[] = "/tmp/bitlang_truncated_XXXXXX";
+    const uint8_t image[] = {
+        0x59, 0x42, 0x4D, 0x56,            // magic
+        BYTECODE_COMPACT_VERSION, 0x00,    // version
+        0x03, 0x00, 0x00, 0x00,            // code_len
+        0x00, 0x00, 0x00, 0x00,            // entry
+        0x00, 0x00, 0x00, 0x00,            // rodata_len
+        0x00, 0x00, 0x00, 0x00,            // data_len
+        OP_MOV, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT), REG_R0, // imm missing
+    };
+    int   fd  = mkstemp(path);
+    FILE* out = fdopen(fd, "wb");
+    fwrite(image, 1, sizeof(image) - 1, out);
+    fputc(0x80, out); // SLEB128 continuation byte with nothing after it
+    fclose(out);
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status        = load_bytecode(vm_ctx, path);
+    g_compiler_log_level = saved_level;
+    unlink(path);
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_BYTECODE, status);
+}
+
+// =================================================================
+// 8. r- and v-registers encode alike, so a v-register in a scalar slot is an assembly error
+// =================================================================
+void test_emitter_rejects_vector_register_in_scalar_slot(void)
+{
+    char path[] = "/tmp/bitlang_vector_slot_XXXXXX";
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status = assemble_to_file("add r0, v1\nhalt\n", BYTECODE_SUPPORTED_VERSION, false, path);
+    g_compiler_log_level = saved_level;
+    unlink(path);
+
+    TEST_ASSERT_NOT_EQUAL(0, status);
+
+    strcpy(path, "/tmp/bitlang_vector_slot_XXXXXX");
+    TEST_ASSERT_EQUAL_INT8(0, assemble_to_file("vsum8 r0, v1\nhalt\n", BYTECODE_SUPPORTED_VERSION,
+                                               false, path));
+    unlink(path);
+}
+
+// =================================================================
+// 9. ...and so is an r-register in a vector slot
+// =================================================================
+void test_emitter_rejects_scalar_register_in_vector_slot(void)
+{
+    char path[] = "/tmp/bitlang_scalar_slot_XXXXXX";
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status = assemble_to_file("vadd8 v0, r3\nhalt\n", BYTECODE_SUPPORTED_VERSION, false,
+                                     path);
+    g_compiler_log_level = saved_level;
+    unlink(path);
+
+    TEST_ASSERT_NOT_EQUAL(0, status);
+
+    strcpy(path, "/tmp/bitlang_scalar_slot_XXXXXX");
+    TEST_ASSERT_EQUAL_INT8(0, assemble_to_file("vadd8 v0, v3\nhalt\n", BYTECODE_SUPPORTED_VERSION,
+                                               false, path));
+    unlink(path);
+}
+
+void run_all_emitter_tests(void)
+{
+    RUN_TEST(test_emitter_fixed_and_compact_images_agree);
+    RUN_TEST(test_compact_codec_round_trip);
+    RUN_TEST(test_compact_encoding_sizes);
+    RUN_TEST(test_emitter_rejects_undefined_symbol);
+    RUN_TEST(test_emitter_rejects_compact_version_1);
+    RUN_TEST(test_emitter_pools_read_only_constants);
+    RUN_TEST(test_loader_rejects_truncated_compact_code);
+    RUN_TEST(test_emitter_rejects_vector_register_in_scalar_slot);
+    RUN_TEST(test_emitter_rejects_scalar_register_in_vector_slot);
+}
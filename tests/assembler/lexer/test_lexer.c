@@ -45,8 +45,38 @@ void test_lexer_immediate_and_symbol_tokens(void)
     TEST_ASSERT_EQUAL_HEX32(0x12345678, tokens[1].value.literal.value.longValue);
 }
 
+void test_lexer_vector_registers(void)
+{
+    char* input[] = {"vadd32", "v0", ",", "v7"};
+    int   count   = 4;
+
+    Token* tokens = lexer(&lexer_arena, input, count);
+
+    TEST_ASSERT_EQUAL_INT(TOK_IDENTIFIER, tokens[0].kind);
+    TEST_ASSERT_EQUAL_STRING("vadd32", tokens[0].value.identifier);
+    TEST_ASSERT_EQUAL_INT(TOK_REGISTER, tokens[1].kind);
+    TEST_ASSERT_EQUAL_HEX(REG_V0, tokens[1].value.reg);
+    TEST_ASSERT_EQUAL_INT(TOK_REGISTER, tokens[3].kind);
+    TEST_ASSERT_EQUAL_HEX(REG_V7, tokens[3].value.reg);
+}
+
+void test_lexer_64_bit_literals(void)
+{
+    char* input[] = {"movq", "r0", ",", "0xCBF29CE484222325", "-5"};
+    int   count   = 5;
+
+    Token* tokens = lexer(&lexer_arena, input, count);
+
+    TEST_ASSERT_EQUAL_INT(TOK_LITERAL, tokens[3].kind);
+    TEST_ASSERT_EQUAL_HEX64(0xCBF29CE484222325ULL,
+                            (uint64_t) tokens[3].value.literal.value.longValue);
+    TEST_ASSERT_EQUAL_INT64(-5, tokens[4].value.literal.value.longValue);
+}
+
 void run_all_lexer_tests(void)
 {
     RUN_TEST(test_lexer_opcode_and_register_tokens);
     RUN_TEST(test_lexer_immediate_and_symbol_tokens);
+    RUN_TEST(test_lexer_vector_registers);
+    RUN_TEST(test_lexer_64_bit_literals);
 }
@@ -0,0 +1,196 @@
+#include "optimizer.h"
+#include "parser.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include <string.h>
+
+void run_all_coalesce_tests(void);
+
+void test_coalesce_removes_dead_moves(void);
+void test_coalesce_renames_copy_whose_source_dies(void);
+void test_coalesce_keeps_copy_live_across_blocks(void);
+void test_coalesce_removes_redundant_spills(void);
+void test_coalesce_keeps_real_save_and_restore(void);
+void test_coalesce_long_program_stays_in_bounds(void);
+
+static Program parse_lines(MemoryArena* arena, const char* source, int capacity)
+{
+    Program      program = {.capcity = capacity};
+    TokenStream* stream  = lex_from_string(arena, source);
+    TEST_ASSERT_EQUAL_INT8(0, run_parser(arena, stream, &program));
+    return program;
+}
+
+static Program parse_source(const char* source)
+{
+    return parse_lines(&test_parser_arena, source, 100);
+}
+
+static const Instruction* nth_instruction(const Program* program, int n)
+{
+    for (int i = 0; i < program->count; i++)
+    {
+        if (program->lines[i].type == LINE_INSTRUCTION && n-- == 0)
+        {
+            return &program->lines[i].value.instruction;
+        }
+    }
+    TEST_FAIL_MESSAGE("program has fewer instructions than expected");
+    return NULL;
+}
+
+static int instruction_count(const Program* program)
+{
+    int count = 0;
+    for (int i = 0; i < program->count; i++)
+    {
+        count += program->lines[i].type == LINE_INSTRUCTION;
+    }
+    return count;
+}
+
+// =================================================================
+// 1. A move whose register is overwritten before anything reads it goes
+// =================================================================
+void test_coalesce_removes_dead_moves(void)
+{
+    Program        program = parse_source("mov r2, 1\n"
+                                          "mov r3, 4\n"
+                                          "mov r2, r3\n"
+                                          "halt\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_coalesce(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_EQUAL_INT(3, instruction_count(&program));
+    TEST_ASSERT_EQUAL_INT(REG_R3, nth_instruction(&program, 0)->operands[0].value.reg);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.instructions_removed);
+}
+
+// =================================================================
+// 2. mov r2, r1 with r1 dead afterwards: r2's uses read r1 and the copy goes
+// =================================================================
+void test_coalesce_renames_copy_whose_source_dies(void)
+{
+    Program        program = parse_source("mov r1, 10\n"
+                                          "mov r2, r1\n"
+                                          "add r2, 5\n"
+                                          "mov r0, r2\n"
+                                          "mov r1, 0\n"
+                                          "mov r2, 0\n"
+                                          "halt\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_coalesce(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_EQUAL_INT(6, instruction_count(&program));
+    const Instruction* add = nth_instruction(&program, 1);
+    TEST_ASSERT_EQUAL_INT(OP_ADD, add->opcode);
+    TEST_ASSERT_EQUAL_INT(REG_R1, add->operands[0].value.reg);
+    TEST_ASSERT_EQUAL_INT(REG_R1, nth_instruction(&program, 2)->operands[1].value.reg);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.instructions_removed);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.instructions_rewritten);
+}
+
+// =================================================================
+// 3. A destination still live at the end of its block is left alone
+// =================================================================
+void test_coalesce_keeps_copy_live_across_blocks(void)
+{
+    Program        program = parse_source("mov r1, 3\n"
+                                          "mov r2, r1\n"
+                                          "loop:\n"
+                                          "sub r2, 1\n"
+                                          "jnz loop\n"
+                                          "mov r1, 0\n"
+                                          "halt\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_coalesce(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_EQUAL_INT(6, instruction_count(&program));
+    TEST_ASSERT_EQUAL_UINT32(0, stats.instructions_removed);
+}
+
+// =================================================================
+// 4. push/pop around code that leaves the register alone is dropped, or becomes a mov
+// =================================================================
+void test_coalesce_removes_redundant_spills(void)
+{
+    Program        program = parse_source("mov r3, 7\n"
+                                          "push r3\n"
+                                          "mov r1, 2\n"
+                                          "add r1, r1\n"
+                                          "pop r3\n"
+                                          "push r3\n"
+                                          "add r1, r3\n"
+                                          "pop r4\n"
+                                          "mov r0, r1\n"
+                                          "halt\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_coalesce(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_EQUAL_UINT32(2, stats.spills_removed);
+    TEST_ASSERT_EQUAL_INT(7, instruction_count(&program));
+    const Instruction* reload = nth_instruction(&program, 4);
+    TEST_ASSERT_EQUAL_INT(OP_MOV, reload->opcode);
+    TEST_ASSERT_EQUAL_INT(REG_R4, reload->operands[0].value.reg);
+    TEST_ASSERT_EQUAL_INT(REG_R3, reload->operands[1].value.reg);
+}
+
+// =================================================================
+// 5. A save around a clobber or a call is a real spill and stays
+// =================================================================
+void test_coalesce_keeps_real_save_and_restore(void)
+{
+    Program        program = parse_source("push r3\n"
+                                          "mov r3, 1\n"
+                                          "add r0, r3\n"
+                                          "pop r3\n"
+                                          "push r5\n"
+                                          "call helper\n"
+                                          "pop r5\n"
+                                          "halt\n"
+                                          "helper:\n"
+                                          "ret\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_coalesce(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_EQUAL_INT(9, instruction_count(&program));
+    TEST_ASSERT_EQUAL_UINT32(0, stats.spills_removed);
+}
+
+// =================================================================
+// 6. Many independent rewrites are made together, without the arena growing per rewrite
+// =================================================================
+void test_coalesce_long_program_stays_in_bounds(void)
+{
+    static char source[1000 * sizeof("push r1\nadd r2, 1\npop r3\n") + sizeof("halt\n")];
+    source[0] = '\0';
+    for (int i = 0; i < 1000; i++)
+    {
+        strcat(source, "push r1\nadd r2, 1\npop r3\n");
+    }
+    strcat(source, "halt\n");
+
+    // The lexer alone needs more than the shared test arena for 3001 lines
+    MemoryArena arena;
+    arena_init(&arena, 8 * MAX_ARENA_SIZE);
+    Program        program = parse_lines(&arena, source, 3001);
+    OptimizerStats stats   = {0};
+    const size_t   used    = arena.offset;
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_coalesce(&program, &arena, &stats));
+    TEST_ASSERT_EQUAL_UINT32(1000, stats.spills_removed);
+    TEST_ASSERT_EQUAL_INT(1002, instruction_count(&program));
+    TEST_ASSERT_EQUAL_size_t(used, arena.offset);
+    arena_free(&arena);
+}
+
+void run_all_coalesce_tests(void)
+{
+    RUN_TEST(test_coalesce_removes_dead_moves);
+    RUN_TEST(test_coalesce_renames_copy_whose_source_dies);
+    RUN_TEST(test_coalesce_keeps_copy_live_across_blocks);
+    RUN_TEST(test_coalesce_removes_redundant_spills);
+    RUN_TEST(test_coalesce_keeps_real_save_and_restore);
+    RUN_TEST(test_coalesce_long_program_stays_in_bounds);
+}
@@ -0,0 +1,225 @@
+#include "logger.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include <stdbool.h>
+#include <string.h>
+
+void run_all_dead_code_tests(void);
+
+void test_dead_code_removes_unreachable_regions(void);
+void test_dead_code_keeps_globals_and_address_taken_labels(void);
+void test_dead_code_without_start_begins_at_first_instruction(void);
+void test_dead_code_rejects_duplicate_names(void);
+void test_dead_code_keeps_data_after_referenced_item(void);
+void test_dead_code_keeps_data_indexed_across_a_label(void);
+
+static Program parse_source(const char* source)
+{
+    Program      program = {.capcity = 100};
+    TokenStream* stream  = lex_from_string(&test_parser_arena, source);
+    TEST_ASSERT_EQUAL_INT8(0, run_parser(&test_parser_arena, stream, &program));
+    return program;
+}
+
+static bool has_label(const Program* program, const char* name)
+{
+    for (int i = 0; i < program->count; i++)
+    {
+        const Line* line = &program->lines[i];
+        if (line->type == LINE_LABEL_DEF && strcmp(line->value.label, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_item(const Program* program, const char* name)
+{
+    for (int i = 0; i < program->count; i++)
+    {
+        const Line* line = &program->lines[i];
+        if (line->type == LINE_DIRECTIVE && line->value.directive.operands[0].type == OT_SYMBOL &&
+            strcmp(line->value.directive.operands[0].value.symbol, name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int instruction_count(const Program* program)
+{
+    int count = 0;
+    for (int i = 0; i < program->count; i++)
+    {
+        count += program->lines[i].type == LINE_INSTRUCTION;
+    }
+    return count;
+}
+
+// =================================================================
+// 1. Code after halt, a never-called function and the data only it used all go
+// =================================================================
+void test_dead_code_removes_unreachable_regions(void)
+{
+    Program        program = parse_source(".data unused, 7\n"
+                                          ".data counter, 5\n"
+                                          ".rodata banner, \"dead\"\n"
+                                          ".start main\n"
+                                          "main:\n"
+                                          "mov r0, counter\n"
+                                          "jmp done\n"
+                                          "mov r1, 1\n"
+                                          "orphan:\n"
+                                          "mov r2, 2\n"
+                                          "done:\n"
+                                          "halt\n"
+                                          "mov r3, 3\n"
+                                          "never_called:\n"
+                                          "load_addr r4, banner\n"
+                                          "ret\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_dead_code(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_EQUAL_INT(3, instruction_count(&program));
+    TEST_ASSERT_TRUE(has_label(&program, "main"));
+    TEST_ASSERT_TRUE(has_label(&program, "done"));
+    TEST_ASSERT_FALSE(has_label(&program, "orphan"));
+    TEST_ASSERT_FALSE(has_label(&program, "never_called"));
+    TEST_ASSERT_TRUE(has_item(&program, "counter"));
+    TEST_ASSERT_FALSE(has_item(&program, "unused"));
+    TEST_ASSERT_FALSE(has_item(&program, "banner"));
+
+    TEST_ASSERT_EQUAL_UINT32(5, stats.instructions_removed);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.labels_removed);
+    TEST_ASSERT_EQUAL_UINT32(2, stats.data_items_removed);
+    TEST_ASSERT_EQUAL_UINT32(5 * INSTRUCTION_SIZE + 8 + sizeof("dead"), stats.bytes_saved);
+}
+
+// =================================================================
+// 2. Exports are roots, and a label whose address is loaded stays reachable
+// =================================================================
+void test_dead_code_keeps_globals_and_address_taken_labels(void)
+{
+    Program        program = parse_source(".start main\n"
+                                          ".global exported\n"
+                                          "main:\n"
+                                          "load_addr r1, callback\n"
+                                          "halt\n"
+                                          "exported:\n"
+                                          "call helper\n"
+                                          "ret\n"
+                                          "helper:\n"
+                                          "ret\n"
+                                          "callback:\n"
+                                          "ret\n"
+                                          "unused:\n"
+                                          "ret\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_dead_code(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_TRUE(has_label(&program, "exported"));
+    TEST_ASSERT_TRUE(has_label(&program, "helper"));
+    TEST_ASSERT_TRUE(has_label(&program, "callback"));
+    TEST_ASSERT_FALSE(has_label(&program, "unused"));
+    TEST_ASSERT_EQUAL_INT(6, instruction_count(&program));
+}
+
+// =================================================================
+// 3. Without .start the image enters at the first instruction, so that is the root
+// =================================================================
+void test_dead_code_without_start_begins_at_first_instruction(void)
+{
+    Program        program = parse_source("mov r0, 1\n"
+                                          "halt\n"
+                                          "mov r0, 2\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_dead_code(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_EQUAL_INT(2, instruction_count(&program));
+    TEST_ASSERT_EQUAL_UINT32(1, stats.instructions_removed);
+}
+
+// =================================================================
+// 4. A name defined twice is reported instead of guessing which one is meant
+// =================================================================
+void test_dead_code_rejects_duplicate_names(void)
+{
+    Program        program = parse_source("twice:\n"
+                                          "halt\n"
+                                          "twice:\n"
+                                          "halt\n");
+    OptimizerStats stats   = {0};
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status        = optimize_dead_code(&program, &test_parser_arena, &stats);
+    g_compiler_log_level = saved_level;
+
+    TEST_ASSERT_NOT_EQUAL(0, status);
+}
+
+// =================================================================
+// 5. .data items after a referenced one all stay, since code can index past it
+// =================================================================
+void test_dead_code_keeps_data_after_referenced_item(void)
+{
+    Program        program = parse_source(".data unused, 0\n"
+                                          ".data table, 1\n"
+                                          ".data table_1, 2\n"
+                                          ".start main\n"
+                                          ".data table_2, 3\n"
+                                          "main:\n"
+                                          "mov r0, table\n"
+                                          "halt\n"
+                                          ".data scratch, 4\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_dead_code(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_FALSE(has_item(&program, "unused"));
+    TEST_ASSERT_TRUE(has_item(&program, "table"));
+    TEST_ASSERT_TRUE(has_item(&program, "table_1"));
+    TEST_ASSERT_TRUE(has_item(&program, "table_2"));
+    TEST_ASSERT_TRUE(has_item(&program, "scratch"));
+    TEST_ASSERT_EQUAL_UINT32(1, stats.data_items_removed);
+}
+
+// =================================================================
+// 6. Indexing from one labeled item into the next crosses a label, which must not end the data
+// =================================================================
+void test_dead_code_keeps_data_indexed_across_a_label(void)
+{
+    Program        program = parse_source(".start main\n"
+                                          "main:\n"
+                                          "load_addr r1, head\n"
+                                          "add r1, 8\n"
+                                          "load_addr r0, copy\n"
+                                          "mov r2, 8\n"
+                                          "memcpy r0, r1\n"
+                                          "halt\n"
+                                          ".data head, 1\n"
+                                          "tail:\n"
+                                          ".data next, 2\n"
+                                          ".data copy, 0\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_dead_code(&program, &test_parser_arena, &stats));
+    TEST_ASSERT_TRUE(has_item(&program, "head"));
+    TEST_ASSERT_TRUE(has_item(&program, "next"));
+    TEST_ASSERT_TRUE(has_item(&program, "copy"));
+    TEST_ASSERT_EQUAL_UINT32(0, stats.data_items_removed);
+}
+
+void run_all_dead_code_tests(void)
+{
+    RUN_TEST(test_dead_code_removes_unreachable_regions);
+    RUN_TEST(test_dead_code_keeps_globals_and_address_taken_labels);
+    RUN_TEST(test_dead_code_without_start_begins_at_first_instruction);
+    RUN_TEST(test_dead_code_rejects_duplicate_names);
+    RUN_TEST(test_dead_code_keeps_data_after_referenced_item);
+    RUN_TEST(test_dead_code_keeps_data_indexed_across_a_label);
+}
@@ -0,0 +1,211 @@
+#define _POSIX_C_SOURCE 200809L
+#include "assembler_context.h"
+#include "emitter.h"
+#include "logger.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_profile.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+void run_all_layout_tests(void);
+
+void test_layout_hot_path_falls_through(void);
+void test_layout_profiled_run_keeps_results(void);
+void test_layout_ignores_mismatched_profile(void);
+void test_layout_rejects_malformed_profile(void);
+
+// The loop body is reached by a taken branch and an error path sits in the middle
+static const char* branchy_program = ".start main\n"
+                                     "main:\n"
+                                     "mov r0, 0\n"
+                                     "mov r1, 5\n"
+                                     "loop:\n"
+                                     "sub r1, 1\n"
+                                     "jnz body\n"
+                                     "jmp done\n"
+                                     "error:\n"
+                                     "mov r0, 99\n"
+                                     "halt\n"
+                                     "body:\n"
+                                     "add r0, r1\n"
+                                     "jmp loop\n"
+                                     "done:\n"
+                                     "halt\n";
+
+static Program parse_source(MemoryArena* arena, const char* source)
+{
+    Program      program = {.capcity = 100};
+    TokenStream* stream  = lex_from_string(arena, source);
+    TEST_ASSERT_EQUAL_INT8(0, run_parser(arena, stream, &program));
+    return program;
+}
+
+static LayoutProfile read_profile_text(const char* text, int8_t expected_status)
+{
+    FILE* f = tmpfile();
+    fputs(text, f);
+    rewind(f);
+    LayoutProfile profile;
+    LogLevel      saved_level = g_compiler_log_level;
+    g_compiler_log_level      = LOG_LEVEL_ERROR;
+    TEST_ASSERT_EQUAL_INT8(expected_status, profile_read(f, &test_parser_arena, &profile));
+    g_compiler_log_level = saved_level;
+    fclose(f);
+    return profile;
+}
+
+static const Instruction* nth_instruction(const Program* program, int n)
+{
+    for (int i = 0; i < program->count; i++)
+    {
+        if (program->lines[i].type == LINE_INSTRUCTION && n-- == 0)
+        {
+            return &program->lines[i].value.instruction;
+        }
+    }
+    TEST_FAIL_MESSAGE("program has fewer instructions than expected");
+    return NULL;
+}
+
+/*
+ *   Assembles source into a temporary file at path, laid out by `profile` when it is not NULL.
+ * */
+static int8_t assemble_to_file(const char* source, const LayoutProfile* profile, char* path)
+{
+    MemoryArena arena;
+    arena_init(&arena, MEM_SIZE + MAX_ARENA_SIZE);
+
+    AssemblerContext* asm_ctx = asm_ctx_init(&arena);
+    TokenStream*      stream  = lex_from_string(&arena, source);
+    asm_ctx->program.capcity  = 100;
+    int8_t status             = run_parser(&arena, stream, &asm_ctx->program);
+
+    OptimizerStats stats = {0};
+    if (status == 0 && profile != NULL)
+    {
+        status = optimize_layout(&asm_ctx->program, &arena, profile, &stats);
+    }
+
+    int   fd  = mkstemp(path);
+    FILE* out = fdopen(fd, "wb");
+    if (status == 0)
+    {
+        status = emit_program(asm_ctx, &arena, out, BYTECODE_SECTIONED_VERSION, false);
+    }
+    fclose(out);
+    asm_ctx_release(asm_ctx);
+    arena_free(&arena);
+    return status;
+}
+
+// =================================================================
+// 1. Taken-hot branch is inverted, the jmp to the next block goes, the cold path moves last
+// =================================================================
+void test_layout_hot_path_falls_through(void)
+{
+    Program        program = parse_source(&test_parser_arena, branchy_program);
+    LayoutProfile  profile = read_profile_text("# block offset, executions\n"
+                                               "0x000000 1\n"
+                                               "0x000010 5\n"
+                                               "0x000020 1\n"
+                                               "0x000028 0\n"
+                                               "0x000038 4\n"
+                                               "0x000048 1\n",
+                                               0);
+    OptimizerStats stats   = {0};
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    TEST_ASSERT_EQUAL_INT8(0, optimize_layout(&program, &test_parser_arena, &profile, &stats));
+    g_compiler_log_level = saved_level;
+
+    const Opcode expected[] = {OP_MOV, OP_MOV,  OP_SUB, OP_JZ,  OP_ADD,
+                               OP_JMP, OP_HALT, OP_MOV, OP_HALT};
+    for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        TEST_ASSERT_EQUAL_INT(expected[i], nth_instruction(&program, (int) i)->opcode);
+    }
+    TEST_ASSERT_EQUAL_STRING("layout.0", nth_instruction(&program, 3)->operands[0].value.symbol);
+    TEST_ASSERT_EQUAL_INT(LINE_LABEL_DEF, program.lines[program.count - 3].type);
+    TEST_ASSERT_EQUAL_STRING("error", program.lines[program.count - 3].value.label);
+
+    TEST_ASSERT_EQUAL_UINT32(4, stats.blocks_moved);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.branches_inverted);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.jumps_inserted);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.instructions_removed);
+}
+
+// =================================================================
+// 2. Profile a real run, rebuild with it and get the same answer
+// =================================================================
+void test_layout_profiled_run_keeps_results(void)
+{
+    char plain_path[] = "/tmp/bitlang_layout_XXXXXX";
+    char laid_path[]  = "/tmp/bitlang_layout_XXXXXX";
+    TEST_ASSERT_EQUAL_INT8(0, assemble_to_file(branchy_program, NULL, plain_path));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_profile_enable(vm_ctx));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_vm(vm_ctx, plain_path));
+    TEST_ASSERT_EQUAL_UINT32(10, vm_ctx->registers[REG_R0]);
+    FILE* f = tmpfile();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_profile_write(vm_ctx, f));
+    rewind(f);
+    LayoutProfile profile;
+    TEST_ASSERT_EQUAL_INT8(0, profile_read(f, &test_parser_arena, &profile));
+    fclose(f);
+    TEST_ASSERT_EQUAL_UINT64(5, profile.entries[1].count); // loop header
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    TEST_ASSERT_EQUAL_INT8(0, assemble_to_file(branchy_program, &profile, laid_path));
+    g_compiler_log_level = saved_level;
+
+    memset(vm_ctx->registers, 0, sizeof(vm_ctx->registers));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_vm(vm_ctx, laid_path));
+    TEST_ASSERT_EQUAL_UINT32(10, vm_ctx->registers[REG_R0]);
+    unlink(plain_path);
+    unlink(laid_path);
+}
+
+// =================================================================
+// 3. A profile naming offsets past the end of the code belongs to another build
+// =================================================================
+void test_layout_ignores_mismatched_profile(void)
+{
+    Program        program = parse_source(&test_parser_arena, branchy_program);
+    const int      count   = program.count;
+    LayoutProfile  profile = read_profile_text("0x0 1\n0x400 7\n", 0);
+    OptimizerStats stats   = {0};
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    TEST_ASSERT_EQUAL_INT8(0, optimize_layout(&program, &test_parser_arena, &profile, &stats));
+    g_compiler_log_level = saved_level;
+
+    TEST_ASSERT_EQUAL_INT(count, program.count);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.blocks_moved);
+    TEST_ASSERT_EQUAL_INT(OP_JNZ, nth_instruction(&program, 3)->opcode);
+}
+
+// =================================================================
+// 4. A line that is not "<offset> <count>" is an error
+// =================================================================
+void test_layout_rejects_malformed_profile(void)
+{
+    read_profile_text("0x0 1\nloop 5\n", -1);
+    read_profile_text("0x10 5 extra\n", -1);
+}
+
+void run_all_layout_tests(void)
+{
+    RUN_TEST(test_layout_hot_path_falls_through);
+    RUN_TEST(test_layout_profiled_run_keeps_results);
+    RUN_TEST(test_layout_ignores_mismatched_profile);
+    RUN_TEST(test_layout_rejects_malformed_profile);
+}
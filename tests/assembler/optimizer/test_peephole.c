@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+#include "assembler_context.h"
+#include "emitter.h"
+#include "logger.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+void run_all_peephole_tests(void);
+
+void test_peephole_removes_redundant_sequences(void);
+void test_peephole_folds_constants(void);
+void test_peephole_keeps_live_flags(void);
+void test_peephole_labels_end_windows(void);
+void test_peephole_preserves_behaviour(void);
+
+static Program parse_source(const char* source)
+{
+    Program      program = {.capcity = 100};
+    TokenStream* stream  = lex_from_string(&test_parser_arena, source);
+    TEST_ASSERT_EQUAL_INT8(0, run_parser(&test_parser_arena, stream, &program));
+    return program;
+}
+
+static const Instruction* nth_instruction(const Program* program, int n)
+{
+    for (int i = 0; i < program->count; i++)
+    {
+        if (program->lines[i].type == LINE_INSTRUCTION && n-- == 0)
+        {
+            return &program->lines[i].value.instruction;
+        }
+    }
+    TEST_FAIL_MESSAGE("instruction index out of range");
+    return NULL;
+}
+
+static int instruction_count(const Program* program)
+{
+    int count = 0;
+    for (int i = 0; i < program->count; i++)
+    {
+        count += program->lines[i].type == LINE_INSTRUCTION;
+    }
+    return count;
+}
+
+// =================================================================
+// 1. Self moves, push/pop pairs and jumps to the next instruction disappear
+// =================================================================
+void test_peephole_removes_redundant_sequences(void)
+{
+    Program        program = parse_source("mov r1, r1\n"
+                                          "push r2\n"
+                                          "pop r2\n"
+                                          "push r3\n"
+                                          "pop r4\n"
+                                          "jmp next\n"
+                                          "next:\n"
+                                          "halt\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_peephole(&program, &stats));
+    TEST_ASSERT_EQUAL_INT(2, instruction_count(&program));
+    TEST_ASSERT_EQUAL_UINT32(5, stats.instructions_removed);
+
+    const Instruction* mov = nth_instruction(&program, 0);
+    TEST_ASSERT_EQUAL_INT(OP_MOV, mov->opcode);
+    TEST_ASSERT_EQUAL_INT(REG_R4, mov->operands[0].value.reg);
+    TEST_ASSERT_EQUAL_INT(REG_R3, mov->operands[1].value.reg);
+    TEST_ASSERT_EQUAL_INT(OP_HALT, nth_instruction(&program, 1)->opcode);
+}
+
+// =================================================================
+// 2. Constant chains collapse once nothing can read the flags they set
+// =================================================================
+void test_peephole_folds_constants(void)
+{
+    Program        program = parse_source("mov r0, 6\n"
+                                          "mul r0, 7\n"
+                                          "add r1, 10\n"
+                                          "sub r1, 3\n"
+                                          "add r1, 1\n"
+                                          "add r2, 5\n"
+                                          "sub r2, 5\n"
+                                          "halt\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_peephole(&program, &stats));
+    TEST_ASSERT_EQUAL_INT(3, instruction_count(&program));
+
+    const Instruction* mov = nth_instruction(&program, 0);
+    TEST_ASSERT_EQUAL_INT(OP_MOV, mov->opcode);
+    TEST_ASSERT_EQUAL_INT64(42, mov->operands[1].value.literal.value.longValue);
+    const Instruction* add = nth_instruction(&program, 1);
+    TEST_ASSERT_EQUAL_INT(OP_ADD, add->opcode);
+    TEST_ASSERT_EQUAL_INT64(8, add->operands[1].value.literal.value.longValue);
+}
+
+// =================================================================
+// 3. A fold that would change flags a following jump reads is left alone
+// =================================================================
+void test_peephole_keeps_live_flags(void)
+{
+    Program        program = parse_source("add r0, 1\n"
+                                          "add r0, 2\n"
+                                          "jz done\n"
+                                          "mov r1, 1\n"
+                                          "done:\n"
+                                          "halt\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_peephole(&program, &stats));
+    TEST_ASSERT_EQUAL_INT(5, instruction_count(&program));
+    TEST_ASSERT_EQUAL_UINT32(0, stats.instructions_removed);
+}
+
+// =================================================================
+// 4. A label between two instructions is a jump target, so they are not a window
+// =================================================================
+void test_peephole_labels_end_windows(void)
+{
+    Program        program = parse_source("push r1\n"
+                                          "entry:\n"
+                                          "pop r1\n"
+                                          "jmp entry\n");
+    OptimizerStats stats   = {0};
+
+    TEST_ASSERT_EQUAL_INT8(0, optimize_peephole(&program, &stats));
+    TEST_ASSERT_EQUAL_INT(3, instruction_count(&program));
+}
+
+// =================================================================
+// 5. The optimized program computes the same result with fewer instructions
+// =================================================================
+void test_peephole_preserves_behaviour(void)
+{
+    static const char* source = ".start main\n"
+                                "main:\n"
+                                "mov r0, 0\n"
+                                "mov r1, 4\n"
+                                "add r1, 6\n"
+                                "loop:\n"
+                                "mov r2, r2\n"
+                                "push r1\n"
+                                "pop r1\n"
+                                "add r0, r1\n"
+                                "add r0, 1\n"
+                                "sub r0, 1\n"
+                                "sub r1, 1\n"
+                                "jnz loop\n"
+                                "jmp end\n"
+                                "end:\n"
+                                "halt\n";
+    uint64_t results[2];
+    int      sizes[2];
+
+    for (int optimize = 0; optimize < 2; optimize++)
+    {
+        char        path[] = "/tmp/bitlang_peephole_XXXXXX";
+        MemoryArena arena;
+        arena_init(&arena, MEM_SIZE + MAX_ARENA_SIZE);
+
+        AssemblerContext* asm_ctx = asm_ctx_init(&arena);
+        asm_ctx->program.capcity  = 100;
+        TokenStream* stream       = lex_from_string(&arena, source);
+        TEST_ASSERT_EQUAL_INT8(0, run_parser(&arena, stream, &asm_ctx->program));
+
+        OptimizerStats stats = {0};
+        if (optimize)
+        {
+            LogLevel saved_level = g_compiler_log_level;
+            g_compiler_log_level = LOG_LEVEL_ERROR;
+            TEST_ASSERT_EQUAL_INT8(0, optimize_program(asm_ctx, &arena, &stats));
+            g_compiler_log_level = saved_level;
+        }
+        sizes[optimize] = instruction_count(&asm_ctx->program);
+
+        FILE* out = fdopen(mkstemp(path), "wb");
+        TEST_ASSERT_EQUAL_INT8(
+            0, emit_program(asm_ctx, &arena, out, BYTECODE_SECTIONED_VERSION, false));
+        fclose(out);
+        asm_ctx_release(asm_ctx);
+        arena_free(&arena);
+
+        memset(vm_ctx->registers, 0, sizeof(vm_ctx->registers));
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_vm(vm_ctx, path));
+        results[optimize] = vm_ctx->registers[REG_R0];
+        unlink(path);
+    }
+
+    TEST_ASSERT_EQUAL_UINT64(55, results[0]);
+    TEST_ASSERT_EQUAL_UINT64(results[0], results[1]);
+    TEST_ASSERT_LESS_THAN(sizes[0], sizes[1]);
+}
+
+void run_all_peephole_tests(void)
+{
+    RUN_TEST(test_peephole_removes_redundant_sequences);
+    RUN_TEST(test_peephole_folds_constants);
+    RUN_TEST(test_peephole_keeps_live_flags);
+    RUN_TEST(test_peephole_labels_end_windows);
+    RUN_TEST(test_peephole_preserves_behaviour);
+}
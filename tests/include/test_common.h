@@ -3,8 +3,26 @@
 #include "token_stream.h"
 #include "vm.h"
 
+// Lays out one 8-byte instruction: opcode, two register bytes, little-endian imm32, metadata
+#define TEST_INST(opcode, operand_1, operand_2, imm, metadata)                                    \
+    (uint8_t) (opcode), (uint8_t) (operand_1), (uint8_t) (operand_2), (uint8_t) (imm),            \
+        (uint8_t) ((uint32_t) (imm) >> 8), (uint8_t) ((uint32_t) (imm) >> 16),                    \
+        (uint8_t) ((uint32_t) (imm) >> 24), (uint8_t) (metadata)
+
+// MOVQ: the 8-byte instruction carrying the low half, then a word with the high half
+#define TEST_MOVQ(reg, imm64)                                                                      \
+    TEST_INST(OP_MOVQ, reg, 0, (uint32_t) (imm64),                                                 \
+              MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),                                     \
+        TEST_INST((uint32_t) ((uint64_t) (imm64) >> 32), (uint32_t) ((uint64_t) (imm64) >> 40),    \
+                  (uint32_t) ((uint64_t) (imm64) >> 48), (uint8_t) ((uint64_t) (imm64) >> 56), 0)
+
 extern VMContext*  vm_ctx;
 extern MemoryArena lexer_arena;
 extern MemoryArena test_parser_arena;
 
 TokenStream* lex_from_string(MemoryArena* arena, const char* source);
+int8_t       run_test_image(VMContext* ctx, const uint8_t* code, uint32_t code_len);
+int8_t       run_test_image_version(VMContext* ctx, const uint8_t* code, uint32_t code_len,
+                                    uint16_t version);
+int8_t       load_test_image(VMContext* ctx, const uint8_t* code, uint32_t code_len);
+int8_t       write_test_image(char* path, const uint8_t* code, uint32_t code_len, uint16_t version);
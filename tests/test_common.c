@@ -1,10 +1,14 @@
+#define _POSIX_C_SOURCE 200809L
 #include "test_common.h"
 #include "arena_allocator.h"
 #include "lexer.h"
 #include "token_stream.h"
 #include "unity.h"
 #include "vm.h"
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 VMContext*  vm_ctx;
 MemoryArena lexer_arena;
@@ -40,3 +44,73 @@ TokenStream* lex_from_string(MemoryArena* arena, const char* source)
         return NULL;
     return build_token_stream(arena, tokens->items, token_count);
 }
+
+static void write_u16(FILE* f, uint16_t value)
+{
+    uint8_t b[2] = {(uint8_t) value, (uint8_t) (value >> 8)};
+    fwrite(b, 1, sizeof(b), f);
+}
+
+static void write_u32(FILE* f, uint32_t value)
+{
+    uint8_t b[4] = {(uint8_t) value, (uint8_t) (value >> 8), (uint8_t) (value >> 16),
+                    (uint8_t) (value >> 24)};
+    fwrite(b, 1, sizeof(b), f);
+}
+
+/*
+ *   Wraps raw code in a v1 bytecode header, writes it to a temporary file and runs it.
+ * */
+int8_t run_test_image(VMContext* ctx, const uint8_t* code, uint32_t code_len)
+{
+    return run_test_image_version(ctx, code, code_len, BYTECODE_SUPPORTED_VERSION);
+}
+
+/*
+ *   Writes code under a `version` bytecode header to a new temporary file; path must end in
+ *   XXXXXX.
+ * */
+int8_t write_test_image(char* path, const uint8_t* code, uint32_t code_len, uint16_t version)
+{
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return VM_ERR_IO_READ_FAILED;
+
+    FILE* f = fdopen(fd, "wb");
+    write_u32(f, BYTECODE_MAGIC);
+    write_u16(f, version);
+    write_u32(f, code_len);
+    write_u32(f, 0);
+    write_u32(f, 0);
+    write_u32(f, 0);
+    fwrite(code, 1, code_len, f);
+    fclose(f);
+    return VM_EXIT_SUCCESS;
+}
+
+static int8_t use_test_image(VMContext* ctx, const uint8_t* code, uint32_t code_len,
+                             uint16_t version, bool run)
+{
+    char   path[] = "/tmp/bitlang_test_XXXXXX";
+    int8_t status = write_test_image(path, code, code_len, version);
+    if (status != VM_EXIT_SUCCESS)
+        return status;
+
+    status = run ? run_vm(ctx, path) : vm_load(ctx, path);
+    unlink(path);
+    return status;
+}
+
+int8_t run_test_image_version(VMContext* ctx, const uint8_t* code, uint32_t code_len,
+                              uint16_t version)
+{
+    return use_test_image(ctx, code, code_len, version, true);
+}
+
+/*
+ *   Same image as run_test_image, but only vm_load it.
+ * */
+int8_t load_test_image(VMContext* ctx, const uint8_t* code, uint32_t code_len)
+{
+    return use_test_image(ctx, code, code_len, BYTECODE_SUPPORTED_VERSION, false);
+}
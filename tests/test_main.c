@@ -6,6 +6,31 @@ void run_all_lexer_tests(void);
 void run_all_parser_tests(void);
 void run_all_decoder_tests(void);
 void run_all_vm_tests(void);
+void run_all_stack_tests(void);
+void run_all_heap_tests(void);
+void run_all_bulk_memory_tests(void);
+void run_all_simd_tests(void);
+void run_all_wide_tests(void);
+void run_all_emitter_tests(void);
+void run_all_constant_pool_tests(void);
+void run_all_peephole_tests(void);
+void run_all_dead_code_tests(void);
+void run_all_coalesce_tests(void);
+void run_all_layout_tests(void);
+void run_all_sections_tests(void);
+void run_all_verifier_tests(void);
+void run_all_fuel_tests(void);
+void run_all_run_api_tests(void);
+void run_all_scheduler_tests(void);
+void run_all_image_tests(void);
+void run_all_snapshot_tests(void);
+void run_all_threads_tests(void);
+void run_all_pipe_tests(void);
+void run_all_native_tests(void);
+void run_all_io_tests(void);
+void run_all_batch_tests(void);
+void run_all_logger_tests(void);
+void run_all_cfg_tests(void);
 
 // void setUp(void) { ctx = vm_create(); }
 // void tearDown(void) { vm_destroy(ctx); }
@@ -28,6 +53,31 @@ int main(void)
     run_all_parser_tests();
     run_all_decoder_tests();
     run_all_vm_tests();
+    run_all_stack_tests();
+    run_all_heap_tests();
+    run_all_bulk_memory_tests();
+    run_all_simd_tests();
+    run_all_wide_tests();
+    run_all_emitter_tests();
+    run_all_constant_pool_tests();
+    run_all_peephole_tests();
+    run_all_dead_code_tests();
+    run_all_coalesce_tests();
+    run_all_layout_tests();
+    run_all_sections_tests();
+    run_all_verifier_tests();
+    run_all_fuel_tests();
+    run_all_run_api_tests();
+    run_all_scheduler_tests();
+    run_all_image_tests();
+    run_all_snapshot_tests();
+    run_all_threads_tests();
+    run_all_pipe_tests();
+    run_all_native_tests();
+    run_all_io_tests();
+    run_all_batch_tests();
+    run_all_logger_tests();
+    run_all_cfg_tests();
 
     return UNITY_END();
 }
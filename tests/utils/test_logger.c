@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+// Errors and warnings only, so this file also checks what the compile-time filter removes
+#undef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 2
+#include "logger.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGGER_THREADS 4
+#define LOGGER_MESSAGES 2000
+
+void run_all_logger_tests(void);
+
+void test_logger_formats_captured_arguments(void);
+void test_logger_keeps_every_record_from_every_thread(void);
+void test_logger_filters_before_evaluating_arguments(void);
+
+// Everything written to sink since the last rewind, NUL-terminated; free it
+static char* read_sink(FILE* sink)
+{
+    log_flush();
+    long size = ftell(sink);
+    char* text = calloc(1, (size_t) size + 1);
+    rewind(sink);
+    TEST_ASSERT_EQUAL_size_t((size_t) size, fread(text, 1, (size_t) size, sink));
+    return text;
+}
+
+// =================================================================
+// 1. Records print as printf would have printed them when logged
+// =================================================================
+void test_logger_formats_captured_arguments(void)
+{
+    FILE* sink = tmpfile();
+    TEST_ASSERT_NOT_NULL(sink);
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_WARN;
+    log_set_sink(sink);
+
+    char name[] = "first";
+    int  line   = __LINE__ + 1;
+    LOG_ERROR("%d %u %ld %lld %zu %x|%5.2f|%s|%c %% %*d %-6s| %.3s", -7, 7u, -70000L, 1LL << 40,
+              (size_t) 42, 0xBEEFu, 3.14159, name, 'z', 4, 9, "left", "truncate");
+    strcpy(name, "later"); // the record holds its own copy
+    LOG_WARN("no arguments");
+
+    char* text = read_sink(sink);
+    log_set_sink(NULL);
+    g_compiler_log_level = saved_level;
+    fclose(sink);
+
+    char expected[512];
+    snprintf(expected, sizeof(expected),
+             "[ERROR] %s:%d %s() - -7 7 -70000 1099511627776 42 beef| 3.14|first|z %%    9 left  "
+             "| tru\n[WARN ] %s:%d %s() - no arguments\n",
+             __FILE__, line, __func__, __FILE__, line + 3, __func__);
+    TEST_ASSERT_EQUAL_STRING(expected, text);
+    free(text);
+}
+
+static void* log_from_thread(void* arg)
+{
+    int thread = (int) (intptr_t) arg;
+    for (int i = 0; i < LOGGER_MESSAGES; i++)
+    {
+        LOG_ERROR("thread %d message %d", thread, i);
+    }
+    return NULL;
+}
+
+// =================================================================
+// 2. Several threads overrunning their rings lose nothing and keep their own order
+// =================================================================
+void test_logger_keeps_every_record_from_every_thread(void)
+{
+    FILE* sink = tmpfile();
+    TEST_ASSERT_NOT_NULL(sink);
+    log_set_sink(sink);
+    pthread_t threads[LOGGER_THREADS];
+    for (int i = 0; i < LOGGER_THREADS; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, log_from_thread,
+                                                (void*) (intptr_t) i));
+    }
+    for (int i = 0; i < LOGGER_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    char* text = read_sink(sink);
+    log_set_sink(NULL);
+    fclose(sink);
+
+    int next[LOGGER_THREADS] = {0};
+    int lines                = 0;
+    for (char* cursor = strstr(text, "thread "); cursor != NULL; cursor = strstr(cursor, "thread "))
+    {
+        int thread, message;
+        TEST_ASSERT_EQUAL_INT(2, sscanf(cursor, "thread %d message %d", &thread, &message));
+        TEST_ASSERT_TRUE(thread >= 0 && thread < LOGGER_THREADS);
+        TEST_ASSERT_EQUAL_INT(next[thread], message);
+        next[thread]++;
+        lines++;
+        cursor++;
+    }
+    TEST_ASSERT_EQUAL_INT(LOGGER_THREADS * LOGGER_MESSAGES, lines);
+    free(text);
+}
+
+// =================================================================
+// 3. Compiled-out levels and levels above g_compiler_log_level never touch their arguments, and
+//    an error is written without waiting for a flush
+// =================================================================
+void test_logger_filters_before_evaluating_arguments(void)
+{
+    FILE* sink = tmpfile();
+    TEST_ASSERT_NOT_NULL(sink);
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_TRACE;
+    log_set_sink(sink);
+
+    int evaluated = 0;
+    LOG_INFO("%d", ++evaluated);
+    LOG_DEBUG("%d", ++evaluated);
+    LOG_TRACE("%d", ++evaluated);
+    TEST_ASSERT_EQUAL_INT(0, evaluated);
+
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    LOG_WARN("%d", ++evaluated);
+    TEST_ASSERT_EQUAL_INT(0, evaluated);
+    LOG_ERROR("%d", ++evaluated);
+    TEST_ASSERT_EQUAL_INT(1, evaluated);
+    TEST_ASSERT_TRUE(ftell(sink) > 0); // an error is out before LOG_ERROR returns
+
+    char* text = read_sink(sink);
+    log_set_sink(NULL);
+    g_compiler_log_level = saved_level;
+    fclose(sink);
+    TEST_ASSERT_NOT_NULL(strstr(text, "() - 1\n"));
+    TEST_ASSERT_NULL(strstr(text, "[WARN "));
+    free(text);
+}
+
+void run_all_logger_tests(void)
+{
+    RUN_TEST(test_logger_formats_captured_arguments);
+    RUN_TEST(test_logger_keeps_every_record_from_every_thread);
+    RUN_TEST(test_logger_filters_before_evaluating_arguments);
+}
@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_batch.h"
+#include "vm_image.h"
+#include "vm_utils.h"
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORD_WORDS 4
+#define RECORD_SIZE (RECORD_WORDS * sizeof(uint32_t))
+#define INPUT_AT DATA_START
+#define TOTAL_AT (DATA_START + 16)
+
+void run_all_batch_tests(void);
+
+void test_batch_records_start_from_the_image_state(void);
+void test_batch_reset_restores_an_instance(void);
+void test_batch_fuel_and_bad_layouts(void);
+
+static const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+static const uint8_t reg_reg = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+
+// Adds the input words into a running total in data, pushes their sum and halts. Without a reset
+// between records the total would carry over from one record to the next.
+static const uint8_t accumulate[] = {
+    TEST_INST(OP_MOV, REG_R1, 0, INPUT_AT, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    TEST_INST(OP_MOV, REG_R2, 0, TOTAL_AT, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    TEST_INST(OP_VLOAD, 0, REG_R1, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+    TEST_INST(OP_VLOAD, 1, REG_R2, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+    TEST_INST(OP_VADD32, 0, 1, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+    TEST_INST(OP_VSTORE, REG_R2, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+    TEST_INST(OP_VSUM32, REG_R0, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+    TEST_INST(OP_PUSH, REG_R0, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_NONE)),
+    TEST_INST(OP_HALT, 0, 0, 0, 0),
+};
+
+static VMImage* image_from_code(const uint8_t* code, uint32_t code_len)
+{
+    char path[] = "/tmp/bitlang_batch_XXXXXX";
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS,
+                           write_test_image(path, code, code_len, BYTECODE_SUPPORTED_VERSION));
+    VMImage* image = vm_image_load(path);
+    unlink(path);
+    TEST_ASSERT_NOT_NULL(image);
+    return image;
+}
+
+// =================================================================
+// 1. Across threads, every record sees the image's data, not the previous record's
+// =================================================================
+void test_batch_records_start_from_the_image_state(void)
+{
+    enum
+    {
+        COUNT = 1000
+    };
+    static uint32_t    inputs[COUNT][RECORD_WORDS];
+    static uint32_t    outputs[COUNT][RECORD_WORDS];
+    static VMRunResult results[COUNT];
+    for (uint32_t i = 0; i < COUNT; i++)
+    {
+        for (uint32_t word = 0; word < RECORD_WORDS; word++)
+        {
+            inputs[i][word] = i * RECORD_WORDS + word;
+        }
+    }
+    memset(outputs, 0xFF, sizeof(outputs));
+
+    VMImage*      image  = image_from_code(accumulate, sizeof(accumulate));
+    VMBatchLayout layout = {
+        .input_at    = INPUT_AT,
+        .input_size  = RECORD_SIZE,
+        .output_at   = TOTAL_AT,
+        .output_size = RECORD_SIZE,
+        .threads     = 4,
+    };
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS,
+                           vm_run_batch(image, &layout, inputs, outputs, COUNT, results));
+    vm_image_release(image);
+
+    for (uint32_t i = 0; i < COUNT; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, results[i]);
+    }
+    TEST_ASSERT_EQUAL_MEMORY(inputs, outputs, sizeof(inputs));
+}
+
+// =================================================================
+// 2. vm_image_reset restores memory, kept or dropped, and registers but not the host's settings
+// =================================================================
+void test_batch_reset_restores_an_instance(void)
+{
+    VMImage*   image = image_from_code(accumulate, sizeof(accumulate));
+    VMContext* ctx   = vm_create_from_image(image);
+    vm_image_release(image);
+    const uint32_t sp                   = ctx->sp;
+    VMNativeFn     table[VM_NATIVE_MAX] = {0};
+    ctx->natives                        = table;
+
+    vm_store_u32(ctx, INPUT_AT, 7);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(ctx));
+    TEST_ASSERT_EQUAL_UINT32(7, vm_load_u32(ctx, TOTAL_AT));
+    TEST_ASSERT_EQUAL_UINT64(7, ctx->registers[REG_R0]);
+    TEST_ASSERT_TRUE(ctx->sp != sp);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_image_reset(ctx, INPUT_AT, 2 * RECORD_SIZE));
+    TEST_ASSERT_EQUAL_INT(VM_STATE_YIELDED, ctx->state);
+    TEST_ASSERT_EQUAL_UINT32(0, vm_load_u32(ctx, INPUT_AT));
+    TEST_ASSERT_EQUAL_UINT32(0, vm_load_u32(ctx, TOTAL_AT));
+    TEST_ASSERT_EQUAL_UINT64(0, ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_UINT32(sp, ctx->sp);
+    TEST_ASSERT_TRUE(ctx->natives == table);
+    TEST_ASSERT_EQUAL_MEMORY(accumulate, ctx->memory + CODE_START, sizeof(accumulate));
+
+    vm_store_u32(ctx, INPUT_AT, 5);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(ctx));
+    TEST_ASSERT_EQUAL_UINT32(5, vm_load_u32(ctx, TOTAL_AT));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_image_reset(ctx, 0, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, vm_load_u32(ctx, TOTAL_AT));
+    TEST_ASSERT_EQUAL_UINT32(0, vm_load_u32(ctx, sp - sizeof(uint32_t)));
+    vm_destroy(ctx);
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    ctx                  = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION, vm_image_reset(ctx, 0, 0));
+    vm_destroy(ctx);
+    g_compiler_log_level = saved_level;
+}
+
+// =================================================================
+// 3. A record that runs out of fuel gets a zeroed output; bad regions fail the whole batch
+// =================================================================
+void test_batch_fuel_and_bad_layouts(void)
+{
+    // Spins forever on odd inputs, copies the input to the output on even ones
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, INPUT_AT, reg_imm),
+        TEST_INST(OP_MOV, REG_R3, REG_R1, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_INDIRECT)),
+        TEST_INST(OP_AND, REG_R3, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, CODE_START + 3 * INSTRUCTION_SIZE,
+                  MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE)),
+        TEST_INST(OP_MOV, REG_R2, 0, TOTAL_AT, reg_imm),
+        TEST_INST(OP_VLOAD, 0, REG_R1, 0, reg_reg),
+        TEST_INST(OP_VSTORE, REG_R2, 0, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    uint32_t    inputs[4][RECORD_WORDS] = {{2, 1, 1, 1}, {3, 1, 1, 1}, {4, 2, 2, 2}, {5}};
+    uint32_t    outputs[4][RECORD_WORDS];
+    VMRunResult results[4];
+    memset(outputs, 0xFF, sizeof(outputs));
+
+    VMImage*      image  = image_from_code(code, sizeof(code));
+    VMBatchLayout layout = {
+        .input_at    = INPUT_AT,
+        .input_size  = RECORD_SIZE,
+        .output_at   = TOTAL_AT,
+        .output_size = RECORD_SIZE,
+        .fuel        = 1000,
+        .threads     = 1,
+    };
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS,
+                           vm_run_batch(image, &layout, inputs, outputs, 4, results));
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, results[0]);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_BUDGET_EXHAUSTED, results[1]);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, results[2]);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_BUDGET_EXHAUSTED, results[3]);
+    TEST_ASSERT_EQUAL_MEMORY(inputs[0], outputs[0], RECORD_SIZE);
+    TEST_ASSERT_EQUAL_MEMORY(inputs[2], outputs[2], RECORD_SIZE);
+    TEST_ASSERT_EACH_EQUAL_UINT32(0, outputs[1], RECORD_WORDS);
+    TEST_ASSERT_EACH_EQUAL_UINT32(0, outputs[3], RECORD_WORDS);
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    layout.input_at      = RODATA_START;
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION,
+                           vm_run_batch(image, &layout, inputs, outputs, 4, NULL));
+    layout.input_at  = INPUT_AT;
+    layout.output_at = HEAP_END - 4;
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_MEMORY_OUT_OF_BOUNDS,
+                           vm_run_batch(image, &layout, inputs, outputs, 4, NULL));
+    g_compiler_log_level = saved_level;
+    vm_image_release(image);
+}
+
+void run_all_batch_tests(void)
+{
+    RUN_TEST(test_batch_records_start_from_the_image_state);
+    RUN_TEST(test_batch_reset_restores_an_instance);
+    RUN_TEST(test_batch_fuel_and_bad_layouts);
+}
@@ -0,0 +1,128 @@
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include <stdint.h>
+#include <string.h>
+
+#define META_REG_IMM MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)
+#define META_REG_REG MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)
+
+void run_all_bulk_memory_tests(void);
+
+void test_bulk_memset_then_strlen(void);
+void test_bulk_memcpy_and_memcmp(void);
+void test_bulk_memchr(void);
+void test_bulk_write_to_code_is_rejected(void);
+void test_bulk_range_crossing_segment_is_rejected(void);
+
+// =================================================================
+// 1. MEMSET 100 bytes of 'a' into DATA, then STRLEN sees all of them
+// =================================================================
+void test_bulk_memset_then_strlen(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, DATA_START, META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R2, 0, 100, META_REG_IMM),
+        TEST_INST(OP_MEMSET, REG_R1, 0, 'a', META_REG_IMM),
+        TEST_INST(OP_STRLEN, REG_R0, REG_R1, 0, META_REG_REG),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    memset(vm_ctx->memory + DATA_START, 0, 256);
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_UINT32(100, vm_ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_UINT8('a', vm_ctx->memory[DATA_START + 99]);
+}
+
+// =================================================================
+// 2. MEMCPY DATA into the heap, MEMCMP reports equal then greater
+// =================================================================
+void test_bulk_memcpy_and_memcmp(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, DATA_START, META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R3, 0, HEAP_START, META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R2, 0, 6, META_REG_IMM),
+        TEST_INST(OP_MEMCPY, REG_R3, REG_R1, 0, META_REG_REG),
+        TEST_INST(OP_MEMCMP, REG_R3, REG_R1, 0, META_REG_REG),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    memcpy(vm_ctx->memory + DATA_START, "bitlang", 8);
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_MEMORY("bitlan", vm_ctx->memory + HEAP_START, 6);
+    TEST_ASSERT_EQUAL_UINT32(1, vm_ctx->flags[VM_FLAG_ZERO]);
+}
+
+// =================================================================
+// 3. MEMCHR finds the first match, or yields 0 with the zero flag
+// =================================================================
+void test_bulk_memchr(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R2, 0, 8, META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R0, 0, DATA_START, META_REG_IMM),
+        TEST_INST(OP_MEMCHR, REG_R0, 0, 'l', META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R1, 0, DATA_START, META_REG_IMM),
+        TEST_INST(OP_MEMCHR, REG_R1, 0, 'z', META_REG_IMM),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    memcpy(vm_ctx->memory + DATA_START, "bitlang", 8);
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_HEX32(DATA_START + 3, vm_ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_HEX32(0, vm_ctx->registers[REG_R1]);
+    TEST_ASSERT_EQUAL_UINT32(1, vm_ctx->flags[VM_FLAG_ZERO]);
+}
+
+// =================================================================
+// 4. Writes into CODE are refused before any byte is touched
+// =================================================================
+void test_bulk_write_to_code_is_rejected(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, CODE_START, META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R2, 0, 8, META_REG_IMM),
+        TEST_INST(OP_MEMSET, REG_R1, 0, 0, META_REG_IMM),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION, status);
+    TEST_ASSERT_EQUAL_UINT8(OP_MOV, vm_ctx->memory[CODE_START]);
+}
+
+// =================================================================
+// 5. A copy running off the end of DATA into the heap is out of bounds
+// =================================================================
+void test_bulk_range_crossing_segment_is_rejected(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, DATA_START + DATA_SIZE - 4, META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R3, 0, HEAP_START, META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R2, 0, 8, META_REG_IMM),
+        TEST_INST(OP_MEMCPY, REG_R3, REG_R1, 0, META_REG_REG),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_MEMORY_OUT_OF_BOUNDS, status);
+}
+
+void run_all_bulk_memory_tests(void)
+{
+    RUN_TEST(test_bulk_memset_then_strlen);
+    RUN_TEST(test_bulk_memcpy_and_memcmp);
+    RUN_TEST(test_bulk_memchr);
+    RUN_TEST(test_bulk_write_to_code_is_rejected);
+    RUN_TEST(test_bulk_range_crossing_segment_is_rejected);
+}
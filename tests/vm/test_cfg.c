@@ -0,0 +1,124 @@
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_cfg.h"
+#include <stdint.h>
+
+#define JUMP(opcode, target)                                                                       \
+    TEST_INST(opcode, 0, 0, CODE_START + (target), MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE))
+#define MOV_IMM(reg, value)                                                                        \
+    TEST_INST(OP_MOV, reg, 0, value, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT))
+#define SUB_IMM(reg, value)                                                                        \
+    TEST_INST(OP_SUB, reg, 0, value, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT))
+#define BARE(opcode) TEST_INST(opcode, 0, 0, 0, 0)
+
+void run_all_cfg_tests(void);
+
+void test_cfg_nested_loops(void);
+void test_cfg_branches_calls_and_dead_code(void);
+void test_cfg_rejects_misplaced_entry(void);
+
+// =================================================================
+// 1. Two nested counting loops: back edges, loop depth and innermost headers
+// =================================================================
+void test_cfg_nested_loops(void)
+{
+    const uint8_t code[] = {
+        MOV_IMM(REG_R1, 3),  // B0
+        MOV_IMM(REG_R2, 2),  // B1: outer header
+        SUB_IMM(REG_R2, 1),  // B2: inner header
+        JUMP(OP_JNZ, 16),    //
+        SUB_IMM(REG_R1, 1),  // B3
+        JUMP(OP_JNZ, 8),     //
+        BARE(OP_HALT),       // B4
+    };
+    ControlFlowGraph cfg;
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, cfg_build(&cfg, code, sizeof(code), 0));
+    TEST_ASSERT_EQUAL_UINT32(5, cfg.block_count);
+    TEST_ASSERT_EQUAL_UINT32(2, cfg.blocks[2].instruction_count);
+    TEST_ASSERT_EQUAL_UINT32(2, cfg.loop_count);
+
+    TEST_ASSERT_EQUAL_UINT32(1, cfg.blocks[2].idom);
+    TEST_ASSERT_EQUAL_UINT32(3, cfg.blocks[4].idom);
+    TEST_ASSERT_TRUE(cfg.blocks[1].flags & CFG_BLOCK_LOOP_HEADER);
+    TEST_ASSERT_TRUE(cfg.blocks[2].flags & CFG_BLOCK_LOOP_HEADER);
+
+    TEST_ASSERT_EQUAL_UINT16(0, cfg.blocks[0].loop_depth);
+    TEST_ASSERT_EQUAL_UINT16(1, cfg.blocks[1].loop_depth);
+    TEST_ASSERT_EQUAL_UINT16(2, cfg.blocks[2].loop_depth);
+    TEST_ASSERT_EQUAL_UINT16(1, cfg.blocks[3].loop_depth);
+    TEST_ASSERT_EQUAL_UINT32(2, cfg.blocks[2].loop_header);
+    TEST_ASSERT_EQUAL_UINT32(1, cfg.blocks[3].loop_header);
+    TEST_ASSERT_EQUAL_UINT32(CFG_NO_BLOCK, cfg.blocks[4].loop_header);
+    cfg_free(&cfg);
+}
+
+// =================================================================
+// 2. A diamond around a call: join dominators, call and return blocks, unreachable code
+// =================================================================
+void test_cfg_branches_calls_and_dead_code(void)
+{
+    const uint8_t code[] = {
+        BARE(OP_CMP),        // B0
+        JUMP(OP_JZ, 40),     //
+        JUMP(OP_CALL, 64),   // B1
+        JUMP(OP_JMP, 48),    // B2
+        BARE(OP_HALT),       // B3: dead
+        MOV_IMM(REG_R1, 1),  // B4
+        BARE(OP_HALT),       // B5: join
+        BARE(OP_HALT),       // B6: dead
+        MOV_IMM(REG_R3, 3),  // B7: callee
+        BARE(OP_RET),        //
+    };
+    ControlFlowGraph cfg;
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, cfg_build(&cfg, code, sizeof(code), 0));
+    TEST_ASSERT_EQUAL_UINT32(8, cfg.block_count);
+    TEST_ASSERT_EQUAL_UINT32(0, cfg.loop_count);
+
+    TEST_ASSERT_EQUAL_UINT32(0, cfg.blocks[5].idom);
+    TEST_ASSERT_TRUE(cfg_dominates(&cfg, 0, 5));
+    TEST_ASSERT_FALSE(cfg_dominates(&cfg, 4, 5));
+    TEST_ASSERT_EQUAL_UINT32(2, cfg.blocks[5].predecessor_count);
+
+    TEST_ASSERT_TRUE(cfg.blocks[1].flags & CFG_BLOCK_CALL);
+    TEST_ASSERT_EQUAL_UINT8(2, cfg.blocks[1].successor_count);
+    TEST_ASSERT_TRUE(cfg.blocks[7].flags & CFG_BLOCK_REACHABLE);
+    TEST_ASSERT_TRUE(cfg.blocks[7].flags & CFG_BLOCK_RETURN);
+    TEST_ASSERT_EQUAL_UINT8(0, cfg.blocks[7].successor_count);
+    TEST_ASSERT_EQUAL_UINT32(7, cfg_block_containing(&cfg, 72));
+
+    TEST_ASSERT_FALSE(cfg.blocks[3].flags & CFG_BLOCK_REACHABLE);
+    TEST_ASSERT_FALSE(cfg.blocks[6].flags & CFG_BLOCK_REACHABLE);
+    TEST_ASSERT_EQUAL_UINT32(CFG_NO_BLOCK, cfg.blocks[3].idom);
+    cfg_free(&cfg);
+}
+
+// =================================================================
+// 3. An entry point inside an instruction is an error
+// =================================================================
+void test_cfg_rejects_misplaced_entry(void)
+{
+    const uint8_t code[] = {
+        MOV_IMM(REG_R1, 1),
+        BARE(OP_HALT),
+    };
+    ControlFlowGraph cfg;
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status        = cfg_build(&cfg, code, sizeof(code), 4);
+    g_compiler_log_level = saved_level;
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_BYTECODE, status);
+}
+
+void run_all_cfg_tests(void)
+{
+    RUN_TEST(test_cfg_nested_loops);
+    RUN_TEST(test_cfg_branches_calls_and_dead_code);
+    RUN_TEST(test_cfg_rejects_misplaced_entry);
+}
@@ -0,0 +1,97 @@
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include <stdint.h>
+
+// r1 = 1000 + 999 + ... + 1: a 5-instruction entry block, a 3-instruction loop block and a halt
+#define SUM_PROGRAM                                                                                \
+    TEST_INST(OP_MOV, REG_R1, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),               \
+        TEST_INST(OP_MOV, REG_R2, 0, 1000, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),        \
+        TEST_INST(OP_ADD, REG_R1, REG_R2, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),   \
+        TEST_INST(OP_SUB, REG_R2, 0, 1, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),           \
+        TEST_INST(OP_JNZ, 0, 0, CODE_START + 16, MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE)),       \
+        TEST_INST(OP_HALT, 0, 0, 0, 0)
+
+#define SUM_INSTRUCTIONS (2 + 3 * 1000 + 1)
+
+void run_all_fuel_tests(void);
+
+void test_fuel_time_slices_to_completion(void);
+void test_fuel_charges_whole_blocks(void);
+void test_fuel_empty_budget_yields_before_running(void);
+
+// =================================================================
+// 1. Small slices: every yield stops at a block start and the result is unchanged
+// =================================================================
+void test_fuel_time_slices_to_completion(void)
+{
+    const uint8_t code[] = {SUM_PROGRAM};
+
+    vm_ctx->fuel = 100;
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_test_image(vm_ctx, code, sizeof(code)));
+    int slices = 1;
+    while (vm_ctx->state == VM_STATE_YIELDED)
+    {
+        TEST_ASSERT_TRUE(vm_ctx->pc == CODE_START + 16 || vm_ctx->pc == CODE_START + 40);
+        vm_ctx->fuel = 100;
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_resume(vm_ctx));
+        slices++;
+    }
+
+    TEST_ASSERT_EQUAL_INT(VM_STATE_HALTED, vm_ctx->state);
+    TEST_ASSERT_EQUAL_UINT32(500500, vm_ctx->registers[REG_R1]);
+    TEST_ASSERT_INT_WITHIN(2, SUM_INSTRUCTIONS / 100, slices);
+}
+
+// =================================================================
+// 2. The budget is exact at block granularity
+// =================================================================
+void test_fuel_charges_whole_blocks(void)
+{
+    const uint8_t code[] = {SUM_PROGRAM};
+
+    vm_ctx->fuel = SUM_INSTRUCTIONS;
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_test_image(vm_ctx, code, sizeof(code)));
+    TEST_ASSERT_EQUAL_INT(VM_STATE_HALTED, vm_ctx->state);
+    TEST_ASSERT_EQUAL_INT64(0, vm_ctx->fuel);
+
+    vm_ctx->state = VM_STATE_HALTED;
+    vm_ctx->fuel  = SUM_INSTRUCTIONS - 1;
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_test_image(vm_ctx, code, sizeof(code)));
+    TEST_ASSERT_EQUAL_INT(VM_STATE_YIELDED, vm_ctx->state);
+    TEST_ASSERT_EQUAL_UINT32(CODE_START + 40, vm_ctx->pc);
+    TEST_ASSERT_EQUAL_UINT32(500500, vm_ctx->registers[REG_R1]);
+}
+
+// =================================================================
+// 3. No fuel: nothing runs, and only a yielded VM can be resumed
+// =================================================================
+void test_fuel_empty_budget_yields_before_running(void)
+{
+    const uint8_t code[] = {SUM_PROGRAM};
+
+    vm_ctx->registers[REG_R1] = 7;
+    vm_ctx->fuel              = 0;
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, run_test_image(vm_ctx, code, sizeof(code)));
+    TEST_ASSERT_EQUAL_INT(VM_STATE_YIELDED, vm_ctx->state);
+    TEST_ASSERT_EQUAL_UINT32(CODE_START, vm_ctx->pc);
+    TEST_ASSERT_EQUAL_UINT32(7, vm_ctx->registers[REG_R1]);
+
+    vm_ctx->fuel = VM_FUEL_UNLIMITED;
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_resume(vm_ctx));
+    TEST_ASSERT_EQUAL_INT(VM_STATE_HALTED, vm_ctx->state);
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION, vm_resume(vm_ctx));
+    g_compiler_log_level = saved_level;
+}
+
+void run_all_fuel_tests(void)
+{
+    RUN_TEST(test_fuel_time_slices_to_completion);
+    RUN_TEST(test_fuel_charges_whole_blocks);
+    RUN_TEST(test_fuel_empty_budget_yields_before_running);
+}
@@ -0,0 +1,174 @@
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_heap.h"
+#include <stdint.h>
+#include <string.h>
+
+void run_all_heap_tests(void);
+
+void test_heap_small_blocks_are_recycled(void);
+void test_heap_large_blocks_coalesce(void);
+void test_heap_free_at_top_shrinks_heap(void);
+void test_heap_realloc_grows_in_place(void);
+void test_heap_double_free_is_rejected(void);
+void test_heap_churn_does_not_exhaust(void);
+void test_heap_allocate_string_returns_start(void);
+void test_heap_opcodes(void);
+
+// =================================================================
+// 1. Small frees go to their size-class bin and are handed straight back
+// =================================================================
+void test_heap_small_blocks_are_recycled(void)
+{
+    vm_heap_init(vm_ctx);
+    uint32_t a = vm_heap_alloc(vm_ctx, 20);
+    uint32_t b = vm_heap_alloc(vm_ctx, 20);
+
+    TEST_ASSERT_NOT_EQUAL(0, a);
+    TEST_ASSERT_EQUAL_UINT32(0, a % VM_HEAP_ALIGN);
+    TEST_ASSERT_TRUE(a >= HEAP_START && b < HEAP_END);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_heap_free(vm_ctx, a));
+    TEST_ASSERT_EQUAL_UINT32(a, vm_heap_alloc(vm_ctx, 24));
+}
+
+// =================================================================
+// 2. Neighbouring large frees merge into one block
+// =================================================================
+void test_heap_large_blocks_coalesce(void)
+{
+    vm_heap_init(vm_ctx);
+    uint32_t a     = vm_heap_alloc(vm_ctx, 1000);
+    uint32_t b     = vm_heap_alloc(vm_ctx, 1000);
+    uint32_t guard = vm_heap_alloc(vm_ctx, 1000);
+    TEST_ASSERT_NOT_EQUAL(0, guard);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_heap_free(vm_ctx, b));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_heap_free(vm_ctx, a));
+
+    uint32_t merged = vm_heap_alloc(vm_ctx, 2000);
+    TEST_ASSERT_EQUAL_UINT32(a, merged);
+}
+
+// =================================================================
+// 3. Freeing the topmost block hands its space back to the top of the heap
+// =================================================================
+void test_heap_free_at_top_shrinks_heap(void)
+{
+    vm_heap_init(vm_ctx);
+    uint32_t initial_hp = vm_ctx->hp;
+    uint32_t a          = vm_heap_alloc(vm_ctx, 4096);
+    uint32_t b          = vm_heap_alloc(vm_ctx, 4096);
+
+    vm_heap_free(vm_ctx, a);
+    vm_heap_free(vm_ctx, b);
+    TEST_ASSERT_EQUAL_HEX32(initial_hp, vm_ctx->hp);
+}
+
+// =================================================================
+// 4. realloc keeps the address when it can grow into free space, and keeps the data
+// =================================================================
+void test_heap_realloc_grows_in_place(void)
+{
+    vm_heap_init(vm_ctx);
+    uint32_t a = vm_heap_alloc(vm_ctx, 600);
+    memcpy(vm_ctx->memory + a, "bitlang", 8);
+
+    uint32_t grown = vm_heap_realloc(vm_ctx, a, 6000);
+    TEST_ASSERT_EQUAL_UINT32(a, grown);
+    TEST_ASSERT_TRUE(vm_heap_usable_size(vm_ctx, grown) >= 6000);
+
+    uint32_t pinned = vm_heap_alloc(vm_ctx, 16);
+    TEST_ASSERT_NOT_EQUAL(0, pinned);
+    uint32_t moved = vm_heap_realloc(vm_ctx, grown, 12000);
+    TEST_ASSERT_NOT_EQUAL(grown, moved);
+    TEST_ASSERT_EQUAL_STRING("bitlang", (char*) vm_ctx->memory + moved);
+}
+
+// =================================================================
+// 5. Double frees, stale reallocs and wild pointers are reported, not corrupted
+// =================================================================
+void test_heap_double_free_is_rejected(void)
+{
+    vm_heap_init(vm_ctx);
+    uint32_t small = vm_heap_alloc(vm_ctx, 8);
+    uint32_t large = vm_heap_alloc(vm_ctx, 2048);
+    vm_heap_alloc(vm_ctx, 8);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_heap_free(vm_ctx, small));
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION, vm_heap_free(vm_ctx, small));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_heap_free(vm_ctx, large));
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION, vm_heap_free(vm_ctx, large));
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_HEAP_OUT_OF_BOUNDS, vm_heap_free(vm_ctx, DATA_START));
+
+    // realloc of a freed block must not hand it out again or touch the free lists
+    TEST_ASSERT_EQUAL_UINT32(0, vm_heap_realloc(vm_ctx, small, 64));
+    TEST_ASSERT_EQUAL_UINT32(0, vm_heap_realloc(vm_ctx, large, 4096));
+    TEST_ASSERT_EQUAL_UINT32(small, vm_heap_alloc(vm_ctx, 8));
+}
+
+// =================================================================
+// 6. Allocating and freeing far more than HEAP_SIZE in total keeps working
+// =================================================================
+void test_heap_churn_does_not_exhaust(void)
+{
+    vm_heap_init(vm_ctx);
+    uint32_t live[8] = {0};
+    for (uint32_t i = 0; i < 20000; i++)
+    {
+        uint32_t slot = i % 8;
+        vm_heap_free(vm_ctx, live[slot]);
+        live[slot] = vm_heap_alloc(vm_ctx, 32 + (i * 37) % 3000);
+        TEST_ASSERT_NOT_EQUAL(0, live[slot]);
+    }
+    TEST_ASSERT_TRUE(vm_ctx->hp < HEAP_START + 64 * 1024);
+}
+
+// =================================================================
+// 7. vm_allocate_string returns the start of the copied string
+// =================================================================
+void test_heap_allocate_string_returns_start(void)
+{
+    vm_heap_init(vm_ctx);
+    uint32_t address = vm_allocate_string(vm_ctx, "hello");
+    TEST_ASSERT_NOT_EQUAL(0, address);
+    TEST_ASSERT_EQUAL_STRING("hello", (char*) vm_ctx->memory + address);
+}
+
+// =================================================================
+// 8. ALLOC / REALLOC / FREE from guest code
+// =================================================================
+void test_heap_opcodes(void)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg_reg = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+    const uint8_t code[]  = {
+        TEST_INST(OP_ALLOC, REG_R0, 0, 100, reg_imm),
+        TEST_INST(OP_MOV, REG_R3, REG_R0, 0, reg_reg),
+        TEST_INST(OP_REALLOC, REG_R0, 0, 5000, reg_imm),
+        TEST_INST(OP_FREE, REG_R0, 0, 0, 0),
+        TEST_INST(OP_ALLOC, REG_R1, 0, 100, reg_imm),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_NOT_EQUAL(0, vm_ctx->registers[REG_R3]);
+    TEST_ASSERT_NOT_EQUAL(0, vm_ctx->registers[REG_R1]);
+    TEST_ASSERT_EQUAL_UINT32(0, vm_ctx->flags[VM_FLAG_ZERO]);
+}
+
+void run_all_heap_tests(void)
+{
+    RUN_TEST(test_heap_small_blocks_are_recycled);
+    RUN_TEST(test_heap_large_blocks_coalesce);
+    RUN_TEST(test_heap_free_at_top_shrinks_heap);
+    RUN_TEST(test_heap_realloc_grows_in_place);
+    RUN_TEST(test_heap_double_free_is_rejected);
+    RUN_TEST(test_heap_churn_does_not_exhaust);
+    RUN_TEST(test_heap_allocate_string_returns_start);
+    RUN_TEST(test_heap_opcodes);
+}
@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_image.h"
+#include "vm_utils.h"
+#include <stdint.h>
+#include <unistd.h>
+
+void run_all_image_tests(void);
+
+void test_image_instances_share_code_and_keep_private_state(void);
+void test_image_runs_predecoded_code(void);
+void test_image_rejects_bad_input(void);
+
+static VMImage* image_from_code(const uint8_t* code, uint32_t code_len, uint16_t version)
+{
+    char path[] = "/tmp/bitlang_image_XXXXXX";
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, write_test_image(path, code, code_len, version));
+    VMImage* image = vm_image_load(path);
+    unlink(path);
+    TEST_ASSERT_NOT_NULL(image);
+    return image;
+}
+
+// =================================================================
+// 1. Instances share the image's tables but never see each other's writes
+// =================================================================
+void test_image_instances_share_code_and_keep_private_state(void)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t code[]  = {
+        TEST_INST(OP_MOV, REG_R1, 0, 0, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, 100, reg_imm),
+        TEST_INST(OP_ADD, REG_R1, REG_R2, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+        TEST_INST(OP_SUB, REG_R2, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, CODE_START + 16, MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE)),
+        TEST_INST(OP_PUSH, REG_R1, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_NONE)),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    VMImage*   image = image_from_code(code, sizeof(code), BYTECODE_SUPPORTED_VERSION);
+    VMContext* first = vm_create_from_image(image);
+    VMContext* other = vm_create_from_image(image);
+    vm_image_release(image);
+
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(other);
+    TEST_ASSERT_EQUAL_INT(VM_STATE_YIELDED, first->state);
+    TEST_ASSERT_TRUE(first->memory != other->memory);
+    TEST_ASSERT_TRUE(first->predecoded == other->predecoded);
+    TEST_ASSERT_TRUE(first->block_cost == other->block_cost);
+    TEST_ASSERT_EQUAL_MEMORY(code, first->memory + CODE_START, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(first));
+    TEST_ASSERT_EQUAL_UINT32(5050, first->registers[REG_R1]);
+    TEST_ASSERT_EQUAL_UINT32(5050, vm_load_u32(first, first->sp));
+    TEST_ASSERT_EQUAL_UINT32(0, vm_load_u32(other, first->sp));
+    TEST_ASSERT_EQUAL_UINT32(0, other->registers[REG_R1]);
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(other));
+    TEST_ASSERT_EQUAL_UINT32(5050, other->registers[REG_R1]);
+    vm_destroy(first);
+    vm_destroy(other);
+}
+
+// =================================================================
+// 2. MOVQ still finds its second word, and a bad opcode fails only once reached
+// =================================================================
+void test_image_runs_predecoded_code(void)
+{
+    const uint8_t code[] = {
+        TEST_MOVQ(REG_R1, 0x123456789ABCDEF0ULL),
+        TEST_INST(OP_JMP, 0, 0, CODE_START + 32, MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE)),
+        TEST_INST(0xEE, 0, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        TEST_INST(0xEE, 0, 0, 0, 0),
+    };
+    VMImage* image =
+        image_from_code(code, sizeof(code), BYTECODE_SUPPORTED_VERSION | BYTECODE_FLAG_WIDE);
+    VMContext* good = vm_create_from_image(image);
+    VMContext* bad  = vm_create_from_image(image);
+    vm_image_release(image);
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(good));
+    TEST_ASSERT_EQUAL_HEX64(0x123456789ABCDEF0ULL, good->registers[REG_R1]);
+
+    bad->pc              = CODE_START + 40;
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    VMRunResult result   = vm_run_until(bad);
+    g_compiler_log_level = saved_level;
+    TEST_ASSERT_EQUAL_INT(VM_RUN_ERROR, result);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_OPCODE_NOT_FOUND, bad->last_error);
+    vm_destroy(good);
+    vm_destroy(bad);
+}
+
+// =================================================================
+// 3. A missing file gives no image, and an instance cannot load another program
+// =================================================================
+void test_image_rejects_bad_input(void)
+{
+    const uint8_t code[]      = {TEST_INST(OP_HALT, 0, 0, 0, 0)};
+    LogLevel      saved_level = g_compiler_log_level;
+    g_compiler_log_level      = LOG_LEVEL_ERROR;
+
+    TEST_ASSERT_NULL(vm_image_load("/tmp/bitlang_no_such_image"));
+    VMImage*   image    = image_from_code(code, sizeof(code), BYTECODE_SUPPORTED_VERSION);
+    VMContext* instance = vm_create_from_image(image);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION, load_test_image(instance, code, sizeof(code)));
+    g_compiler_log_level = saved_level;
+
+    vm_destroy(instance);
+    vm_image_release(image);
+}
+
+void run_all_image_tests(void)
+{
+    RUN_TEST(test_image_instances_share_code_and_keep_private_state);
+    RUN_TEST(test_image_runs_predecoded_code);
+    RUN_TEST(test_image_rejects_bad_input);
+}
@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_io.h"
+#include "vm_scheduler.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PATH_AT DATA_START
+#define TEXT_AT (DATA_START + 256)
+#define BUFFER_AT (DATA_START + 512)
+
+void run_all_io_tests(void);
+
+void test_io_round_trip_through_a_file(void);
+void test_io_reader_waits_on_the_ring_while_the_writer_runs(void);
+void test_io_reports_errors_in_r0(void);
+void test_io_cancels_a_read_left_in_flight(void);
+
+static const uint8_t reg_imm    = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+static const uint8_t reg_reg    = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+static const uint8_t reg_only   = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_NONE);
+static const uint8_t reg_target = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_ADDR);
+
+static void put_string(VMContext* ctx, uint32_t address, const char* text)
+{
+    memcpy(ctx->memory + address, text, strlen(text) + 1);
+}
+
+// =================================================================
+// 1. Without a ring: write a file, read it back to end of file, close it
+// =================================================================
+void test_io_round_trip_through_a_file(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, PATH_AT, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, VM_OPEN_WRITE, reg_imm),
+        TEST_INST(OP_OPEN, REG_R3, REG_R1, 0, reg_reg),
+        TEST_INST(OP_MOV, REG_R4, 0, TEXT_AT, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, 5, reg_imm),
+        TEST_INST(OP_WRITE, REG_R3, REG_R4, 0, reg_reg),
+        TEST_INST(OP_MOV, REG_R5, REG_R0, 0, reg_reg),
+        TEST_INST(OP_CLOSE, REG_R3, 0, 0, reg_only),
+        TEST_INST(OP_MOV, REG_R2, 0, VM_OPEN_READ, reg_imm),
+        TEST_INST(OP_OPEN, REG_R3, REG_R1, 0, reg_reg),
+        TEST_INST(OP_MOV, REG_R4, 0, BUFFER_AT, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, 64, reg_imm),
+        TEST_INST(OP_READ, REG_R3, REG_R4, 0, reg_reg),
+        TEST_INST(OP_MOV, REG_R6, REG_R0, 0, reg_reg),
+        TEST_INST(OP_READ, REG_R3, REG_R4, 0, reg_reg),
+        TEST_INST(OP_MOV, REG_R7, REG_R0, 0, reg_reg),
+        TEST_INST(OP_CLOSE, REG_R3, 0, 0, reg_only),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    char path[] = "/tmp/bitlang_io_XXXXXX";
+    int  fd     = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+
+    VMContext* ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, code, sizeof(code)));
+    put_string(ctx, PATH_AT, path);
+    put_string(ctx, TEXT_AT, "hello");
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(ctx));
+    unlink(path);
+
+    TEST_ASSERT_EQUAL_UINT64(1, ctx->registers[REG_R3]);
+    TEST_ASSERT_EQUAL_UINT64(5, ctx->registers[REG_R5]);
+    TEST_ASSERT_EQUAL_UINT64(5, ctx->registers[REG_R6]);
+    TEST_ASSERT_EQUAL_UINT64(0, ctx->registers[REG_R7]);
+    TEST_ASSERT_EQUAL_MEMORY("hello", ctx->memory + BUFFER_AT, 5);
+    TEST_ASSERT_FALSE(ctx->files[0].open);
+    vm_destroy(ctx);
+}
+
+// =================================================================
+// 2. On one worker, a VM reading an empty pipe parks while the VM that fills it runs
+// =================================================================
+void test_io_reader_waits_on_the_ring_while_the_writer_runs(void)
+{
+    VMIoRing* probe = vm_io_ring_create(1);
+    if (probe == NULL)
+    {
+        TEST_IGNORE_MESSAGE("io_uring is not available here");
+    }
+    vm_io_ring_destroy(probe);
+
+    // r1 holds the handle the host lends each VM
+    const uint8_t reader[] = {
+        TEST_INST(OP_MOV, REG_R4, 0, BUFFER_AT, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, 64, reg_imm),
+        TEST_INST(OP_READ, REG_R1, REG_R4, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    const uint8_t writer[] = {
+        TEST_INST(OP_MOV, REG_R4, 0, TEXT_AT, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, 4, reg_imm),
+        TEST_INST(OP_WRITE, REG_R1, REG_R4, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+    VMScheduler* scheduler = vm_scheduler_create(1, 1000);
+    VMTask       tasks[2]  = {0};
+    tasks[0].vm            = vm_create();
+    tasks[1].vm            = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(tasks[0].vm, reader, sizeof(reader)));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(tasks[1].vm, writer, sizeof(writer)));
+    put_string(tasks[1].vm, TEXT_AT, "ping");
+    tasks[0].vm->registers[REG_R1] = vm_attach_file(tasks[0].vm, fds[0]);
+    tasks[1].vm->registers[REG_R1] = vm_attach_file(tasks[1].vm, fds[1]);
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_submit(scheduler, &tasks[i]));
+    }
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_run(scheduler));
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, tasks[0].result);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, tasks[1].result);
+    TEST_ASSERT_EQUAL_UINT64(4, tasks[0].vm->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_UINT64(4, tasks[1].vm->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_MEMORY("ping", tasks[0].vm->memory + BUFFER_AT, 4);
+    TEST_ASSERT_GREATER_THAN_UINT32(1, tasks[0].slices);
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        vm_task_release(&tasks[i]);
+        vm_destroy(tasks[i].vm);
+    }
+    vm_scheduler_destroy(scheduler);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// =================================================================
+// 3. Failed calls leave -errno in r0 and set the sign flag; closing a lent handle keeps the fd
+// =================================================================
+void test_io_reports_errors_in_r0(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, 9, reg_imm),
+        TEST_INST(OP_MOV, REG_R4, 0, BUFFER_AT, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, 4, reg_imm),
+        TEST_INST(OP_READ, REG_R1, REG_R4, 0, reg_reg),
+        TEST_INST(OP_MOV, REG_R5, REG_R0, 0, reg_reg),
+        TEST_INST(OP_MOV, REG_R1, 0, PATH_AT, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, VM_OPEN_READ, reg_imm),
+        TEST_INST(OP_OPEN, REG_R3, REG_R1, 0, reg_reg),
+        TEST_INST(OP_MOV, REG_R2, 0, 7, reg_imm),
+        TEST_INST(OP_OPEN, REG_R6, REG_R1, 0, reg_reg),
+        TEST_INST(OP_CLOSE, REG_R7, 0, 0, reg_only),
+        TEST_INST(OP_MOV, REG_R4, 0, CODE_START, reg_imm),
+        TEST_INST(OP_READ, REG_R7, REG_R4, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+    VMContext* ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, code, sizeof(code)));
+    put_string(ctx, PATH_AT, "/nonexistent/bitlang");
+    ctx->registers[REG_R7] = vm_attach_file(ctx, fds[1]);
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    TEST_ASSERT_EQUAL_INT(VM_RUN_ERROR, vm_run_until(ctx));
+    g_compiler_log_level = saved_level;
+
+    // The read into the code segment is refused before any system call
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION, ctx->last_error);
+    TEST_ASSERT_EQUAL_UINT64((uint32_t) -EBADF, ctx->registers[REG_R5]);
+    TEST_ASSERT_EQUAL_UINT64((uint32_t) -ENOENT, ctx->registers[REG_R3]);
+    TEST_ASSERT_EQUAL_UINT64((uint32_t) -EINVAL, ctx->registers[REG_R6]);
+    TEST_ASSERT_EQUAL_UINT64(0, ctx->registers[REG_R0]);
+    TEST_ASSERT_FALSE(ctx->files[0].open);
+    TEST_ASSERT_EQUAL_INT(1, write(fds[1], "x", 1));
+    vm_destroy(ctx);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// =================================================================
+// 4. Main halting while a worker thread's read is out cancels the read before the task ends
+// =================================================================
+void test_io_cancels_a_read_left_in_flight(void)
+{
+    VMIoRing* probe = vm_io_ring_create(1);
+    if (probe == NULL)
+    {
+        TEST_IGNORE_MESSAGE("io_uring is not available here");
+    }
+    vm_io_ring_destroy(probe);
+
+    const uint8_t code[] = {
+        TEST_INST(OP_SPAWN, REG_R3, 0, CODE_START + 3 * INSTRUCTION_SIZE, reg_target),
+        TEST_INST(OP_YIELD, 0, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        TEST_INST(OP_MOV, REG_R4, 0, BUFFER_AT, reg_imm), // 3: worker, reads the empty pipe
+        TEST_INST(OP_MOV, REG_R2, 0, 64, reg_imm),
+        TEST_INST(OP_READ, REG_R1, REG_R4, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+    VMScheduler* scheduler = vm_scheduler_create(1, 1000);
+    VMTask       task      = {0};
+    task.vm                = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(task.vm, code, sizeof(code)));
+    put_string(task.vm, BUFFER_AT, "none");
+    task.vm->registers[REG_R1] = vm_attach_file(task.vm, fds[0]);
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_submit(scheduler, &task));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_run(scheduler));
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, task.result);
+    TEST_ASSERT_EQUAL_UINT32(VM_IO_IDLE, atomic_load(&task.vm->io_request.state));
+
+    // What arrives later stays in the pipe instead of landing in the halted VM
+    char late[4];
+    TEST_ASSERT_EQUAL_INT(4, write(fds[1], "late", 4));
+    TEST_ASSERT_EQUAL_INT(4, read(fds[0], late, sizeof(late)));
+    TEST_ASSERT_EQUAL_MEMORY("late", late, 4);
+    TEST_ASSERT_EQUAL_STRING("none", (const char*) task.vm->memory + BUFFER_AT);
+
+    vm_task_release(&task);
+    vm_destroy(task.vm);
+    vm_scheduler_destroy(scheduler);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void run_all_io_tests(void)
+{
+    RUN_TEST(test_io_round_trip_through_a_file);
+    RUN_TEST(test_io_reader_waits_on_the_ring_while_the_writer_runs);
+    RUN_TEST(test_io_reports_errors_in_r0);
+    RUN_TEST(test_io_cancels_a_read_left_in_flight);
+}
@@ -0,0 +1,186 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_image.h"
+#include "vm_utils.h"
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NATIVE_HASH 3
+#define NATIVE_STORE 7
+
+void run_all_native_tests(void);
+
+void test_native_image_table_reaches_every_instance(void);
+void test_native_errors_stop_the_vm(void);
+void test_native_plain_context_and_snapshot_tables(void);
+
+static const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+static const uint8_t reg_reg = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+static const uint8_t imm     = MAKE_METADATA(VM_AM_IMM_INT, VM_AM_NONE);
+static const uint8_t target  = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE);
+
+static uint32_t fnv1a(const uint8_t* data, uint64_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (uint64_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// r0 = FNV-1a of the r2 bytes at r1
+static int8_t native_hash(VMContext* ctx, uint64_t* registers)
+{
+    const uint8_t* data = vm_guest_pointer(ctx, registers[REG_R1], registers[REG_R2], false);
+    if (data == NULL)
+    {
+        return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+    }
+    registers[REG_R0] = fnv1a(data, registers[REG_R2]);
+    return VM_EXIT_SUCCESS;
+}
+
+// Writes r0 as a 32-bit word at r1
+static int8_t native_store(VMContext* ctx, uint64_t* registers)
+{
+    uint8_t* slot = vm_guest_pointer(ctx, registers[REG_R1], sizeof(uint32_t), true);
+    if (slot == NULL)
+    {
+        return VM_ERR_MEMORY_OUT_OF_BOUNDS;
+    }
+    uint32_t value = (uint32_t) registers[REG_R0];
+    memcpy(slot, &value, sizeof(value));
+    return VM_EXIT_SUCCESS;
+}
+
+// Fills 16 bytes at DATA_START with 'a' and hashes them through the host
+static const uint8_t hash_code[] = {
+    TEST_INST(OP_MOV, REG_R1, 0, DATA_START, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    TEST_INST(OP_MOV, REG_R2, 0, 16, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    TEST_INST(OP_MOV, REG_R3, 0, 'a', MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    TEST_INST(OP_MEMSET, REG_R1, REG_R3, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+    TEST_INST(OP_CALLNATIVE, 0, 0, NATIVE_HASH, MAKE_METADATA(VM_AM_IMM_INT, VM_AM_NONE)),
+    TEST_INST(OP_HALT, 0, 0, 0, 0),
+};
+
+static uint32_t expected_hash(void)
+{
+    uint8_t bytes[16];
+    memset(bytes, 'a', sizeof(bytes));
+    return fnv1a(bytes, sizeof(bytes));
+}
+
+// =================================================================
+// 1. One registration on the image serves instances made before and after it
+// =================================================================
+void test_native_image_table_reaches_every_instance(void)
+{
+    char path[] = "/tmp/bitlang_native_XXXXXX";
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, write_test_image(path, hash_code, sizeof(hash_code),
+                                                             BYTECODE_SUPPORTED_VERSION));
+    VMImage* image = vm_image_load(path);
+    unlink(path);
+    TEST_ASSERT_NOT_NULL(image);
+
+    VMContext* early = vm_create_from_image(image);
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS,
+                           vm_image_register_native(image, NATIVE_HASH, native_hash));
+    VMContext* late = vm_create_from_image(image);
+    vm_image_release(image);
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(early));
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(late));
+    TEST_ASSERT_EQUAL_UINT64(expected_hash(), early->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_UINT64(expected_hash(), late->registers[REG_R0]);
+    TEST_ASSERT_TRUE(early->natives == late->natives);
+    vm_destroy(early);
+    vm_destroy(late);
+}
+
+// =================================================================
+// 2. Unregistered ids, out-of-range registrations and failing functions are errors
+// =================================================================
+void test_native_errors_stop_the_vm(void)
+{
+    const uint8_t store_to_code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, CODE_START, reg_imm),
+        TEST_INST(OP_CALLNATIVE, 0, 0, NATIVE_STORE, imm),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    VMNativeFn table[VM_NATIVE_MAX] = {[NATIVE_STORE] = native_store};
+    LogLevel   saved_level          = g_compiler_log_level;
+    g_compiler_log_level            = LOG_LEVEL_ERROR;
+
+    VMContext* ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, hash_code, sizeof(hash_code)));
+    TEST_ASSERT_EQUAL_INT(VM_RUN_ERROR, vm_run_until(ctx));
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_NATIVE, ctx->last_error);
+    vm_destroy(ctx);
+
+    ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS,
+                           load_test_image(ctx, store_to_code, sizeof(store_to_code)));
+    ctx->natives = table;
+    TEST_ASSERT_EQUAL_INT(VM_RUN_ERROR, vm_run_until(ctx));
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_MEMORY_OUT_OF_BOUNDS, ctx->last_error);
+    TEST_ASSERT_NULL(vm_guest_pointer(ctx, HEAP_END - 2, sizeof(uint32_t), false));
+    vm_destroy(ctx);
+
+    char path[] = "/tmp/bitlang_native_XXXXXX";
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, write_test_image(path, hash_code, sizeof(hash_code),
+                                                             BYTECODE_SUPPORTED_VERSION));
+    VMImage* image = vm_image_load(path);
+    unlink(path);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_NATIVE,
+                           vm_image_register_native(image, VM_NATIVE_MAX, native_hash));
+    vm_image_release(image);
+    g_compiler_log_level = saved_level;
+}
+
+// =================================================================
+// 3. A plain context calls through a host array; its snapshot keeps the functions
+// =================================================================
+void test_native_plain_context_and_snapshot_tables(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R0, 0, 41, reg_imm),
+        TEST_INST(OP_MOV, REG_R1, 0, DATA_START + 64, reg_imm),
+        TEST_INST(OP_CALLNATIVE, 0, 0, NATIVE_STORE, imm),
+        TEST_INST(OP_JMP, 0, 0, CODE_START + 4 * INSTRUCTION_SIZE, target), // ends the block
+        TEST_INST(OP_ADD, REG_R0, 0, 1, reg_imm),
+        TEST_INST(OP_CALLNATIVE, 0, 0, NATIVE_STORE, imm),
+        TEST_INST(OP_MOV, REG_R5, REG_R0, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    VMNativeFn table[VM_NATIVE_MAX] = {[NATIVE_STORE] = native_store};
+    VMContext* ctx                  = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, code, sizeof(code)));
+    ctx->natives = table;
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_BUDGET_EXHAUSTED, vm_step_n(ctx, 1));
+    TEST_ASSERT_EQUAL_UINT32(41, vm_load_u32(ctx, DATA_START + 64));
+    VMImage* snapshot = vm_snapshot(ctx);
+    TEST_ASSERT_NOT_NULL(snapshot);
+    table[NATIVE_STORE] = NULL; // the snapshot took its own copy
+    VMContext* fork     = vm_fork(snapshot);
+    vm_image_release(snapshot);
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_step_n(fork, UINT64_MAX));
+    TEST_ASSERT_EQUAL_UINT32(42, vm_load_u32(fork, DATA_START + 64));
+    TEST_ASSERT_EQUAL_UINT64(42, fork->registers[REG_R5]);
+    vm_destroy(fork);
+    vm_destroy(ctx);
+}
+
+void run_all_native_tests(void)
+{
+    RUN_TEST(test_native_image_table_reaches_every_instance);
+    RUN_TEST(test_native_errors_stop_the_vm);
+    RUN_TEST(test_native_plain_context_and_snapshot_tables);
+}
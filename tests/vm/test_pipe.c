@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_pipe.h"
+#include "vm_scheduler.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define AT(slot) (CODE_START + (slot) * INSTRUCTION_SIZE)
+#define PIPE_TEST_PRODUCERS 3
+#define PIPE_TEST_MESSAGES 20000
+
+void run_all_pipe_tests(void);
+
+void test_pipe_spsc_keeps_order_across_wraparound(void);
+void test_pipe_connects_two_scheduled_vms(void);
+void test_pipe_mpsc_keeps_every_producer_in_order(void);
+
+static const uint8_t reg_imm      = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+static const uint8_t reg_reg      = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+static const uint8_t reg_indirect = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_INDIRECT);
+static const uint8_t target       = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE);
+
+// =================================================================
+// 1. SPSC: full and empty are reported, order survives the ring wrapping, ports are checked
+// =================================================================
+void test_pipe_spsc_keeps_order_across_wraparound(void)
+{
+    VMPipe* pipe = vm_pipe_create(VM_PIPE_SPSC, 3, sizeof(uint32_t));
+    TEST_ASSERT_NOT_NULL(pipe);
+    TEST_ASSERT_EQUAL_UINT32(sizeof(uint32_t), vm_pipe_message_size(pipe));
+
+    uint32_t next = 0;
+    uint32_t out  = 0;
+    for (uint32_t round = 0; round < 5; round++)
+    {
+        while (vm_pipe_send(pipe, &next))
+        {
+            next++;
+        }
+        TEST_ASSERT_EQUAL_UINT32(4 * (round + 1), next); // 3 slots round up to 4
+        for (uint32_t expected = 4 * round; expected < next; expected++)
+        {
+            TEST_ASSERT_TRUE(vm_pipe_recv(pipe, &out));
+            TEST_ASSERT_EQUAL_UINT32(expected, out);
+        }
+        TEST_ASSERT_FALSE(vm_pipe_recv(pipe, &out));
+    }
+
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, 1, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, DATA_START, reg_imm),
+        TEST_INST(OP_PRECV, REG_R1, REG_R2, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    VMContext* ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, code, sizeof(code)));
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    TEST_ASSERT_NULL(vm_pipe_create(VM_PIPE_SPSC, 4, 0));
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_PIPE, vm_attach_pipe(ctx, VM_PIPE_MAX, pipe));
+    TEST_ASSERT_EQUAL_INT(VM_RUN_ERROR, vm_run_until(ctx));
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_PIPE, ctx->last_error);
+    g_compiler_log_level = saved_level;
+
+    vm_destroy(ctx);
+    vm_pipe_destroy(pipe);
+}
+
+// =================================================================
+// 2. A producer VM streams 1..100 to a consumer VM through a 4-slot pipe on the scheduler
+// =================================================================
+void test_pipe_connects_two_scheduled_vms(void)
+{
+    // One-byte messages: memset writes the value, psend ships it
+    const uint8_t producer[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, 0, reg_imm),
+        TEST_INST(OP_MOV, REG_R5, 0, DATA_START, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, 1, reg_imm),
+        TEST_INST(OP_MOV, REG_R6, 0, 100, reg_imm),
+        TEST_INST(OP_MEMSET, REG_R5, REG_R6, 0, reg_reg), // 4: loop
+        TEST_INST(OP_PSEND, REG_R1, REG_R5, 0, reg_reg),
+        TEST_INST(OP_SUB, REG_R6, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, AT(4), target),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    const uint8_t consumer[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, 0, reg_imm),
+        TEST_INST(OP_MOV, REG_R5, 0, DATA_START, reg_imm),
+        TEST_INST(OP_MOV, REG_R3, 0, 0, reg_imm),
+        TEST_INST(OP_MOV, REG_R6, 0, 100, reg_imm),
+        TEST_INST(OP_PRECV, REG_R1, REG_R5, 0, reg_reg), // 4: loop
+        TEST_INST(OP_MOV, REG_R4, REG_R5, 0, reg_indirect),
+        TEST_INST(OP_ADD, REG_R3, REG_R4, 0, reg_reg),
+        TEST_INST(OP_SUB, REG_R6, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, AT(4), target),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    VMPipe*      pipe      = vm_pipe_create(VM_PIPE_SPSC, 4, 1);
+    VMScheduler* scheduler = vm_scheduler_create(2, 1000);
+    VMTask       tasks[2]  = {0};
+    TEST_ASSERT_NOT_NULL(pipe);
+    TEST_ASSERT_NOT_NULL(scheduler);
+
+    // Consumer first, so it finds the pipe empty and has to wait
+    tasks[0].vm = vm_create();
+    tasks[1].vm = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS,
+                           load_test_image(tasks[0].vm, consumer, sizeof(consumer)));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS,
+                           load_test_image(tasks[1].vm, producer, sizeof(producer)));
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_attach_pipe(tasks[i].vm, 0, pipe));
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_submit(scheduler, &tasks[i]));
+    }
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_run(scheduler));
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, tasks[0].result);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, tasks[1].result);
+    TEST_ASSERT_EQUAL_UINT64(5050, tasks[0].vm->registers[REG_R3]);
+    TEST_ASSERT_GREATER_THAN_UINT32(1, tasks[0].slices);
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        vm_task_release(&tasks[i]);
+        vm_destroy(tasks[i].vm);
+    }
+    vm_scheduler_destroy(scheduler);
+    vm_pipe_destroy(pipe);
+}
+
+typedef struct
+{
+    VMPipe*  pipe;
+    uint32_t id;
+} PipeProducer;
+
+static void* produce(void* arg)
+{
+    PipeProducer* producer = arg;
+    for (uint32_t sequence = 0; sequence < PIPE_TEST_MESSAGES; sequence++)
+    {
+        const uint32_t message[2] = {producer->id, sequence};
+        while (!vm_pipe_send(producer->pipe, message))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// =================================================================
+// 3. MPSC: several host threads send at once; nothing is lost, duplicated or reordered per sender
+// =================================================================
+void test_pipe_mpsc_keeps_every_producer_in_order(void)
+{
+    VMPipe* pipe = vm_pipe_create(VM_PIPE_MPSC, 64, 2 * sizeof(uint32_t));
+    TEST_ASSERT_NOT_NULL(pipe);
+
+    PipeProducer producers[PIPE_TEST_PRODUCERS];
+    pthread_t    threads[PIPE_TEST_PRODUCERS];
+    uint32_t     expected[PIPE_TEST_PRODUCERS] = {0};
+    for (uint32_t i = 0; i < PIPE_TEST_PRODUCERS; i++)
+    {
+        producers[i] = (PipeProducer){.pipe = pipe, .id = i};
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, produce, &producers[i]));
+    }
+
+    uint32_t message[2];
+    for (uint32_t received = 0; received < PIPE_TEST_PRODUCERS * PIPE_TEST_MESSAGES;)
+    {
+        if (!vm_pipe_recv(pipe, message))
+        {
+            sched_yield();
+            continue;
+        }
+        TEST_ASSERT_LESS_THAN_UINT32(PIPE_TEST_PRODUCERS, message[0]);
+        TEST_ASSERT_EQUAL_UINT32(expected[message[0]], message[1]);
+        expected[message[0]]++;
+        received++;
+    }
+    for (uint32_t i = 0; i < PIPE_TEST_PRODUCERS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    TEST_ASSERT_FALSE(vm_pipe_recv(pipe, message));
+    vm_pipe_destroy(pipe);
+}
+
+void run_all_pipe_tests(void)
+{
+    RUN_TEST(test_pipe_spsc_keeps_order_across_wraparound);
+    RUN_TEST(test_pipe_connects_two_scheduled_vms);
+    RUN_TEST(test_pipe_mpsc_keeps_every_producer_in_order);
+}
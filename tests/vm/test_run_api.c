@@ -0,0 +1,132 @@
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+void run_all_run_api_tests(void);
+
+void test_run_api_steps_in_slices(void);
+void test_run_api_waits_on_blocked_output(void);
+void test_run_api_reports_errors_without_exiting(void);
+
+typedef struct
+{
+    bool    blocked;
+    char    text[16];
+    uint8_t len;
+} TestSink;
+
+static int8_t test_sink_write(void* user, const uint8_t* data, uint32_t len, bool end_line)
+{
+    TestSink* sink = user;
+    if (sink->blocked)
+    {
+        return VM_ERR_IO_WOULD_BLOCK;
+    }
+    memcpy(sink->text + sink->len, data, len);
+    sink->len += len;
+    if (end_line)
+    {
+        sink->text[sink->len++] = '\n';
+    }
+    return VM_EXIT_SUCCESS;
+}
+
+// =================================================================
+// 1. vm_step_n hands control back between slices and the result is unchanged
+// =================================================================
+void test_run_api_steps_in_slices(void)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t code[]  = {
+        TEST_INST(OP_MOV, REG_R1, 0, 0, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, 100, reg_imm),
+        TEST_INST(OP_ADD, REG_R1, REG_R2, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+        TEST_INST(OP_SUB, REG_R2, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, CODE_START + 16, MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE)),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(vm_ctx, code, sizeof(code)));
+    TEST_ASSERT_EQUAL_INT(VM_STATE_YIELDED, vm_ctx->state);
+    TEST_ASSERT_EQUAL_UINT32(0, vm_ctx->registers[REG_R1]);
+
+    int         slices = 0;
+    VMRunResult result;
+    do
+    {
+        result = vm_step_n(vm_ctx, 30);
+        slices++;
+    } while (result == VM_RUN_BUDGET_EXHAUSTED);
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, result);
+    TEST_ASSERT_EQUAL_UINT32(5050, vm_ctx->registers[REG_R1]);
+    TEST_ASSERT_INT_WITHIN(1, 303 / 30, slices);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(vm_ctx));
+}
+
+// =================================================================
+// 2. A sink that would block parks the VM on the print, which then retries
+// =================================================================
+void test_run_api_waits_on_blocked_output(void)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t reg     = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_NONE);
+    const uint8_t code[]  = {
+        TEST_INST(OP_MOV, REG_R0, 0, 'h', reg_imm), TEST_INST(OP_PRINT_CHR, REG_R0, 0, 0, reg),
+        TEST_INST(OP_MOV, REG_R0, 0, 'i', reg_imm), TEST_INST(OP_PRINT_CHR, REG_R0, 0, 0, reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    TestSink sink = {.blocked = true};
+
+    vm_ctx->write      = test_sink_write;
+    vm_ctx->write_user = &sink;
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(vm_ctx, code, sizeof(code)));
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_IO_WAIT, vm_run_until(vm_ctx));
+    TEST_ASSERT_EQUAL_UINT32(CODE_START + INSTRUCTION_SIZE, vm_ctx->pc);
+    TEST_ASSERT_EQUAL_UINT8(0, sink.len);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_IO_WAIT, vm_run_until(vm_ctx));
+
+    sink.blocked = false;
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(vm_ctx));
+    TEST_ASSERT_EQUAL_UINT8(2, sink.len);
+    TEST_ASSERT_EQUAL_MEMORY("hi", sink.text, 2);
+}
+
+// =================================================================
+// 3. Fatal guest errors and failed loads come back as codes; the process keeps going
+// =================================================================
+void test_run_api_reports_errors_without_exiting(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(0xEE, 0, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t      load     = load_test_image(vm_ctx, code, sizeof(code));
+    VMRunResult result   = vm_run_until(vm_ctx);
+    int8_t      error    = vm_ctx->last_error;
+    int8_t      missing  = vm_load(vm_ctx, "/tmp/bitlang_no_such_image");
+    g_compiler_log_level = saved_level;
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_ERROR, result);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_OPCODE_NOT_FOUND, error);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_IO_READ_FAILED, missing);
+    TEST_ASSERT_EQUAL_INT(VM_STATE_FATAL_ERROR, vm_ctx->state);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_ERROR, vm_run_until(vm_ctx));
+}
+
+void run_all_run_api_tests(void)
+{
+    RUN_TEST(test_run_api_steps_in_slices);
+    RUN_TEST(test_run_api_waits_on_blocked_output);
+    RUN_TEST(test_run_api_reports_errors_without_exiting);
+}
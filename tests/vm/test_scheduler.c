@@ -0,0 +1,121 @@
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_scheduler.h"
+#include <stdint.h>
+#include <string.h>
+
+#define SCHEDULER_TEST_VMS 12
+
+void run_all_scheduler_tests(void);
+
+void test_scheduler_runs_every_vm_to_completion(void);
+void test_scheduler_isolates_a_failing_vm(void);
+void test_scheduler_rejects_empty_pool(void);
+
+/*
+ *   r1 = n + (n - 1) + ... + 1, then prints `tag` and halts. The loop runs 3n instructions.
+ * */
+static int8_t load_sum(VMContext* ctx, uint32_t n, char tag)
+{
+    const uint8_t reg_imm = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+    const uint8_t code[]  = {
+        TEST_INST(OP_MOV, REG_R1, 0, 0, reg_imm),
+        TEST_INST(OP_MOV, REG_R2, 0, n, reg_imm),
+        TEST_INST(OP_ADD, REG_R1, REG_R2, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+        TEST_INST(OP_SUB, REG_R2, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, CODE_START + 16, MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE)),
+        TEST_INST(OP_MOV, REG_R0, 0, tag, reg_imm),
+        TEST_INST(OP_PRINT_CHR, REG_R0, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_NONE)),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    return load_test_image(ctx, code, sizeof(code));
+}
+
+// =================================================================
+// 1. Many VMs on a few workers: each finishes with its own result and its own output
+// =================================================================
+void test_scheduler_runs_every_vm_to_completion(void)
+{
+    VMTask       tasks[SCHEDULER_TEST_VMS] = {0};
+    VMScheduler* scheduler                 = vm_scheduler_create(4, 50);
+    TEST_ASSERT_NOT_NULL(scheduler);
+
+    for (uint32_t i = 0; i < SCHEDULER_TEST_VMS; i++)
+    {
+        tasks[i].vm = vm_create();
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_sum(tasks[i].vm, 100 * (i + 1), 'a' + i));
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_submit(scheduler, &tasks[i]));
+    }
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_run(scheduler));
+
+    for (uint32_t i = 0; i < SCHEDULER_TEST_VMS; i++)
+    {
+        uint32_t n = 100 * (i + 1);
+        TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, tasks[i].result);
+        TEST_ASSERT_EQUAL_UINT32(n * (n + 1) / 2, tasks[i].vm->registers[REG_R1]);
+        TEST_ASSERT_EQUAL_UINT32(1, tasks[i].output_len);
+        TEST_ASSERT_EQUAL_CHAR('a' + i, tasks[i].output[0]);
+        // A slice may overdraw by one 3-instruction block
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(3 * n / (50 + 3), tasks[i].slices);
+        vm_task_release(&tasks[i]);
+        vm_destroy(tasks[i].vm);
+    }
+    vm_scheduler_destroy(scheduler);
+}
+
+// =================================================================
+// 2. A fatal error ends only the VM that hit it
+// =================================================================
+void test_scheduler_isolates_a_failing_vm(void)
+{
+    const uint8_t bad_code[]  = {TEST_INST(0xEE, 0, 0, 0, 0)};
+    VMTask        tasks[3]    = {0};
+    VMScheduler*  scheduler   = vm_scheduler_create(2, 64);
+    LogLevel      saved_level = g_compiler_log_level;
+    g_compiler_log_level      = LOG_LEVEL_ERROR;
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        tasks[i].vm = vm_create();
+        int8_t status = i == 1 ? load_test_image(tasks[i].vm, bad_code, sizeof(bad_code))
+                               : load_sum(tasks[i].vm, 500, 'x');
+        TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+        vm_scheduler_submit(scheduler, &tasks[i]);
+    }
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_scheduler_run(scheduler));
+    g_compiler_log_level = saved_level;
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, tasks[0].result);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_ERROR, tasks[1].result);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_OPCODE_NOT_FOUND, tasks[1].vm->last_error);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, tasks[2].result);
+    TEST_ASSERT_EQUAL_STRING("x", tasks[2].output);
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        vm_task_release(&tasks[i]);
+        vm_destroy(tasks[i].vm);
+    }
+    vm_scheduler_destroy(scheduler);
+}
+
+// =================================================================
+// 3. No workers or no slice is refused up front
+// =================================================================
+void test_scheduler_rejects_empty_pool(void)
+{
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    TEST_ASSERT_NULL(vm_scheduler_create(0, 100));
+    TEST_ASSERT_NULL(vm_scheduler_create(4, 0));
+    g_compiler_log_level = saved_level;
+}
+
+void run_all_scheduler_tests(void)
+{
+    RUN_TEST(test_scheduler_runs_every_vm_to_completion);
+    RUN_TEST(test_scheduler_isolates_a_failing_vm);
+    RUN_TEST(test_scheduler_rejects_empty_pool);
+}
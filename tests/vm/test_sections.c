@@ -0,0 +1,167 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LE16(value) (uint8_t) (value), (uint8_t) ((value) >> 8)
+#define LE32(value)                                                                                \
+    (uint8_t) (value), (uint8_t) ((value) >> 8), (uint8_t) ((value) >> 16), (uint8_t) ((value) >> 24)
+#define SECTIONED_HEADER(count)                                                                    \
+    LE32(BYTECODE_MAGIC), LE16(BYTECODE_SECTIONED_VERSION), LE16(count), LE32(0)
+#define SECTION(type, flags, align_log2, offset, size)                                             \
+    (type), (flags), (align_log2), 0, LE32(offset), LE32(size)
+
+void run_all_sections_tests(void);
+
+void test_sections_load_in_any_order(void);
+void test_sections_compact_code_section(void);
+void test_sections_reject_duplicates(void);
+void test_sections_reject_misaligned_offset(void);
+void test_sections_reject_unknown_flags(void);
+void test_bad_magic_is_rejected(void);
+
+/*
+ *   Writes a raw image to a temporary file and runs it, or only loads it when `run` is false.
+ * */
+static int8_t use_image(const uint8_t* image, uint32_t len, bool run)
+{
+    char path[] = "/tmp/bitlang_sections_XXXXXX";
+    int  fd     = mkstemp(path);
+    if (fd < 0)
+        return VM_ERR_IO_READ_FAILED;
+
+    FILE* f = fdopen(fd, "wb");
+    fwrite(image, 1, len, f);
+    fclose(f);
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status        = run ? run_vm(vm_ctx, path) : load_bytecode(vm_ctx, path);
+    g_compiler_log_level = saved_level;
+    unlink(path);
+    return status;
+}
+
+// =================================================================
+// 1. Data, rodata and code land in their segments whatever the table order
+// =================================================================
+void test_sections_load_in_any_order(void)
+{
+    const uint8_t image[] = {
+        SECTIONED_HEADER(3),
+        SECTION(BYTECODE_SECTION_DATA, 0, 3, 48, 8),
+        SECTION(BYTECODE_SECTION_RODATA, 0, 0, 56, 6),
+        SECTION(BYTECODE_SECTION_CODE, 0, 3, 64, 32),
+        // 48: data
+        LE32(42), LE32(0),
+        // 56: rodata, then padding up to 64
+        'h', 'e', 'l', 'l', 'o', 0, 0, 0,
+        // 64: code
+        TEST_INST(OP_LOAD_ADDR, REG_R1, 0, RODATA_START,
+                  MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_ADDR)),
+        TEST_INST(OP_STRLEN, REG_R2, REG_R1, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+        TEST_INST(OP_MOV, REG_R3, 0, DATA_START, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_ADDR)),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, use_image(image, sizeof(image), true));
+    TEST_ASSERT_EQUAL_UINT32(5, vm_ctx->registers[REG_R2]);
+    TEST_ASSERT_EQUAL_UINT32(42, vm_ctx->registers[REG_R3]);
+}
+
+// =================================================================
+// 2. A code section flagged compact is expanded on load
+// =================================================================
+void test_sections_compact_code_section(void)
+{
+    const uint8_t image[] = {
+        SECTIONED_HEADER(1),
+        SECTION(BYTECODE_SECTION_CODE, BYTECODE_SECTION_COMPACT, 0, 24, 5),
+        // mov r4, 7 ; halt
+        OP_MOV, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT), REG_R4, 7, OP_HALT,
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, use_image(image, sizeof(image), true));
+    TEST_ASSERT_EQUAL_UINT32(7, vm_ctx->registers[REG_R4]);
+}
+
+// =================================================================
+// 3. Two sections of the same type are rejected
+// =================================================================
+void test_sections_reject_duplicates(void)
+{
+    const uint8_t image[] = {
+        SECTIONED_HEADER(2),
+        SECTION(BYTECODE_SECTION_CODE, 0, 0, 36, 8),
+        SECTION(BYTECODE_SECTION_CODE, 0, 0, 36, 8),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_BYTECODE, use_image(image, sizeof(image), false));
+}
+
+// =================================================================
+// 4. A section whose offset breaks its declared alignment is rejected
+// =================================================================
+void test_sections_reject_misaligned_offset(void)
+{
+    const uint8_t image[] = {
+        SECTIONED_HEADER(1),
+        SECTION(BYTECODE_SECTION_CODE, 0, 3, 24, 8),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    uint8_t misaligned[sizeof(image) + 4] = {0};
+    memcpy(misaligned, image, sizeof(image));
+    misaligned[16] = 28; // move the payload to offset 28, which is not 8-aligned
+    memcpy(misaligned + 28, image + 24, INSTRUCTION_SIZE);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, use_image(image, sizeof(image), true));
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_BYTECODE,
+                           use_image(misaligned, sizeof(misaligned), false));
+}
+
+// =================================================================
+// 5. Flags the loader does not know are rejected, as is compact rodata
+// =================================================================
+void test_sections_reject_unknown_flags(void)
+{
+    const uint8_t image[] = {
+        SECTIONED_HEADER(2),
+        SECTION(BYTECODE_SECTION_CODE, 0, 0, 36, 8),
+        SECTION(BYTECODE_SECTION_RODATA, BYTECODE_SECTION_COMPACT, 0, 44, 1),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        0,
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_BYTECODE, use_image(image, sizeof(image), false));
+}
+
+// =================================================================
+// 6. Files that do not start with the magic number are not bytecode
+// =================================================================
+void test_bad_magic_is_rejected(void)
+{
+    const uint8_t image[] = {
+        LE32(0x464C457F), LE16(BYTECODE_SUPPORTED_VERSION), LE32(8), LE32(0), LE32(0), LE32(0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_BYTECODE, use_image(image, sizeof(image), false));
+}
+
+void run_all_sections_tests(void)
+{
+    RUN_TEST(test_sections_load_in_any_order);
+    RUN_TEST(test_sections_compact_code_section);
+    RUN_TEST(test_sections_reject_duplicates);
+    RUN_TEST(test_sections_reject_misaligned_offset);
+    RUN_TEST(test_sections_reject_unknown_flags);
+    RUN_TEST(test_bad_magic_is_rejected);
+}
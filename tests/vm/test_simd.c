@@ -0,0 +1,112 @@
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_simd.h"
+#include <stdint.h>
+#include <string.h>
+
+#define META_REG_IMM MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)
+#define META_REG_REG MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)
+
+void run_all_simd_tests(void);
+
+void test_simd_kernels_match_scalar(void);
+void test_simd_load_add_store(void);
+void test_simd_byte_count(void);
+void test_simd_store_to_rodata_is_rejected(void);
+
+// =================================================================
+// 1. Lane kernels agree with scalar arithmetic, including wrap-around
+// =================================================================
+void test_simd_kernels_match_scalar(void)
+{
+    VMVector a = {.u32 = {0xFFFFFFFF, 3, 0x12345678, 0x80000000}};
+    VMVector b = {.u32 = {2, 0xFFFFFFFF, 0x9ABCDEF0, 2}};
+    VMVector product = a;
+
+    vm_vec_mul32(&product, &b);
+    for (int i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL_HEX32(a.u32[i] * b.u32[i], product.u32[i]);
+    }
+
+    VMVector bytes;
+    vm_vec_splat8(&bytes, 0xFF);
+    TEST_ASSERT_EQUAL_UINT32(16 * 0xFF, vm_vec_sum8(&bytes));
+    TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF + 3 + 0x12345678 + 0x80000000u, vm_vec_sum32(&a));
+}
+
+// =================================================================
+// 2. VLOAD two vectors, VADD32, VSTORE the result back to DATA
+// =================================================================
+void test_simd_load_add_store(void)
+{
+    const uint32_t lhs[4] = {1, 2, 3, 4};
+    const uint32_t rhs[4] = {10, 20, 30, 40};
+    const uint8_t  code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, DATA_START, META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R2, 0, DATA_START + 16, META_REG_IMM),
+        TEST_INST(OP_VLOAD, 0, REG_R1, 0, META_REG_REG),
+        TEST_INST(OP_VLOAD, 1, REG_R2, 0, META_REG_REG),
+        TEST_INST(OP_VADD32, 0, 1, 0, META_REG_REG),
+        TEST_INST(OP_VSTORE, REG_R1, 0, 0, META_REG_REG),
+        TEST_INST(OP_VSUM32, REG_R0, 0, 0, META_REG_REG),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    memcpy(vm_ctx->memory + DATA_START, lhs, sizeof(lhs));
+    memcpy(vm_ctx->memory + DATA_START + 16, rhs, sizeof(rhs));
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    const uint32_t expected[4] = {11, 22, 33, 44};
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_MEMORY(expected, vm_ctx->memory + DATA_START, sizeof(expected));
+    TEST_ASSERT_EQUAL_UINT32(110, vm_ctx->registers[REG_R0]);
+}
+
+// =================================================================
+// 3. VSPLAT8 + VCMPEQ8 + VSUM8 count matching bytes in one block
+// =================================================================
+void test_simd_byte_count(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, DATA_START, META_REG_IMM),
+        TEST_INST(OP_VSPLAT8, 1, 0, 'l', META_REG_IMM),
+        TEST_INST(OP_VLOAD, 0, REG_R1, 0, META_REG_REG),
+        TEST_INST(OP_VCMPEQ8, 0, 1, 0, META_REG_REG),
+        TEST_INST(OP_VSUM8, REG_R0, 0, 0, META_REG_REG),
+        TEST_INST(OP_DIV, REG_R0, 0, 0xFF, META_REG_IMM),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    memcpy(vm_ctx->memory + DATA_START, "hello, parallel!", 16);
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_UINT32(5, vm_ctx->registers[REG_R0]);
+}
+
+// =================================================================
+// 4. VSTORE honours the same segment permissions as the bulk opcodes
+// =================================================================
+void test_simd_store_to_rodata_is_rejected(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, RODATA_START, META_REG_IMM),
+        TEST_INST(OP_VSTORE, REG_R1, 0, 0, META_REG_REG),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_ILLEGAL_OPERATION, status);
+}
+
+void run_all_simd_tests(void)
+{
+    RUN_TEST(test_simd_kernels_match_scalar);
+    RUN_TEST(test_simd_load_add_store);
+    RUN_TEST(test_simd_byte_count);
+    RUN_TEST(test_simd_store_to_rodata_is_rejected);
+}
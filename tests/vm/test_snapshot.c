@@ -0,0 +1,140 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_image.h"
+#include "vm_pipe.h"
+#include "vm_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+void run_all_snapshot_tests(void);
+
+void test_snapshot_forks_resume_where_it_was_taken(void);
+void test_snapshot_of_a_fork_shares_the_image_tables(void);
+void test_snapshot_refuses_a_running_context(void);
+
+/*
+ *   r1 = 1000 + 999 + ... + 1, three instructions per iteration.
+ * */
+static const uint8_t sum_code[] = {
+    TEST_INST(OP_MOV, REG_R1, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    TEST_INST(OP_MOV, REG_R2, 0, 1000, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    TEST_INST(OP_ADD, REG_R1, REG_R2, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+    TEST_INST(OP_SUB, REG_R2, 0, 1, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    TEST_INST(OP_JNZ, 0, 0, CODE_START + 16, MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE)),
+    TEST_INST(OP_HALT, 0, 0, 0, 0),
+};
+
+static int8_t discard_output(void* user, const uint8_t* data, uint32_t len, bool end_line)
+{
+    (void) user;
+    (void) data;
+    (void) len;
+    (void) end_line;
+    return VM_EXIT_SUCCESS;
+}
+
+// =================================================================
+// 1. Forks start at the snapshot's pc and state and keep their writes to themselves
+// =================================================================
+void test_snapshot_forks_resume_where_it_was_taken(void)
+{
+    VMContext* ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, sum_code, sizeof(sum_code)));
+    TEST_ASSERT_EQUAL_INT(VM_RUN_BUDGET_EXHAUSTED, vm_step_n(ctx, 300));
+    vm_store_u32(ctx, DATA_START, 0xC0FFEE);
+
+    // The sink and pipe ends are ctx's own and must not be shared with the forks
+    VMPipe* pipe = vm_pipe_create(VM_PIPE_SPSC, 4, 1);
+    TEST_ASSERT_NOT_NULL(pipe);
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, vm_attach_pipe(ctx, 0, pipe));
+    ctx->write      = discard_output;
+    ctx->write_user = ctx;
+
+    VMImage* snapshot = vm_snapshot(ctx);
+    TEST_ASSERT_NOT_NULL(snapshot);
+    VMContext* first = vm_fork(snapshot);
+    VMContext* other = vm_fork(snapshot);
+    vm_image_release(snapshot);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(other);
+
+    TEST_ASSERT_EQUAL_INT(VM_STATE_YIELDED, first->state);
+    TEST_ASSERT_EQUAL_UINT32(ctx->pc, first->pc);
+    TEST_ASSERT_EQUAL_UINT64(ctx->registers[REG_R1], first->registers[REG_R1]);
+    TEST_ASSERT_EQUAL_UINT64(ctx->registers[REG_R2], first->registers[REG_R2]);
+    TEST_ASSERT_EQUAL_UINT32(0xC0FFEE, vm_load_u32(first, DATA_START));
+    TEST_ASSERT_NULL(first->pipes[0]);
+    TEST_ASSERT_NULL(first->write);
+    TEST_ASSERT_NULL(first->write_user);
+
+    vm_store_u32(first, DATA_START, 7);
+    first->registers[REG_R2] = 10;
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_step_n(first, UINT64_MAX));
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_step_n(ctx, UINT64_MAX));
+    TEST_ASSERT_EQUAL_UINT32(0xC0FFEE, vm_load_u32(other, DATA_START));
+    TEST_ASSERT_EQUAL_UINT32(0xC0FFEE, vm_load_u32(ctx, DATA_START));
+
+    vm_destroy(ctx);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_step_n(other, UINT64_MAX));
+    TEST_ASSERT_EQUAL_UINT64(500500, other->registers[REG_R1]);
+    TEST_ASSERT_TRUE(first->registers[REG_R1] < other->registers[REG_R1]);
+    vm_destroy(first);
+    vm_destroy(other);
+    vm_pipe_destroy(pipe);
+}
+
+// =================================================================
+// 2. A snapshot of an image-backed context reuses the image's tables and outlives it
+// =================================================================
+void test_snapshot_of_a_fork_shares_the_image_tables(void)
+{
+    char path[] = "/tmp/bitlang_snapshot_XXXXXX";
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, write_test_image(path, sum_code, sizeof(sum_code),
+                                                             BYTECODE_SUPPORTED_VERSION));
+    VMImage* image = vm_image_load(path);
+    unlink(path);
+    TEST_ASSERT_NOT_NULL(image);
+    VMContext* ctx = vm_create_from_image(image);
+    vm_image_release(image);
+    TEST_ASSERT_EQUAL_INT(VM_RUN_BUDGET_EXHAUSTED, vm_step_n(ctx, 600));
+
+    VMImage* snapshot = vm_snapshot(ctx);
+    TEST_ASSERT_NOT_NULL(snapshot);
+    VMContext* fork = vm_fork(snapshot);
+    vm_image_release(snapshot);
+    TEST_ASSERT_TRUE(fork->predecoded == ctx->predecoded);
+    TEST_ASSERT_TRUE(fork->block_cost == ctx->block_cost);
+    vm_destroy(ctx);
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_step_n(fork, UINT64_MAX));
+    TEST_ASSERT_EQUAL_UINT64(500500, fork->registers[REG_R1]);
+    vm_destroy(fork);
+}
+
+// =================================================================
+// 3. Only a stopped context can be captured
+// =================================================================
+void test_snapshot_refuses_a_running_context(void)
+{
+    VMContext* ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, sum_code, sizeof(sum_code)));
+    ctx->state = VM_STATE_RUNNING;
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    TEST_ASSERT_NULL(vm_snapshot(ctx));
+    g_compiler_log_level = saved_level;
+    vm_destroy(ctx);
+}
+
+void run_all_snapshot_tests(void)
+{
+    RUN_TEST(test_snapshot_forks_resume_where_it_was_taken);
+    RUN_TEST(test_snapshot_of_a_fork_shares_the_image_tables);
+    RUN_TEST(test_snapshot_refuses_a_running_context);
+}
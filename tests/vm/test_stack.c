@@ -0,0 +1,156 @@
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include <stdint.h>
+
+#define META_REG_IMM MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)
+#define META_REG_REG MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)
+#define META_TARGET MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_REG_DIRECT)
+#define AT(index) ((index) * INSTRUCTION_SIZE)
+
+void run_all_stack_tests(void);
+
+void test_stack_push_pop(void);
+void test_stack_call_ret(void);
+void test_stack_recursive_fib(void);
+void test_stack_pop_underflow(void);
+void test_stack_ret_underflow(void);
+void test_stack_call_overflow(void);
+
+// =================================================================
+// 1. PUSH R1; POP R2 moves a value through the stack
+// =================================================================
+void test_stack_push_pop(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, 42, META_REG_IMM),
+        TEST_INST(OP_PUSH, REG_R1, 0, 0, 0),
+        TEST_INST(OP_POP, REG_R2, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_UINT32(42, vm_ctx->registers[REG_R2]);
+    TEST_ASSERT_EQUAL_HEX32(STACK_END, vm_ctx->sp);
+}
+
+// =================================================================
+// 2. CALL/RET restore pc, sp and bp
+// =================================================================
+void test_stack_call_ret(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_CALL, 0, 0, AT(2), META_TARGET),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        TEST_INST(OP_MOV, REG_R0, 0, 7, META_REG_IMM),
+        TEST_INST(OP_PUSH, REG_R0, 0, 0, 0), // left on the frame, discarded by RET
+        TEST_INST(OP_RET, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_UINT32(7, vm_ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_HEX32(STACK_END, vm_ctx->sp);
+    TEST_ASSERT_EQUAL_HEX32(STACK_END, vm_ctx->bp);
+}
+
+// =================================================================
+// 3. Recursive fib(10) exercises nested frames, cmp and branches
+// =================================================================
+void test_stack_recursive_fib(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R0, 0, 10, META_REG_IMM),
+        TEST_INST(OP_CALL, 0, 0, AT(3), META_TARGET),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        // fib:
+        TEST_INST(OP_MOV, REG_R1, 0, 2, META_REG_IMM),
+        TEST_INST(OP_CMP, 0, 0, 0, 0),
+        TEST_INST(OP_JLT, 0, 0, AT(17), META_TARGET),
+        TEST_INST(OP_PUSH, REG_R0, 0, 0, 0),
+        TEST_INST(OP_SUB, REG_R0, 0, 1, META_REG_IMM),
+        TEST_INST(OP_CALL, 0, 0, AT(3), META_TARGET),
+        TEST_INST(OP_POP, REG_R2, 0, 0, 0),
+        TEST_INST(OP_PUSH, REG_R0, 0, 0, 0),
+        TEST_INST(OP_MOV, REG_R0, REG_R2, 0, META_REG_REG),
+        TEST_INST(OP_SUB, REG_R0, 0, 2, META_REG_IMM),
+        TEST_INST(OP_CALL, 0, 0, AT(3), META_TARGET),
+        TEST_INST(OP_POP, REG_R2, 0, 0, 0),
+        TEST_INST(OP_ADD, REG_R0, REG_R2, 0, META_REG_REG),
+        TEST_INST(OP_RET, 0, 0, 0, 0),
+        // base:
+        TEST_INST(OP_RET, 0, 0, 0, 0),
+    };
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status        = run_test_image(vm_ctx, code, sizeof(code));
+    g_compiler_log_level = saved_level;
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_UINT32(55, vm_ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_HEX32(STACK_END, vm_ctx->sp);
+}
+
+// =================================================================
+// 4. POP on an empty stack is a soft underflow error
+// =================================================================
+void test_stack_pop_underflow(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_POP, REG_R0, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_STACK_UNDERFLOW, status);
+    TEST_ASSERT_EQUAL_INT(VM_STATE_SOFT_ERROR, vm_ctx->state);
+}
+
+// =================================================================
+// 5. RET without a frame is a soft underflow error
+// =================================================================
+void test_stack_ret_underflow(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_RET, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_STACK_UNDERFLOW, status);
+}
+
+// =================================================================
+// 6. Unbounded recursion stops at STACK_START instead of running into the heap
+// =================================================================
+void test_stack_call_overflow(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_CALL, 0, 0, AT(0), META_TARGET),
+    };
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status        = run_test_image(vm_ctx, code, sizeof(code));
+    g_compiler_log_level = saved_level;
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_STACK_OVERFLOW, status);
+    TEST_ASSERT_EQUAL_HEX32(STACK_START, vm_ctx->sp);
+}
+
+void run_all_stack_tests(void)
+{
+    RUN_TEST(test_stack_push_pop);
+    RUN_TEST(test_stack_call_ret);
+    RUN_TEST(test_stack_recursive_fib);
+    RUN_TEST(test_stack_pop_underflow);
+    RUN_TEST(test_stack_ret_underflow);
+    RUN_TEST(test_stack_call_overflow);
+}
@@ -0,0 +1,218 @@
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define AT(slot) (CODE_START + (slot) * INSTRUCTION_SIZE)
+
+void run_all_threads_tests(void);
+
+void test_threads_pass_values_through_a_channel(void);
+void test_threads_run_while_output_would_block(void);
+void test_threads_report_deadlock_and_bad_ids(void);
+void test_threads_stay_inside_their_stacks(void);
+
+static const uint8_t reg_imm    = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT);
+static const uint8_t reg_reg    = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT);
+static const uint8_t reg_target = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_ADDR);
+static const uint8_t target     = MAKE_METADATA(VM_AM_IMM_ADDR, VM_AM_NONE);
+static const uint8_t reg_only   = MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_NONE);
+
+// =================================================================
+// 1. A producer and a consumer hand 100 values through a 4-slot channel
+// =================================================================
+void test_threads_pass_values_through_a_channel(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_CHAN, REG_R1, 0, 4, reg_imm),
+        TEST_INST(OP_SPAWN, REG_R2, 0, AT(10), reg_target),
+        TEST_INST(OP_MOV, REG_R3, 0, 0, reg_imm),
+        TEST_INST(OP_MOV, REG_R5, 0, 100, reg_imm),
+        TEST_INST(OP_RECV, REG_R4, REG_R1, 0, reg_reg), // 4: consumer loop
+        TEST_INST(OP_ADD, REG_R3, REG_R4, 0, reg_reg),
+        TEST_INST(OP_SUB, REG_R5, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, AT(4), target),
+        TEST_INST(OP_JOIN, REG_R2, 0, 0, reg_only),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        TEST_INST(OP_MOV, REG_R6, 0, 100, reg_imm), // 10: producer, r1 inherited
+        TEST_INST(OP_SEND, REG_R1, REG_R6, 0, reg_reg),
+        TEST_INST(OP_SUB, REG_R6, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, AT(11), target),
+        TEST_INST(OP_MOV, REG_R0, 0, 77, reg_imm),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    VMContext* ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, code, sizeof(code)));
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(ctx));
+    TEST_ASSERT_EQUAL_UINT64(5050, ctx->registers[REG_R3]);
+    TEST_ASSERT_EQUAL_UINT64(77, ctx->registers[REG_R2]);
+    TEST_ASSERT_EQUAL_UINT32(0, ctx->threads.current);
+    TEST_ASSERT_EQUAL_UINT32(1, ctx->threads.live);
+    TEST_ASSERT_EQUAL_UINT32(STACK_END - VM_THREAD_STACK_SIZE, ctx->threads.threads[1].sp);
+    vm_destroy(ctx);
+}
+
+typedef struct
+{
+    bool     blocked;
+    uint32_t calls;
+    char     out[4];
+} HeldSink;
+
+static int8_t held_write(void* user, const uint8_t* data, uint32_t len, bool end_line)
+{
+    HeldSink* sink = user;
+    (void) end_line;
+    sink->calls++;
+    if (sink->blocked)
+    {
+        return VM_ERR_IO_WOULD_BLOCK;
+    }
+    sink->out[0] = (char) data[0];
+    return len == 1 ? VM_EXIT_SUCCESS : VM_ERR_IO_WRITE_FAILED;
+}
+
+// =================================================================
+// 2. While the main thread's print is held back, the worker finishes its loop
+// =================================================================
+void test_threads_run_while_output_would_block(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_SPAWN, REG_R2, 0, AT(5), reg_target),
+        TEST_INST(OP_MOV, REG_R0, 0, 'x', reg_imm),
+        TEST_INST(OP_PRINT_CHR, REG_R0, 0, 0, reg_only),
+        TEST_INST(OP_JOIN, REG_R2, 0, 0, reg_only),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        TEST_INST(OP_MOV, REG_R1, 0, 0, reg_imm), // 5: worker
+        TEST_INST(OP_MOV, REG_R3, 0, 50, reg_imm),
+        TEST_INST(OP_ADD, REG_R1, REG_R3, 0, reg_reg),
+        TEST_INST(OP_SUB, REG_R3, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, AT(7), target),
+        TEST_INST(OP_MOV, REG_R0, REG_R1, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    HeldSink   sink = {.blocked = true};
+    VMContext* ctx  = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, code, sizeof(code)));
+    ctx->write      = held_write;
+    ctx->write_user = &sink;
+
+    TEST_ASSERT_EQUAL_INT(VM_RUN_IO_WAIT, vm_run_until(ctx));
+    TEST_ASSERT_EQUAL_UINT32(AT(2), ctx->pc);
+    TEST_ASSERT_EQUAL_INT(VM_THREAD_DONE, ctx->threads.threads[1].state);
+    TEST_ASSERT_EQUAL_UINT64(1275, ctx->threads.threads[1].exit_value);
+
+    sink.blocked = false;
+    TEST_ASSERT_EQUAL_INT(VM_RUN_HALTED, vm_run_until(ctx));
+    TEST_ASSERT_EQUAL_CHAR('x', sink.out[0]);
+    TEST_ASSERT_EQUAL_UINT64(1275, ctx->registers[REG_R2]);
+    vm_destroy(ctx);
+}
+
+static VMContext* run_program(const uint8_t* code, uint32_t code_len, VMRunResult expected)
+{
+    VMContext* ctx = vm_create();
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, load_test_image(ctx, code, code_len));
+    TEST_ASSERT_EQUAL_INT(expected, vm_run_until(ctx));
+    return ctx;
+}
+
+// =================================================================
+// 3. Waiting on nothing is a deadlock, bad ids are errors, spawning stops at VM_THREAD_MAX
+// =================================================================
+void test_threads_report_deadlock_and_bad_ids(void)
+{
+    const uint8_t deadlock[] = {
+        TEST_INST(OP_CHAN, REG_R1, 0, 1, reg_imm),
+        TEST_INST(OP_RECV, REG_R2, REG_R1, 0, reg_reg),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    const uint8_t bad_join[] = {
+        TEST_INST(OP_MOV, REG_R1, 0, 3, reg_imm),
+        TEST_INST(OP_JOIN, REG_R1, 0, 0, reg_only),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+    const uint8_t too_many[] = {
+        TEST_INST(OP_MOV, REG_R3, 0, VM_THREAD_MAX, reg_imm),
+        TEST_INST(OP_SPAWN, REG_R1, 0, AT(5), reg_target),
+        TEST_INST(OP_SUB, REG_R3, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, AT(1), target),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0), // 5: never runs, main halts first
+    };
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+
+    VMContext* ctx = run_program(deadlock, sizeof(deadlock), VM_RUN_ERROR);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_DEADLOCK, ctx->last_error);
+    vm_destroy(ctx);
+
+    ctx = run_program(bad_join, sizeof(bad_join), VM_RUN_ERROR);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_INVALID_THREAD, ctx->last_error);
+    vm_destroy(ctx);
+    g_compiler_log_level = saved_level;
+
+    ctx = run_program(too_many, sizeof(too_many), VM_RUN_HALTED);
+    TEST_ASSERT_EQUAL_UINT64(0, ctx->registers[REG_R1]);
+    TEST_ASSERT_EQUAL_UINT32(VM_THREAD_MAX, ctx->threads.live);
+    vm_destroy(ctx);
+}
+
+// =================================================================
+// 4. Each thread's pushes fault at the edge of its own slice instead of overwriting another's
+// =================================================================
+void test_threads_stay_inside_their_stacks(void)
+{
+    const uint8_t deep_main[] = {
+        TEST_INST(OP_MOV, REG_R3, 0, 9000, reg_imm),
+        TEST_INST(OP_PUSH, REG_R3, 0, 0, reg_only), // 1: 36000 bytes, past main's slice
+        TEST_INST(OP_SUB, REG_R3, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, AT(1), target),
+        TEST_INST(OP_SPAWN, REG_R1, 0, AT(6), reg_target),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0), // 6: never starts
+    };
+    const uint8_t greedy_worker[] = {
+        TEST_INST(OP_MOV, REG_R3, 0, 100, reg_imm),
+        TEST_INST(OP_PUSH, REG_R3, 0, 0, reg_only), // 1
+        TEST_INST(OP_SUB, REG_R3, 0, 1, reg_imm),
+        TEST_INST(OP_JNZ, 0, 0, AT(1), target),
+        TEST_INST(OP_SPAWN, REG_R1, 0, AT(7), reg_target),
+        TEST_INST(OP_JOIN, REG_R1, 0, 0, reg_only),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+        TEST_INST(OP_PUSH, REG_R1, 0, 0, reg_only), // 7: worker, pushes until its slice is full
+        TEST_INST(OP_JMP, 0, 0, AT(7), target),
+    };
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_NONE;
+
+    VMContext* ctx = run_program(deep_main, sizeof(deep_main), VM_RUN_ERROR);
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_STACK_OVERFLOW, ctx->last_error);
+    TEST_ASSERT_EQUAL_UINT32(0, ctx->threads.live);
+    vm_destroy(ctx);
+
+    ctx = run_program(greedy_worker, sizeof(greedy_worker), VM_RUN_ERROR);
+    g_compiler_log_level = saved_level;
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_STACK_OVERFLOW, ctx->last_error);
+    TEST_ASSERT_EQUAL_UINT32(1, ctx->threads.current);
+    TEST_ASSERT_EQUAL_HEX32(STACK_END - 2 * VM_THREAD_STACK_SIZE, ctx->sp);
+    TEST_ASSERT_EQUAL_HEX32(STACK_END - 100 * STACK_SLOT_SIZE, ctx->threads.threads[0].sp);
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(100 - i, vm_load_u32(ctx, STACK_END - (i + 1) * STACK_SLOT_SIZE));
+    }
+    vm_destroy(ctx);
+}
+
+void run_all_threads_tests(void)
+{
+    RUN_TEST(test_threads_pass_values_through_a_channel);
+    RUN_TEST(test_threads_run_while_output_would_block);
+    RUN_TEST(test_threads_report_deadlock_and_bad_ids);
+    RUN_TEST(test_threads_stay_inside_their_stacks);
+}
@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+#include "logger.h"
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LE16(value) (uint8_t) (value), (uint8_t) ((value) >> 8)
+#define LE32(value)                                                                                \
+    (uint8_t) (value), (uint8_t) ((value) >> 8), (uint8_t) ((value) >> 16), (uint8_t) ((value) >> 24)
+#define CODE_IMAGE(entry, code_len)                                                                \
+    LE32(BYTECODE_MAGIC), LE16(BYTECODE_SECTIONED_VERSION), LE16(1), LE32(entry),                  \
+        BYTECODE_SECTION_CODE, 0, 0, 0, LE32(24), LE32(code_len)
+
+// sum = 10 + 9 + ... + 1 in r1, counting r2 down with a backwards jnz
+#define SUM_LOOP(jnz_mode, jnz_target)                                                             \
+    TEST_INST(OP_MOV, REG_R1, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),               \
+        TEST_INST(OP_MOV, REG_R2, 0, 10, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),          \
+        TEST_INST(OP_ADD, REG_R1, REG_R2, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),   \
+        TEST_INST(OP_SUB, REG_R2, 0, 1, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),           \
+        TEST_INST(OP_JNZ, 0, 0, jnz_target, MAKE_METADATA(jnz_mode, VM_AM_NONE)),                  \
+        TEST_INST(OP_HALT, 0, 0, 0, 0)
+
+void run_all_verifier_tests(void);
+
+void test_verifier_accepts_valid_image(void);
+void test_verifier_bad_register_runs_checked(void);
+void test_verifier_rejects_branch_into_instruction(void);
+void test_verifier_rejects_misplaced_entry(void);
+void test_verifier_paths_agree(void);
+void test_verifier_checks_register_targets(void);
+
+static int8_t use_image(const uint8_t* image, uint32_t len, bool run)
+{
+    char path[] = "/tmp/bitlang_verifier_XXXXXX";
+    int  fd     = mkstemp(path);
+    if (fd < 0)
+        return VM_ERR_IO_READ_FAILED;
+
+    FILE* f = fdopen(fd, "wb");
+    fwrite(image, 1, len, f);
+    fclose(f);
+
+    LogLevel saved_level = g_compiler_log_level;
+    g_compiler_log_level = LOG_LEVEL_ERROR;
+    int8_t status        = run ? run_vm(vm_ctx, path) : load_bytecode(vm_ctx, path);
+    g_compiler_log_level = saved_level;
+    unlink(path);
+    return status;
+}
+
+// =================================================================
+// 1. A well-formed image is verified and runs on the fast handlers
+// =================================================================
+void test_verifier_accepts_valid_image(void)
+{
+    const uint8_t image[] = {
+        CODE_IMAGE(0, 48),
+        SUM_LOOP(VM_AM_PC_RELATIVE, (uint32_t) -24),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, use_image(image, sizeof(image), true));
+    TEST_ASSERT_TRUE(vm_ctx->verified);
+    TEST_ASSERT_EQUAL_UINT32(55, vm_ctx->registers[REG_R1]);
+}
+
+// =================================================================
+// 2. An out-of-range register or v-register id is not trusted: it is a soft error at run time
+// =================================================================
+void test_verifier_bad_register_runs_checked(void)
+{
+    const uint8_t image[] = {
+        CODE_IMAGE(0, 16),
+        TEST_INST(OP_MOV, 9, 0, 1, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_REGISTER_NOT_FOUND, use_image(image, sizeof(image), true));
+    TEST_ASSERT_FALSE(vm_ctx->verified);
+
+    // v8 is a valid r-register id but not a v-register
+    const uint8_t vector[] = {
+        CODE_IMAGE(0, 16),
+        TEST_INST(OP_VADD8, 0, VM_VECTOR_REGISTER_COUNT, 0,
+                  MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_REGISTER_NOT_FOUND, use_image(vector, sizeof(vector), true));
+    TEST_ASSERT_FALSE(vm_ctx->verified);
+}
+
+// =================================================================
+// 3. A static branch into the middle of an instruction fails verification
+// =================================================================
+void test_verifier_rejects_branch_into_instruction(void)
+{
+    const uint8_t image[] = {
+        CODE_IMAGE(0, 48),
+        SUM_LOOP(VM_AM_IMM_ADDR, CODE_START + 20),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, use_image(image, sizeof(image), false));
+    TEST_ASSERT_FALSE(vm_ctx->verified);
+}
+
+// =================================================================
+// 4. So does an entry point that is not an instruction boundary
+// =================================================================
+void test_verifier_rejects_misplaced_entry(void)
+{
+    const uint8_t image[] = {
+        CODE_IMAGE(4, 48),
+        SUM_LOOP(VM_AM_IMM_ADDR, CODE_START + 16),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, use_image(image, sizeof(image), false));
+    TEST_ASSERT_FALSE(vm_ctx->verified);
+}
+
+// =================================================================
+// 5. The fast and checked handler sets compute the same result
+// =================================================================
+void test_verifier_paths_agree(void)
+{
+    // The trailing instruction is never reached, but its register byte keeps the image unverified
+    const uint8_t checked[] = {
+        CODE_IMAGE(0, 56),
+        SUM_LOOP(VM_AM_IMM_ADDR, CODE_START + 16),
+        TEST_INST(OP_MOV, 9, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+    };
+    const uint8_t fast[] = {
+        CODE_IMAGE(0, 48),
+        SUM_LOOP(VM_AM_IMM_ADDR, CODE_START + 16),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, use_image(checked, sizeof(checked), true));
+    TEST_ASSERT_FALSE(vm_ctx->verified);
+    const uint64_t checked_sum = vm_ctx->registers[REG_R1];
+
+    memset(vm_ctx->registers, 0, sizeof(vm_ctx->registers));
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, use_image(fast, sizeof(fast), true));
+    TEST_ASSERT_TRUE(vm_ctx->verified);
+    TEST_ASSERT_EQUAL_UINT64(checked_sum, vm_ctx->registers[REG_R1]);
+    TEST_ASSERT_EQUAL_UINT64(55, checked_sum);
+}
+
+// =================================================================
+// 6. A verified image cannot jump through a register into the middle of an instruction
+// =================================================================
+void test_verifier_checks_register_targets(void)
+{
+    // The second word of the movq decodes as "mov r9, ..." if it is ever run as an instruction
+    const uint8_t image[] = {
+        CODE_IMAGE(0, 40),
+        TEST_INST(OP_MOV, REG_R0, 0, CODE_START + 24,
+                  MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)),
+        TEST_INST(OP_JMP, REG_R0, 0, 0, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_NONE)),
+        TEST_MOVQ(REG_R1, (uint64_t) (OP_MOV | 9 << 8) << 32),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    TEST_ASSERT_EQUAL_INT8(VM_ERR_PC_OUT_OF_BOUNDS, use_image(image, sizeof(image), true));
+    TEST_ASSERT_TRUE(vm_ctx->verified);
+}
+
+void run_all_verifier_tests(void)
+{
+    RUN_TEST(test_verifier_accepts_valid_image);
+    RUN_TEST(test_verifier_bad_register_runs_checked);
+    RUN_TEST(test_verifier_rejects_branch_into_instruction);
+    RUN_TEST(test_verifier_rejects_misplaced_entry);
+    RUN_TEST(test_verifier_paths_agree);
+    RUN_TEST(test_verifier_checks_register_targets);
+}
@@ -10,14 +10,14 @@ void test_vm_loader();
 
 void test_full_vm_cycle()
 {
-    const char* filename = "/home/varun/Personal/Projects/C/bitlang/test.vmbc";
+    const char* filename = BITLANG_SOURCE_ROOT "/test.vmbc";
     int8_t      status   = run_vm(vm_ctx, filename);
     TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
 }
 
 void test_vm_loader()
 {
-    const char* filename = "/home/varun/Personal/Projects/C/bitlang/test.vmbc";
+    const char* filename = BITLANG_SOURCE_ROOT "/test.vmbc";
     int8_t      status   = load_bytecode(vm_ctx, filename);
     TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
 }
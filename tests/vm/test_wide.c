@@ -0,0 +1,156 @@
+#include "test_common.h"
+#include "unity.h"
+#include "unity_internals.h"
+#include "vm.h"
+#include "vm_utils.h"
+#include <stdint.h>
+#include <string.h>
+
+#define META_REG_IMM MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_INT)
+#define META_REG_REG MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_REG_DIRECT)
+#define WIDE_VERSION (BYTECODE_SUPPORTED_VERSION | BYTECODE_FLAG_WIDE)
+
+void run_all_wide_tests(void);
+
+void test_wide_add_carries_past_bit_31(void);
+void test_narrow_add_still_wraps_at_32_bits(void);
+void test_wide_movq_and_mul(void);
+void test_wide_immediates_are_sign_extended(void);
+void test_wide_push_pop_keep_all_64_bits(void);
+void test_wide_memory_operands_load_8_bytes(void);
+
+// =================================================================
+// 1. In 64-bit mode 0xFFFFFFFF + 1 no longer wraps
+// =================================================================
+void test_wide_add_carries_past_bit_31(void)
+{
+    const uint8_t code[] = {
+        TEST_MOVQ(REG_R0, 0xFFFFFFFFULL),
+        TEST_INST(OP_ADD, REG_R0, 0, 1, META_REG_IMM),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image_version(vm_ctx, code, sizeof(code), WIDE_VERSION);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_HEX64(0x100000000ULL, vm_ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_UINT32(0, vm_ctx->flags[VM_FLAG_CARRY]);
+    TEST_ASSERT_EQUAL_UINT32(0, vm_ctx->flags[VM_FLAG_ZERO]);
+}
+
+// =================================================================
+// 2. The same arithmetic in a v1 image keeps 32-bit registers and flags
+// =================================================================
+void test_narrow_add_still_wraps_at_32_bits(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R0, 0, 0xFFFFFFFF, META_REG_IMM),
+        TEST_INST(OP_ADD, REG_R0, 0, 1, META_REG_IMM),
+        TEST_MOVQ(REG_R1, 0x123456789ABCDEF0ULL),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image(vm_ctx, code, sizeof(code));
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_HEX64(0, vm_ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_UINT32(1, vm_ctx->flags[VM_FLAG_CARRY]);
+    TEST_ASSERT_EQUAL_UINT32(1, vm_ctx->flags[VM_FLAG_ZERO]);
+    TEST_ASSERT_EQUAL_HEX64(0x9ABCDEF0, vm_ctx->registers[REG_R1]);
+}
+
+// =================================================================
+// 3. One FNV-1a step: MOVQ loads the 64-bit basis and prime, MUL wraps at 2^64
+// =================================================================
+void test_wide_movq_and_mul(void)
+{
+    const uint64_t basis  = 0xCBF29CE484222325ULL;
+    const uint64_t prime  = 0x00000100000001B3ULL;
+    const uint8_t  code[] = {
+        TEST_MOVQ(REG_R0, basis),
+        TEST_MOVQ(REG_R1, prime),
+        TEST_INST(OP_MOV, REG_R2, 0, 'a', META_REG_IMM),
+        TEST_INST(OP_MOV, REG_R3, REG_R0, 0, META_REG_REG),
+        TEST_INST(OP_OR, REG_R3, REG_R2, 0, META_REG_REG),
+        TEST_INST(OP_MOV, REG_R4, REG_R0, 0, META_REG_REG),
+        TEST_INST(OP_AND, REG_R4, REG_R2, 0, META_REG_REG),
+        TEST_INST(OP_SUB, REG_R3, REG_R4, 0, META_REG_REG), // r3 = basis ^ 'a'
+        TEST_INST(OP_MUL, REG_R3, REG_R1, 0, META_REG_REG),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image_version(vm_ctx, code, sizeof(code), WIDE_VERSION);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_HEX64(basis, vm_ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_HEX64((basis ^ 'a') * prime, vm_ctx->registers[REG_R3]);
+}
+
+// =================================================================
+// 4. imm32 is sign-extended, and SF/OF come from bit 63
+// =================================================================
+void test_wide_immediates_are_sign_extended(void)
+{
+    const uint8_t code[] = {
+        TEST_INST(OP_MOV, REG_R0, 0, (uint32_t) -1, META_REG_IMM),
+        TEST_MOVQ(REG_R1, 0x7FFFFFFFFFFFFFFFULL),
+        TEST_INST(OP_ADD, REG_R1, 0, 1, META_REG_IMM),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image_version(vm_ctx, code, sizeof(code), WIDE_VERSION);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_HEX64(UINT64_MAX, vm_ctx->registers[REG_R0]);
+    TEST_ASSERT_EQUAL_HEX64(0x8000000000000000ULL, vm_ctx->registers[REG_R1]);
+    TEST_ASSERT_EQUAL_UINT32(1, vm_ctx->flags[VM_FLAG_SIGN]);
+    TEST_ASSERT_EQUAL_UINT32(1, vm_ctx->flags[VM_FLAG_OVERFLOW]);
+}
+
+// =================================================================
+// 5. Stack slots are 8 bytes wide in 64-bit mode
+// =================================================================
+void test_wide_push_pop_keep_all_64_bits(void)
+{
+    const uint8_t code[] = {
+        TEST_MOVQ(REG_R0, 0x0123456789ABCDEFULL),
+        TEST_INST(OP_PUSH, REG_R0, 0, 0, 0),
+        TEST_INST(OP_POP, REG_R1, 0, 0, 0),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    int8_t status = run_test_image_version(vm_ctx, code, sizeof(code), WIDE_VERSION);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_HEX64(0x0123456789ABCDEFULL, vm_ctx->registers[REG_R1]);
+    TEST_ASSERT_EQUAL_HEX32(STACK_END, vm_ctx->sp);
+    TEST_ASSERT_EQUAL_HEX64(0x0123456789ABCDEFULL, vm_load_u64(vm_ctx, STACK_END - 8));
+}
+
+// =================================================================
+// 6. A memory source operand reads a whole 64-bit constant from DATA
+// =================================================================
+void test_wide_memory_operands_load_8_bytes(void)
+{
+    const uint64_t constant = 0xFEEDFACECAFEBEEFULL;
+    const uint8_t  code[]   = {
+        TEST_INST(OP_MOV, REG_R0, 0, DATA_START, MAKE_METADATA(VM_AM_REG_DIRECT, VM_AM_IMM_ADDR)),
+        TEST_INST(OP_HALT, 0, 0, 0, 0),
+    };
+
+    memcpy(vm_ctx->memory + DATA_START, &constant, sizeof(constant));
+    int8_t status = run_test_image_version(vm_ctx, code, sizeof(code), WIDE_VERSION);
+
+    TEST_ASSERT_EQUAL_INT8(VM_EXIT_SUCCESS, status);
+    TEST_ASSERT_EQUAL_HEX64(constant, vm_ctx->registers[REG_R0]);
+}
+
+void run_all_wide_tests(void)
+{
+    RUN_TEST(test_wide_add_carries_past_bit_31);
+    RUN_TEST(test_narrow_add_still_wraps_at_32_bits);
+    RUN_TEST(test_wide_movq_and_mul);
+    RUN_TEST(test_wide_immediates_are_sign_extended);
+    RUN_TEST(test_wide_push_pop_keep_all_64_bits);
+    RUN_TEST(test_wide_memory_operands_load_8_bytes);
+}